@@ -25,6 +25,7 @@ Software Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
 #include "prefix.h"
 #include "hash.h"
 #include "thread.h"
+#include "jhash.h"
 
 #include "bgpd/bgpd.h"
 #include "bgpd/bgp_table.h"
@@ -152,6 +153,330 @@ bgp_advertise_unintern (struct hash *hash, struct bgp_advertise_attr *baa)
     }
 }
 
+/* Adjacencies of a node are kept on plain lists, which is all most
+   nodes need.  Once a node has BGP_ADJ_INDEX_MIN adjacencies in or out,
+   as on a route server with many clients, they are also indexed by peer
+   in an open addressed table, found through the table's adj_index hash.
+   BGP_NODE_ADJ_INDEX tells whether a node has one, so nodes without
+   pay nothing but the flag.  */
+#define BGP_ADJ_INDEX_MIN 8
+
+struct bgp_adj_slot
+{
+  struct peer *peer;
+  void *adj;
+};
+
+struct bgp_adj_slots
+{
+  struct bgp_adj_slot *slot;
+  unsigned int size;
+  unsigned int count;
+};
+
+struct bgp_adj_index
+{
+  struct bgp_node *rn;
+  struct bgp_adj_slots in;
+  struct bgp_adj_slots out;
+};
+
+static unsigned int
+bgp_adj_slot_key (const struct peer *peer, unsigned int size)
+{
+  return jhash_1word ((u_int32_t) (uintptr_t) peer, 0) & (size - 1);
+}
+
+static void *
+bgp_adj_slots_find (struct bgp_adj_slots *slots, const struct peer *peer)
+{
+  unsigned int i;
+
+  for (i = bgp_adj_slot_key (peer, slots->size); slots->slot[i].peer;
+       i = (i + 1) & (slots->size - 1))
+    if (slots->slot[i].peer == peer)
+      return slots->slot[i].adj;
+  return NULL;
+}
+
+static void
+bgp_adj_slots_put (struct bgp_adj_slots *slots, struct peer *peer, void *adj)
+{
+  unsigned int i;
+
+  for (i = bgp_adj_slot_key (peer, slots->size); slots->slot[i].peer;
+       i = (i + 1) & (slots->size - 1))
+    ;
+  slots->slot[i].peer = peer;
+  slots->slot[i].adj = adj;
+  slots->count++;
+}
+
+/* Size the table for count entries at no more than half load. */
+static void
+bgp_adj_slots_resize (struct bgp_adj_slots *slots, unsigned int count)
+{
+  struct bgp_adj_slot *old = slots->slot;
+  unsigned int old_size = slots->size;
+  unsigned int size = 4;
+  unsigned int i;
+
+  while (size < count * 2)
+    size *= 2;
+  if (size == old_size)
+    return;
+
+  slots->slot = XCALLOC (MTYPE_BGP_ADJ_INDEX,
+			 size * sizeof (struct bgp_adj_slot));
+  slots->size = size;
+  slots->count = 0;
+  for (i = 0; i < old_size; i++)
+    if (old[i].peer)
+      bgp_adj_slots_put (slots, old[i].peer, old[i].adj);
+  if (old)
+    XFREE (MTYPE_BGP_ADJ_INDEX, old);
+}
+
+static void
+bgp_adj_slots_add (struct bgp_adj_slots *slots, struct peer *peer, void *adj)
+{
+  if ((slots->count + 1) * 2 > slots->size)
+    bgp_adj_slots_resize (slots, slots->count + 1);
+  bgp_adj_slots_put (slots, peer, adj);
+}
+
+/* Linear probing delete: move later entries of the probe sequence back
+   into the hole, so lookups never need tombstones. */
+static void
+bgp_adj_slots_del (struct bgp_adj_slots *slots, struct peer *peer)
+{
+  unsigned int mask = slots->size - 1;
+  unsigned int i, j, k;
+
+  for (i = bgp_adj_slot_key (peer, slots->size); slots->slot[i].peer;
+       i = (i + 1) & mask)
+    if (slots->slot[i].peer == peer)
+      break;
+  if (! slots->slot[i].peer)
+    return;
+
+  for (j = (i + 1) & mask; slots->slot[j].peer; j = (j + 1) & mask)
+    {
+      k = bgp_adj_slot_key (slots->slot[j].peer, slots->size);
+      if (i <= j ? (k <= i || k > j) : (k <= i && k > j))
+	{
+	  slots->slot[i] = slots->slot[j];
+	  i = j;
+	}
+    }
+  slots->slot[i].peer = NULL;
+  slots->slot[i].adj = NULL;
+  slots->count--;
+}
+
+static unsigned int
+bgp_adj_index_hash_key (void *p)
+{
+  struct bgp_adj_index *index = p;
+
+  return jhash_1word ((u_int32_t) (uintptr_t) index->rn, 0);
+}
+
+static int
+bgp_adj_index_hash_cmp (const void *p1, const void *p2)
+{
+  const struct bgp_adj_index *i1 = p1;
+  const struct bgp_adj_index *i2 = p2;
+
+  return i1->rn == i2->rn;
+}
+
+static struct bgp_adj_index *
+bgp_adj_index_get (struct bgp_node *rn)
+{
+  struct bgp_adj_index tmp;
+
+  if (! CHECK_FLAG (rn->flags, BGP_NODE_ADJ_INDEX))
+    return NULL;
+
+  tmp.rn = rn;
+  return hash_lookup (rn->table->adj_index, &tmp);
+}
+
+static void
+bgp_adj_index_free (void *p)
+{
+  struct bgp_adj_index *index = p;
+
+  if (index->in.slot)
+    XFREE (MTYPE_BGP_ADJ_INDEX, index->in.slot);
+  if (index->out.slot)
+    XFREE (MTYPE_BGP_ADJ_INDEX, index->out.slot);
+  XFREE (MTYPE_BGP_ADJ_INDEX, index);
+}
+
+/* Index all adjacencies of the node. */
+static void
+bgp_adj_index_create (struct bgp_node *rn)
+{
+  struct bgp_adj_index *index;
+  struct bgp_adj_in *ain;
+  struct bgp_adj_out *aout;
+  unsigned int nin = 0, nout = 0;
+
+  if (! rn->table->adj_index)
+    rn->table->adj_index = hash_create (bgp_adj_index_hash_key,
+					bgp_adj_index_hash_cmp);
+
+  for (ain = rn->adj_in; ain; ain = ain->next)
+    nin++;
+  for (aout = rn->adj_out; aout; aout = aout->next)
+    nout++;
+
+  index = XCALLOC (MTYPE_BGP_ADJ_INDEX, sizeof (struct bgp_adj_index));
+  index->rn = rn;
+  bgp_adj_slots_resize (&index->in, nin);
+  bgp_adj_slots_resize (&index->out, nout);
+  for (ain = rn->adj_in; ain; ain = ain->next)
+    bgp_adj_slots_put (&index->in, ain->peer, ain);
+  for (aout = rn->adj_out; aout; aout = aout->next)
+    bgp_adj_slots_put (&index->out, aout->peer, aout);
+
+  hash_get (rn->table->adj_index, index, hash_alloc_intern);
+  SET_FLAG (rn->flags, BGP_NODE_ADJ_INDEX);
+}
+
+/* Drop the index of a node that is no longer crowded. */
+static void
+bgp_adj_index_check (struct bgp_node *rn, struct bgp_adj_index *index)
+{
+  if (index->in.count >= BGP_ADJ_INDEX_MIN / 2
+      || index->out.count >= BGP_ADJ_INDEX_MIN / 2)
+    {
+      /* Give back space after mass withdraws. */
+      if (index->in.count * 8 < index->in.size && index->in.size > 4)
+	bgp_adj_slots_resize (&index->in, index->in.count);
+      if (index->out.count * 8 < index->out.size && index->out.size > 4)
+	bgp_adj_slots_resize (&index->out, index->out.count);
+      return;
+    }
+
+  hash_release (rn->table->adj_index, index);
+  bgp_adj_index_free (index);
+  UNSET_FLAG (rn->flags, BGP_NODE_ADJ_INDEX);
+}
+
+/* Release the indexes of a table that is being freed. */
+void
+bgp_adj_index_finish (struct bgp_table *table)
+{
+  if (! table->adj_index)
+    return;
+
+  hash_clean (table->adj_index, bgp_adj_index_free);
+  hash_free (table->adj_index);
+  table->adj_index = NULL;
+}
+
+/* Adjacency of the peer on the node, if any. */
+struct bgp_adj_in *
+bgp_adj_in_find (struct bgp_node *rn, const struct peer *peer)
+{
+  struct bgp_adj_index *index;
+  struct bgp_adj_in *adj;
+
+  if ((index = bgp_adj_index_get (rn)) != NULL)
+    return bgp_adj_slots_find (&index->in, peer);
+
+  for (adj = rn->adj_in; adj; adj = adj->next)
+    if (adj->peer == peer)
+      break;
+  return adj;
+}
+
+struct bgp_adj_out *
+bgp_adj_out_find (struct bgp_node *rn, const struct peer *peer)
+{
+  struct bgp_adj_index *index;
+  struct bgp_adj_out *adj;
+
+  if ((index = bgp_adj_index_get (rn)) != NULL)
+    return bgp_adj_slots_find (&index->out, peer);
+
+  for (adj = rn->adj_out; adj; adj = adj->next)
+    if (adj->peer == peer)
+      break;
+  return adj;
+}
+
+static void
+bgp_adj_in_link (struct bgp_node *rn, struct bgp_adj_in *adj)
+{
+  struct bgp_adj_index *index;
+  struct bgp_adj_in *ain;
+  unsigned int n = 0;
+
+  BGP_ADJ_IN_ADD (rn, adj);
+
+  if ((index = bgp_adj_index_get (rn)) != NULL)
+    {
+      bgp_adj_slots_add (&index->in, adj->peer, adj);
+      return;
+    }
+  for (ain = rn->adj_in; ain && n < BGP_ADJ_INDEX_MIN; ain = ain->next)
+    n++;
+  if (n == BGP_ADJ_INDEX_MIN)
+    bgp_adj_index_create (rn);
+}
+
+static void
+bgp_adj_in_unlink (struct bgp_node *rn, struct bgp_adj_in *adj)
+{
+  struct bgp_adj_index *index;
+
+  BGP_ADJ_IN_DEL (rn, adj);
+
+  if ((index = bgp_adj_index_get (rn)) != NULL)
+    {
+      bgp_adj_slots_del (&index->in, adj->peer);
+      bgp_adj_index_check (rn, index);
+    }
+}
+
+static void
+bgp_adj_out_link (struct bgp_node *rn, struct bgp_adj_out *adj)
+{
+  struct bgp_adj_index *index;
+  struct bgp_adj_out *aout;
+  unsigned int n = 0;
+
+  BGP_ADJ_OUT_ADD (rn, adj);
+
+  if ((index = bgp_adj_index_get (rn)) != NULL)
+    {
+      bgp_adj_slots_add (&index->out, adj->peer, adj);
+      return;
+    }
+  for (aout = rn->adj_out; aout && n < BGP_ADJ_INDEX_MIN; aout = aout->next)
+    n++;
+  if (n == BGP_ADJ_INDEX_MIN)
+    bgp_adj_index_create (rn);
+}
+
+static void
+bgp_adj_out_unlink (struct bgp_node *rn, struct bgp_adj_out *adj)
+{
+  struct bgp_adj_index *index;
+
+  BGP_ADJ_OUT_DEL (rn, adj);
+
+  if ((index = bgp_adj_index_get (rn)) != NULL)
+    {
+      bgp_adj_slots_del (&index->out, adj->peer);
+      bgp_adj_index_check (rn, index);
+    }
+}
+
 /* BGP adjacency keeps minimal advertisement information.  */
 static void
 bgp_adj_out_free (struct bgp_adj_out *adj)
@@ -166,10 +491,7 @@ bgp_adj_out_lookup (struct peer *peer, struct prefix *p,
 {
   struct bgp_adj_out *adj;
 
-  for (adj = rn->adj_out; adj; adj = adj->next)
-    if (adj->peer == peer)
-      break;
-
+  adj = bgp_adj_out_find (rn, peer);
   if (! adj)
     return 0;
 
@@ -225,11 +547,7 @@ bgp_adj_out_set (struct bgp_node *rn, struct peer *peer, struct prefix *p,
 
   /* Look for adjacency information. */
   if (rn)
-    {
-      for (adj = rn->adj_out; adj; adj = adj->next)
-	if (adj->peer == peer)
-	  break;
-    }
+    adj = bgp_adj_out_find (rn, peer);
 
   if (! adj)
     {
@@ -238,7 +556,7 @@ bgp_adj_out_set (struct bgp_node *rn, struct peer *peer, struct prefix *p,
       
       if (rn)
         {
-          BGP_ADJ_OUT_ADD (rn, adj);
+          bgp_adj_out_link (rn, adj);
           bgp_lock_node (rn);
         }
     }
@@ -277,10 +595,7 @@ bgp_adj_out_unset (struct bgp_node *rn, struct peer *peer, struct prefix *p,
     return;
 
   /* Lookup existing adjacency, if it is not there return immediately.  */
-  for (adj = rn->adj_out; adj; adj = adj->next)
-    if (adj->peer == peer)
-      break;
-
+  adj = bgp_adj_out_find (rn, peer);
   if (! adj)
     return;
 
@@ -305,7 +620,7 @@ bgp_adj_out_unset (struct bgp_node *rn, struct peer *peer, struct prefix *p,
   else
     {
       /* Remove myself from adjacency. */
-      BGP_ADJ_OUT_DEL (rn, adj);
+      bgp_adj_out_unlink (rn, adj);
       
       /* Free allocated information.  */
       bgp_adj_out_free (adj);
@@ -324,7 +639,7 @@ bgp_adj_out_remove (struct bgp_node *rn, struct bgp_adj_out *adj,
   if (adj->adv)
     bgp_advertise_clean (peer, adj, afi, safi);
 
-  BGP_ADJ_OUT_DEL (rn, adj);
+  bgp_adj_out_unlink (rn, adj);
   bgp_adj_out_free (adj);
 }
 
@@ -333,22 +648,20 @@ bgp_adj_in_set (struct bgp_node *rn, struct peer *peer, struct attr *attr)
 {
   struct bgp_adj_in *adj;
 
-  for (adj = rn->adj_in; adj; adj = adj->next)
+  adj = bgp_adj_in_find (rn, peer);
+  if (adj)
     {
-      if (adj->peer == peer)
+      if (adj->attr != attr)
 	{
-	  if (adj->attr != attr)
-	    {
-	      bgp_attr_unintern (adj->attr);
-	      adj->attr = bgp_attr_intern (attr);
-	    }
-	  return;
+	  bgp_attr_unintern (adj->attr);
+	  adj->attr = bgp_attr_intern (attr);
 	}
+      return;
     }
   adj = XCALLOC (MTYPE_BGP_ADJ_IN, sizeof (struct bgp_adj_in));
   adj->peer = peer_lock (peer); /* adj_in peer reference */
   adj->attr = bgp_attr_intern (attr);
-  BGP_ADJ_IN_ADD (rn, adj);
+  bgp_adj_in_link (rn, adj);
   bgp_lock_node (rn);
 }
 
@@ -356,7 +669,7 @@ void
 bgp_adj_in_remove (struct bgp_node *rn, struct bgp_adj_in *bai)
 {
   bgp_attr_unintern (bai->attr);
-  BGP_ADJ_IN_DEL (rn, bai);
+  bgp_adj_in_unlink (rn, bai);
   peer_unlock (bai->peer); /* adj_in peer reference */
   XFREE (MTYPE_BGP_ADJ_IN, bai);
 }
@@ -366,10 +679,7 @@ bgp_adj_in_unset (struct bgp_node *rn, struct peer *peer)
 {
   struct bgp_adj_in *adj;
 
-  for (adj = rn->adj_in; adj; adj = adj->next)
-    if (adj->peer == peer)
-      break;
-
+  adj = bgp_adj_in_find (rn, peer);
   if (! adj)
     return;
 
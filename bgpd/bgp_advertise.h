@@ -136,10 +136,16 @@ extern void bgp_adj_out_remove (struct bgp_node *, struct bgp_adj_out *,
 			 struct peer *, afi_t, safi_t);
 extern int bgp_adj_out_lookup (struct peer *, struct prefix *, afi_t, safi_t,
 			struct bgp_node *);
+extern struct bgp_adj_out *bgp_adj_out_find (struct bgp_node *,
+					     const struct peer *);
 
 extern void bgp_adj_in_set (struct bgp_node *, struct peer *, struct attr *);
 extern void bgp_adj_in_unset (struct bgp_node *, struct peer *);
 extern void bgp_adj_in_remove (struct bgp_node *, struct bgp_adj_in *);
+extern struct bgp_adj_in *bgp_adj_in_find (struct bgp_node *,
+					   const struct peer *);
+
+extern void bgp_adj_index_finish (struct bgp_table *);
 
 extern struct bgp_advertise *
 bgp_advertise_clean (struct peer *, struct bgp_adj_out *, afi_t, safi_t);
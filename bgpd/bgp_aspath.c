@@ -1849,6 +1849,7 @@ void
 aspath_init (void)
 {
   ashash = hash_create_size (128*1024, aspath_key_make, aspath_cmp);
+  hash_set_name (ashash, "BGP AS path");
 }
 
 void
@@ -46,6 +46,9 @@ struct assegment
   u_char type;
 };
 
+/* Number of AS path access-list results kept in each path. */
+#define ASPATH_FILTER_CACHE 4
+
 /* AS path may be include some AsSegments.  */
 struct aspath 
 {
@@ -58,6 +61,10 @@ struct aspath
   /* String expression of AS path.  This string is used by vty output
      and AS path regular expression match.  */
   char *str;
+
+  /* Results of AS path access-lists for an interned path, see
+     as_list_apply().  */
+  u_int32_t filter_cache[ASPATH_FILTER_CACHE];
 };
 
 #define ASPATH_STR_DEFAULT_LEN 32
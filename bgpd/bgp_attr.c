@@ -208,6 +208,7 @@ static void
 cluster_init (void)
 {
   cluster_hash = hash_create (cluster_hash_key_make, cluster_hash_cmp);
+  hash_set_name (cluster_hash, "BGP cluster list");
 }
 
 static void
@@ -293,6 +294,7 @@ static void
 transit_init (void)
 {
   transit_hash = hash_create (transit_hash_key_make, transit_hash_cmp);
+  hash_set_name (transit_hash, "BGP transitive attr");
 }
 
 static void
@@ -449,6 +451,7 @@ static void
 attrhash_init (void)
 {
   attrhash = hash_create_size (256*1024, attrhash_key_make, attrhash_cmp);
+  hash_set_name (attrhash, "BGP attributes");
 }
 
 static void
@@ -23,6 +23,7 @@ Software Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
 #include "command.h"
 #include "prefix.h"
 #include "memory.h"
+#include "routemap.h"
 
 #include "bgpd/bgpd.h"
 #include "bgpd/bgp_community.h"
@@ -31,6 +32,9 @@ Software Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
 #include "bgpd/bgp_regex.h"
 #include "bgpd/bgp_clist.h"
 
+/* Last community-list serial handed out.  */
+static u_int32_t community_list_serial;
+
 /* Lookup master structure for community-list or
    extcommunity-list.  */
 struct community_list_master *
@@ -230,12 +234,39 @@ community_list_get (struct community_list_handler *ch,
   return list;
 }
 
+/* Drop the index community_list_match() built.  */
+static void
+community_list_unindex (struct community_list *list)
+{
+  if (list->values)
+    XFREE (MTYPE_COMMUNITY_LIST_INDEX, list->values);
+  if (list->others)
+    XFREE (MTYPE_COMMUNITY_LIST_INDEX, list->others);
+  list->values = NULL;
+  list->others = NULL;
+  list->values_count = list->others_count = 0;
+  list->indexed = 0;
+}
+
+/* Give list a serial no attribute has a result cached for.  Serials
+   are kept to 30 bits, as the kind of match and its result are stored
+   next to them.  */
+static void
+community_list_changed (struct community_list *list)
+{
+  community_list_unindex (list);
+  if (++community_list_serial > 0x3fffffff)
+    community_list_serial = 1;
+  list->serial = community_list_serial;
+}
+
 static void
 community_list_delete (struct community_list *list)
 {
   struct community_list_list *clist;
   struct community_entry *entry, *next;
 
+  community_list_unindex (list);
   for (entry = list->head; entry; entry = next)
     {
       next = entry->next;
@@ -255,6 +286,8 @@ community_list_delete (struct community_list *list)
     clist->head = list->next;
 
   community_list_free (list);
+
+  route_map_cache_flush ();
 }
 
 static int
@@ -268,6 +301,7 @@ static void
 community_list_entry_add (struct community_list *list,
                           struct community_entry *entry)
 {
+  community_list_changed (list);
   entry->next = NULL;
   entry->prev = list->tail;
 
@@ -276,6 +310,8 @@ community_list_entry_add (struct community_list *list,
   else
     list->head = entry;
   list->tail = entry;
+
+  route_map_cache_flush ();
 }
 
 /* Delete community-list entry from the list.  */
@@ -283,6 +319,7 @@ static void
 community_list_entry_delete (struct community_list *list,
                              struct community_entry *entry, int style)
 {
+  community_list_changed (list);
   if (entry->next)
     entry->next->prev = entry->prev;
   else
@@ -297,6 +334,8 @@ community_list_entry_delete (struct community_list *list,
 
   if (community_list_empty_p (list))
     community_list_delete (list);
+
+  route_map_cache_flush ();
 }
 
 /* Lookup community-list entry from the list.  */
@@ -420,33 +459,151 @@ community_regexp_delete (struct community *com, regex_t * reg)
   return com;
 }
 
+static int
+community_list_value_cmp (const void *p1, const void *p2)
+{
+  const struct community_list_value *v1 = p1;
+  const struct community_list_value *v2 = p2;
+
+  if (v1->val != v2->val)
+    return v1->val < v2->val ? -1 : 1;
+  return v1->seq - v2->seq;
+}
+
+/* Sort the standard entries of a single community by value, so that
+   the communities of an attribute can be looked up in them, and keep
+   the other entries, which are tried one by one, in order.  */
+static void
+community_list_index (struct community_list *list)
+{
+  struct community_entry *entry;
+  struct community_list_value *v;
+  int count = 0;
+  int seq = 0;
+
+  for (entry = list->head; entry; entry = entry->next)
+    count++;
+
+  if (count)
+    {
+      list->values = XMALLOC (MTYPE_COMMUNITY_LIST_INDEX,
+			      count * sizeof (struct community_list_value));
+      list->others = XMALLOC (MTYPE_COMMUNITY_LIST_INDEX,
+			      count * sizeof (struct community_entry *));
+    }
+
+  for (entry = list->head; entry; entry = entry->next)
+    {
+      entry->seq = seq++;
+      if (entry->style == COMMUNITY_LIST_STANDARD && ! entry->any
+	  && entry->u.com && entry->u.com->size == 1
+	  && ! community_include (entry->u.com, COMMUNITY_INTERNET))
+	{
+	  v = &list->values[list->values_count++];
+	  v->val = entry->u.com->val[0];
+	  v->seq = entry->seq;
+	  v->direct = entry->direct;
+	}
+      else
+	list->others[list->others_count++] = entry;
+    }
+
+  qsort (list->values, list->values_count,
+	 sizeof (struct community_list_value), community_list_value_cmp);
+  list->indexed = 1;
+}
+
+/* The first entry of a single community val.  */
+static struct community_list_value *
+community_list_value_lookup (struct community_list *list, u_int32_t val)
+{
+  int lo = 0, hi = list->values_count, mid;
+
+  while (lo < hi)
+    {
+      mid = (lo + hi) / 2;
+      if (list->values[mid].val < val)
+	lo = mid + 1;
+      else
+	hi = mid;
+    }
+  if (lo < list->values_count && list->values[lo].val == val)
+    return &list->values[lo];
+  return NULL;
+}
+
+/* Where the result of matching com against list is kept, or NULL.
+   Interned attributes are shared by many routes and never change.  */
+static u_int32_t *
+community_list_cache (struct community *com, struct community_list *list,
+		      int exact)
+{
+  if (com == NULL || ! com->refcnt || ! list->serial)
+    return NULL;
+  return &com->filter_cache[((list->serial << 1) | exact)
+			    % COMMUNITY_FILTER_CACHE];
+}
+
+static int
+community_entry_match (struct community *com, struct community_entry *entry)
+{
+  if (entry->any)
+    return 1;
+
+  if (entry->style == COMMUNITY_LIST_STANDARD)
+    return (community_include (entry->u.com, COMMUNITY_INTERNET)
+	    || community_match (com, entry->u.com));
+  else if (entry->style == COMMUNITY_LIST_EXPANDED)
+    return community_regexp_match (com, entry->reg);
+
+  return 0;
+}
+
 /* When given community attribute matches to the community-list return
    1 else return 0.  */
 int
 community_list_match (struct community *com, struct community_list *list)
 {
+  struct community_list_value *v;
   struct community_entry *entry;
+  u_int32_t *cache;
+  u_int32_t key = list->serial << 1;
+  int seq = INT_MAX;
+  int ret = 0;
+  int i;
 
-  for (entry = list->head; entry; entry = entry->next)
-    {
-      if (entry->any)
-        return entry->direct == COMMUNITY_PERMIT ? 1 : 0;
+  cache = community_list_cache (com, list, 0);
+  if (cache && (*cache >> 1) == key)
+    return *cache & 1;
 
-      if (entry->style == COMMUNITY_LIST_STANDARD)
-        {
-          if (community_include (entry->u.com, COMMUNITY_INTERNET))
-            return entry->direct == COMMUNITY_PERMIT ? 1 : 0;
+  if (! list->indexed)
+    community_list_index (list);
 
-          if (community_match (com, entry->u.com))
-            return entry->direct == COMMUNITY_PERMIT ? 1 : 0;
-        }
-      else if (entry->style == COMMUNITY_LIST_EXPANDED)
-        {
-          if (community_regexp_match (com, entry->reg))
-            return entry->direct == COMMUNITY_PERMIT ? 1 : 0;
-        }
+  /* The first entry of a single community the attribute has... */
+  for (i = 0; com && i < com->size; i++)
+    if ((v = community_list_value_lookup (list, com->val[i])) != NULL
+	&& v->seq < seq)
+      {
+	seq = v->seq;
+	ret = v->direct == COMMUNITY_PERMIT ? 1 : 0;
+      }
+
+  /* ...unless one of the other entries before it matches. */
+  for (i = 0; i < list->others_count; i++)
+    {
+      entry = list->others[i];
+      if (entry->seq > seq)
+	break;
+      if (community_entry_match (com, entry))
+	{
+	  ret = entry->direct == COMMUNITY_PERMIT ? 1 : 0;
+	  break;
+	}
     }
-  return 0;
+
+  if (cache)
+    *cache = (key << 1) | ret;
+  return ret;
 }
 
 int
@@ -480,27 +637,44 @@ community_list_exact_match (struct community *com,
                             struct community_list *list)
 {
   struct community_entry *entry;
+  u_int32_t *cache;
+  u_int32_t key = (list->serial << 1) | 1;
+  int ret = 0;
+
+  cache = community_list_cache (com, list, 1);
+  if (cache && (*cache >> 1) == key)
+    return *cache & 1;
 
   for (entry = list->head; entry; entry = entry->next)
     {
       if (entry->any)
-        return entry->direct == COMMUNITY_PERMIT ? 1 : 0;
+        {
+          ret = entry->direct == COMMUNITY_PERMIT ? 1 : 0;
+          break;
+        }
 
       if (entry->style == COMMUNITY_LIST_STANDARD)
         {
-          if (community_include (entry->u.com, COMMUNITY_INTERNET))
-            return entry->direct == COMMUNITY_PERMIT ? 1 : 0;
-
-          if (community_cmp (com, entry->u.com))
-            return entry->direct == COMMUNITY_PERMIT ? 1 : 0;
+          if (community_include (entry->u.com, COMMUNITY_INTERNET)
+              || community_cmp (com, entry->u.com))
+            {
+              ret = entry->direct == COMMUNITY_PERMIT ? 1 : 0;
+              break;
+            }
         }
       else if (entry->style == COMMUNITY_LIST_EXPANDED)
         {
           if (community_regexp_match (com, entry->reg))
-            return entry->direct == COMMUNITY_PERMIT ? 1 : 0;
+            {
+              ret = entry->direct == COMMUNITY_PERMIT ? 1 : 0;
+              break;
+            }
         }
     }
-  return 0;
+
+  if (cache)
+    *cache = (key << 1) | ret;
+  return ret;
 }
 
 /* Delete all permitted communities in the list from com.  */
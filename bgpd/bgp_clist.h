@@ -58,6 +58,25 @@ struct community_list
   /* Community-list entry in this community-list.  */
   struct community_entry *head;
   struct community_entry *tail;
+
+  /* Changes whenever the entries do, see community_list_match().  */
+  u_int32_t serial;
+
+  /* Standard entries of a single community by value, and the other
+     entries in order, built on first use after a change.  */
+  int indexed;
+  struct community_list_value *values;
+  int values_count;
+  struct community_entry **others;
+  int others_count;
+};
+
+/* Standard community-list entry of a single community.  */
+struct community_list_value
+{
+  u_int32_t val;
+  int seq;
+  u_char direct;
 };
 
 /* Each entry in community-list.  */
@@ -87,6 +106,9 @@ struct community_entry
 
   /* Expanded community-list regular expression.  */
   regex_t *reg;
+
+  /* Position in the community-list, while it is indexed.  */
+  int seq;
 };
 
 /* Linked list of community-list.  */
@@ -21,6 +21,9 @@ Software Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
 #ifndef _QUAGGA_BGP_COMMUNITY_H
 #define _QUAGGA_BGP_COMMUNITY_H
 
+/* Number of community-list results kept in each attribute.  */
+#define COMMUNITY_FILTER_CACHE 4
+
 /* Communities attribute.  */
 struct community 
 {
@@ -36,6 +39,10 @@ struct community
   /* String of community attribute.  This sring is used by vty output
      and expanded community-list for regular expression match.  */
   char *str;
+
+  /* Results of community-lists for an interned attribute, see
+     community_list_match().  */
+  u_int32_t filter_cache[COMMUNITY_FILTER_CACHE];
 };
 
 /* Well-known communities value.  */
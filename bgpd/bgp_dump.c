@@ -87,8 +87,45 @@ struct bgp_dump bgp_dump_updates;
 /* BGP dump structure for 'dump bgp routes' */
 struct bgp_dump bgp_dump_routes;
 
-/* Dump whole BGP table is very heavy process.  */
-struct thread *t_bgp_dump_routes;
+/* Dump whole BGP table is very heavy process, so it is done a slice
+   at a time.  */
+#define BGP_DUMP_ROUTES_SLICE 1000
+
+/* Output buffer of the table dump file. */
+#define BGP_DUMP_ROUTES_BUFSIZ 65536
+
+struct bgp_dump_walk
+{
+  /* Instance being dumped, NULL when no dump is in progress. */
+  struct bgp *bgp;
+
+  /* Next node to dump, locked. */
+  afi_t afi;
+  struct bgp_table *table;
+  struct bgp_node *rn;
+  unsigned int seq;
+
+  /* Peers in the index table are marked with this generation. */
+  unsigned int gen;
+
+  struct thread *t_walk;
+
+  /* Statistics of the current or last dump, times in microseconds. */
+  struct timeval start;
+  unsigned long prefixes;
+  unsigned long bytes;
+  unsigned long slices;
+  unsigned long slice_max;
+  unsigned long duration;
+
+  unsigned long started;
+  unsigned long completed;
+  unsigned long aborted;
+  unsigned long skipped;
+};
+
+static struct bgp_dump_walk bgp_dump_walk;
+static char bgp_dump_routes_buf[BGP_DUMP_ROUTES_BUFSIZ];
 
 /* Some define for BGP packet dump. */
 static FILE *
@@ -133,6 +170,10 @@ bgp_dump_open_file (struct bgp_dump *bgp_dump)
     }
   umask(oldumask);  
 
+  if (bgp_dump->type == BGP_DUMP_ROUTES)
+    setvbuf (bgp_dump->fp, bgp_dump_routes_buf, _IOFBF,
+	     sizeof (bgp_dump_routes_buf));
+
   return bgp_dump->fp;
 }
 
@@ -193,7 +234,7 @@ bgp_dump_set_size (struct stream *s, int type)
 }
 
 static void
-bgp_dump_routes_index_table(struct bgp *bgp)
+bgp_dump_routes_index_table(struct bgp *bgp, unsigned int gen)
 {
   struct peer *peer;
   struct listnode *node;
@@ -261,9 +302,14 @@ bgp_dump_routes_index_table(struct bgp *bgp)
 
       /* Store the peer number for this peer */
       peer->table_dump_index = peerno;
+      peer->table_dump_gen = gen;
       peerno++;
     }
 
+  /* Locally originated routes use whatever index peer_self has. */
+  if (bgp->peer_self)
+    bgp->peer_self->table_dump_gen = gen;
+
   bgp_dump_set_size(obuf, MSG_TABLE_DUMP_V2);
 
   fwrite (STREAM_DATA (obuf), stream_get_endp (obuf), 1, bgp_dump_routes.fp);
@@ -271,115 +317,245 @@ bgp_dump_routes_index_table(struct bgp *bgp)
 }
 
 
-/* Runs under child process. */
-static unsigned int
-bgp_dump_routes_func (int afi, int first_run, unsigned int seq)
+/* Encode the TABLE_DUMP_V2 RIB entry for one prefix into OBUF. */
+static void
+bgp_dump_routes_node (struct stream *obuf, struct bgp_node *rn, afi_t afi,
+		      unsigned int seq, unsigned int gen, time_t origin)
 {
-  struct stream *obuf;
   struct bgp_info *info;
-  struct bgp_node *rn;
-  struct bgp *bgp;
-  struct bgp_table *table;
-
-  bgp = bgp_get_default ();
-  if (!bgp)
-    return seq;
 
-  if (bgp_dump_routes.fp == NULL)
-    return seq;
-
-  /* Note that bgp_dump_routes_index_table will do ipv4 and ipv6 peers,
-     so this should only be done on the first call to bgp_dump_routes_func.
-     ( this function will be called once for ipv4 and once for ipv6 ) */
-  if(first_run)
-    bgp_dump_routes_index_table(bgp);
-
-  obuf = bgp_dump_obuf;
   stream_reset(obuf);
 
-  /* Walk down each BGP route. */
-  table = bgp->rib[afi][SAFI_UNICAST];
-
-  for (rn = bgp_table_top (table); rn; rn = bgp_route_next (rn))
+  /* MRT header */
+  if (afi == AFI_IP)
     {
-      if(!rn->info)
-        continue;
-
-      stream_reset(obuf);
-
-      /* MRT header */
-      if (afi == AFI_IP)
-        {
-          bgp_dump_header (obuf, MSG_TABLE_DUMP_V2, TABLE_DUMP_V2_RIB_IPV4_UNICAST);
-        }
+      bgp_dump_header (obuf, MSG_TABLE_DUMP_V2, TABLE_DUMP_V2_RIB_IPV4_UNICAST);
+    }
 #ifdef HAVE_IPV6
-      else if (afi == AFI_IP6)
-        {
-          bgp_dump_header (obuf, MSG_TABLE_DUMP_V2, TABLE_DUMP_V2_RIB_IPV6_UNICAST);
-        }
+  else if (afi == AFI_IP6)
+    {
+      bgp_dump_header (obuf, MSG_TABLE_DUMP_V2, TABLE_DUMP_V2_RIB_IPV6_UNICAST);
+    }
 #endif /* HAVE_IPV6 */
 
-      /* Sequence number */
-      stream_putl(obuf, seq);
+  /* Sequence number */
+  stream_putl(obuf, seq);
 
-      /* Prefix length */
-      stream_putc (obuf, rn->p.prefixlen);
+  /* Prefix length */
+  stream_putc (obuf, rn->p.prefixlen);
 
-      /* Prefix */
-      if (afi == AFI_IP)
-        {
-          /* We'll dump only the useful bits (those not 0), but have to align on 8 bits */
-          stream_write(obuf, (u_char *)&rn->p.u.prefix4, (rn->p.prefixlen+7)/8);
-        }
+  /* Prefix */
+  if (afi == AFI_IP)
+    {
+      /* We'll dump only the useful bits (those not 0), but have to align on 8 bits */
+      stream_write(obuf, (u_char *)&rn->p.u.prefix4, (rn->p.prefixlen+7)/8);
+    }
 #ifdef HAVE_IPV6
-      else if (afi == AFI_IP6)
-        {
-          /* We'll dump only the useful bits (those not 0), but have to align on 8 bits */
-          stream_write (obuf, (u_char *)&rn->p.u.prefix6, (rn->p.prefixlen+7)/8);
-        }
+  else if (afi == AFI_IP6)
+    {
+      /* We'll dump only the useful bits (those not 0), but have to align on 8 bits */
+      stream_write (obuf, (u_char *)&rn->p.u.prefix6, (rn->p.prefixlen+7)/8);
+    }
 #endif /* HAVE_IPV6 */
 
-      /* Save where we are now, so we can overwride the entry count later */
-      int sizep = stream_get_endp(obuf);
+  /* Save where we are now, so we can overwride the entry count later */
+  int sizep = stream_get_endp(obuf);
 
-      /* Entry count */
-      uint16_t entry_count = 0;
+  /* Entry count */
+  uint16_t entry_count = 0;
 
-      /* Entry count, note that this is overwritten later */
-      stream_putw(obuf, 0);
+  /* Entry count, note that this is overwritten later */
+  stream_putw(obuf, 0);
 
-      for (info = rn->info; info; info = info->next)
-        {
-          entry_count++;
+  for (info = rn->info; info; info = info->next)
+    {
+      /* Peers configured after the peer index table was written have
+         no index to refer to. */
+      if (info->peer->table_dump_gen != gen)
+	continue;
+
+      entry_count++;
 
-          /* Peer index */
-          stream_putw(obuf, info->peer->table_dump_index);
+      /* Peer index */
+      stream_putw(obuf, info->peer->table_dump_index);
 
-          /* Originated */
+      /* Originated */
 #ifdef HAVE_CLOCK_MONOTONIC
-          stream_putl (obuf, time(NULL) - (bgp_clock() - info->uptime));
+      stream_putl (obuf, origin + info->uptime);
 #else
-          stream_putl (obuf, info->uptime);
+      stream_putl (obuf, info->uptime);
 #endif /* HAVE_CLOCK_MONOTONIC */
 
-          /* Dump attribute. */
-          /* Skip prefix & AFI/SAFI for MP_NLRI */
-          bgp_dump_routes_attr (obuf, info->attr, &rn->p);
-        }
+      /* Dump attribute. */
+      /* Skip prefix & AFI/SAFI for MP_NLRI */
+      bgp_dump_routes_attr (obuf, info->attr, &rn->p);
+    }
+
+  /* Overwrite the entry count, now that we know the right number */
+  stream_putw_at (obuf, sizep, entry_count);
+
+  bgp_dump_set_size(obuf, MSG_TABLE_DUMP_V2);
+}
+
+static unsigned long
+bgp_dump_usecs (const struct timeval *start)
+{
+  struct timeval now;
+
+  quagga_gettime (QUAGGA_CLK_MONOTONIC, &now);
+  return (now.tv_sec - start->tv_sec) * 1000000L
+    + (now.tv_usec - start->tv_usec);
+}
+
+/* Finish or abandon the table dump in progress. */
+static void
+bgp_dump_routes_stop (int completed)
+{
+  struct bgp_dump_walk *walk = &bgp_dump_walk;
+
+  if (walk->t_walk)
+    {
+      thread_cancel (walk->t_walk);
+      walk->t_walk = NULL;
+    }
+  if (walk->rn)
+    {
+      bgp_unlock_node (walk->rn);
+      walk->rn = NULL;
+    }
+  if (walk->table)
+    {
+      bgp_table_unlock (walk->table);
+      walk->table = NULL;
+    }
+  if (! walk->bgp)
+    return;
+  walk->bgp = NULL;
+
+  if (bgp_dump_routes.fp)
+    {
+      fclose (bgp_dump_routes.fp);
+      bgp_dump_routes.fp = NULL;
+    }
+
+  walk->duration = bgp_dump_usecs (&walk->start);
+  if (completed)
+    walk->completed++;
+  else
+    walk->aborted++;
+}
+
+/* Move on to the IPv6 table at the end of the IPv4 one. */
+static void
+bgp_dump_routes_next_table (struct bgp_dump_walk *walk)
+{
+#ifdef HAVE_IPV6
+  if (! walk->rn && walk->afi == AFI_IP)
+    {
+      bgp_table_unlock (walk->table);
+      walk->afi = AFI_IP6;
+      walk->table = walk->bgp->rib[AFI_IP6][SAFI_UNICAST];
+      bgp_table_lock (walk->table);
+      walk->rn = bgp_table_top (walk->table);
+    }
+#endif /* HAVE_IPV6 */
+}
 
-      /* Overwrite the entry count, now that we know the right number */
-      stream_putw_at (obuf, sizep, entry_count);
+/* Dump up to BGP_DUMP_ROUTES_SLICE prefixes, then yield to the event
+   loop until it is idle again.  The walk keeps its current node locked
+   so that the node stays in the table meanwhile. */
+static int
+bgp_dump_routes_slice (struct thread *t)
+{
+  struct bgp_dump_walk *walk = &bgp_dump_walk;
+  struct stream *obuf = bgp_dump_obuf;
+  struct timeval start;
+  unsigned long usecs;
+  unsigned int count = 0;
+  time_t origin;
+
+  walk->t_walk = NULL;
+  quagga_gettime (QUAGGA_CLK_MONOTONIC, &start);
+  origin = time (NULL) - bgp_clock ();
+
+  while (walk->rn && count < BGP_DUMP_ROUTES_SLICE)
+    {
+      if (walk->rn->info)
+	{
+	  bgp_dump_routes_node (obuf, walk->rn, walk->afi, walk->seq++,
+				walk->gen, origin);
+	  fwrite (STREAM_DATA (obuf), stream_get_endp (obuf), 1,
+		  bgp_dump_routes.fp);
+	  walk->bytes += stream_get_endp (obuf);
+	  walk->prefixes++;
+	  count++;
+	}
 
-      seq++;
+      walk->rn = bgp_route_next (walk->rn);
+      bgp_dump_routes_next_table (walk);
+    }
 
-      bgp_dump_set_size(obuf, MSG_TABLE_DUMP_V2);
-      fwrite (STREAM_DATA (obuf), stream_get_endp (obuf), 1, bgp_dump_routes.fp);
+  walk->slices++;
+  usecs = bgp_dump_usecs (&start);
+  if (usecs > walk->slice_max)
+    walk->slice_max = usecs;
 
+  if (walk->rn)
+    walk->t_walk = thread_add_background (master, bgp_dump_routes_slice,
+					  NULL, 0);
+  else
+    {
+      fflush (bgp_dump_routes.fp);
+      bgp_dump_routes_stop (1);
     }
 
-  fflush (bgp_dump_routes.fp);
+  return 0;
+}
 
-  return seq;
+/* Write the peer index table and start walking the RIB. */
+static void
+bgp_dump_routes_start (void)
+{
+  struct bgp_dump_walk *walk = &bgp_dump_walk;
+  struct bgp *bgp;
+
+  bgp = bgp_get_default ();
+  if (!bgp)
+    {
+      fclose (bgp_dump_routes.fp);
+      bgp_dump_routes.fp = NULL;
+      return;
+    }
+
+  /* The index table must not refer to peers from an earlier dump. */
+  walk->gen++;
+  bgp_dump_routes_index_table (bgp, walk->gen);
+
+  walk->bgp = bgp;
+  walk->afi = AFI_IP;
+  walk->table = bgp->rib[AFI_IP][SAFI_UNICAST];
+  bgp_table_lock (walk->table);
+  walk->rn = bgp_table_top (walk->table);
+  bgp_dump_routes_next_table (walk);
+  walk->seq = 0;
+  walk->prefixes = 0;
+  walk->bytes = 0;
+  walk->slices = 0;
+  walk->slice_max = 0;
+  walk->duration = 0;
+  quagga_gettime (QUAGGA_CLK_MONOTONIC, &walk->start);
+  walk->started++;
+
+  walk->t_walk = thread_add_background (master, bgp_dump_routes_slice,
+					NULL, 0);
+}
+
+/* Abandon a table dump of an instance that is going away. */
+void
+bgp_dump_routes_cancel (struct bgp *bgp)
+{
+  if (bgp_dump_walk.bgp == bgp)
+    bgp_dump_routes_stop (0);
 }
 
 static int
@@ -389,20 +565,22 @@ bgp_dump_interval_func (struct thread *t)
   bgp_dump = THREAD_ARG (t);
   bgp_dump->t_interval = NULL;
 
+  /* A table dump still in progress keeps its file. */
+  if (bgp_dump->type == BGP_DUMP_ROUTES && bgp_dump_walk.bgp)
+    {
+      zlog_warn ("bgp_dump_interval_func: previous table dump still running,"
+		 " skipping this one");
+      bgp_dump_walk.skipped++;
+    }
   /* Reschedule dump even if file couldn't be opened this time... */
-  if (bgp_dump_open_file (bgp_dump) != NULL)
+  else if (bgp_dump_open_file (bgp_dump) != NULL)
     {
-      /* In case of bgp_dump_routes, we need special route dump function. */
+      /* In case of bgp_dump_routes, we need special route dump function.
+       * The file is closed when the dump is finished: for a RIB dump
+       * there's no point in leaving it open until the next scheduled
+       * dump starts. */
       if (bgp_dump->type == BGP_DUMP_ROUTES)
-	{
-	  unsigned int seq = bgp_dump_routes_func (AFI_IP, 1, 0);
-#ifdef HAVE_IPV6
-	  bgp_dump_routes_func (AFI_IP6, 0, seq);
-#endif /* HAVE_IPV6 */
-	  /* Close the file now. For a RIB dump there's no point in leaving
-	   * it open until the next scheduled dump starts. */
-	  fclose(bgp_dump->fp); bgp_dump->fp = NULL;
-	}
+	bgp_dump_routes_start ();
     }
 
   /* if interval is set reschedule */
@@ -621,6 +799,10 @@ bgp_dump_set (struct vty *vty, struct bgp_dump *bgp_dump,
       interval = 0;
     }
     
+  /* The file of a table dump in progress is about to be replaced. */
+  if (bgp_dump == &bgp_dump_routes)
+    bgp_dump_routes_stop (0);
+
   /* Create interval thread. */
   bgp_dump_interval_add (bgp_dump, interval);
 
@@ -641,6 +823,9 @@ bgp_dump_set (struct vty *vty, struct bgp_dump *bgp_dump,
 static int
 bgp_dump_unset (struct vty *vty, struct bgp_dump *bgp_dump)
 {
+  if (bgp_dump == &bgp_dump_routes)
+    bgp_dump_routes_stop (0);
+
   /* Set file name. */
   if (bgp_dump->filename)
     {
@@ -776,6 +961,45 @@ DEFUN (no_dump_bgp_routes,
   return bgp_dump_unset (vty, &bgp_dump_routes);
 }
 
+DEFUN (show_dump,
+       show_dump_cmd,
+       "show dump",
+       SHOW_STR
+       "BGP packet dump\n")
+{
+  struct bgp_dump_walk *walk = &bgp_dump_walk;
+  struct bgp_dump *dumps[] = { &bgp_dump_all, &bgp_dump_updates,
+			       &bgp_dump_routes };
+  const char *names[] = { "all", "updates", "routes-mrt" };
+  unsigned int i;
+
+  for (i = 0; i < sizeof (dumps) / sizeof (dumps[0]); i++)
+    {
+      if (! dumps[i]->filename)
+	continue;
+      vty_out (vty, "dump bgp %s %s%s%s, file %s%s", names[i],
+	       dumps[i]->filename, dumps[i]->interval_str ? " " : "",
+	       dumps[i]->interval_str ? dumps[i]->interval_str : "",
+	       dumps[i]->fp ? "open" : "closed", VTY_NEWLINE);
+    }
+
+  vty_out (vty, "Table dumps: %lu started, %lu completed, %lu aborted, "
+	   "%lu skipped%s", walk->started, walk->completed, walk->aborted,
+	   walk->skipped, VTY_NEWLINE);
+  if (! walk->started)
+    return CMD_SUCCESS;
+
+  vty_out (vty, "%s table dump: %lu prefixes, %lu bytes, %lu slices%s",
+	   walk->bgp ? "Current" : "Last", walk->prefixes, walk->bytes,
+	   walk->slices, VTY_NEWLINE);
+  vty_out (vty, "  %s %lu msecs, longest slice %lu usecs%s",
+	   walk->bgp ? "running for" : "took",
+	   (walk->bgp ? bgp_dump_usecs (&walk->start) : walk->duration) / 1000,
+	   walk->slice_max, VTY_NEWLINE);
+
+  return CMD_SUCCESS;
+}
+
 /* BGP node structure. */
 static struct cmd_node bgp_dump_node =
 {
@@ -868,11 +1092,15 @@ bgp_dump_init (void)
   install_element (CONFIG_NODE, &dump_bgp_routes_cmd);
   install_element (CONFIG_NODE, &dump_bgp_routes_interval_cmd);
   install_element (CONFIG_NODE, &no_dump_bgp_routes_cmd);
+
+  install_element (VIEW_NODE, &show_dump_cmd);
+  install_element (ENABLE_NODE, &show_dump_cmd);
 }
 
 void
 bgp_dump_finish (void)
 {
+  bgp_dump_routes_stop (0);
   stream_free (bgp_dump_obuf);
   bgp_dump_obuf = NULL;
 }
@@ -51,5 +51,6 @@ extern void bgp_dump_init (void);
 extern void bgp_dump_finish (void);
 extern void bgp_dump_state (struct peer *, int, int);
 extern void bgp_dump_packet (struct peer *, int, struct stream *);
+extern void bgp_dump_routes_cancel (struct bgp *);
 
 #endif /* _QUAGGA_BGP_DUMP_H */
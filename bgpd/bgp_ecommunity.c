@@ -261,6 +261,7 @@ void
 ecommunity_init (void)
 {
   ecomhash = hash_create (ecommunity_hash_make, ecommunity_cmp);
+  hash_set_name (ecomhash, "BGP ext community");
 }
 
 void
@@ -62,6 +62,7 @@ struct as_filter
   enum as_filter_type type;
 
   regex_t *reg;
+  struct bgp_asregex *asreg;
   char *reg_str;
 };
 
@@ -83,6 +84,9 @@ struct as_list
 
   struct as_filter *head;
   struct as_filter *tail;
+
+  /* Changes whenever the filters do, see as_list_apply(). */
+  u_int32_t serial;
 };
 
 /* ip as-path access-list 10 permit AS1. */
@@ -95,6 +99,9 @@ static struct as_list_master as_list_master =
   NULL
 };
 
+/* Last as_list serial handed out. */
+static u_int32_t as_list_serial;
+
 /* Allocate new AS filter. */
 static struct as_filter *
 as_filter_new (void)
@@ -108,6 +115,8 @@ as_filter_free (struct as_filter *asfilter)
 {
   if (asfilter->reg)
     bgp_regex_free (asfilter->reg);
+  if (asfilter->asreg)
+    bgp_asregex_free (asfilter->asreg);
   if (asfilter->reg_str)
     XFREE (MTYPE_AS_FILTER_STR, asfilter->reg_str);
   XFREE (MTYPE_AS_FILTER, asfilter);
@@ -121,6 +130,7 @@ as_filter_make (regex_t *reg, const char *reg_str, enum as_filter_type type)
 
   asfilter = as_filter_new ();
   asfilter->reg = reg;
+  asfilter->asreg = bgp_asregcomp (reg_str);
   asfilter->type = type;
   asfilter->reg_str = XSTRDUP (MTYPE_AS_FILTER_STR, reg_str);
 
@@ -139,9 +149,20 @@ as_filter_lookup (struct as_list *aslist, const char *reg_str,
   return NULL;
 }
 
+/* Give aslist a serial no path has a result cached for.  Serials are
+   kept to 31 bits, as the result is stored next to them. */
+static void
+as_list_changed (struct as_list *aslist)
+{
+  if (++as_list_serial > 0x7fffffff)
+    as_list_serial = 1;
+  aslist->serial = as_list_serial;
+}
+
 static void
 as_list_filter_add (struct as_list *aslist, struct as_filter *asfilter)
 {
+  as_list_changed (aslist);
   asfilter->next = NULL;
   asfilter->prev = aslist->tail;
 
@@ -350,6 +371,7 @@ as_list_empty (struct as_list *aslist)
 static void
 as_list_filter_delete (struct as_list *aslist, struct as_filter *asfilter)
 {
+  as_list_changed (aslist);
   if (asfilter->next)
     asfilter->next->prev = asfilter->prev;
   else
@@ -374,29 +396,48 @@ as_list_filter_delete (struct as_list *aslist, struct as_filter *asfilter)
 static int
 as_filter_match (struct as_filter *asfilter, struct aspath *aspath)
 {
+  if (asfilter->asreg)
+    return bgp_asregexec (asfilter->asreg, aspath) != REG_NOMATCH;
   if (bgp_regexec (asfilter->reg, aspath) != REG_NOMATCH)
     return 1;
   return 0;
 }
 
-/* Apply AS path filter to AS. */
+/* Apply AS path filter to AS.  Interned paths are shared by many
+   routes and never change, so they keep the result for the last few
+   lists applied to them, tagged with the serial of the list. */
 enum as_filter_type
 as_list_apply (struct as_list *aslist, void *object)
 {
   struct as_filter *asfilter;
   struct aspath *aspath;
+  enum as_filter_type type = AS_FILTER_DENY;
+  u_int32_t *cache = NULL;
 
   aspath = (struct aspath *) object;
 
   if (aslist == NULL)
     return AS_FILTER_DENY;
 
+  if (aspath->refcnt && aslist->serial)
+    {
+      cache = &aspath->filter_cache[aslist->serial % ASPATH_FILTER_CACHE];
+      if ((*cache >> 1) == aslist->serial)
+	return (*cache & 1) ? AS_FILTER_PERMIT : AS_FILTER_DENY;
+    }
+
   for (asfilter = aslist->head; asfilter; asfilter = asfilter->next)
     {
       if (as_filter_match (asfilter, aspath))
-	return asfilter->type;
+	{
+	  type = asfilter->type;
+	  break;
+	}
     }
-  return AS_FILTER_DENY;
+
+  if (cache)
+    *cache = (aslist->serial << 1) | (type == AS_FILTER_PERMIT);
+  return type;
 }
 
 /* Add hook function. */
@@ -40,6 +40,8 @@ Software Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
 #include "bgpd/bgp_route.h"
 #include "bgpd/bgp_dump.h"
 #include "bgpd/bgp_open.h"
+#include "bgpd/bgp_advertise.h"
+#include "bgpd/bgp_updgrp.h"
 #ifdef HAVE_SNMP
 #include "bgpd/bgp_snmp.h"
 #endif /* HAVE_SNMP */
@@ -261,6 +263,14 @@ bgp_holdtime_timer (struct thread *thread)
   peer = THREAD_ARG (thread);
   peer->t_holdtime = NULL;
 
+  /* Timers run ahead of I/O, so messages may be waiting on the socket
+     of a busy bgpd.  They count as received. */
+  if (peer->status == Established && bgp_read_input (peer) > 0)
+    {
+      BGP_TIMER_ON (peer->t_holdtime, bgp_holdtime_timer, peer->v_holdtime);
+      return 0;
+    }
+
   if (BGP_DEBUG (fsm, FSM))
     zlog (peer->log, LOG_DEBUG,
 	  "%s [FSM] Timer (holdtime timer expire)",
@@ -514,6 +524,8 @@ bgp_stop (struct peer *peer)
   /* Clear input and output buffer.  */
   if (peer->ibuf)
     stream_reset (peer->ibuf);
+  if (peer->ibuf_work)
+    stream_reset (peer->ibuf_work);
   if (peer->work)
     stream_reset (peer->work);
   if (peer->obuf)
@@ -546,6 +558,8 @@ bgp_stop (struct peer *peer)
         /* ORF received prefix-filter pnt */
         sprintf (orf_name, "%s.%d.%d", peer->host, afi, safi);
         prefix_bgp_orf_remove_all (orf_name);
+
+	bgp_updgrp_leave (peer, afi, safi);
       }
 
   /* Reset keepalive and holdtime */
@@ -775,6 +789,9 @@ bgp_establish (struct peer *peer)
   safi_t safi;
   int nsf_af_count = 0;
 
+  /* Capabilities and nexthops the update groups depend on are known. */
+  bgp_updgrp_invalidate ();
+
   /* Reset capability open status flag. */
   if (! CHECK_FLAG (peer->sflags, PEER_STATUS_CAPABILITY_OPEN))
     SET_FLAG (peer->sflags, PEER_STATUS_CAPABILITY_OPEN);
@@ -35,6 +35,9 @@ Software Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
 #include "routemap.h"
 #include "filter.h"
 #include "plist.h"
+#include "linklist.h"
+#include "hash.h"
+#include "stream.h"
 
 #include "bgpd/bgpd.h"
 #include "bgpd/bgp_attr.h"
@@ -47,6 +50,8 @@ Software Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
 #include "bgpd/bgp_clist.h"
 #include "bgpd/bgp_debug.h"
 #include "bgpd/bgp_filter.h"
+#include "bgpd/bgp_table.h"
+#include "bgpd/bgp_advertise.h"
 
 /* bgpd options, we use GNU getopt library. */
 static const struct option longopts[] = 
@@ -69,6 +74,28 @@ static const struct option longopts[] =
   { 0 }
 };
 
+/* Small objects allocated and freed per route or per peer, at high
+   rates on table loads and session flaps, served from memory pools. */
+static const struct
+{
+  int type;
+  size_t size;
+} bgp_memory_pools[] =
+{
+  { MTYPE_BGP_NODE,		sizeof (struct bgp_node)		},
+  { MTYPE_BGP_ROUTE,		sizeof (struct bgp_info)		},
+  { MTYPE_BGP_ROUTE_EXTRA,	sizeof (struct bgp_info_extra)		},
+  { MTYPE_BGP_ADJ_IN,		sizeof (struct bgp_adj_in)		},
+  { MTYPE_BGP_ADJ_OUT,		sizeof (struct bgp_adj_out)		},
+  { MTYPE_BGP_ADVERTISE,	sizeof (struct bgp_advertise)		},
+  { MTYPE_ATTR,			sizeof (struct attr)			},
+  { MTYPE_ATTR_EXTRA,		sizeof (struct attr_extra)		},
+  { MTYPE_HASH_BACKET,		sizeof (struct hash_backet)		},
+  { MTYPE_THREAD,		sizeof (struct thread)			},
+  { MTYPE_LINK_NODE,		sizeof (struct listnode)		},
+  { MTYPE_STREAM,		sizeof (struct stream)			},
+};
+
 /* signal definitions */
 void sighup (void);
 void sigint (void);
@@ -322,10 +349,15 @@ main (int argc, char **argv)
   char *progname;
   struct thread thread;
   int tmp_port;
+  unsigned int i;
 
   /* Set umask before anything for security */
   umask (0027);
 
+  /* Pools must be set up before anything of their type is allocated. */
+  for (i = 0; i < sizeof (bgp_memory_pools) / sizeof (bgp_memory_pools[0]); i++)
+    memory_pool_enable (bgp_memory_pools[i].type, bgp_memory_pools[i].size);
+
   /* Preserve name of myself. */
   progname = ((p = strrchr (argv[0], '/')) ? ++p : argv[0]);
 
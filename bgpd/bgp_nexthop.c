@@ -37,14 +37,18 @@ Software Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
 #include "bgpd/bgp_nexthop.h"
 #include "bgpd/bgp_debug.h"
 #include "bgpd/bgp_damp.h"
+#include "bgpd/bgp_advertise.h"
+#include "bgpd/bgp_updgrp.h"
 #include "zebra/rib.h"
 #include "zebra/zserv.h"	/* For ZEBRA_SERV_PATH. */
 
-struct bgp_nexthop_cache *zlookup_query (struct in_addr);
-#ifdef HAVE_IPV6
-struct bgp_nexthop_cache *zlookup_query_ipv6 (struct in6_addr *);
-#endif /* HAVE_IPV6 */
 static int zlookup_write_packet (const char *, int *, const u_char *, const int);
+static int zlookup_busy (void);
+static void zlookup_request_add (u_int16_t, struct bgp *, struct bgp_node *,
+				 afi_t, safi_t);
+static void zlookup_drain (void);
+static void bgp_import_apply (struct bgp *, struct bgp_node *, afi_t, safi_t,
+			      int, u_int32_t, struct in_addr);
 
 /* Only one BGP scan thread are activated at the same time. */
 static struct thread *bgp_scan_thread = NULL;
@@ -52,22 +56,31 @@ static struct thread *bgp_scan_thread = NULL;
 /* BGP import thread */
 static struct thread *bgp_import_thread = NULL;
 
+/* Recheck of the paths whose nexthop has to be on a connected network. */
+static struct thread *bgp_connected_thread = NULL;
+
 /* BGP scan interval. */
 static int bgp_scan_interval;
 
 /* BGP import interval. */
 static int bgp_import_interval;
 
-/* Route table for next-hop lookup cache. */
+/* Route table for next-hop lookup cache.  An entry lives as long as
+   paths use the nexthop, and is kept up to date by zebra's nexthop
+   tracking or, while zebra does not track nexthops, by bgp_scan().  */
 static struct bgp_table *bgp_nexthop_cache_table[AFI_MAX];
-static struct bgp_table *cache1_table[AFI_MAX];
-static struct bgp_table *cache2_table[AFI_MAX];
+
+/* Zebra has answered nexthop registrations since we connected. */
+static int bgp_nexthop_tracking;
 
 /* Route table for connected route. */
 static struct bgp_table *bgp_connected_table[AFI_MAX];
 
 /* BGP nexthop lookup query client. */
 struct zclient *zlookup = NULL;
+
+/* Zebra client nexthops are registered for tracking on. */
+extern struct zclient *zclient;
 
 /* Add nexthop to the end of the list.  */
 static void
@@ -210,193 +223,299 @@ bgp_nexthop_onlink (afi_t afi, struct attr *attr)
   return 0;
 }
 
-static void
-bnct_init (const afi_t afi)
+/* Zebra keeps the nexthop cache up to date. */
+static int
+bgp_nexthop_tracked (void)
 {
-  cache1_table[afi] = bgp_nexthop_cache_table[afi] = bgp_table_init (afi, SAFI_UNICAST);
-  cache2_table[afi] = bgp_table_init (afi, SAFI_UNICAST);
+  return bgp_nexthop_tracking && zclient && zclient->sock >= 0;
 }
 
-static struct bgp_table *
-bnct_active (const afi_t afi)
+/* Register the address of bnc with zebra for tracking, or unregister it,
+   as command says.  */
+static void
+bgp_nexthop_register (int command, struct bgp_nexthop_cache *bnc)
 {
-  return bgp_nexthop_cache_table[afi];
+  struct stream *s;
+  struct prefix *p = &bnc->node->p;
+
+  if (! zclient || zclient->sock < 0)
+    return;
+
+  s = zclient->obuf;
+  stream_reset (s);
+  zclient_create_header (s, command);
+  stream_putc (s, p->family);
+  stream_put (s, &p->u.prefix, PSIZE (p->prefixlen));
+  stream_putw_at (s, 0, stream_get_endp (s));
+
+  zclient_send_message (zclient);
 }
 
-static struct bgp_table *
-bnct_inactive (const afi_t afi)
+/* Find the cache entry for the nexthop p, making it if there is none.
+   A new entry is unresolved, and its paths invalid, until zebra says
+   where it resolves to: in answer to its registration when zebra
+   tracks nexthops, through bgp_nexthop_update(), or else to a lookup
+   queued on the zlookup connection.  */
+static struct bgp_nexthop_cache *
+bgp_nexthop_cache_get (afi_t afi, struct prefix *p)
 {
-  return bgp_nexthop_cache_table[afi] == cache1_table[afi] ? cache2_table[afi] : cache1_table[afi];
+  struct bgp_node *rn;
+  struct bgp_nexthop_cache *bnc;
+
+  rn = bgp_node_get (bgp_nexthop_cache_table[afi], p);
+  if (rn->info)
+    {
+      bgp_unlock_node (rn);
+      return rn->info;
+    }
+
+  bnc = bnc_new ();
+  bnc->node = rn;
+  rn->info = bnc;
+
+  if (! bgp_nexthop_tracked () && zlookup->sock >= 0)
+    {
+      if (afi == AFI_IP)
+	zlookup_request_add (ZEBRA_IPV4_NEXTHOP_LOOKUP, NULL, rn,
+			     afi, SAFI_UNICAST);
+#ifdef HAVE_IPV6
+      else if (afi == AFI_IP6)
+	zlookup_request_add (ZEBRA_IPV6_NEXTHOP_LOOKUP, NULL, rn,
+			     afi, SAFI_UNICAST);
+#endif /* HAVE_IPV6 */
+    }
+
+  bgp_nexthop_register (ZEBRA_NEXTHOP_REGISTER, bnc);
+  return bnc;
 }
 
 static void
-bnct_swap (const afi_t afi)
+bgp_nexthop_cache_delete (struct bgp_nexthop_cache *bnc)
 {
-  bgp_nexthop_cache_table[afi] = bnct_inactive (afi);
+  struct bgp_node *rn = bnc->node;
+
+  bgp_nexthop_register (ZEBRA_NEXTHOP_UNREGISTER, bnc);
+
+  rn->info = NULL;
+  bgp_unlock_node (rn);
+  bnc_free (bnc);
 }
 
+/* Add ri to the paths using bnc. */
 static void
-bnct_finish (const afi_t afi)
+bgp_nexthop_link (struct bgp_info *ri, struct bgp_nexthop_cache *bnc)
 {
-  bgp_table_unlock (cache1_table[afi]);
-  bgp_table_unlock (cache2_table[afi]);
-  cache1_table[afi] = cache2_table[afi] = NULL;
+  if (ri->nexthop == bnc)
+    return;
+
+  bgp_nexthop_unlink (ri);
+
+  ri->nexthop = bnc;
+  ri->nh_prev = NULL;
+  ri->nh_next = bnc->paths;
+  if (bnc->paths)
+    bnc->paths->nh_prev = ri;
+  bnc->paths = ri;
+  bnc->path_count++;
 }
 
-#ifdef HAVE_IPV6
-/* Check specified next-hop is reachable or not. */
-static int
-bgp_nexthop_lookup_ipv6 (struct peer *peer, struct bgp_info *ri, int *changed,
-			 int *metricchanged)
+/* Remove ri from the paths using its nexthop cache entry, and forget the
+   entry when it was the last one.  */
+void
+bgp_nexthop_unlink (struct bgp_info *ri)
 {
-  struct bgp_node *rn;
-  struct prefix p;
-  struct bgp_nexthop_cache *bnc;
-  struct attr *attr;
+  struct bgp_nexthop_cache *bnc = ri->nexthop;
 
-  /* Only check IPv6 global address only nexthop. */
-  attr = ri->attr;
+  if (! bnc)
+    return;
 
-  if (attr->extra->mp_nexthop_len != 16 
-      || IN6_IS_ADDR_LINKLOCAL (&attr->extra->mp_nexthop_global))
-    return 1;
+  if (ri->nh_next)
+    ri->nh_next->nh_prev = ri->nh_prev;
+  if (ri->nh_prev)
+    ri->nh_prev->nh_next = ri->nh_next;
+  else
+    bnc->paths = ri->nh_next;
+  ri->nexthop = NULL;
+  ri->nh_next = ri->nh_prev = NULL;
 
-  memset (&p, 0, sizeof (struct prefix));
-  p.family = AF_INET6;
-  p.prefixlen = IPV6_MAX_BITLEN;
-  p.u.prefix6 = attr->extra->mp_nexthop_global;
+  if (--bnc->path_count == 0)
+    bgp_nexthop_cache_delete (bnc);
+}
 
-  /* IBGP or ebgp-multihop */
-  rn = bgp_node_get (bnct_active (AFI_IP6), &p);
+static void
+bgp_nexthop_igpmetric (struct bgp_info *ri, struct bgp_nexthop_cache *bnc)
+{
+  if (bnc->valid && bnc->metric)
+    (bgp_info_extra_get (ri))->igpmetric = bnc->metric;
+  else if (ri->extra)
+    ri->extra->igpmetric = 0;
+}
 
-  if (rn->info)
-    {
-      bnc = rn->info;
-      bgp_unlock_node (rn);
-    }
-  else
-    {
-      if (NULL == (bnc = zlookup_query_ipv6 (&attr->extra->mp_nexthop_global)))
-	bnc = bnc_new ();
-      else
-	{
-	  if (changed)
-	    {
-	      struct bgp_node *oldrn;
+/* Revalidate the paths using bnc, which changed, and have their
+   prefixes processed.  */
+static void
+bgp_nexthop_cache_paths (afi_t afi, struct bgp_nexthop_cache *bnc,
+			 int changed)
+{
+  struct bgp_info *ri;
+  struct bgp_node *rn;
+  struct bgp *bgp;
+  int current;
 
-	      oldrn = bgp_node_lookup (bnct_inactive (AFI_IP6), &p);
-	      if (oldrn)
-		{
-		  struct bgp_nexthop_cache *oldbnc = oldrn->info;
+  for (ri = bnc->paths; ri; ri = ri->nh_next)
+    {
+      rn = ri->net;
+      if (! rn || CHECK_FLAG (ri->flags, BGP_INFO_REMOVED))
+	continue;
+      bgp = ri->peer->bgp;
 
-		  bnc->changed = bgp_nexthop_cache_different (bnc, oldbnc);
+      bgp_nexthop_igpmetric (ri, bnc);
 
-		  if (bnc->metric != oldbnc->metric)
-		    bnc->metricchanged = 1;
+      if (changed)
+	SET_FLAG (ri->flags, BGP_INFO_IGP_CHANGED);
 
-                  bgp_unlock_node (oldrn);
-		}
+      current = CHECK_FLAG (ri->flags, BGP_INFO_VALID) ? 1 : 0;
+      if (bnc->valid != current)
+	{
+	  if (current)
+	    {
+	      bgp_aggregate_decrement (bgp, &rn->p, ri, afi, SAFI_UNICAST);
+	      bgp_info_unset_flag (rn, ri, BGP_INFO_VALID);
+	    }
+	  else
+	    {
+	      bgp_info_set_flag (rn, ri, BGP_INFO_VALID);
+	      bgp_aggregate_increment (bgp, &rn->p, ri, afi, SAFI_UNICAST);
 	    }
 	}
-      rn->info = bnc;
+
+      bgp_process (bgp, rn, afi, SAFI_UNICAST);
     }
+}
 
-  if (changed)
-    *changed = bnc->changed;
+/* Make bnc resolve as fresh, a new answer from zebra which is freed, and
+   revalidate the paths using bnc if that is a change.  */
+static void
+bgp_nexthop_cache_update (afi_t afi, struct bgp_nexthop_cache *bnc,
+			  struct bgp_nexthop_cache *fresh)
+{
+  int changed;
+  int metricchanged;
 
-  if (metricchanged)
-    *metricchanged = bnc->metricchanged;
+  changed = bnc->valid != fresh->valid
+    || bgp_nexthop_cache_different (bnc, fresh);
+  metricchanged = bnc->metric != fresh->metric;
 
-  if (bnc->valid && bnc->metric)
-    (bgp_info_extra_get (ri))->igpmetric = bnc->metric;
-  else if (ri->extra)
-    ri->extra->igpmetric = 0;
+  bnc_nexthop_free (bnc);
+  bnc->valid = fresh->valid;
+  bnc->metric = fresh->metric;
+  bnc->nexthop_num = fresh->nexthop_num;
+  bnc->nexthop = fresh->nexthop;
+  fresh->nexthop = NULL;
+  bnc_free (fresh);
+
+  if (changed || metricchanged)
+    {
+      if (BGP_DEBUG (nexthop, NEXTHOP))
+	{
+	  char buf[INET6_ADDRSTRLEN];
 
-  return bnc->valid;
+	  zlog_debug ("%s: %s %s, %lu paths", __func__,
+		      inet_ntop (bnc->node->p.family, &bnc->node->p.u.prefix,
+				 buf, INET6_ADDRSTRLEN),
+		      bnc->valid ? "changed" : "unreachable",
+		      bnc->path_count);
+	}
+      bgp_nexthop_cache_paths (afi, bnc, changed);
+    }
 }
-#endif /* HAVE_IPV6 */
 
-/* Check specified next-hop is reachable or not. */
-int
-bgp_nexthop_lookup (afi_t afi, struct peer *peer, struct bgp_info *ri,
-		    int *changed, int *metricchanged)
+/* Without zebra tracking them, look up all cached nexthops again.  The
+   lookups are queued, and each nexthop is updated as its answer comes
+   in. */
+static void
+bgp_nexthop_cache_refresh (afi_t afi)
 {
   struct bgp_node *rn;
-  struct prefix p;
-  struct bgp_nexthop_cache *bnc;
-  struct in_addr addr;
 
+  if (zlookup->sock < 0)
+    return;
+
+  for (rn = bgp_table_top (bgp_nexthop_cache_table[afi]); rn;
+       rn = bgp_route_next (rn))
+    if (rn->info != NULL)
+      {
+	if (afi == AFI_IP)
+	  zlookup_request_add (ZEBRA_IPV4_NEXTHOP_LOOKUP, NULL, rn,
+			       afi, SAFI_UNICAST);
 #ifdef HAVE_IPV6
-  if (afi == AFI_IP6)
-    return bgp_nexthop_lookup_ipv6 (peer, ri, changed, metricchanged);
+	else if (afi == AFI_IP6)
+	  zlookup_request_add (ZEBRA_IPV6_NEXTHOP_LOOKUP, NULL, rn,
+			       afi, SAFI_UNICAST);
 #endif /* HAVE_IPV6 */
+      }
+}
 
-  addr = ri->attr->nexthop;
-
-  memset (&p, 0, sizeof (struct prefix));
-  p.family = AF_INET;
-  p.prefixlen = IPV4_MAX_BITLEN;
-  p.u.prefix4 = addr;
+/* Check specified next-hop is reachable or not, and have the path
+   revalidated when that changes.  */
+int
+bgp_nexthop_lookup (afi_t afi, struct peer *peer, struct bgp_info *ri)
+{
+  struct prefix p;
+  struct bgp_nexthop_cache *bnc;
+  struct attr *attr;
 
-  /* IBGP or ebgp-multihop */
-  rn = bgp_node_get (bnct_active (AFI_IP), &p);
+  attr = ri->attr;
 
-  if (rn->info)
+  memset (&p, 0, sizeof (struct prefix));
+#ifdef HAVE_IPV6
+  if (afi == AFI_IP6)
     {
-      bnc = rn->info;
-      bgp_unlock_node (rn);
+      /* Only check IPv6 global address only nexthop. */
+      if (attr->extra->mp_nexthop_len != 16 
+	  || IN6_IS_ADDR_LINKLOCAL (&attr->extra->mp_nexthop_global))
+	{
+	  bgp_nexthop_unlink (ri);
+	  return 1;
+	}
+
+      p.family = AF_INET6;
+      p.prefixlen = IPV6_MAX_BITLEN;
+      p.u.prefix6 = attr->extra->mp_nexthop_global;
     }
   else
+#endif /* HAVE_IPV6 */
     {
-      if (NULL == (bnc = zlookup_query (addr)))
-	bnc = bnc_new ();
-      else
-	{
-	  if (changed)
-	    {
-	      struct bgp_node *oldrn;
-
-	      oldrn = bgp_node_lookup (bnct_inactive (AFI_IP), &p);
-	      if (oldrn)
-		{
-		  struct bgp_nexthop_cache *oldbnc = oldrn->info;
-
-		  bnc->changed = bgp_nexthop_cache_different (bnc, oldbnc);
-
-		  if (bnc->metric != oldbnc->metric)
-		    bnc->metricchanged = 1;
-
-                  bgp_unlock_node (oldrn);
-		}
-	    }
-	}
-      rn->info = bnc;
+      p.family = AF_INET;
+      p.prefixlen = IPV4_MAX_BITLEN;
+      p.u.prefix4 = attr->nexthop;
     }
 
-  if (changed)
-    *changed = bnc->changed;
-
-  if (metricchanged)
-    *metricchanged = bnc->metricchanged;
-
-  if (bnc->valid && bnc->metric)
-    (bgp_info_extra_get(ri))->igpmetric = bnc->metric;
-  else if (ri->extra)
-    ri->extra->igpmetric = 0;
+  /* IBGP or ebgp-multihop */
+  bnc = bgp_nexthop_cache_get (afi, &p);
+  bgp_nexthop_link (ri, bnc);
+  bgp_nexthop_igpmetric (ri, bnc);
 
   return bnc->valid;
 }
 
-/* Reset and free all BGP nexthop cache. */
+/* Forget the BGP nexthop cache. */
 static void
 bgp_nexthop_cache_reset (struct bgp_table *table)
 {
   struct bgp_node *rn;
   struct bgp_nexthop_cache *bnc;
+  struct bgp_info *ri;
 
   for (rn = bgp_table_top (table); rn; rn = bgp_route_next (rn))
     if ((bnc = rn->info) != NULL)
       {
+	while ((ri = bnc->paths) != NULL)
+	  {
+	    bnc->paths = ri->nh_next;
+	    ri->nexthop = NULL;
+	    ri->nh_next = ri->nh_prev = NULL;
+	  }
 	bnc_free (bnc);
 	rn->info = NULL;
 	bgp_unlock_node (rn);
@@ -494,20 +613,24 @@ verify_ipv4_rgates (struct bgp_table *nhtable, struct route_table *pfxlist)
 {
   struct bgp_node *rn;
   struct bgp_nexthop_cache *bnc;
+  struct nexthop *nexthop;
   struct nexthop buffered[VERIFIED_NEXTHOPS_PER_MSG];
   unsigned numbuffered = 0;
-  unsigned i;
 
+  if (zlookup->sock < 0)
+    return;
+
+  zlookup_drain ();
   if (zlookup->sock < 0)
     return;
 
   for (rn = bgp_table_top (nhtable); rn; rn = bgp_route_next (rn))
     if ((bnc = rn->info) != NULL && bnc->valid)
-      for (i = 0; i < bnc->nexthop_num; i++)
-        if (bnc->nexthop[i].type == NEXTHOP_TYPE_IPV4)
+      for (nexthop = bnc->nexthop; nexthop; nexthop = nexthop->next)
+        if (nexthop->type == NEXTHOP_TYPE_IPV4)
           {
             IPV4_ADDR_COPY (&buffered[numbuffered].gate.ipv4, &rn->p.u.prefix4);
-            IPV4_ADDR_COPY (&buffered[numbuffered].rgate.ipv4, &bnc->nexthop[i].gate.ipv4);
+            IPV4_ADDR_COPY (&buffered[numbuffered].rgate.ipv4, &nexthop->gate.ipv4);
             if (++numbuffered == VERIFIED_NEXTHOPS_PER_MSG)
               {
                 if (send_rgates (buffered, numbuffered, 1) <= 0)
@@ -531,14 +654,10 @@ bgp_scan (afi_t afi, safi_t safi)
   struct bgp_info *next;
   struct peer *peer;
   struct listnode *node, *nnode;
-  struct route_table *desyncpfxs;
+  struct route_table *desyncpfxs = NULL;
   struct route_node *dprn;
-  int valid;
-  int current;
-  int changed;
-  int metricchanged;
-
-  bnct_swap (afi);
+  int dampening;
+  int process;
 
   /* Get default bgp. */
   bgp = bgp_get_default ();
@@ -562,88 +681,67 @@ bgp_scan (afi_t afi, safi_t safi)
 	bgp_maximum_prefix_overflow (peer, afi, SAFI_MPLS_VPN, 1);
     }
 
+  /* The gateways verified are those of the last lookup, as the lookups
+     bgp_scan_timer() makes are answered only after the scan. */
   if (afi == AFI_IP)
     {
       desyncpfxs = route_table_init();
-      verify_ipv4_rgates (bnct_inactive (afi), desyncpfxs);
+      verify_ipv4_rgates (bgp_nexthop_cache_table[afi], desyncpfxs);
     }
 
-  for (rn = bgp_table_top (bgp->rib[afi][SAFI_UNICAST]); rn;
-       rn = bgp_route_next (rn))
-    {
-      for (bi = rn->info; bi; bi = next)
-	{
-	  next = bi->next;
+  /* Only dampened paths and prefixes zebra found out of sync need the
+     RIB walked. */
+  dampening = CHECK_FLAG (bgp->af_flags[afi][SAFI_UNICAST],
+			  BGP_CONFIG_DAMPENING);
+  if (dampening || (desyncpfxs && desyncpfxs->top))
+    for (rn = bgp_table_top (bgp->rib[afi][SAFI_UNICAST]); rn;
+	 rn = bgp_route_next (rn))
+      {
+	process = 0;
 
-	  if (bi->type == ZEBRA_ROUTE_BGP && bi->sub_type == BGP_ROUTE_NORMAL)
-	    {
-	      changed = 0;
-	      metricchanged = 0;
-
-              if (afi == AFI_IP)
-                if ((dprn = route_node_match (desyncpfxs, &rn->p)))
-                  {
-                    /* The current prefix failed zebra nexthop verification,
-                     * further checks can be omitted.
-                     */
-                    route_unlock_node (dprn);
-                    if (BGP_DEBUG (nexthop, NEXTHOP))
-                      {
-                        char buf[INET_ADDRSTRLEN];
-                        inet_ntop (AF_INET, &rn->p.u.prefix4, buf, INET_ADDRSTRLEN);
-                        zlog_debug ("%s: rgate out of sync for %s/%u", __func__, buf, rn->p.prefixlen);
-                      }
-                    /* Setting this flag will eventually lead to the old BGP RIB
-                     * entry of the prefix withdrawn at zebra side of the socket
-                     * and reinstalled using freshly resolved IGP gateway.
-                     */
-                    SET_FLAG (bi->flags, BGP_INFO_IGP_CHANGED);
-                    goto nextprefix;
-                  }
-
-	      if (peer_sort (bi->peer) == BGP_PEER_EBGP && bi->peer->ttl == 1)
-		valid = bgp_nexthop_onlink (afi, bi->attr);
-	      else
-		valid = bgp_nexthop_lookup (afi, bi->peer, bi,
-					    &changed, &metricchanged);
-
-	      current = CHECK_FLAG (bi->flags, BGP_INFO_VALID) ? 1 : 0;
-
-	      if (changed)
+	for (bi = rn->info; bi; bi = next)
+	  {
+	    next = bi->next;
+
+	    if (bi->type != ZEBRA_ROUTE_BGP || bi->sub_type != BGP_ROUTE_NORMAL)
+	      continue;
+
+	    if (desyncpfxs && desyncpfxs->top
+		&& (dprn = route_node_match (desyncpfxs, &rn->p)))
+	      {
+		/* The current prefix failed zebra nexthop verification,
+		 * further checks can be omitted.
+		 */
+		route_unlock_node (dprn);
+		if (BGP_DEBUG (nexthop, NEXTHOP))
+		  {
+		    char buf[INET_ADDRSTRLEN];
+		    inet_ntop (AF_INET, &rn->p.u.prefix4, buf, INET_ADDRSTRLEN);
+		    zlog_debug ("%s: rgate out of sync for %s/%u", __func__, buf, rn->p.prefixlen);
+		  }
+		/* Setting this flag will eventually lead to the old BGP RIB
+		 * entry of the prefix withdrawn at zebra side of the socket
+		 * and reinstalled using freshly resolved IGP gateway.
+		 */
 		SET_FLAG (bi->flags, BGP_INFO_IGP_CHANGED);
-	      else
-		UNSET_FLAG (bi->flags, BGP_INFO_IGP_CHANGED);
-
-	      if (valid != current)
-		{
-		  if (CHECK_FLAG (bi->flags, BGP_INFO_VALID))
-		    {
-		      bgp_aggregate_decrement (bgp, &rn->p, bi,
-					       afi, SAFI_UNICAST);
-		      bgp_info_unset_flag (rn, bi, BGP_INFO_VALID);
-		    }
-		  else
-		    {
-		      bgp_info_set_flag (rn, bi, BGP_INFO_VALID);
-		      bgp_aggregate_increment (bgp, &rn->p, bi,
-					       afi, SAFI_UNICAST);
-		    }
-		}
-
-              if (CHECK_FLAG (bgp->af_flags[afi][SAFI_UNICAST],
-		  BGP_CONFIG_DAMPENING)
-                  &&  bi->extra && bi->extra->damp_info )
-                if (bgp_damp_scan (bi, afi, SAFI_UNICAST))
+		process = 1;
+		continue;
+	      }
+
+	    if (dampening && bi->extra && bi->extra->damp_info)
+	      {
+		if (bgp_damp_scan (bi, afi, SAFI_UNICAST))
 		  bgp_aggregate_increment (bgp, &rn->p, bi,
 					   afi, SAFI_UNICAST);
-nextprefix: ;
-	    }
-	}
-      bgp_process (bgp, rn, afi, SAFI_UNICAST);
-    }
+		process = 1;
+	      }
+	  }
 
-  bgp_nexthop_cache_reset (bnct_inactive (afi));
-  if (afi == AFI_IP)
+	if (process)
+	  bgp_process (bgp, rn, afi, SAFI_UNICAST);
+      }
+
+  if (desyncpfxs)
     {
       for (dprn = route_top (desyncpfxs); dprn; dprn = route_next (dprn))
         dprn->info = NULL;
@@ -667,6 +765,17 @@ bgp_scan_timer (struct thread *t)
   bgp_scan (AFI_IP6, SAFI_UNICAST);
 #endif /* HAVE_IPV6 */
 
+  /* Paths follow their nexthops by themselves, unless zebra does not
+     track them and they have to be looked up again.  Lookups still
+     unanswered from the last scan are left to finish. */
+  if (! bgp_nexthop_tracked () && ! zlookup_busy ())
+    {
+      bgp_nexthop_cache_refresh (AFI_IP);
+#ifdef HAVE_IPV6
+      bgp_nexthop_cache_refresh (AFI_IP6);
+#endif /* HAVE_IPV6 */
+    }
+
   return 0;
 }
 
@@ -675,6 +784,81 @@ struct bgp_connected_ref
   unsigned int refcnt;
 };
 
+/* Paths from single hop EBGP peers are valid as long as their nexthop
+   is on a connected network.  */
+static void
+bgp_connected_paths (struct bgp *bgp, afi_t afi)
+{
+  struct bgp_node *rn;
+  struct bgp_info *bi;
+  struct peer *peer;
+  int valid;
+  int process;
+
+  for (rn = bgp_table_top (bgp->rib[afi][SAFI_UNICAST]); rn;
+       rn = bgp_route_next (rn))
+    {
+      process = 0;
+
+      for (bi = rn->info; bi; bi = bi->next)
+	{
+	  peer = bi->peer;
+	  if (bi->type != ZEBRA_ROUTE_BGP || bi->sub_type != BGP_ROUTE_NORMAL
+	      || CHECK_FLAG (bi->flags, BGP_INFO_REMOVED)
+	      || peer_sort (peer) != BGP_PEER_EBGP || peer->ttl != 1
+	      || CHECK_FLAG (peer->flags, PEER_FLAG_DISABLE_CONNECTED_CHECK))
+	    continue;
+
+	  valid = bgp_nexthop_onlink (afi, bi->attr);
+	  if (valid == (CHECK_FLAG (bi->flags, BGP_INFO_VALID) ? 1 : 0))
+	    continue;
+
+	  if (valid)
+	    {
+	      bgp_info_set_flag (rn, bi, BGP_INFO_VALID);
+	      bgp_aggregate_increment (bgp, &rn->p, bi, afi, SAFI_UNICAST);
+	    }
+	  else
+	    {
+	      bgp_aggregate_decrement (bgp, &rn->p, bi, afi, SAFI_UNICAST);
+	      bgp_info_unset_flag (rn, bi, BGP_INFO_VALID);
+	    }
+	  process = 1;
+	}
+
+      if (process)
+	bgp_process (bgp, rn, afi, SAFI_UNICAST);
+    }
+}
+
+static int
+bgp_connected_check (struct thread *t)
+{
+  struct listnode *node, *nnode;
+  struct bgp *bgp;
+
+  bgp_connected_thread = NULL;
+
+  for (ALL_LIST_ELEMENTS (bm->bgp, node, nnode, bgp))
+    {
+      bgp_connected_paths (bgp, AFI_IP);
+#ifdef HAVE_IPV6
+      bgp_connected_paths (bgp, AFI_IP6);
+#endif /* HAVE_IPV6 */
+    }
+  return 0;
+}
+
+/* A connected network appeared or went away.  The paths are checked
+   once the addresses zebra sends in a row are all in.  */
+static void
+bgp_connected_changed (void)
+{
+  if (! bgp_connected_thread)
+    bgp_connected_thread = thread_add_event (master, bgp_connected_check,
+					     NULL, 0);
+}
+
 void
 bgp_connected_add (struct connected *ifc)
 {
@@ -684,6 +868,8 @@ bgp_connected_add (struct connected *ifc)
   struct bgp_node *rn;
   struct bgp_connected_ref *bc;
 
+  bgp_updgrp_invalidate ();
+
   ifp = ifc->ifp;
 
   if (! ifp)
@@ -713,6 +899,7 @@ bgp_connected_add (struct connected *ifc)
 	  bc = XCALLOC (MTYPE_BGP_CONN, sizeof (struct bgp_connected_ref));
 	  bc->refcnt = 1;
 	  rn->info = bc;
+	  bgp_connected_changed ();
 	}
     }
 #ifdef HAVE_IPV6
@@ -738,6 +925,7 @@ bgp_connected_add (struct connected *ifc)
 	  bc = XCALLOC (MTYPE_BGP_CONN, sizeof (struct bgp_connected_ref));
 	  bc->refcnt = 1;
 	  rn->info = bc;
+	  bgp_connected_changed ();
 	}
     }
 #endif /* HAVE_IPV6 */
@@ -752,6 +940,8 @@ bgp_connected_delete (struct connected *ifc)
   struct bgp_node *rn;
   struct bgp_connected_ref *bc;
 
+  bgp_updgrp_invalidate ();
+
   ifp = ifc->ifp;
 
   if (if_is_loopback (ifp))
@@ -777,6 +967,7 @@ bgp_connected_delete (struct connected *ifc)
 	{
 	  XFREE (MTYPE_BGP_CONN, bc);
 	  rn->info = NULL;
+	  bgp_connected_changed ();
 	}
       bgp_unlock_node (rn);
       bgp_unlock_node (rn);
@@ -803,6 +994,7 @@ bgp_connected_delete (struct connected *ifc)
 	{
 	  XFREE (MTYPE_BGP_CONN, bc);
 	  rn->info = NULL;
+	  bgp_connected_changed ();
 	}
       bgp_unlock_node (rn);
       bgp_unlock_node (rn);
@@ -833,74 +1025,58 @@ bgp_nexthop_self (afi_t afi, struct attr *attr)
   return 0;
 }
 
+/* Read the metric and the nexthops which follow the address in nexthop
+   lookup replies and tracking updates.  Return NULL if there are no
+   nexthops.  */
 static struct bgp_nexthop_cache *
-zlookup_read (void)
+bnc_read (struct stream *s)
 {
-  struct stream *s;
-  uint16_t length;
-  u_char marker;
-  u_char version;
-  uint16_t command;
-  int nbytes;
-  struct in_addr raddr;
   uint32_t metric;
   int i;
   u_char nexthop_num;
   struct nexthop *nexthop;
   struct bgp_nexthop_cache *bnc;
 
-  s = zlookup->ibuf;
-  stream_reset (s);
-
-  nbytes = stream_read (s, zlookup->sock, 2);
-  length = stream_getw (s);
-
-  nbytes = stream_read (s, zlookup->sock, length - 2);
-  marker = stream_getc (s);
-  version = stream_getc (s);
-  
-  if (version != ZSERV_VERSION || marker != ZEBRA_HEADER_MARKER)
-    {
-      zlog_err("%s: socket %d version mismatch, marker %d, version %d",
-               __func__, zlookup->sock, marker, version);
-      return NULL;
-    }
-    
-  command = stream_getw (s);
-  
-  raddr.s_addr = stream_get_ipv4 (s);
   metric = stream_getl (s);
   nexthop_num = stream_getc (s);
 
-  if (nexthop_num)
-    {
-      bnc = bnc_new ();
-      bnc->valid = 1;
-      bnc->metric = metric;
-      bnc->nexthop_num = nexthop_num;
+  if (! nexthop_num)
+    return NULL;
+
+  bnc = bnc_new ();
+  bnc->valid = 1;
+  bnc->metric = metric;
+  bnc->nexthop_num = nexthop_num;
 
-      for (i = 0; i < nexthop_num; i++)
+  for (i = 0; i < nexthop_num; i++)
+    {
+      nexthop = XCALLOC (MTYPE_NEXTHOP, sizeof (struct nexthop));
+      nexthop->type = stream_getc (s);
+      switch (nexthop->type)
 	{
-	  nexthop = XCALLOC (MTYPE_NEXTHOP, sizeof (struct nexthop));
-	  nexthop->type = stream_getc (s);
-	  switch (nexthop->type)
-	    {
-	    case ZEBRA_NEXTHOP_IPV4:
-	      nexthop->gate.ipv4.s_addr = stream_get_ipv4 (s);
-	      break;
-	    case ZEBRA_NEXTHOP_IFINDEX:
-	    case ZEBRA_NEXTHOP_IFNAME:
-	      nexthop->ifindex = stream_getl (s);
-	      break;
-            default:
-              /* do nothing */
-              break;
-	    }
-	  bnc_nexthop_add (bnc, nexthop);
+	case ZEBRA_NEXTHOP_IPV4:
+	  nexthop->gate.ipv4.s_addr = stream_get_ipv4 (s);
+	  break;
+#ifdef HAVE_IPV6
+	case ZEBRA_NEXTHOP_IPV6:
+	  stream_get (&nexthop->gate.ipv6, s, 16);
+	  break;
+	case ZEBRA_NEXTHOP_IPV6_IFINDEX:
+	case ZEBRA_NEXTHOP_IPV6_IFNAME:
+	  stream_get (&nexthop->gate.ipv6, s, 16);
+	  nexthop->ifindex = stream_getl (s);
+	  break;
+#endif /* HAVE_IPV6 */
+	case ZEBRA_NEXTHOP_IFINDEX:
+	case ZEBRA_NEXTHOP_IFNAME:
+	  nexthop->ifindex = stream_getl (s);
+	  break;
+	default:
+	  /* do nothing */
+	  break;
 	}
+      bnc_nexthop_add (bnc, nexthop);
     }
-  else
-    return NULL;
 
   return bnc;
 }
@@ -920,210 +1096,480 @@ zlookup_write_packet (const char *caller, int *socket, const u_char *data, const
   return ret;
 }
 
-struct bgp_nexthop_cache *
-zlookup_query (struct in_addr addr)
+/* A nexthop or import lookup queued on the zlookup connection.  The
+   node (and for imports the bgp instance) stays locked until zebra's
+   answer has been applied to it. */
+struct zlookup_request
 {
-  struct stream *s;
+  u_int16_t command;
+  struct bgp *bgp;
+  struct bgp_node *rn;
+  afi_t afi;
+  safi_t safi;
 
-  /* Check socket. */
-  if (zlookup->sock < 0)
-    return NULL;
+  /* Zebra's answer, NULL if the prefix is unreachable. */
+  struct bgp_nexthop_cache *fresh;
+};
 
-  s = zlookup->obuf;
-  stream_reset (s);
-  zclient_create_header (s, ZEBRA_IPV4_NEXTHOP_LOOKUP);
-  stream_put_in_addr (s, &addr);
-  
-  stream_putw_at (s, 0, stream_get_endp (s));
-  
-  return zlookup_write_packet (__func__, &zlookup->sock, s->data, stream_get_endp (s)) <= 0 ?
-    NULL : zlookup_read ();
+/* Requests not sent yet, those sent which zebra answers in order, and
+   those answered while draining which are still to be applied. */
+static struct list *zlookup_waiting;
+static struct list *zlookup_sent;
+static struct list *zlookup_done;
+
+/* Most requests zebra has to answer before more are sent. */
+#define ZLOOKUP_WINDOW 128
+
+static struct thread *zlookup_read_thread = NULL;
+static struct thread *zlookup_fill_thread = NULL;
+
+/* A batch runs from the first request queued on an idle connection
+   until the last answer is in. */
+static struct zlookup_stats
+{
+  unsigned long batches;
+  unsigned long lookups;
+  unsigned long last_count;
+  unsigned long last_usecs;
+  unsigned long max_usecs;
+
+  struct timeval start;
+  unsigned long count;
+} zlookup_stats;
+
+static int zlookup_fill (struct thread *);
+static int zlookup_read_answer (struct thread *);
+
+static int
+zlookup_busy (void)
+{
+  return listcount (zlookup_waiting) || listcount (zlookup_sent)
+    || listcount (zlookup_done);
 }
 
-#ifdef HAVE_IPV6
-static struct bgp_nexthop_cache *
-zlookup_read_ipv6 (void)
+static void
+zlookup_request_free (struct zlookup_request *req)
+{
+  if (req->fresh)
+    bnc_free (req->fresh);
+  bgp_unlock_node (req->rn);
+  if (req->bgp)
+    bgp_unlock (req->bgp);
+  XFREE (MTYPE_BGP_ZLOOKUP, req);
+}
+
+static void
+zlookup_batch_end (void)
+{
+  struct zlookup_stats *stats = &zlookup_stats;
+  struct timeval now;
+
+  if (zlookup_busy () || ! stats->count)
+    return;
+
+  quagga_gettime (QUAGGA_CLK_MONOTONIC, &now);
+  stats->last_usecs = (now.tv_sec - stats->start.tv_sec) * 1000000L
+    + (now.tv_usec - stats->start.tv_usec);
+  if (stats->last_usecs > stats->max_usecs)
+    stats->max_usecs = stats->last_usecs;
+  stats->last_count = stats->count;
+  stats->count = 0;
+  stats->batches++;
+
+  if (BGP_DEBUG (nexthop, NEXTHOP))
+    zlog_debug ("%s: %lu lookups in %lu usecs", __func__,
+		stats->last_count, stats->last_usecs);
+}
+
+/* Queue a lookup of rn's prefix, to be sent when the window allows. */
+static void
+zlookup_request_add (u_int16_t command, struct bgp *bgp,
+		     struct bgp_node *rn, afi_t afi, safi_t safi)
+{
+  struct zlookup_request *req;
+
+  if (! zlookup_busy ())
+    quagga_gettime (QUAGGA_CLK_MONOTONIC, &zlookup_stats.start);
+
+  req = XCALLOC (MTYPE_BGP_ZLOOKUP, sizeof (struct zlookup_request));
+  req->command = command;
+  req->bgp = bgp;
+  req->rn = bgp_lock_node (rn);
+  req->afi = afi;
+  req->safi = safi;
+  if (bgp)
+    bgp_lock (bgp);
+
+  listnode_add (zlookup_waiting, req);
+  zlookup_stats.count++;
+
+  if (! zlookup_fill_thread)
+    zlookup_fill_thread = thread_add_event (master, zlookup_fill, NULL, 0);
+}
+
+static void
+zlookup_list_flush (struct list *list)
+{
+  struct zlookup_request *req;
+
+  while (listcount (list))
+    {
+      req = listgetdata (listhead (list));
+      list_delete_node (list, listhead (list));
+      zlookup_request_free (req);
+    }
+}
+
+/* Give up on all requests, the connection is gone. */
+static void
+zlookup_fail_all (void)
+{
+  THREAD_OFF (zlookup_read_thread);
+  THREAD_OFF (zlookup_fill_thread);
+
+  zlookup_list_flush (zlookup_sent);
+  zlookup_list_flush (zlookup_waiting);
+  zlookup_list_flush (zlookup_done);
+
+  zlookup_batch_end ();
+}
+
+/* Hand zebra's answer to what asked for it. */
+static void
+zlookup_request_done (struct zlookup_request *req)
+{
+  struct bgp_nexthop_cache *fresh = req->fresh;
+  struct in_addr nexthop;
+
+  req->fresh = NULL;
+  switch (req->command)
+    {
+    case ZEBRA_IPV4_NEXTHOP_LOOKUP:
+    case ZEBRA_IPV6_NEXTHOP_LOOKUP:
+      /* The nexthop may have gone unused meanwhile. */
+      if (req->rn->info)
+	bgp_nexthop_cache_update (req->afi, req->rn->info,
+				  fresh ? fresh : bnc_new ());
+      else if (fresh)
+	bnc_free (fresh);
+      break;
+    case ZEBRA_IPV4_IMPORT_LOOKUP:
+      nexthop.s_addr = 0;
+      if (fresh && fresh->nexthop->type == ZEBRA_NEXTHOP_IPV4)
+	nexthop = fresh->nexthop->gate.ipv4;
+      /* And the static may have been removed. */
+      if (req->rn->info)
+	bgp_import_apply (req->bgp, req->rn, req->afi, req->safi,
+			  fresh != NULL, fresh ? fresh->metric : 0, nexthop);
+      if (fresh)
+	bnc_free (fresh);
+      break;
+    }
+}
+
+/* Apply the answers zebra gave while the connection was drained. */
+static void
+zlookup_apply (void)
+{
+  struct zlookup_request *req;
+
+  while (listcount (zlookup_done))
+    {
+      req = listgetdata (listhead (zlookup_done));
+      list_delete_node (zlookup_done, listhead (zlookup_done));
+      zlookup_request_done (req);
+      zlookup_request_free (req);
+    }
+}
+
+/* Read the answer to the oldest request sent onto the done list.
+   Return -1 when the connection has failed. */
+static int
+zlookup_answer_one (void)
 {
   struct stream *s;
+  struct zlookup_request *req;
   uint16_t length;
-  u_char version, marker;
-  uint16_t  command;
-  int nbytes;
-  struct in6_addr raddr;
-  uint32_t metric;
-  int i;
-  u_char nexthop_num;
-  struct nexthop *nexthop;
-  struct bgp_nexthop_cache *bnc;
+  u_char marker;
+  u_char version;
+  uint16_t command;
+  int match;
+
+  req = listgetdata (listhead (zlookup_sent));
+  list_delete_node (zlookup_sent, listhead (zlookup_sent));
 
   s = zlookup->ibuf;
   stream_reset (s);
 
-  nbytes = stream_read (s, zlookup->sock, 2);
-  length = stream_getw (s);
+  if (stream_read (s, zlookup->sock, 2) != 2
+      || (length = stream_getw (s)) < ZEBRA_HEADER_SIZE
+      || stream_read (s, zlookup->sock, length - 2) != length - 2)
+    {
+      zlog_err ("%s: zlookup connection failed", __func__);
+      close (zlookup->sock);
+      zlookup->sock = -1;
+      zlookup_request_free (req);
+      zlookup_fail_all ();
+      return -1;
+    }
 
-  nbytes = stream_read (s, zlookup->sock, length - 2);
   marker = stream_getc (s);
   version = stream_getc (s);
-  
   if (version != ZSERV_VERSION || marker != ZEBRA_HEADER_MARKER)
     {
       zlog_err("%s: socket %d version mismatch, marker %d, version %d",
                __func__, zlookup->sock, marker, version);
-      return NULL;
+      zlookup_request_free (req);
+      return 0;
     }
-    
-  command = stream_getw (s);
-  
-  stream_get (&raddr, s, 16);
-
-  metric = stream_getl (s);
-  nexthop_num = stream_getc (s);
 
-  if (nexthop_num)
+  command = stream_getw (s);
+  if (command == ZEBRA_IPV6_NEXTHOP_LOOKUP)
     {
-      bnc = bnc_new ();
-      bnc->valid = 1;
-      bnc->metric = metric;
-      bnc->nexthop_num = nexthop_num;
+      struct in6_addr raddr;
 
-      for (i = 0; i < nexthop_num; i++)
-	{
-	  nexthop = XCALLOC (MTYPE_NEXTHOP, sizeof (struct nexthop));
-	  nexthop->type = stream_getc (s);
-	  switch (nexthop->type)
-	    {
-	    case ZEBRA_NEXTHOP_IPV6:
-	      stream_get (&nexthop->gate.ipv6, s, 16);
-	      break;
-	    case ZEBRA_NEXTHOP_IPV6_IFINDEX:
-	    case ZEBRA_NEXTHOP_IPV6_IFNAME:
-	      stream_get (&nexthop->gate.ipv6, s, 16);
-	      nexthop->ifindex = stream_getl (s);
-	      break;
-	    case ZEBRA_NEXTHOP_IFINDEX:
-	    case ZEBRA_NEXTHOP_IFNAME:
-	      nexthop->ifindex = stream_getl (s);
-	      break;
-	    default:
-	      /* do nothing */
-	      break;
-	    }
-	  bnc_nexthop_add (bnc, nexthop);
-	}
+      stream_get (&raddr, s, 16);
+      match = IPV6_ADDR_SAME (&raddr, &req->rn->p.u.prefix6);
     }
   else
-    return NULL;
+    match = stream_get_ipv4 (s) == req->rn->p.u.prefix4.s_addr;
 
-  return bnc;
+  if (command != req->command || ! match)
+    {
+      zlog_warn ("%s: answer (command %u) does not match request "
+		 "(command %u), dropped", __func__, command, req->command);
+      zlookup_request_free (req);
+      return 0;
+    }
+
+  req->fresh = bnc_read (s);
+  listnode_add (zlookup_done, req);
+  return 0;
 }
 
-struct bgp_nexthop_cache *
-zlookup_query_ipv6 (struct in6_addr *addr)
+/* Send waiting requests back to back, as far as the window allows. */
+static int
+zlookup_fill (struct thread *t)
 {
   struct stream *s;
+  struct zlookup_request *req;
+
+  zlookup_fill_thread = NULL;
+
+  zlookup_apply ();
 
-  /* Check socket. */
   if (zlookup->sock < 0)
-    return NULL;
+    {
+      zlookup_fail_all ();
+      return 0;
+    }
 
   s = zlookup->obuf;
-  stream_reset (s);
-  zclient_create_header (s, ZEBRA_IPV6_NEXTHOP_LOOKUP);
-  stream_put (s, addr, 16);
-  stream_putw_at (s, 0, stream_get_endp (s));
+  while (listcount (zlookup_waiting)
+	 && listcount (zlookup_sent) < ZLOOKUP_WINDOW)
+    {
+      req = listgetdata (listhead (zlookup_waiting));
+
+      stream_reset (s);
+      zclient_create_header (s, req->command);
+      if (req->command == ZEBRA_IPV4_IMPORT_LOOKUP)
+	stream_putc (s, req->rn->p.prefixlen);
+      if (req->command == ZEBRA_IPV6_NEXTHOP_LOOKUP)
+	stream_put (s, &req->rn->p.u.prefix6, 16);
+      else
+	stream_put_in_addr (s, &req->rn->p.u.prefix4);
+      stream_putw_at (s, 0, stream_get_endp (s));
 
-  return zlookup_write_packet (__func__, &zlookup->sock, s->data, stream_get_endp (s)) <= 0 ?
-    NULL : zlookup_read_ipv6();
+      if (zlookup_write_packet (__func__, &zlookup->sock, s->data,
+				stream_get_endp (s)) <= 0)
+	{
+	  zlookup_fail_all ();
+	  return 0;
+	}
+
+      list_delete_node (zlookup_waiting, listhead (zlookup_waiting));
+      listnode_add (zlookup_sent, req);
+      zlookup_stats.lookups++;
+    }
+
+  if (listcount (zlookup_sent) && ! zlookup_read_thread)
+    zlookup_read_thread = thread_add_read (master, zlookup_read_answer, NULL,
+					   zlookup->sock);
+  zlookup_batch_end ();
+  return 0;
 }
-#endif /* HAVE_IPV6 */
 
+/* Zebra has answered, apply that and keep the window full. */
 static int
-bgp_import_check (struct prefix *p, u_int32_t *igpmetric,
-                  struct in_addr *igpnexthop)
+zlookup_read_answer (struct thread *t)
+{
+  zlookup_read_thread = NULL;
+
+  if (zlookup_answer_one () < 0)
+    return 0;
+
+  zlookup_fill (NULL);
+  return 0;
+}
+
+/* Take all outstanding answers off the connection, so a synchronous
+   query can be made on it.  They are applied later, from an event,
+   as the caller may be in the middle of changing what they affect. */
+static void
+zlookup_drain (void)
+{
+  if (! listcount (zlookup_sent))
+    return;
+
+  THREAD_OFF (zlookup_read_thread);
+
+  while (listcount (zlookup_sent))
+    if (zlookup_answer_one () < 0)
+      return;
+
+  if (! zlookup_fill_thread)
+    zlookup_fill_thread = thread_add_event (master, zlookup_fill, NULL, 0);
+}
+
+/* Zebra tells where a registered nexthop resolves to now. */
+int
+bgp_nexthop_update (int command, struct zclient *zclient,
+		    zebra_size_t length)
 {
   struct stream *s;
-  u_int16_t length, command;
-  u_char version, marker;
-  int nbytes;
-  struct in_addr addr;
-  struct in_addr nexthop;
-  u_int32_t metric = 0;
-  u_char nexthop_num;
-  u_char nexthop_type;
+  struct prefix p;
+  struct bgp_node *rn;
+  struct bgp_nexthop_cache *fresh;
+  afi_t afi;
 
-  /* If lookup connection is not available return valid. */
-  if (zlookup->sock < 0)
+  s = zclient->ibuf;
+
+  memset (&p, 0, sizeof (struct prefix));
+  p.family = stream_getc (s);
+  if (p.family == AF_INET)
     {
-      if (igpmetric)
-	*igpmetric = 0;
-      return 1;
+      afi = AFI_IP;
+      p.prefixlen = IPV4_MAX_BITLEN;
+      p.u.prefix4.s_addr = stream_get_ipv4 (s);
     }
+#ifdef HAVE_IPV6
+  else if (p.family == AF_INET6)
+    {
+      afi = AFI_IP6;
+      p.prefixlen = IPV6_MAX_BITLEN;
+      stream_get (&p.u.prefix6, s, 16);
+    }
+#endif /* HAVE_IPV6 */
+  else
+    return -1;
 
-  /* Send query to the lookup connection */
-  s = zlookup->obuf;
-  stream_reset (s);
-  zclient_create_header (s, ZEBRA_IPV4_IMPORT_LOOKUP);
-  
-  stream_putc (s, p->prefixlen);
-  stream_put_in_addr (s, &p->u.prefix4);
-  
-  stream_putw_at (s, 0, stream_get_endp (s));
-  
-  if (zlookup_write_packet (__func__, &zlookup->sock, s->data, stream_get_endp (s)) <= 0)
-    return 1;
+  fresh = bnc_read (s);
+  if (fresh == NULL)
+    fresh = bnc_new ();
 
-  /* Get result. */
-  stream_reset (s);
+  bgp_nexthop_tracking = 1;
 
-  /* Fetch length. */
-  nbytes = stream_read (s, zlookup->sock, 2);
-  length = stream_getw (s);
+  /* The nexthop may have been unregistered meanwhile. */
+  rn = bgp_node_lookup (bgp_nexthop_cache_table[afi], &p);
+  if (! rn || ! rn->info)
+    {
+      if (rn)
+	bgp_unlock_node (rn);
+      bnc_free (fresh);
+      return 0;
+    }
+  bgp_unlock_node (rn);
 
-  /* Fetch whole data. */
-  nbytes = stream_read (s, zlookup->sock, length - 2);
-  marker = stream_getc (s);
-  version = stream_getc (s);
+  bgp_nexthop_cache_update (afi, rn->info, fresh);
+  return 0;
+}
 
-  if (version != ZSERV_VERSION || marker != ZEBRA_HEADER_MARKER)
+/* Register all cached nexthops with a newly connected zebra, packing as
+   many into a message as fit.  */
+void
+bgp_nexthop_zebra_connected (struct zclient *zclient)
+{
+  struct stream *s;
+  struct bgp_node *rn;
+  afi_t afi;
+  int count = 0;
+
+  bgp_nexthop_tracking = 0;
+
+  s = zclient->obuf;
+  for (afi = AFI_IP; afi < AFI_MAX; afi++)
     {
-      zlog_err("%s: socket %d version mismatch, marker %d, version %d",
-               __func__, zlookup->sock, marker, version);
-      return 0;
+      if (! bgp_nexthop_cache_table[afi])
+	continue;
+
+      for (rn = bgp_table_top (bgp_nexthop_cache_table[afi]); rn;
+	   rn = bgp_route_next (rn))
+	if (rn->info)
+	  {
+	    if (count
+		&& stream_get_endp (s) + 1 + sizeof (struct in6_addr)
+		   > STREAM_SIZE (s))
+	      {
+		stream_putw_at (s, 0, stream_get_endp (s));
+		zclient_send_message (zclient);
+		count = 0;
+	      }
+	    if (! count)
+	      {
+		stream_reset (s);
+		zclient_create_header (s, ZEBRA_NEXTHOP_REGISTER);
+	      }
+	    stream_putc (s, rn->p.family);
+	    stream_put (s, &rn->p.u.prefix, PSIZE (rn->p.prefixlen));
+	    count++;
+	  }
     }
-    
-  command = stream_getw (s);
-  
-  addr.s_addr = stream_get_ipv4 (s);
-  metric = stream_getl (s);
-  nexthop_num = stream_getc (s);
 
-  /* Set IGP metric value. */
-  if (igpmetric)
-    *igpmetric = metric;
+  if (count)
+    {
+      stream_putw_at (s, 0, stream_get_endp (s));
+      zclient_send_message (zclient);
+    }
+}
+
+/* Record whether a static route is found in the IGP, and through which
+   nexthop and metric, and announce or withdraw it if that changed. */
+static void
+bgp_import_apply (struct bgp *bgp, struct bgp_node *rn, afi_t afi,
+		  safi_t safi, int valid, u_int32_t metric,
+		  struct in_addr nexthop)
+{
+  struct bgp_static *bgp_static = rn->info;
+  int oldvalid;
+  u_int32_t oldmetric;
+  struct in_addr oldnexthop;
 
-  /* If there is nexthop then this is active route. */
-  if (nexthop_num)
+  oldvalid = bgp_static->valid;
+  oldmetric = bgp_static->igpmetric;
+  oldnexthop = bgp_static->igpnexthop;
+
+  bgp_static->valid = valid;
+  bgp_static->igpmetric = metric;
+  bgp_static->igpnexthop = nexthop;
+
+  if (bgp_static->valid != oldvalid)
     {
-      nexthop.s_addr = 0;
-      nexthop_type = stream_getc (s);
-      if (nexthop_type == ZEBRA_NEXTHOP_IPV4)
-	{
-	  nexthop.s_addr = stream_get_ipv4 (s);
-	  if (igpnexthop)
-	    *igpnexthop = nexthop;
-	}
+      if (bgp_static->valid)
+	bgp_static_update (bgp, &rn->p, bgp_static, afi, safi);
       else
-	*igpnexthop = nexthop;
-
-      return 1;
+	bgp_static_withdraw (bgp, &rn->p, afi, safi);
+    }
+  else if (bgp_static->valid)
+    {
+      if (bgp_static->igpmetric != oldmetric
+	  || bgp_static->igpnexthop.s_addr != oldnexthop.s_addr
+	  || bgp_static->rmap.name)
+	bgp_static_update (bgp, &rn->p, bgp_static, afi, safi);
     }
-  else
-    return 0;
 }
 
 /* Scan all configured BGP route then check the route exists in IGP or
-   not. */
+   not.  The IGP lookups are queued and applied as zebra answers them. */
 static int
 bgp_import (struct thread *t)
 {
@@ -1131,8 +1577,6 @@ bgp_import (struct thread *t)
   struct bgp_node *rn;
   struct bgp_static *bgp_static;
   struct listnode *node, *nnode;
-  int valid;
-  u_int32_t metric;
   struct in_addr nexthop;
   afi_t afi;
   safi_t safi;
@@ -1143,6 +1587,12 @@ bgp_import (struct thread *t)
   if (BGP_DEBUG (events, EVENTS))
     zlog_debug ("Import timer expired.");
 
+  /* Still waiting for zebra to answer the previous round. */
+  if (zlookup_busy ())
+    return 0;
+
+  nexthop.s_addr = 0;
+
   for (ALL_LIST_ELEMENTS (bm->bgp, node, nnode, bgp))
     {
       for (afi = AFI_IP; afi < AFI_MAX; afi++)
@@ -1154,35 +1604,14 @@ bgp_import (struct thread *t)
 		if (bgp_static->backdoor)
 		  continue;
 
-		valid = bgp_static->valid;
-		metric = bgp_static->igpmetric;
-		nexthop = bgp_static->igpnexthop;
-
+		/* If lookup connection is not available assume valid. */
 		if (bgp_flag_check (bgp, BGP_FLAG_IMPORT_CHECK)
-		    && afi == AFI_IP && safi == SAFI_UNICAST)
-		  bgp_static->valid = bgp_import_check (&rn->p, &bgp_static->igpmetric,
-						        &bgp_static->igpnexthop);
+		    && afi == AFI_IP && safi == SAFI_UNICAST
+		    && zlookup->sock >= 0)
+		  zlookup_request_add (ZEBRA_IPV4_IMPORT_LOOKUP, bgp, rn,
+				       afi, safi);
 		else
-		  {
-		    bgp_static->valid = 1;
-		    bgp_static->igpmetric = 0;
-		    bgp_static->igpnexthop.s_addr = 0;
-		  }
-
-		if (bgp_static->valid != valid)
-		  {
-		    if (bgp_static->valid)
-		      bgp_static_update (bgp, &rn->p, bgp_static, afi, safi);
-		    else
-		      bgp_static_withdraw (bgp, &rn->p, afi, safi);
-		  }
-		else if (bgp_static->valid)
-		  {
-		    if (bgp_static->igpmetric != metric
-			|| bgp_static->igpnexthop.s_addr != nexthop.s_addr
-			|| bgp_static->rmap.name)
-		      bgp_static_update (bgp, &rn->p, bgp_static, afi, safi);
-		  }
+		  bgp_import_apply (bgp, rn, afi, safi, 1, 0, nexthop);
 	      }
     }
   return 0;
@@ -1252,6 +1681,31 @@ bgp_multiaccess_check_v4 (struct in_addr nexthop, char *peer)
   return 0;
 }
 
+/* Connected network the peer address is on.  Peers on the same one
+   get the same answer from bgp_multiaccess_check_v4().  */
+void *
+bgp_multiaccess_network_v4 (char *peer)
+{
+  struct bgp_node *rn;
+  struct prefix p;
+  struct in_addr addr;
+
+  if (zlookup->sock < 0 || ! inet_aton (peer, &addr))
+    return NULL;
+
+  memset (&p, 0, sizeof (struct prefix));
+  p.family = AF_INET;
+  p.prefixlen = IPV4_MAX_BITLEN;
+  p.u.prefix4 = addr;
+
+  rn = bgp_node_match (bgp_connected_table[AFI_IP], &p);
+  if (! rn)
+    return NULL;
+  bgp_unlock_node (rn);
+
+  return rn;
+}
+
 DEFUN (bgp_scan_time,
        bgp_scan_time_cmd,
        "bgp scan-time <5-60>",
@@ -1298,79 +1752,83 @@ ALIAS (no_bgp_scan_time,
        "Configure background scanner interval\n"
        "Scanner interval (seconds)\n")
 
+/* Show a nexthop cache entry, and with detail what it resolves to. */
+static void
+show_ip_bgp_scan_nexthop (struct vty *vty, struct bgp_node *rn,
+			  const char detail)
+{
+  struct bgp_nexthop_cache *bnc = rn->info;
+  struct nexthop *nexthop;
+  char buf[INET6_ADDRSTRLEN];
+
+  inet_ntop (rn->p.family, &rn->p.u.prefix, buf, INET6_ADDRSTRLEN);
+  if (! bnc->valid)
+    {
+      vty_out (vty, " %s invalid, %lu paths%s", buf, bnc->path_count,
+	       VTY_NEWLINE);
+      return;
+    }
+
+  vty_out (vty, " %s valid [IGP metric %d], %lu paths%s",
+	   buf, bnc->metric, bnc->path_count, VTY_NEWLINE);
+  if (detail)
+    for (nexthop = bnc->nexthop; nexthop; nexthop = nexthop->next)
+      switch (nexthop->type)
+	{
+	case NEXTHOP_TYPE_IPV4:
+	  vty_out (vty, "  gate %s%s", inet_ntop (AF_INET, &nexthop->gate.ipv4, buf, INET6_ADDRSTRLEN), VTY_NEWLINE);
+	  break;
+#ifdef HAVE_IPV6
+	case NEXTHOP_TYPE_IPV6:
+	  vty_out (vty, "  gate %s%s", inet_ntop (AF_INET6, &nexthop->gate.ipv6, buf, INET6_ADDRSTRLEN), VTY_NEWLINE);
+	  break;
+#endif /* HAVE_IPV6 */
+	case NEXTHOP_TYPE_IFINDEX:
+	case NEXTHOP_TYPE_IFNAME:
+	  vty_out (vty, "  ifidx %u%s", nexthop->ifindex, VTY_NEWLINE);
+	  break;
+	default:
+	  vty_out (vty, "  invalid nexthop type %u%s", nexthop->type, VTY_NEWLINE);
+	}
+}
+
 static int
 show_ip_bgp_scan_tables (struct vty *vty, const char detail)
 {
   struct bgp_node *rn;
-  struct bgp_nexthop_cache *bnc;
   char buf[INET6_ADDRSTRLEN];
-  u_char i;
 
   if (bgp_scan_thread)
     vty_out (vty, "BGP scan is running%s", VTY_NEWLINE);
   else
     vty_out (vty, "BGP scan is not running%s", VTY_NEWLINE);
   vty_out (vty, "BGP scan interval is %d%s", bgp_scan_interval, VTY_NEWLINE);
+  if (bgp_nexthop_tracked ())
+    vty_out (vty, "BGP nexthops are tracked by zebra%s", VTY_NEWLINE);
+  else
+    vty_out (vty, "BGP nexthops are looked up by the scan%s", VTY_NEWLINE);
+  vty_out (vty, "BGP nexthop lookups: %lu batches, %lu lookups, "
+	   "%d outstanding%s", zlookup_stats.batches, zlookup_stats.lookups,
+	   listcount (zlookup_waiting) + listcount (zlookup_sent)
+	   + listcount (zlookup_done), VTY_NEWLINE);
+  if (zlookup_stats.batches)
+    vty_out (vty, "Last batch: %lu lookups in %lu.%03lu ms, "
+	     "longest %lu.%03lu ms%s", zlookup_stats.last_count,
+	     zlookup_stats.last_usecs / 1000, zlookup_stats.last_usecs % 1000,
+	     zlookup_stats.max_usecs / 1000, zlookup_stats.max_usecs % 1000,
+	     VTY_NEWLINE);
 
   vty_out (vty, "Current BGP nexthop cache:%s", VTY_NEWLINE);
-  for (rn = bgp_table_top (bnct_active (AFI_IP)); rn; rn = bgp_route_next (rn))
-    if ((bnc = rn->info) != NULL)
-      {
-	if (bnc->valid)
-	{
-	  vty_out (vty, " %s valid [IGP metric %d]%s",
-		   inet_ntop (AF_INET, &rn->p.u.prefix4, buf, INET6_ADDRSTRLEN), bnc->metric, VTY_NEWLINE);
-	  if (detail)
-	    for (i = 0; i < bnc->nexthop_num; i++)
-	      switch (bnc->nexthop[i].type)
-	      {
-	      case NEXTHOP_TYPE_IPV4:
-		vty_out (vty, "  gate %s%s", inet_ntop (AF_INET, &bnc->nexthop[i].gate.ipv4, buf, INET6_ADDRSTRLEN), VTY_NEWLINE);
-		break;
-	      case NEXTHOP_TYPE_IFINDEX:
-		vty_out (vty, "  ifidx %u%s", bnc->nexthop[i].ifindex, VTY_NEWLINE);
-		break;
-	      default:
-		vty_out (vty, "  invalid nexthop type %u%s", bnc->nexthop[i].type, VTY_NEWLINE);
-	      }
-	}
-	else
-	  vty_out (vty, " %s invalid%s",
-		   inet_ntop (AF_INET, &rn->p.u.prefix4, buf, INET6_ADDRSTRLEN), VTY_NEWLINE);
-      }
+  for (rn = bgp_table_top (bgp_nexthop_cache_table[AFI_IP]); rn;
+       rn = bgp_route_next (rn))
+    if (rn->info != NULL)
+      show_ip_bgp_scan_nexthop (vty, rn, detail);
 
 #ifdef HAVE_IPV6
-  {
-    for (rn = bgp_table_top (bnct_active (AFI_IP6));
-         rn; 
-         rn = bgp_route_next (rn))
-      if ((bnc = rn->info) != NULL)
-	{
-	  if (bnc->valid)
-	  {
-	    vty_out (vty, " %s valid [IGP metric %d]%s",
-		     inet_ntop (AF_INET6, &rn->p.u.prefix6, buf, INET6_ADDRSTRLEN),
-		     bnc->metric, VTY_NEWLINE);
-	    if (detail)
-	      for (i = 0; i < bnc->nexthop_num; i++)
-		switch (bnc->nexthop[i].type)
-		{
-		case NEXTHOP_TYPE_IPV6:
-		  vty_out (vty, "  gate %s%s", inet_ntop (AF_INET6, &bnc->nexthop[i].gate.ipv6, buf, INET6_ADDRSTRLEN), VTY_NEWLINE);
-		  break;
-		case NEXTHOP_TYPE_IFINDEX:
-		  vty_out (vty, "  ifidx %u%s", bnc->nexthop[i].ifindex, VTY_NEWLINE);
-		  break;
-		default:
-		  vty_out (vty, "  invalid nexthop type %u%s", bnc->nexthop[i].type, VTY_NEWLINE);
-		}
-	  }
-	  else
-	    vty_out (vty, " %s invalid%s",
-		     inet_ntop (AF_INET6, &rn->p.u.prefix6, buf, INET6_ADDRSTRLEN),
-		     VTY_NEWLINE);
-	}
-  }
+  for (rn = bgp_table_top (bgp_nexthop_cache_table[AFI_IP6]); rn;
+       rn = bgp_route_next (rn))
+    if (rn->info != NULL)
+      show_ip_bgp_scan_nexthop (vty, rn, detail);
 #endif /* HAVE_IPV6 */
 
   vty_out (vty, "BGP connected route:%s", VTY_NEWLINE);
@@ -1434,15 +1892,18 @@ bgp_scan_init (void)
   zlookup = zclient_new ();
   zlookup->sock = -1;
   zlookup->t_connect = thread_add_event (master, zlookup_connect, zlookup, 0);
+  zlookup_waiting = list_new ();
+  zlookup_sent = list_new ();
+  zlookup_done = list_new ();
 
   bgp_scan_interval = BGP_SCAN_INTERVAL_DEFAULT;
   bgp_import_interval = BGP_IMPORT_INTERVAL_DEFAULT;
 
-  bnct_init (AFI_IP);
+  bgp_nexthop_cache_table[AFI_IP] = bgp_table_init (AFI_IP, SAFI_UNICAST);
   bgp_connected_table[AFI_IP] = bgp_table_init (AFI_IP, SAFI_UNICAST);
 
 #ifdef HAVE_IPV6
-  bnct_init (AFI_IP6);
+  bgp_nexthop_cache_table[AFI_IP6] = bgp_table_init (AFI_IP6, SAFI_UNICAST);
   bgp_connected_table[AFI_IP6] = bgp_table_init (AFI_IP6, SAFI_UNICAST);
 #endif /* HAVE_IPV6 */
 
@@ -1465,16 +1926,25 @@ bgp_scan_init (void)
 void
 bgp_scan_finish (void)
 {
-  /* Only the current one needs to be reset. */
-  bgp_nexthop_cache_reset (bnct_active (AFI_IP));
-  bnct_finish (AFI_IP);
+  THREAD_OFF (bgp_connected_thread);
+
+  /* Requests hold nodes of the nexthop cache. */
+  zlookup_fail_all ();
+  list_delete (zlookup_waiting);
+  list_delete (zlookup_sent);
+  list_delete (zlookup_done);
+  zlookup_waiting = zlookup_sent = zlookup_done = NULL;
+
+  bgp_nexthop_cache_reset (bgp_nexthop_cache_table[AFI_IP]);
+  bgp_table_unlock (bgp_nexthop_cache_table[AFI_IP]);
+  bgp_nexthop_cache_table[AFI_IP] = NULL;
   bgp_table_unlock (bgp_connected_table[AFI_IP]);
   bgp_connected_table[AFI_IP] = NULL;
 
 #ifdef HAVE_IPV6
-  /* Only the current one needs to be reset. */
-  bgp_nexthop_cache_reset (bnct_active (AFI_IP6));
-  bnct_finish (AFI_IP6);
+  bgp_nexthop_cache_reset (bgp_nexthop_cache_table[AFI_IP6]);
+  bgp_table_unlock (bgp_nexthop_cache_table[AFI_IP6]);
+  bgp_nexthop_cache_table[AFI_IP6] = NULL;
   bgp_table_unlock (bgp_connected_table[AFI_IP6]);
   bgp_connected_table[AFI_IP6] = NULL;
 #endif /* HAVE_IPV6 */
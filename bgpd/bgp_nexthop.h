@@ -22,6 +22,7 @@ Software Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
 #define _QUAGGA_BGP_NEXTHOP_H
 
 #include "if.h"
+#include "zclient.h"
 
 #define BGP_SCAN_INTERVAL_DEFAULT   60
 #define BGP_IMPORT_INTERVAL_DEFAULT 15
@@ -32,27 +33,29 @@ struct bgp_nexthop_cache
   /* This nexthop exists in IGP. */
   u_char valid;
 
-  /* Nexthop is changed. */
-  u_char changed;
-
-  /* Nexthop is changed. */
-  u_char metricchanged;
-
   /* IGP route's metric. */
   u_int32_t metric;
 
   /* Nexthop number and nexthop linked list.*/
   u_char nexthop_num;
   struct nexthop *nexthop;
+
+  /* Cache table node, and the paths using this nexthop. */
+  struct bgp_node *node;
+  struct bgp_info *paths;
+  unsigned long path_count;
 };
 
 extern void bgp_scan_init (void);
 extern void bgp_scan_finish (void);
-extern int bgp_nexthop_lookup (afi_t, struct peer *peer, struct bgp_info *,
-			int *, int *);
+extern int bgp_nexthop_lookup (afi_t, struct peer *peer, struct bgp_info *);
+extern void bgp_nexthop_unlink (struct bgp_info *);
+extern int bgp_nexthop_update (int, struct zclient *, zebra_size_t);
+extern void bgp_nexthop_zebra_connected (struct zclient *);
 extern void bgp_connected_add (struct connected *c);
 extern void bgp_connected_delete (struct connected *c);
 extern int bgp_multiaccess_check_v4 (struct in_addr, char *);
+extern void *bgp_multiaccess_network_v4 (char *);
 extern int bgp_config_write_scan_time (struct vty *);
 extern int bgp_nexthop_onlink (afi_t, struct attr *);
 extern int bgp_nexthop_self (afi_t, struct attr *);
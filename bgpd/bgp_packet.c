@@ -48,6 +48,7 @@ Software Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
 #include "bgpd/bgp_mplsvpn.h"
 #include "bgpd/bgp_advertise.h"
 #include "bgpd/bgp_vty.h"
+#include "bgpd/bgp_updgrp.h"
 
 int stream_put_prefix (struct stream *, struct prefix *);
 
@@ -151,12 +152,26 @@ bgp_update_packet (struct peer *peer, afi_t afi, safi_t safi)
   bgp_size_t total_attr_len = 0;
   unsigned long pos;
   char buf[BUFSIZ];
+  static struct bgp_node *packed[BGP_MAX_PACKET_SIZE];
+  struct update_group *group = NULL;
+  struct update_group_packet *shared = NULL;
+  struct attr *attr = NULL;
+  struct peer *from = NULL;
+  int count = 0;
 
   s = peer->work;
   stream_reset (s);
 
   adv = FIFO_HEAD (&peer->sync[afi][safi]->update);
 
+  /* Another member of the update group may have built this very
+     packet already. */
+  if (adv && afi == AFI_IP && safi == SAFI_UNICAST)
+    {
+      group = bgp_updgrp_get (peer, afi, safi);
+      shared = bgp_updgrp_packet_lookup (group, adv);
+    }
+
   while (adv)
     {
       assert (adv->rn);
@@ -165,16 +180,20 @@ bgp_update_packet (struct peer *peer, afi_t afi, safi_t safi)
       if (adv->binfo)
         binfo = adv->binfo;
 
+      if (shared)
+	{
+	  if (count == shared->count)
+	    break;
+	}
       /* When remaining space can't include NLRI and it's length.  */
-      if (STREAM_REMAIN (s) <= BGP_NLRI_LENGTH + PSIZE (rn->p.prefixlen))
+      else if (STREAM_REMAIN (s) <= BGP_NLRI_LENGTH + PSIZE (rn->p.prefixlen))
 	break;
 
       /* If packet is empty, set attribute. */
-      if (stream_empty (s))
+      if (! shared && stream_empty (s))
 	{
 	  struct prefix_rd *prd = NULL;
 	  u_char *tag = NULL;
-	  struct peer *from = NULL;
 	  
 	  if (rn->prn)
 	    prd = (struct prefix_rd *) &rn->prn->p;
@@ -185,19 +204,21 @@ bgp_update_packet (struct peer *peer, afi_t afi, safi_t safi)
                 tag = binfo->extra->tag;
             }
           
+	  attr = adv->baa->attr;
 	  bgp_packet_set_marker (s, BGP_MSG_UPDATE);
 	  stream_putw (s, 0);		
 	  pos = stream_get_endp (s);
 	  stream_putw (s, 0);
 	  total_attr_len = bgp_packet_attribute (NULL, peer, s, 
-	                                         adv->baa->attr,
+	                                         attr,
 	                                         &rn->p, afi, safi, 
 	                                         from, prd, tag);
 	  stream_putw_at (s, pos, total_attr_len);
 	}
 
-      if (afi == AFI_IP && safi == SAFI_UNICAST)
+      if (! shared && afi == AFI_IP && safi == SAFI_UNICAST)
 	stream_put_prefix (s, &rn->p);
+      packed[count++] = rn;
       
       if (BGP_DEBUG (update, UPDATE_OUT))
 	zlog (peer->log, LOG_DEBUG, "%s send UPDATE %s/%d",
@@ -218,11 +239,23 @@ bgp_update_packet (struct peer *peer, afi_t afi, safi_t safi)
       if (! (afi == AFI_IP && safi == SAFI_UNICAST))
 	break;
     }
+
+  if (shared)
+    {
+      packet = stream_share (shared->packet);
+      bgp_updgrp_packet_sent (group, shared);
+      bgp_packet_add (peer, packet);
+      BGP_WRITE_ON (peer->t_write, bgp_write, peer->fd);
+      return packet;
+    }
 	 
   if (! stream_empty (s))
     {
       bgp_packet_set_size (s);
       packet = stream_dup (s);
+      if (group)
+	bgp_updgrp_packet_add (group, packet, packed, count, adv == NULL,
+			       attr, from);
       bgp_packet_add (peer, packet);
       BGP_WRITE_ON (peer->t_write, bgp_write, peer->fd);
       stream_reset (s);
@@ -499,19 +532,15 @@ bgp_default_withdraw_send (struct peer *peer, afi_t afi, safi_t safi)
   BGP_WRITE_ON (peer->t_write, bgp_write, peer->fd);
 }
 
-/* Get next packet to be written.  */
+/* Make the next UPDATE to be written and queue it.  */
 static struct stream *
-bgp_write_packet (struct peer *peer)
+bgp_write_packet_make (struct peer *peer)
 {
   afi_t afi;
   safi_t safi;
   struct stream *s = NULL;
   struct bgp_advertise *adv;
 
-  s = stream_fifo_head (peer->obuf);
-  if (s)
-    return s;
-
   for (afi = AFI_IP; afi < AFI_MAX; afi++)
     for (safi = SAFI_UNICAST; safi < SAFI_MAX; safi++)
       {
@@ -564,6 +593,19 @@ bgp_write_packet (struct peer *peer)
   return NULL;
 }
 
+/* Get next packet to be written.  */
+static struct stream *
+bgp_write_packet (struct peer *peer)
+{
+  struct stream *s;
+
+  s = stream_fifo_head (peer->obuf);
+  if (s)
+    return s;
+
+  return bgp_write_packet_make (peer);
+}
+
 /* Is there partially written packet or updates we can send right
    now.  */
 static int
@@ -597,7 +639,8 @@ bgp_write (struct thread *thread)
   struct peer *peer;
   u_char type;
   struct stream *s; 
-  int num;
+  ssize_t num;
+  size_t writenum;
   unsigned int count = 0;
 
   /* Yes first of all get peer pointer. */
@@ -617,16 +660,18 @@ bgp_write (struct thread *thread)
 
   setsockopt_tcp_cork (peer->fd, 1);
 
-  /* Nonblocking write until TCP output buffer is full.  */
-  do
+  /* Nonblocking write until TCP output buffer is full.  Up to
+     BGP_WRITE_PACKET_MAX packets are queued and written together.  */
+  while (count < BGP_WRITE_PACKET_MAX)
     {
-      int writenum;
-
-      /* Number of bytes to be sent.  */
-      writenum = stream_get_endp (s) - stream_get_getp (s);
+      while (peer->obuf->count < BGP_WRITE_PACKET_MAX - count
+	     && bgp_write_packet_make (peer))
+	;
+      if (peer->obuf->count == 0)
+	break;
 
-      /* Call write() system call.  */
-      num = write (peer->fd, STREAM_PNT (s), writenum);
+      num = stream_fifo_writev (peer->obuf, peer->fd,
+				BGP_WRITE_PACKET_MAX - count);
       if (num < 0)
 	{
 	  /* write failed either retry needed or error */
@@ -637,54 +682,66 @@ bgp_write (struct thread *thread)
 	  return 0;
 	}
 
-      if (num != writenum)
+      /* Nothing written, like a partial write wait for the socket. */
+      if (num == 0)
+	break;
+
+      /* Drop the packets written in full.  */
+      while (num > 0 && (s = stream_fifo_head (peer->obuf)) != NULL)
 	{
-	  /* Partial write */
-	  stream_forward_getp (s, num);
-	  break;
-	}
+	  /* Number of bytes to be sent.  */
+	  writenum = stream_get_endp (s) - stream_get_getp (s);
+	  if ((size_t) num < writenum)
+	    break;
+	  num -= writenum;
+	  count++;
 
-      /* Retrieve BGP packet type. */
-      stream_set_getp (s, BGP_MARKER_SIZE + 2);
-      type = stream_getc (s);
+	  /* Retrieve BGP packet type. */
+	  type = stream_getc_from (s, BGP_MARKER_SIZE + 2);
 
-      switch (type)
-	{
-	case BGP_MSG_OPEN:
-	  peer->open_out++;
-	  break;
-	case BGP_MSG_UPDATE:
-	  peer->update_out++;
-	  break;
-	case BGP_MSG_NOTIFY:
-	  peer->notify_out++;
-	  /* Double start timer. */
-	  peer->v_start *= 2;
+	  switch (type)
+	    {
+	    case BGP_MSG_OPEN:
+	      peer->open_out++;
+	      break;
+	    case BGP_MSG_UPDATE:
+	      peer->update_out++;
+	      break;
+	    case BGP_MSG_NOTIFY:
+	      peer->notify_out++;
+	      /* Double start timer. */
+	      peer->v_start *= 2;
+
+	      /* Overflow check. */
+	      if (peer->v_start >= (60 * 2))
+		peer->v_start = (60 * 2);
+
+	      /* Flush any existing events */
+	      BGP_EVENT_ADD (peer, BGP_Stop);
+	      return 0;
+	    case BGP_MSG_KEEPALIVE:
+	      peer->keepalive_out++;
+	      break;
+	    case BGP_MSG_ROUTE_REFRESH_NEW:
+	    case BGP_MSG_ROUTE_REFRESH_OLD:
+	      peer->refresh_out++;
+	      break;
+	    case BGP_MSG_CAPABILITY:
+	      peer->dynamic_cap_out++;
+	      break;
+	    }
 
-	  /* Overflow check. */
-	  if (peer->v_start >= (60 * 2))
-	    peer->v_start = (60 * 2);
+	  /* OK we send packet so delete it. */
+	  bgp_packet_delete (peer);
+	}
 
-	  /* Flush any existing events */
-	  BGP_EVENT_ADD (peer, BGP_Stop);
-	  return 0;
-	case BGP_MSG_KEEPALIVE:
-	  peer->keepalive_out++;
-	  break;
-	case BGP_MSG_ROUTE_REFRESH_NEW:
-	case BGP_MSG_ROUTE_REFRESH_OLD:
-	  peer->refresh_out++;
-	  break;
-	case BGP_MSG_CAPABILITY:
-	  peer->dynamic_cap_out++;
+      if (num > 0)
+	{
+	  /* Partial write */
+	  stream_forward_getp (s, num);
 	  break;
 	}
-
-      /* OK we send packet so delete it. */
-      bgp_packet_delete (peer);
     }
-  while (++count < BGP_WRITE_PACKET_MAX &&
-	 (s = bgp_write_packet (peer)) != NULL);
   
   if (bgp_write_proceed (peer))
     BGP_WRITE_ON (peer->t_write, bgp_write, peer->fd);
@@ -2078,6 +2135,7 @@ bgp_route_refresh_receive (struct peer *peer, bgp_size_t size)
 		}
 	      peer->orf_plist[afi][safi] =
 			 prefix_list_lookup (AFI_ORF_PREFIX, name);
+	      bgp_updgrp_invalidate ();
 	    }
 	  stream_forward_getp (s, orf_len);
 	}
@@ -2240,6 +2298,34 @@ bgp_capability_receive (struct peer *peer, bgp_size_t size)
   return bgp_capability_msg_parse (peer, pnt, size);
 }
 
+/* The connection failed, or the peer closed it. */
+static void
+bgp_read_error (struct peer *peer, int nbytes)
+{
+  if (nbytes < 0)
+    plog_err (peer->log, "%s [Error] bgp_read_packet error: %s",
+	      peer->host, safe_strerror (errno));
+  else if (BGP_DEBUG (events, EVENTS))
+    plog_debug (peer->log, "%s [Event] BGP connection closed fd %d",
+		peer->host, peer->fd);
+
+  if (peer->status == Established) 
+    {
+      if (CHECK_FLAG (peer->sflags, PEER_STATUS_NSF_MODE))
+	{
+	  peer->last_reset = PEER_DOWN_NSF_CLOSE_SESSION;
+	  SET_FLAG (peer->sflags, PEER_STATUS_NSF_WAIT);
+	}
+      else
+	peer->last_reset = PEER_DOWN_CLOSE_SESSION;
+    }
+
+  if (nbytes < 0)
+    BGP_EVENT_ADD (peer, TCP_fatal_error);
+  else
+    BGP_EVENT_ADD (peer, TCP_connection_closed);
+}
+
 /* BGP read utility function. */
 static int
 bgp_read_packet (struct peer *peer)
@@ -2256,52 +2342,17 @@ bgp_read_packet (struct peer *peer)
   /* Read packet from fd. */
   nbytes = stream_read_try (peer->ibuf, peer->fd, readsize);
 
-  /* If read byte is smaller than zero then error occured. */
-  if (nbytes < 0) 
-    {
-      /* Transient error should retry */
-      if (nbytes == -2)
-	return -1;
-
-      plog_err (peer->log, "%s [Error] bgp_read_packet error: %s",
-		 peer->host, safe_strerror (errno));
-
-      if (peer->status == Established) 
-	{
-	  if (CHECK_FLAG (peer->sflags, PEER_STATUS_NSF_MODE))
-	    {
-	      peer->last_reset = PEER_DOWN_NSF_CLOSE_SESSION;
-	      SET_FLAG (peer->sflags, PEER_STATUS_NSF_WAIT);
-	    }
-	  else
-	    peer->last_reset = PEER_DOWN_CLOSE_SESSION;
-	}
-
-      BGP_EVENT_ADD (peer, TCP_fatal_error);
-      return -1;
-    }  
+  /* Transient error should retry */
+  if (nbytes == -2)
+    return -1;
 
-  /* When read byte is zero : clear bgp peer and return */
-  if (nbytes == 0) 
+  /* If read byte is smaller than zero then error occured, if it is
+     zero the connection was closed. */
+  if (nbytes <= 0) 
     {
-      if (BGP_DEBUG (events, EVENTS))
-	plog_debug (peer->log, "%s [Event] BGP connection closed fd %d",
-		   peer->host, peer->fd);
-
-      if (peer->status == Established) 
-	{
-	  if (CHECK_FLAG (peer->sflags, PEER_STATUS_NSF_MODE))
-	    {
-	      peer->last_reset = PEER_DOWN_NSF_CLOSE_SESSION;
-	      SET_FLAG (peer->sflags, PEER_STATUS_NSF_WAIT);
-	    }
-	  else
-	    peer->last_reset = PEER_DOWN_CLOSE_SESSION;
-	}
-
-      BGP_EVENT_ADD (peer, TCP_connection_closed);
+      bgp_read_error (peer, nbytes);
       return -1;
-    }
+    }  
 
   /* We read partial packet. */
   if (stream_get_endp (peer->ibuf) != peer->packet_size)
@@ -2323,115 +2374,86 @@ bgp_marker_all_one (struct stream *s, int length)
   return 1;
 }
 
-/* Starting point of packet process function. */
-int
-bgp_read (struct thread *thread)
+/* Check the header in peer->ibuf and set the packet size from it.  A
+   NOTIFICATION is sent if it is no good. */
+static int
+bgp_read_header (struct peer *peer)
 {
-  int ret;
   u_char type = 0;
-  struct peer *peer;
   bgp_size_t size;
   char notify_data_length[2];
 
-  /* Yes first of all get peer pointer. */
-  peer = THREAD_ARG (thread);
-  peer->t_read = NULL;
+  /* Get size and type. */
+  stream_forward_getp (peer->ibuf, BGP_MARKER_SIZE);
+  memcpy (notify_data_length, stream_pnt (peer->ibuf), 2);
+  size = stream_getw (peer->ibuf);
+  type = stream_getc (peer->ibuf);
 
-  /* For non-blocking IO check. */
-  if (peer->status == Connect)
+  if (BGP_DEBUG (normal, NORMAL) && type != 2 && type != 0)
+    zlog_debug ("%s rcv message type %d, length (excl. header) %d",
+	       peer->host, type, size - BGP_HEADER_SIZE);
+
+  /* Marker check */
+  if (((type == BGP_MSG_OPEN) || (type == BGP_MSG_KEEPALIVE))
+      && ! bgp_marker_all_one (peer->ibuf, BGP_MARKER_SIZE))
     {
-      bgp_connect_check (peer);
-      goto done;
+      bgp_notify_send (peer,
+		       BGP_NOTIFY_HEADER_ERR, 
+		       BGP_NOTIFY_HEADER_NOT_SYNC);
+      return -1;
     }
-  else
+
+  /* BGP type check. */
+  if (type != BGP_MSG_OPEN && type != BGP_MSG_UPDATE 
+      && type != BGP_MSG_NOTIFY && type != BGP_MSG_KEEPALIVE 
+      && type != BGP_MSG_ROUTE_REFRESH_NEW
+      && type != BGP_MSG_ROUTE_REFRESH_OLD
+      && type != BGP_MSG_CAPABILITY)
     {
-      if (peer->fd < 0)
-	{
-	  zlog_err ("bgp_read peer's fd is negative value %d", peer->fd);
-	  return -1;
-	}
-      BGP_READ_ON (peer->t_read, bgp_read, peer->fd);
+      if (BGP_DEBUG (normal, NORMAL))
+	plog_debug (peer->log,
+		  "%s unknown message type 0x%02x",
+		  peer->host, type);
+      bgp_notify_send_with_data (peer,
+				 BGP_NOTIFY_HEADER_ERR,
+				 BGP_NOTIFY_HEADER_BAD_MESTYPE,
+				 &type, 1);
+      return -1;
     }
-
-  /* Read packet header to determine type of the packet */
-  if (peer->packet_size == 0)
-    peer->packet_size = BGP_HEADER_SIZE;
-
-  if (stream_get_endp (peer->ibuf) < BGP_HEADER_SIZE)
+  /* Mimimum packet length check. */
+  if ((size < BGP_HEADER_SIZE)
+      || (size > BGP_MAX_PACKET_SIZE)
+      || (type == BGP_MSG_OPEN && size < BGP_MSG_OPEN_MIN_SIZE)
+      || (type == BGP_MSG_UPDATE && size < BGP_MSG_UPDATE_MIN_SIZE)
+      || (type == BGP_MSG_NOTIFY && size < BGP_MSG_NOTIFY_MIN_SIZE)
+      || (type == BGP_MSG_KEEPALIVE && size != BGP_MSG_KEEPALIVE_MIN_SIZE)
+      || (type == BGP_MSG_ROUTE_REFRESH_NEW && size < BGP_MSG_ROUTE_REFRESH_MIN_SIZE)
+      || (type == BGP_MSG_ROUTE_REFRESH_OLD && size < BGP_MSG_ROUTE_REFRESH_MIN_SIZE)
+      || (type == BGP_MSG_CAPABILITY && size < BGP_MSG_CAPABILITY_MIN_SIZE))
     {
-      ret = bgp_read_packet (peer);
-
-      /* Header read error or partial read packet. */
-      if (ret < 0) 
-	goto done;
-
-      /* Get size and type. */
-      stream_forward_getp (peer->ibuf, BGP_MARKER_SIZE);
-      memcpy (notify_data_length, stream_pnt (peer->ibuf), 2);
-      size = stream_getw (peer->ibuf);
-      type = stream_getc (peer->ibuf);
-
-      if (BGP_DEBUG (normal, NORMAL) && type != 2 && type != 0)
-	zlog_debug ("%s rcv message type %d, length (excl. header) %d",
-		   peer->host, type, size - BGP_HEADER_SIZE);
-
-      /* Marker check */
-      if (((type == BGP_MSG_OPEN) || (type == BGP_MSG_KEEPALIVE))
-	  && ! bgp_marker_all_one (peer->ibuf, BGP_MARKER_SIZE))
-	{
-	  bgp_notify_send (peer,
-			   BGP_NOTIFY_HEADER_ERR, 
-			   BGP_NOTIFY_HEADER_NOT_SYNC);
-	  goto done;
-	}
-
-      /* BGP type check. */
-      if (type != BGP_MSG_OPEN && type != BGP_MSG_UPDATE 
-	  && type != BGP_MSG_NOTIFY && type != BGP_MSG_KEEPALIVE 
-	  && type != BGP_MSG_ROUTE_REFRESH_NEW
-	  && type != BGP_MSG_ROUTE_REFRESH_OLD
-	  && type != BGP_MSG_CAPABILITY)
-	{
-	  if (BGP_DEBUG (normal, NORMAL))
-	    plog_debug (peer->log,
-		      "%s unknown message type 0x%02x",
-		      peer->host, type);
-	  bgp_notify_send_with_data (peer,
-				     BGP_NOTIFY_HEADER_ERR,
-			 	     BGP_NOTIFY_HEADER_BAD_MESTYPE,
-				     &type, 1);
-	  goto done;
-	}
-      /* Mimimum packet length check. */
-      if ((size < BGP_HEADER_SIZE)
-	  || (size > BGP_MAX_PACKET_SIZE)
-	  || (type == BGP_MSG_OPEN && size < BGP_MSG_OPEN_MIN_SIZE)
-	  || (type == BGP_MSG_UPDATE && size < BGP_MSG_UPDATE_MIN_SIZE)
-	  || (type == BGP_MSG_NOTIFY && size < BGP_MSG_NOTIFY_MIN_SIZE)
-	  || (type == BGP_MSG_KEEPALIVE && size != BGP_MSG_KEEPALIVE_MIN_SIZE)
-	  || (type == BGP_MSG_ROUTE_REFRESH_NEW && size < BGP_MSG_ROUTE_REFRESH_MIN_SIZE)
-	  || (type == BGP_MSG_ROUTE_REFRESH_OLD && size < BGP_MSG_ROUTE_REFRESH_MIN_SIZE)
-	  || (type == BGP_MSG_CAPABILITY && size < BGP_MSG_CAPABILITY_MIN_SIZE))
-	{
-	  if (BGP_DEBUG (normal, NORMAL))
-	    plog_debug (peer->log,
-		      "%s bad message length - %d for %s",
-		      peer->host, size, 
-		      LOOKUP (bgp_type_str, type));
-	  bgp_notify_send_with_data (peer,
-				     BGP_NOTIFY_HEADER_ERR,
-			  	     BGP_NOTIFY_HEADER_BAD_MESLEN,
-				     (u_char *) notify_data_length, 2);
-	  goto done;
-	}
-
-      /* Adjust size to message length. */
-      peer->packet_size = size;
+      if (BGP_DEBUG (normal, NORMAL))
+	plog_debug (peer->log,
+		  "%s bad message length - %d for %s",
+		  peer->host, size, 
+		  LOOKUP (bgp_type_str, type));
+      bgp_notify_send_with_data (peer,
+				 BGP_NOTIFY_HEADER_ERR,
+				 BGP_NOTIFY_HEADER_BAD_MESLEN,
+				 (u_char *) notify_data_length, 2);
+      return -1;
     }
 
-  ret = bgp_read_packet (peer);
-  if (ret < 0) 
-    goto done;
+  /* Adjust size to message length. */
+  peer->packet_size = size;
+  return 0;
+}
+
+/* Hand the packet in peer->ibuf to the routine for its type. */
+static void
+bgp_read_dispatch (struct peer *peer)
+{
+  u_char type;
+  bgp_size_t size;
 
   /* Get size and type again. */
   size = stream_getw_from (peer->ibuf, BGP_MARKER_SIZE);
@@ -2475,6 +2497,124 @@ bgp_read (struct thread *thread)
   peer->packet_size = 0;
   if (peer->ibuf)
     stream_reset (peer->ibuf);
+}
+
+/* Read whatever an established session has waiting on its socket, as
+   much as fits into peer->ibuf_work, and process all the complete
+   packets in it.  This takes one read() per batch of packets instead
+   of two per packet, and is also used by the hold timer, so that
+   messages which arrived while bgpd was busy elsewhere count as
+   received.  Returns the number of packets processed. */
+int
+bgp_read_input (struct peer *peer)
+{
+  struct stream *s = peer->ibuf_work;
+  bgp_size_t size;
+  unsigned long notify_out;
+  int nbytes;
+  int count = 0;
+
+  nbytes = stream_read_try (s, peer->fd, STREAM_WRITEABLE (s));
+  if (nbytes == -2)
+    return 0;
+  if (nbytes <= 0)
+    {
+      bgp_read_error (peer, nbytes);
+      return 0;
+    }
+
+  while (STREAM_READABLE (s) >= BGP_HEADER_SIZE)
+    {
+      /* A length which is no good is caught by bgp_read_header(),
+	 from the header alone. */
+      size = stream_getw_from (s, stream_get_getp (s) + BGP_MARKER_SIZE);
+      if (size < BGP_HEADER_SIZE || size > BGP_MAX_PACKET_SIZE)
+	size = BGP_HEADER_SIZE;
+      else if (STREAM_READABLE (s) < size)
+	break;
+
+      stream_reset (peer->ibuf);
+      stream_put (peer->ibuf, stream_pnt (s), size);
+      stream_forward_getp (s, size);
+
+      notify_out = peer->notify_out;
+      if (bgp_read_header (peer) < 0)
+	{
+	  stream_reset (s);
+	  break;
+	}
+      bgp_read_dispatch (peer);
+      count++;
+
+      /* The session is going down, the rest is of no use. */
+      if (peer->status != Established || peer->fd < 0
+	  || peer->notify_out != notify_out)
+	{
+	  stream_reset (s);
+	  break;
+	}
+    }
+
+  stream_pulldown (s);
+  return count;
+}
+
+/* Starting point of packet process function. */
+int
+bgp_read (struct thread *thread)
+{
+  int ret;
+  struct peer *peer;
+
+  /* Yes first of all get peer pointer. */
+  peer = THREAD_ARG (thread);
+  peer->t_read = NULL;
+
+  /* For non-blocking IO check. */
+  if (peer->status == Connect)
+    {
+      bgp_connect_check (peer);
+      goto done;
+    }
+  else
+    {
+      if (peer->fd < 0)
+	{
+	  zlog_err ("bgp_read peer's fd is negative value %d", peer->fd);
+	  return -1;
+	}
+      BGP_READ_ON (peer->t_read, bgp_read, peer->fd);
+    }
+
+  /* Until the session is established packets are read one at a time,
+     whatever follows an OPEN may be for another peer structure. */
+  if (peer->status == Established)
+    {
+      bgp_read_input (peer);
+      goto done;
+    }
+
+  /* Read packet header to determine type of the packet */
+  if (peer->packet_size == 0)
+    peer->packet_size = BGP_HEADER_SIZE;
+
+  if (stream_get_endp (peer->ibuf) < BGP_HEADER_SIZE)
+    {
+      ret = bgp_read_packet (peer);
+
+      /* Header read error or partial read packet. */
+      if (ret < 0) 
+	goto done;
+
+      if (bgp_read_header (peer) < 0)
+	goto done;
+    }
+
+  ret = bgp_read_packet (peer);
+  if (ret < 0) 
+    goto done;
+
+  bgp_read_dispatch (peer);
 
  done:
   if (CHECK_FLAG (peer->sflags, PEER_STATUS_ACCEPT_PEER))
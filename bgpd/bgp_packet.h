@@ -26,6 +26,9 @@ Software Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
 #define BGP_UNFEASIBLE_LEN    2U
 #define BGP_WRITE_PACKET_MAX 10U
 
+/* Input buffer of an established session. */
+#define BGP_READ_BUFSIZE (4 * BGP_MAX_PACKET_SIZE)
+
 /* When to refresh */
 #define REFRESH_IMMEDIATE 1
 #define REFRESH_DEFER     2 
@@ -39,6 +42,7 @@ Software Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
 
 /* Packet send and receive function prototypes. */
 extern int bgp_read (struct thread *);
+extern int bgp_read_input (struct peer *);
 extern int bgp_write (struct thread *);
 
 extern void bgp_keepalive_send (struct peer *);
@@ -91,3 +91,201 @@ bgp_regex_free (regex_t *regex)
   regfree (regex);
   XFREE (MTYPE_BGP_REGEXP, regex);
 }
+
+/* Read one AS number written the way the AS path string has it, so
+   that matching the number is matching its digits. */
+static const char *
+bgp_asregex_asn (const char *str, as_t *asn)
+{
+  unsigned long long val = 0;
+  const char *p;
+
+  if (str[0] == '0' && isdigit ((int) str[1]))
+    return NULL;
+
+  for (p = str; isdigit ((int) *p); p++)
+    {
+      val = val * 10 + (*p - '0');
+      if (val > UINT32_MAX)
+	return NULL;
+    }
+  if (p == str)
+    return NULL;
+
+  *asn = val;
+  return p;
+}
+
+#define BGP_ASREGEX_ASNS 64
+
+/* Compile regstr if it is one of the forms bgp_asregexec() handles,
+   otherwise return NULL and leave it to bgp_regcomp(). */
+struct bgp_asregex *
+bgp_asregcomp (const char *regstr)
+{
+  struct bgp_asregex asregex;
+  struct bgp_asregex *new;
+  as_t asns[BGP_ASREGEX_ASNS];
+  const char *p = regstr;
+
+  if (*p != '^' && *p != '_')
+    return NULL;
+  asregex.start = *p++;
+  asregex.count = 0;
+
+  /* ^$ is the empty path. */
+  if (asregex.start == '^' && *p == '$' && p[1] == '\0')
+    {
+      asregex.end = '$';
+      goto done;
+    }
+
+  while (1)
+    {
+      if (asregex.count == BGP_ASREGEX_ASNS)
+	return NULL;
+      p = bgp_asregex_asn (p, &asns[asregex.count]);
+      if (p == NULL)
+	return NULL;
+      asregex.count++;
+
+      if (*p == '$' && p[1] == '\0')
+	break;
+      if (*p != '_')
+	return NULL;
+      if (p[1] == '\0')
+	break;
+      p++;
+    }
+  asregex.end = *p;
+
+ done:
+  new = XMALLOC (MTYPE_BGP_REGEXP, sizeof (struct bgp_asregex));
+  *new = asregex;
+  new->asns = NULL;
+  if (asregex.count)
+    {
+      new->asns = XMALLOC (MTYPE_BGP_REGEXP, asregex.count * sizeof (as_t));
+      memcpy (new->asns, asns, asregex.count * sizeof (as_t));
+    }
+  return new;
+}
+
+/* The AS path string, with every AS number taking a single place:
+   delimiters are the characters printed between numbers, and numbers
+   have a zero delimiter. */
+struct bgp_asregex_item
+{
+  as_t asn;
+  char delim;
+};
+
+#define BGP_ASREGEX_ITEMS 128
+
+/* What `_' stands for when it is not at the start or the end. */
+#define BGP_ASREGEX_BOUNDARY(c) ((c) && strchr (",{}() ", (c)) != NULL)
+
+/* Room bgp_asregex_items() needs for aspath. */
+static int
+bgp_asregex_size (struct aspath *aspath)
+{
+  struct assegment *seg;
+  int n = 0;
+
+  for (seg = aspath->segments; seg; seg = seg->next)
+    n += 2 * seg->length + 3;
+  return n;
+}
+
+static int
+bgp_asregex_items (struct aspath *aspath, struct bgp_asregex_item *items)
+{
+  struct assegment *seg;
+  int n = 0;
+  int i;
+
+  for (seg = aspath->segments; seg; seg = seg->next)
+    {
+      char open = 0, close = 0, sep = ' ';
+
+      switch (seg->type)
+	{
+	case AS_SET:
+	  open = '{', close = '}', sep = ',';
+	  break;
+	case AS_CONFED_SEQUENCE:
+	  open = '(', close = ')';
+	  break;
+	case AS_CONFED_SET:
+	  open = '[', close = ']', sep = ',';
+	  break;
+	}
+
+      if (open)
+	items[n++].delim = open;
+      for (i = 0; i < seg->length; i++)
+	{
+	  if (i)
+	    items[n++].delim = sep;
+	  items[n].asn = seg->as[i];
+	  items[n++].delim = 0;
+	}
+      if (close)
+	items[n++].delim = close;
+      if (seg->next)
+	items[n++].delim = ' ';
+    }
+  return n;
+}
+
+/* Match a compiled AS path regular expression, returning 0 on a match
+   and REG_NOMATCH otherwise, like bgp_regexec(). */
+int
+bgp_asregexec (struct bgp_asregex *asregex, struct aspath *aspath)
+{
+  struct bgp_asregex_item buf[BGP_ASREGEX_ITEMS];
+  struct bgp_asregex_item *items = buf;
+  int ret = REG_NOMATCH;
+  int n, s, i, k;
+
+  n = bgp_asregex_size (aspath);
+  if (n > BGP_ASREGEX_ITEMS)
+    items = XMALLOC (MTYPE_TMP, n * sizeof (struct bgp_asregex_item));
+  n = bgp_asregex_items (aspath, items);
+
+  if (asregex->count == 0 && n == 0)
+    ret = 0;
+
+  for (s = 0; s < n && asregex->count && ret == REG_NOMATCH; s++)
+    {
+      if (items[s].delim || items[s].asn != asregex->asns[0])
+	continue;
+      if (s > 0 && (asregex->start == '^'
+		    || ! BGP_ASREGEX_BOUNDARY (items[s - 1].delim)))
+	continue;
+
+      for (i = s, k = 1; k < asregex->count; i += 2, k++)
+	if (i + 2 >= n
+	    || ! BGP_ASREGEX_BOUNDARY (items[i + 1].delim)
+	    || items[i + 2].delim || items[i + 2].asn != asregex->asns[k])
+	  break;
+      if (k < asregex->count)
+	continue;
+
+      if (i == n - 1
+	  || (asregex->end == '_' && BGP_ASREGEX_BOUNDARY (items[i + 1].delim)))
+	ret = 0;
+    }
+
+  if (items != buf)
+    XFREE (MTYPE_TMP, items);
+  return ret;
+}
+
+void
+bgp_asregex_free (struct bgp_asregex *asregex)
+{
+  if (asregex->asns)
+    XFREE (MTYPE_BGP_REGEXP, asregex->asns);
+  XFREE (MTYPE_BGP_REGEXP, asregex);
+}
@@ -33,8 +33,24 @@ Software Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
 # endif /* HAVE_GNU_REGEX */
 #endif /* HAVE_LIBPCREPOSIX */
 
+/* AS path regular expressions made of AS numbers joined by `_', and
+   anchored at both ends by `^', `_' or `$', such as _X_, ^X_, _X$ or
+   ^X_Y_, are matched against the AS numbers of a path rather than
+   against its string. */
+struct bgp_asregex
+{
+  char start;			/* '^' or '_' */
+  char end;			/* '$' or '_' */
+  int count;
+  as_t *asns;
+};
+
 extern void bgp_regex_free (regex_t *regex);
 extern regex_t *bgp_regcomp (const char *str);
 extern int bgp_regexec (regex_t *regex, struct aspath *aspath);
 
+extern struct bgp_asregex *bgp_asregcomp (const char *str);
+extern int bgp_asregexec (struct bgp_asregex *asregex, struct aspath *aspath);
+extern void bgp_asregex_free (struct bgp_asregex *asregex);
+
 #endif /* _QUAGGA_BGP_REGEX_H */
@@ -34,6 +34,7 @@ Software Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
 #include "plist.h"
 #include "thread.h"
 #include "workqueue.h"
+#include "hash.h"
 
 #include "bgpd/bgpd.h"
 #include "bgpd/bgp_table.h"
@@ -54,6 +55,7 @@ Software Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
 #include "bgpd/bgp_advertise.h"
 #include "bgpd/bgp_zebra.h"
 #include "bgpd/bgp_vty.h"
+#include "bgpd/bgp_updgrp.h"
 
 /* Extern from bgp_dump.c */
 extern const char *bgp_origin_str[];
@@ -136,6 +138,8 @@ bgp_info_new (void)
 static void
 bgp_info_free (struct bgp_info *binfo)
 {
+  bgp_nexthop_unlink (binfo);
+
   if (binfo->attr)
     bgp_attr_unintern (binfo->attr);
   
@@ -192,6 +196,7 @@ bgp_info_add (struct bgp_node *rn, struct bgp_info *ri)
   if (top)
     top->prev = ri;
   rn->info = ri;
+  ri->net = rn;
   
   bgp_info_lock (ri);
   bgp_lock_node (rn);
@@ -209,6 +214,8 @@ bgp_info_reap (struct bgp_node *rn, struct bgp_info *ri)
     ri->prev->next = ri->next;
   else
     rn->info = ri->next;
+  ri->net = NULL;
+  bgp_nexthop_unlink (ri);
   
   bgp_info_unlock (ri);
   bgp_unlock_node (rn);
@@ -522,20 +529,22 @@ bgp_info_cmp (struct bgp *bgp, struct bgp_info *new, struct bgp_info *exist)
   return 1;
 }
 
+#define FILTER_EXIST_WARN(F,f,filter) \
+  if (BGP_DEBUG (update, UPDATE_IN) \
+      && !(F ## _IN (filter))) \
+    plog_warn (peer->log, "%s: Could not find configured input %s-list %s!", \
+               peer->host, #f, F ## _IN_NAME(filter));
+
+/* Input distribute-list and prefix-list, which only look at the
+   prefix. */
 static enum filter_type
-bgp_input_filter (struct peer *peer, struct prefix *p, struct attr *attr,
-		  afi_t afi, safi_t safi)
+bgp_input_filter_prefix (struct peer *peer, struct prefix *p,
+			 afi_t afi, safi_t safi)
 {
   struct bgp_filter *filter;
 
   filter = &peer->filter[afi][safi];
 
-#define FILTER_EXIST_WARN(F,f,filter) \
-  if (BGP_DEBUG (update, UPDATE_IN) \
-      && !(F ## _IN (filter))) \
-    plog_warn (peer->log, "%s: Could not find configured input %s-list %s!", \
-               peer->host, #f, F ## _IN_NAME(filter));
-  
   if (DISTRIBUTE_IN_NAME (filter)) {
     FILTER_EXIST_WARN(DISTRIBUTE, distribute, filter);
       
@@ -549,7 +558,19 @@ bgp_input_filter (struct peer *peer, struct prefix *p, struct attr *attr,
     if (prefix_list_apply (PREFIX_LIST_IN (filter), p) == PREFIX_DENY)
       return FILTER_DENY;
   }
-  
+
+  return FILTER_PERMIT;
+}
+
+/* Input filter-list, which only looks at the attribute. */
+static enum filter_type
+bgp_input_filter_path (struct peer *peer, struct attr *attr,
+		       afi_t afi, safi_t safi)
+{
+  struct bgp_filter *filter;
+
+  filter = &peer->filter[afi][safi];
+
   if (FILTER_LIST_IN_NAME (filter)) {
     FILTER_EXIST_WARN(FILTER_LIST, as, filter);
     
@@ -558,8 +579,8 @@ bgp_input_filter (struct peer *peer, struct prefix *p, struct attr *attr,
   }
   
   return FILTER_PERMIT;
-#undef FILTER_EXIST_WARN
 }
+#undef FILTER_EXIST_WARN
 
 static enum filter_type
 bgp_output_filter (struct peer *peer, struct prefix *p, struct attr *attr,
@@ -753,9 +774,48 @@ bgp_import_modifier (struct peer *rsclient, struct peer *peer,
   return RMAP_PERMIT;
 }
 
+/* Announcement checks which depend on the identity of the peer rather
+   than on its outbound configuration, so can't be shared within an
+   update group. */
 static int
-bgp_announce_check (struct bgp_info *ri, struct peer *peer, struct prefix *p,
-		    struct attr *attr, afi_t afi, safi_t safi)
+bgp_announce_check_peer (struct bgp_info *ri, struct peer *peer,
+			 struct prefix *p)
+{
+  char buf[SU_ADDRSTRLEN];
+
+  /* Do not send back route to sender. */
+  if (ri->peer == peer)
+    return 0;
+
+  /* If peer's id and route's nexthop are same. draft-ietf-idr-bgp4-23 5.1.3 */
+  if (p->family == AF_INET
+      && IPV4_ADDR_SAME(&peer->remote_id, &ri->attr->nexthop))
+    return 0;
+
+  /* If the attribute has originator-id and it is same as remote
+     peer's id. */
+  if (ri->attr->flag & ATTR_FLAG_BIT (BGP_ATTR_ORIGINATOR_ID))
+    {
+      if (IPV4_ADDR_SAME (&peer->remote_id, &ri->attr->extra->originator_id))
+	{
+	  if (BGP_DEBUG (filter, FILTER))  
+	    zlog (peer->log, LOG_DEBUG,
+		  "%s [Update:SEND] %s/%d originator-id is same as remote router-id",
+		  peer->host,
+		  inet_ntop(p->family, &p->u.prefix, buf, SU_ADDRSTRLEN),
+		  p->prefixlen);
+	  return 0;
+	}
+    }
+  return 1;
+}
+
+/* The rest of the announcement checks, and the outbound policy.  The
+   result is the same for all members of an update group. */
+static int
+bgp_announce_check_policy (struct bgp_info *ri, struct peer *peer,
+			   struct prefix *p, struct attr *attr,
+			   afi_t afi, safi_t safi)
 {
   int ret;
   char buf[SU_ADDRSTRLEN];
@@ -776,15 +836,6 @@ bgp_announce_check (struct bgp_info *ri, struct peer *peer, struct prefix *p,
   if (CHECK_FLAG(peer->af_flags[afi][safi], PEER_FLAG_RSERVER_CLIENT))
     return 0;
 
-  /* Do not send back route to sender. */
-  if (from == peer)
-    return 0;
-
-  /* If peer's id and route's nexthop are same. draft-ietf-idr-bgp4-23 5.1.3 */
-  if (p->family == AF_INET
-      && IPV4_ADDR_SAME(&peer->remote_id, &ri->attr->nexthop))
-    return 0;
-
   /* Aggregate-address suppress check. */
   if (ri->extra && ri->extra->suppress)
     if (! UNSUPPRESS_MAP_NAME (filter))
@@ -812,22 +863,6 @@ bgp_announce_check (struct bgp_info *ri, struct peer *peer, struct prefix *p,
   if (! transparent && bgp_community_filter (peer, ri->attr)) 
     return 0;
 
-  /* If the attribute has originator-id and it is same as remote
-     peer's id. */
-  if (ri->attr->flag & ATTR_FLAG_BIT (BGP_ATTR_ORIGINATOR_ID))
-    {
-      if (IPV4_ADDR_SAME (&peer->remote_id, &ri->attr->extra->originator_id))
-	{
-	  if (BGP_DEBUG (filter, FILTER))  
-	    zlog (peer->log, LOG_DEBUG,
-		  "%s [Update:SEND] %s/%d originator-id is same as remote router-id",
-		  peer->host,
-		  inet_ntop(p->family, &p->u.prefix, buf, SU_ADDRSTRLEN),
-		  p->prefixlen);
-	  return 0;
-	}
-    }
- 
   /* ORF prefix-list filter check */
   if (CHECK_FLAG (peer->af_cap[afi][safi], PEER_CAP_ORF_PREFIX_RM_ADV)
       && (CHECK_FLAG (peer->af_cap[afi][safi], PEER_CAP_ORF_PREFIX_SM_RCV)
@@ -1055,6 +1090,14 @@ bgp_announce_check (struct bgp_info *ri, struct peer *peer, struct prefix *p,
   return 1;
 }
 
+static int
+bgp_announce_check (struct bgp_info *ri, struct peer *peer, struct prefix *p,
+		    struct attr *attr, afi_t afi, safi_t safi)
+{
+  return bgp_announce_check_peer (ri, peer, p)
+         && bgp_announce_check_policy (ri, peer, p, attr, afi, safi);
+}
+
 static int
 bgp_announce_check_rsclient (struct bgp_info *ri, struct peer *rsclient,
         struct prefix *p, struct attr *attr, afi_t afi, safi_t safi)
@@ -1392,6 +1435,46 @@ bgp_process_announce_selected (struct peer *peer, struct bgp_info *selected,
   return 0;
 }
 
+/* Announce the selected route of the main table to the peer.  The
+   outbound policy is evaluated only for the first member of each
+   update group, the others just do the checks particular to them. */
+static void
+bgp_process_announce_main (struct peer *peer, struct bgp_info *selected,
+			   struct bgp_node *rn, afi_t afi, safi_t safi,
+			   unsigned long serial)
+{
+  struct update_group *group;
+  struct attr attr = { 0 };
+  int announce;
+
+  if (peer->status != Established
+      || ! peer->afc_nego[afi][safi]
+      || CHECK_FLAG (peer->af_sflags[afi][safi], PEER_STATUS_ORF_WAIT_REFRESH))
+    return;
+
+  if (! selected)
+    {
+      bgp_adj_out_unset (rn, peer, &rn->p, afi, safi);
+      return;
+    }
+
+  group = bgp_updgrp_get (peer, afi, safi);
+  if (group->serial == serial && group->ri == selected)
+    group->policy_shared++;
+  else
+    {
+      announce = bgp_announce_check_policy (selected, peer, &rn->p, &attr,
+					    afi, safi);
+      bgp_updgrp_set_policy (group, serial, selected, announce, &attr);
+      bgp_attr_extra_free (&attr);
+    }
+
+  if (group->announce && bgp_announce_check_peer (selected, peer, &rn->p))
+    bgp_adj_out_set (rn, peer, &rn->p, group->attr, afi, safi, selected);
+  else
+    bgp_adj_out_unset (rn, peer, &rn->p, afi, safi);
+}
+
 struct bgp_process_queue 
 {
   struct bgp *bgp;
@@ -1474,6 +1557,7 @@ bgp_process_main (struct work_queue *wq, void *data)
   struct bgp_info_pair old_and_new;
   struct listnode *node, *nnode;
   struct peer *peer;
+  static unsigned long serial;
   
   /* Best path selection. */
   bgp_best_selection (bgp, rn, &old_and_new);
@@ -1486,7 +1570,10 @@ bgp_process_main (struct work_queue *wq, void *data)
       if (! CHECK_FLAG (old_select->flags, BGP_INFO_ATTR_CHANGED))
         {
           if (CHECK_FLAG (old_select->flags, BGP_INFO_IGP_CHANGED))
-            bgp_zebra_announce (p, old_select, bgp, safi);
+            {
+              bgp_zebra_announce (p, old_select, bgp, safi);
+              UNSET_FLAG (old_select->flags, BGP_INFO_IGP_CHANGED);
+            }
           
           UNSET_FLAG (rn->flags, BGP_NODE_PROCESS_SCHEDULED);
           return WQ_SUCCESS;
@@ -1499,13 +1586,15 @@ bgp_process_main (struct work_queue *wq, void *data)
     {
       bgp_info_set_flag (rn, new_select, BGP_INFO_SELECTED);
       bgp_info_unset_flag (rn, new_select, BGP_INFO_ATTR_CHANGED);
+      UNSET_FLAG (new_select->flags, BGP_INFO_IGP_CHANGED);
     }
 
 
   /* Check each BGP peer. */
+  serial++;
   for (ALL_LIST_ELEMENTS (bgp->peer, node, nnode, peer))
     {
-      bgp_process_announce_selected (peer, new_select, rn, afi, safi);
+      bgp_process_announce_main (peer, new_select, rn, afi, safi, serial);
     }
 
   /* FIB update. */
@@ -1565,8 +1654,7 @@ bgp_process_queue_init (void)
   bm->process_main_queue->spec.max_retries = 0;
   bm->process_main_queue->spec.hold = 50;
   
-  memcpy (bm->process_rsclient_queue, bm->process_main_queue,
-          sizeof (struct work_queue *));
+  bm->process_rsclient_queue->spec = bm->process_main_queue->spec;
   bm->process_rsclient_queue->spec.workfunc = &bgp_process_rsclient;
 }
 
@@ -1595,6 +1683,7 @@ bgp_process (struct bgp *bgp, struct bgp_node *rn, afi_t afi, safi_t safi)
   bgp_lock (bgp);
   pqnode->afi = afi;
   pqnode->safi = safi;
+  SET_FLAG (rn->flags, BGP_NODE_PROCESS_SCHEDULED);
   
   switch (rn->table->type)
     {
@@ -1966,19 +2055,183 @@ bgp_withdraw_rsclient (struct peer *rsclient, afi_t afi, safi_t safi,
   bgp_unlock_node (rn);
 }
 
+/* Checks of a received path against our own AS, router-id and
+   cluster, which only look at the attribute.  Returns why the path is
+   rejected, or NULL. */
+static const char *
+bgp_input_check_path (struct peer *peer, struct attr *attr,
+		      afi_t afi, safi_t safi)
+{
+  struct bgp *bgp = peer->bgp;
+  int aspath_loop_count = 0;
+
+  /* AS path local-as loop check. */
+  if (peer->change_local_as)
+    {
+      if (! CHECK_FLAG (peer->flags, PEER_FLAG_LOCAL_AS_NO_PREPEND))
+	aspath_loop_count = 1;
+
+      if (aspath_loop_check (attr->aspath, peer->change_local_as) > aspath_loop_count) 
+	return "as-path contains our own AS;";
+    }
+
+  /* AS path loop check. */
+  if (aspath_loop_check (attr->aspath, bgp->as) > peer->allowas_in[afi][safi]
+      || (CHECK_FLAG(bgp->config, BGP_CONFIG_CONFEDERATION)
+	  && aspath_loop_check(attr->aspath, bgp->confed_id)
+	  > peer->allowas_in[afi][safi]))
+    return "as-path contains our own AS;";
+
+  /* Route reflector originator ID check.  */
+  if (attr->flag & ATTR_FLAG_BIT (BGP_ATTR_ORIGINATOR_ID)
+      && IPV4_ADDR_SAME (&bgp->router_id, &attr->extra->originator_id))
+    return "originator is us;";
+
+  /* Route reflector cluster ID check.  */
+  if (bgp_cluster_filter (peer, attr))
+    return "reflected from the same cluster;";
+
+  return NULL;
+}
+
+/* Apply the incoming route-map to NEW_ATTR and check the next hop it
+   ends up with.  Returns why the route is rejected, or NULL. */
+static const char *
+bgp_input_policy (struct peer *peer, struct prefix *p, struct attr *new_attr,
+		  afi_t afi, safi_t safi)
+{
+  if (bgp_input_modifier (peer, p, new_attr, afi, safi) == RMAP_DENY)
+    return "route-map;";
+
+  /* IPv4 unicast next hop check.  */
+  if (afi == AFI_IP && safi == SAFI_UNICAST)
+    {
+      /* If the peer is EBGP and nexthop is not on connected route,
+	 discard it.  */
+      if (peer_sort (peer) == BGP_PEER_EBGP && peer->ttl == 1
+	  && ! bgp_nexthop_onlink (afi, new_attr)
+	  && ! CHECK_FLAG (peer->flags, PEER_FLAG_DISABLE_CONNECTED_CHECK))
+	return "non-connected next-hop;";
+
+      /* Next hop must not be 0.0.0.0 nor Class D/E address. Next hop
+	 must not be my own address.  */
+      if (bgp_nexthop_self (afi, new_attr)
+	  || new_attr->nexthop.s_addr == 0
+	  || IPV4_CLASS_DE (ntohl (new_attr->nexthop.s_addr)))
+	return "martian next-hop;";
+    }
+
+  return NULL;
+}
+
+/* Soft reconfiguration runs inbound policy again for every prefix the
+   peer sent, but most of that policy only looks at the attribute,
+   which is shared by many prefixes.  During one such walk, what the
+   checks make of each distinct attribute is kept here.  The
+   distribute-list and prefix-list are still applied per prefix, and
+   so is the route-map if it has rules that look at the prefix. */
+struct bgp_input_cache
+{
+  /* Interned attribute received from the peer. */
+  struct attr *attr;
+
+  /* Why bgp_input_check_path() rejects it, or NULL. */
+  const char *reason;
+
+  /* Denied by the filter-list. */
+  int filtered;
+
+  /* Outcome of bgp_input_policy(), once it has run for the first
+     prefix that passed the filters: why it was rejected, or the
+     interned attribute to use. */
+  int policy_cached;
+  int policy_done;
+  const char *policy_reason;
+  struct attr *result;
+};
+
+static unsigned int
+bgp_input_cache_key (void *p)
+{
+  return (unsigned int) ((uintptr_t) ((struct bgp_input_cache *) p)->attr
+			 / sizeof (struct attr));
+}
+
+static int
+bgp_input_cache_cmp (const void *p1, const void *p2)
+{
+  return ((const struct bgp_input_cache *) p1)->attr
+    == ((const struct bgp_input_cache *) p2)->attr;
+}
+
+static struct bgp_input_cache *
+bgp_input_cache_get (struct hash *cache, struct peer *peer, struct attr *attr,
+		     afi_t afi, safi_t safi)
+{
+  struct bgp_input_cache lookup;
+  struct bgp_input_cache *entry;
+  struct bgp_filter *filter;
+
+  lookup.attr = attr;
+  if ((entry = hash_lookup (cache, &lookup)) != NULL)
+    return entry;
+
+  entry = XCALLOC (MTYPE_BGP_INPUT_CACHE, sizeof (struct bgp_input_cache));
+  entry->attr = bgp_attr_intern (attr);
+  entry->reason = bgp_input_check_path (peer, attr, afi, safi);
+  if (! entry->reason)
+    entry->filtered = 
+      (bgp_input_filter_path (peer, attr, afi, safi) == FILTER_DENY);
+
+  /* A missing route-map denies everything alike. */
+  filter = &peer->filter[afi][safi];
+  entry->policy_cached = (! ROUTE_MAP_IN_NAME (filter)
+			  || ! ROUTE_MAP_IN (filter)
+			  || route_map_is_cacheable (ROUTE_MAP_IN (filter)));
+
+  hash_get (cache, entry, hash_alloc_intern);
+  return entry;
+}
+
+static void
+bgp_input_cache_policy (struct bgp_input_cache *entry, struct peer *peer,
+			struct prefix *p, afi_t afi, safi_t safi)
+{
+  struct attr new_attr = { 0 };
+
+  bgp_attr_dup (&new_attr, entry->attr);
+  entry->policy_reason = bgp_input_policy (peer, p, &new_attr, afi, safi);
+  if (! entry->policy_reason)
+    entry->result = bgp_attr_intern (&new_attr);
+  bgp_attr_extra_free (&new_attr);
+  entry->policy_done = 1;
+}
+
+static void
+bgp_input_cache_free (void *p)
+{
+  struct bgp_input_cache *entry = p;
+
+  if (entry->result)
+    bgp_attr_unintern (entry->result);
+  bgp_attr_unintern (entry->attr);
+  XFREE (MTYPE_BGP_INPUT_CACHE, entry);
+}
+
 static int
 bgp_update_main (struct peer *peer, struct prefix *p, struct attr *attr,
 	    afi_t afi, safi_t safi, int type, int sub_type,
-	    struct prefix_rd *prd, u_char *tag, int soft_reconfig)
+	    struct prefix_rd *prd, u_char *tag, int soft_reconfig,
+	    struct hash *cache)
 {
   int ret;
-  int aspath_loop_count = 0;
   struct bgp_node *rn;
   struct bgp *bgp;
   struct attr new_attr = { 0 };
   struct attr *attr_new;
   struct bgp_info *ri;
   struct bgp_info *new;
+  struct bgp_input_cache *entry;
   const char *reason;
   char buf[SU_ADDRSTRLEN];
 
@@ -1996,82 +2249,59 @@ bgp_update_main (struct peer *peer, struct prefix *p, struct attr *attr,
     if (ri->peer == peer && ri->type == type && ri->sub_type == sub_type)
       break;
 
-  /* AS path local-as loop check. */
-  if (peer->change_local_as)
+  if (cache)
     {
-      if (! CHECK_FLAG (peer->flags, PEER_FLAG_LOCAL_AS_NO_PREPEND))
-	aspath_loop_count = 1;
-
-      if (aspath_loop_check (attr->aspath, peer->change_local_as) > aspath_loop_count) 
+      entry = bgp_input_cache_get (cache, peer, attr, afi, safi);
+      if (entry->reason)
 	{
-	  reason = "as-path contains our own AS;";
+	  reason = entry->reason;
 	  goto filtered;
 	}
-    }
 
-  /* AS path loop check. */
-  if (aspath_loop_check (attr->aspath, bgp->as) > peer->allowas_in[afi][safi]
-      || (CHECK_FLAG(bgp->config, BGP_CONFIG_CONFEDERATION)
-	  && aspath_loop_check(attr->aspath, bgp->confed_id)
-	  > peer->allowas_in[afi][safi]))
-    {
-      reason = "as-path contains our own AS;";
-      goto filtered;
-    }
-
-  /* Route reflector originator ID check.  */
-  if (attr->flag & ATTR_FLAG_BIT (BGP_ATTR_ORIGINATOR_ID)
-      && IPV4_ADDR_SAME (&bgp->router_id, &attr->extra->originator_id))
-    {
-      reason = "originator is us;";
-      goto filtered;
-    }
+      if (bgp_input_filter_prefix (peer, p, afi, safi) == FILTER_DENY
+	  || entry->filtered)
+	{
+	  reason = "filter;";
+	  goto filtered;
+	}
 
-  /* Route reflector cluster ID check.  */
-  if (bgp_cluster_filter (peer, attr))
-    {
-      reason = "reflected from the same cluster;";
-      goto  filtered;
-    }
+      if (entry->policy_cached && ! entry->policy_done)
+	bgp_input_cache_policy (entry, peer, p, afi, safi);
 
-  /* Apply incoming filter.  */
-  if (bgp_input_filter (peer, p, attr, afi, safi) == FILTER_DENY)
-    {
-      reason = "filter;";
-      goto filtered;
+      if (entry->policy_done)
+	{
+	  if (entry->policy_reason)
+	    {
+	      reason = entry->policy_reason;
+	      goto filtered;
+	    }
+	  bgp_attr_dup (&new_attr, entry->result);
+	}
+      else
+	{
+	  bgp_attr_dup (&new_attr, attr);
+	  if ((reason = bgp_input_policy (peer, p, &new_attr, afi, safi)))
+	    goto filtered;
+	}
     }
-
-  /* Apply incoming route-map. */
-  bgp_attr_dup (&new_attr, attr);
-
-  if (bgp_input_modifier (peer, p, &new_attr, afi, safi) == RMAP_DENY)
+  else
     {
-      reason = "route-map;";
-      goto filtered;
-    }
+      if ((reason = bgp_input_check_path (peer, attr, afi, safi)))
+	goto filtered;
 
-  /* IPv4 unicast next hop check.  */
-  if (afi == AFI_IP && safi == SAFI_UNICAST)
-    {
-      /* If the peer is EBGP and nexthop is not on connected route,
-	 discard it.  */
-      if (peer_sort (peer) == BGP_PEER_EBGP && peer->ttl == 1
-	  && ! bgp_nexthop_onlink (afi, &new_attr)
-	  && ! CHECK_FLAG (peer->flags, PEER_FLAG_DISABLE_CONNECTED_CHECK))
+      /* Apply incoming filter.  */
+      if (bgp_input_filter_prefix (peer, p, afi, safi) == FILTER_DENY
+	  || bgp_input_filter_path (peer, attr, afi, safi) == FILTER_DENY)
 	{
-	  reason = "non-connected next-hop;";
+	  reason = "filter;";
 	  goto filtered;
 	}
 
-      /* Next hop must not be 0.0.0.0 nor Class D/E address. Next hop
-	 must not be my own address.  */
-      if (bgp_nexthop_self (afi, &new_attr)
-	  || new_attr.nexthop.s_addr == 0
-	  || IPV4_CLASS_DE (ntohl (new_attr.nexthop.s_addr)))
-	{
-	  reason = "martian next-hop;";
-	  goto filtered;
-	}
+      /* Apply incoming route-map. */
+      bgp_attr_dup (&new_attr, attr);
+
+      if ((reason = bgp_input_policy (peer, p, &new_attr, afi, safi)))
+	goto filtered;
     }
 
   attr_new = bgp_attr_intern (&new_attr);
@@ -2197,13 +2427,16 @@ bgp_update_main (struct peer *peer, struct prefix *p, struct attr *attr,
 	      || (peer_sort (peer) == BGP_PEER_EBGP && peer->ttl != 1)
 	      || CHECK_FLAG (peer->flags, PEER_FLAG_DISABLE_CONNECTED_CHECK)))
 	{
-	  if (bgp_nexthop_lookup (afi, peer, ri, NULL, NULL))
+	  if (bgp_nexthop_lookup (afi, peer, ri))
 	    bgp_info_set_flag (rn, ri, BGP_INFO_VALID);
 	  else
 	    bgp_info_unset_flag (rn, ri, BGP_INFO_VALID);
 	}
       else
-        bgp_info_set_flag (rn, ri, BGP_INFO_VALID);
+        {
+          bgp_nexthop_unlink (ri);
+          bgp_info_set_flag (rn, ri, BGP_INFO_VALID);
+        }
 
       /* Process change. */
       bgp_aggregate_increment (bgp, p, ri, afi, safi);
@@ -2244,7 +2477,7 @@ bgp_update_main (struct peer *peer, struct prefix *p, struct attr *attr,
 	  || (peer_sort (peer) == BGP_PEER_EBGP && peer->ttl != 1)
 	  || CHECK_FLAG (peer->flags, PEER_FLAG_DISABLE_CONNECTED_CHECK)))
     {
-      if (bgp_nexthop_lookup (afi, peer, new, NULL, NULL))
+      if (bgp_nexthop_lookup (afi, peer, new))
 	bgp_info_set_flag (rn, new, BGP_INFO_VALID);
       else
         bgp_info_unset_flag (rn, new, BGP_INFO_VALID);
@@ -2293,10 +2526,11 @@ bgp_update_main (struct peer *peer, struct prefix *p, struct attr *attr,
   return 0;
 }
 
-int
-bgp_update (struct peer *peer, struct prefix *p, struct attr *attr,
-            afi_t afi, safi_t safi, int type, int sub_type,
-            struct prefix_rd *prd, u_char *tag, int soft_reconfig)
+static int
+bgp_update_cached (struct peer *peer, struct prefix *p, struct attr *attr,
+		   afi_t afi, safi_t safi, int type, int sub_type,
+		   struct prefix_rd *prd, u_char *tag, int soft_reconfig,
+		   struct hash *cache)
 {
   struct peer *rsclient;
   struct listnode *node, *nnode;
@@ -2304,7 +2538,7 @@ bgp_update (struct peer *peer, struct prefix *p, struct attr *attr,
   int ret;
 
   ret = bgp_update_main (peer, p, attr, afi, safi, type, sub_type, prd, tag,
-          soft_reconfig);
+          soft_reconfig, cache);
 
   bgp = peer->bgp;
 
@@ -2319,6 +2553,15 @@ bgp_update (struct peer *peer, struct prefix *p, struct attr *attr,
   return ret;
 }
 
+int
+bgp_update (struct peer *peer, struct prefix *p, struct attr *attr,
+            afi_t afi, safi_t safi, int type, int sub_type,
+            struct prefix_rd *prd, u_char *tag, int soft_reconfig)
+{
+  return bgp_update_cached (peer, p, attr, afi, safi, type, sub_type,
+			    prd, tag, soft_reconfig, NULL);
+}
+
 int
 bgp_withdraw (struct peer *peer, struct prefix *p, struct attr *attr, 
 	     afi_t afi, safi_t safi, int type, int sub_type, 
@@ -2450,11 +2693,16 @@ bgp_default_originate (struct peer *peer, afi_t afi, safi_t safi, int withdraw)
   if (withdraw)
     {
       if (CHECK_FLAG (peer->af_sflags[afi][safi], PEER_STATUS_DEFAULT_ORIGINATE))
-	bgp_default_withdraw_send (peer, afi, safi);
+	{
+	  bgp_default_withdraw_send (peer, afi, safi);
+	  bgp_updgrp_invalidate ();
+	}
       UNSET_FLAG (peer->af_sflags[afi][safi], PEER_STATUS_DEFAULT_ORIGINATE);
     }
   else
     {
+      if (! CHECK_FLAG (peer->af_sflags[afi][safi], PEER_STATUS_DEFAULT_ORIGINATE))
+	bgp_updgrp_invalidate ();
       SET_FLAG (peer->af_sflags[afi][safi], PEER_STATUS_DEFAULT_ORIGINATE);
       bgp_default_update_send (peer, &attr, afi, safi, from);
     }
@@ -2568,7 +2816,7 @@ bgp_soft_reconfig_rsclient (struct peer *rsclient, afi_t afi, safi_t safi)
 
 static void
 bgp_soft_reconfig_table (struct peer *peer, afi_t afi, safi_t safi,
-			 struct bgp_table *table)
+			 struct bgp_table *table, struct hash *cache)
 {
   int ret;
   struct bgp_node *rn;
@@ -2578,19 +2826,15 @@ bgp_soft_reconfig_table (struct peer *peer, afi_t afi, safi_t safi,
     table = peer->bgp->rib[afi][safi];
 
   for (rn = bgp_table_top (table); rn; rn = bgp_route_next (rn))
-    for (ain = rn->adj_in; ain; ain = ain->next)
+    if ((ain = bgp_adj_in_find (rn, peer)) != NULL)
       {
-	if (ain->peer == peer)
+	ret = bgp_update_cached (peer, &rn->p, ain->attr, afi, safi,
+				 ZEBRA_ROUTE_BGP, BGP_ROUTE_NORMAL,
+				 NULL, NULL, 1, cache);
+	if (ret < 0)
 	  {
-	    ret = bgp_update (peer, &rn->p, ain->attr, afi, safi,
-			      ZEBRA_ROUTE_BGP, BGP_ROUTE_NORMAL,
-			      NULL, NULL, 1);
-	    if (ret < 0)
-	      {
-		bgp_unlock_node (rn);
-		return;
-	      }
-	    continue;
+	    bgp_unlock_node (rn);
+	    return;
 	  }
       }
 }
@@ -2600,17 +2844,23 @@ bgp_soft_reconfig_in (struct peer *peer, afi_t afi, safi_t safi)
 {
   struct bgp_node *rn;
   struct bgp_table *table;
+  struct hash *cache;
 
   if (peer->status != Established)
     return;
 
+  cache = hash_create (bgp_input_cache_key, bgp_input_cache_cmp);
+
   if (safi != SAFI_MPLS_VPN)
-    bgp_soft_reconfig_table (peer, afi, safi, NULL);
+    bgp_soft_reconfig_table (peer, afi, safi, NULL, cache);
   else
     for (rn = bgp_table_top (peer->bgp->rib[afi][safi]); rn;
 	 rn = bgp_route_next (rn))
       if ((table = rn->info) != NULL)
-	bgp_soft_reconfig_table (peer, afi, safi, table);
+	bgp_soft_reconfig_table (peer, afi, safi, table, cache);
+
+  hash_clean (cache, bgp_input_cache_free);
+  hash_free (cache);
 }
 
 
@@ -2765,20 +3015,26 @@ bgp_clear_route_table (struct peer *peer, afi_t afi, safi_t safi,
             break;
           }
 
-      for (ain = rn->adj_in; ain; ain = ain->next)
-        if (ain->peer == peer || purpose == BGP_CLEAR_ROUTE_MY_RSCLIENT)
-          {
-            bgp_adj_in_remove (rn, ain);
-            bgp_unlock_node (rn);
-            break;
-          }
-      for (aout = rn->adj_out; aout; aout = aout->next)
-        if (aout->peer == peer || purpose == BGP_CLEAR_ROUTE_MY_RSCLIENT)
-          {
-            bgp_adj_out_remove (rn, aout, peer, afi, safi);
-            bgp_unlock_node (rn);
-            break;
-          }
+      if (purpose == BGP_CLEAR_ROUTE_MY_RSCLIENT)
+        {
+          ain = rn->adj_in;
+          aout = rn->adj_out;
+        }
+      else
+        {
+          ain = bgp_adj_in_find (rn, peer);
+          aout = bgp_adj_out_find (rn, peer);
+        }
+      if (ain)
+        {
+          bgp_adj_in_remove (rn, ain);
+          bgp_unlock_node (rn);
+        }
+      if (aout)
+        {
+          bgp_adj_out_remove (rn, aout, peer, afi, safi);
+          bgp_unlock_node (rn);
+        }
     }
   return;
 }
@@ -2880,13 +3136,11 @@ bgp_clear_adj_in (struct peer *peer, afi_t afi, safi_t safi)
   table = peer->bgp->rib[afi][safi];
 
   for (rn = bgp_table_top (table); rn; rn = bgp_route_next (rn))
-    for (ain = rn->adj_in; ain ; ain = ain->next)
-      if (ain->peer == peer)
-	{
-          bgp_adj_in_remove (rn, ain);
-          bgp_unlock_node (rn);
-          break;
-	}
+    if ((ain = bgp_adj_in_find (rn, peer)) != NULL)
+      {
+        bgp_adj_in_remove (rn, ain);
+        bgp_unlock_node (rn);
+      }
 }
 
 void
@@ -9479,12 +9733,10 @@ bgp_peer_count_walker (struct thread *t)
   
   for (rn = bgp_table_top (pc->table); rn; rn = bgp_route_next (rn))
     {
-      struct bgp_adj_in *ain;
       struct bgp_info *ri;
       
-      for (ain = rn->adj_in; ain; ain = ain->next)
-        if (ain->peer == peer)
-          pc->count[PCOUNT_ADJ_IN]++;
+      if (bgp_adj_in_find (rn, peer))
+        pc->count[PCOUNT_ADJ_IN]++;
 
       for (ri = rn->info; ri; ri = ri->next)
         {
@@ -9707,51 +9959,49 @@ show_adj_route (struct vty *vty, struct peer *peer, afi_t afi, safi_t safi,
   for (rn = bgp_table_top (table); rn; rn = bgp_route_next (rn))
     if (in)
       {
-	for (ain = rn->adj_in; ain; ain = ain->next)
-	  if (ain->peer == peer)
-	    {
-	      if (header1)
-		{
-		  vty_out (vty, "BGP table version is 0, local router ID is %s%s", inet_ntoa (bgp->router_id), VTY_NEWLINE);
-		  vty_out (vty, BGP_SHOW_SCODE_HEADER, VTY_NEWLINE, VTY_NEWLINE);
-		  vty_out (vty, BGP_SHOW_OCODE_HEADER, VTY_NEWLINE, VTY_NEWLINE);
-		  header1 = 0;
-		}
-	      if (header2)
-		{
-		  vty_out (vty, BGP_SHOW_HEADER, VTY_NEWLINE);
-		  header2 = 0;
-		}
-	      if (ain->attr)
-		{ 
-		  route_vty_out_tmp (vty, &rn->p, ain->attr, safi);
-		  output_count++;
-		}
-	    }
+	if ((ain = bgp_adj_in_find (rn, peer)) != NULL)
+	  {
+	    if (header1)
+	      {
+		vty_out (vty, "BGP table version is 0, local router ID is %s%s", inet_ntoa (bgp->router_id), VTY_NEWLINE);
+		vty_out (vty, BGP_SHOW_SCODE_HEADER, VTY_NEWLINE, VTY_NEWLINE);
+		vty_out (vty, BGP_SHOW_OCODE_HEADER, VTY_NEWLINE, VTY_NEWLINE);
+		header1 = 0;
+	      }
+	    if (header2)
+	      {
+		vty_out (vty, BGP_SHOW_HEADER, VTY_NEWLINE);
+		header2 = 0;
+	      }
+	    if (ain->attr)
+	      {
+		route_vty_out_tmp (vty, &rn->p, ain->attr, safi);
+		output_count++;
+	      }
+	  }
       }
     else
       {
-	for (adj = rn->adj_out; adj; adj = adj->next)
-	  if (adj->peer == peer)
-	    {
-	      if (header1)
-		{
-		  vty_out (vty, "BGP table version is 0, local router ID is %s%s", inet_ntoa (bgp->router_id), VTY_NEWLINE);
-		  vty_out (vty, BGP_SHOW_SCODE_HEADER, VTY_NEWLINE, VTY_NEWLINE);
-		  vty_out (vty, BGP_SHOW_OCODE_HEADER, VTY_NEWLINE, VTY_NEWLINE);
-		  header1 = 0;
-		}
-	      if (header2)
-		{
-		  vty_out (vty, BGP_SHOW_HEADER, VTY_NEWLINE);
-		  header2 = 0;
-		}
-	      if (adj->attr)
-		{	
-		  route_vty_out_tmp (vty, &rn->p, adj->attr, safi);
-		  output_count++;
-		}
-	    }
+	if ((adj = bgp_adj_out_find (rn, peer)) != NULL)
+	  {
+	    if (header1)
+	      {
+		vty_out (vty, "BGP table version is 0, local router ID is %s%s", inet_ntoa (bgp->router_id), VTY_NEWLINE);
+		vty_out (vty, BGP_SHOW_SCODE_HEADER, VTY_NEWLINE, VTY_NEWLINE);
+		vty_out (vty, BGP_SHOW_OCODE_HEADER, VTY_NEWLINE, VTY_NEWLINE);
+		header1 = 0;
+	      }
+	    if (header2)
+	      {
+		vty_out (vty, BGP_SHOW_HEADER, VTY_NEWLINE);
+		header2 = 0;
+	      }
+	    if (adj->attr)
+	      {
+		route_vty_out_tmp (vty, &rn->p, adj->attr, safi);
+		output_count++;
+	      }
+	  }
       }
   
   if (output_count != 0)
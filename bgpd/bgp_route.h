@@ -56,6 +56,15 @@ struct bgp_info
   
   /* Extra information */
   struct bgp_info_extra *extra;
+
+  /* Node this information is on, while it is.  */
+  struct bgp_node *net;
+
+  /* Nexthop cache entry tracking the nexthop, and the other paths
+     using it.  */
+  struct bgp_nexthop_cache *nexthop;
+  struct bgp_info *nh_next;
+  struct bgp_info *nh_prev;
   
   /* Uptime.  */
   time_t uptime;
@@ -53,6 +53,8 @@ Software Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
 #include "bgpd/bgp_ecommunity.h"
 #include "bgpd/bgp_vty.h"
 #include "bgpd/bgp_zebra.h"
+#include "bgpd/bgp_advertise.h"
+#include "bgpd/bgp_updgrp.h"
 
 /* Memo of route-map commands.
 
@@ -204,7 +206,8 @@ struct route_map_rule_cmd route_match_peer_cmd =
   "peer",
   route_match_peer,
   route_match_peer_compile,
-  route_match_peer_free
+  route_match_peer_free,
+  RMAP_RULE_PEER
 };
 
 /* `match ip address IP_ACCESS_LIST' */
@@ -303,7 +306,8 @@ struct route_map_rule_cmd route_match_ip_next_hop_cmd =
   "ip next-hop",
   route_match_ip_next_hop,
   route_match_ip_next_hop_compile,
-  route_match_ip_next_hop_free
+  route_match_ip_next_hop_free,
+  RMAP_RULE_CACHEABLE
 };
 
 /* `match ip route-source ACCESS-LIST' */
@@ -361,7 +365,8 @@ struct route_map_rule_cmd route_match_ip_route_source_cmd =
   "ip route-source",
   route_match_ip_route_source,
   route_match_ip_route_source_compile,
-  route_match_ip_route_source_free
+  route_match_ip_route_source_free,
+  RMAP_RULE_PEER
 };
 
 /* `match ip address prefix-list PREFIX_LIST' */
@@ -448,7 +453,8 @@ struct route_map_rule_cmd route_match_ip_next_hop_prefix_list_cmd =
   "ip next-hop prefix-list",
   route_match_ip_next_hop_prefix_list,
   route_match_ip_next_hop_prefix_list_compile,
-  route_match_ip_next_hop_prefix_list_free
+  route_match_ip_next_hop_prefix_list_free,
+  RMAP_RULE_CACHEABLE
 };
 
 /* `match ip route-source prefix-list PREFIX_LIST' */
@@ -501,7 +507,8 @@ struct route_map_rule_cmd route_match_ip_route_source_prefix_list_cmd =
   "ip route-source prefix-list",
   route_match_ip_route_source_prefix_list,
   route_match_ip_route_source_prefix_list_compile,
-  route_match_ip_route_source_prefix_list_free
+  route_match_ip_route_source_prefix_list_free,
+  RMAP_RULE_PEER
 };
 
 /* `match metric METRIC' */
@@ -566,7 +573,8 @@ struct route_map_rule_cmd route_match_metric_cmd =
   "metric",
   route_match_metric,
   route_match_metric_compile,
-  route_match_metric_free
+  route_match_metric_free,
+  RMAP_RULE_CACHEABLE
 };
 
 /* `match as-path ASPATH' */
@@ -615,7 +623,8 @@ struct route_map_rule_cmd route_match_aspath_cmd =
   "as-path",
   route_match_aspath,
   route_match_aspath_compile,
-  route_match_aspath_free
+  route_match_aspath_free,
+  RMAP_RULE_CACHEABLE
 };
 
 /* `match community COMMUNIY' */
@@ -699,7 +708,8 @@ struct route_map_rule_cmd route_match_community_cmd =
   "community",
   route_match_community,
   route_match_community_compile,
-  route_match_community_free
+  route_match_community_free,
+  RMAP_RULE_CACHEABLE
 };
 
 /* Match function for extcommunity match. */
@@ -748,7 +758,8 @@ struct route_map_rule_cmd route_match_ecommunity_cmd =
   "extcommunity",
   route_match_ecommunity,
   route_match_ecommunity_compile,
-  route_match_ecommunity_free
+  route_match_ecommunity_free,
+  RMAP_RULE_CACHEABLE
 };
 
 /* `match nlri` and `set nlri` are replaced by `address-family ipv4`
@@ -804,7 +815,8 @@ struct route_map_rule_cmd route_match_origin_cmd =
   "origin",
   route_match_origin,
   route_match_origin_compile,
-  route_match_origin_free
+  route_match_origin_free,
+  RMAP_RULE_CACHEABLE
 };
 
 /* match probability  { */
@@ -980,7 +992,8 @@ struct route_map_rule_cmd route_set_ip_nexthop_cmd =
   "ip next-hop",
   route_set_ip_nexthop,
   route_set_ip_nexthop_compile,
-  route_set_ip_nexthop_free
+  route_set_ip_nexthop_free,
+  RMAP_RULE_PEER
 };
 
 /* `set local-preference LOCAL_PREF' */
@@ -1048,6 +1061,7 @@ struct route_map_rule_cmd route_set_local_pref_cmd =
   route_set_local_pref,
   route_set_local_pref_compile,
   route_set_local_pref_free,
+  RMAP_RULE_CACHEABLE
 };
 
 /* `set weight WEIGHT' */
@@ -1117,6 +1131,7 @@ struct route_map_rule_cmd route_set_weight_cmd =
   route_set_weight,
   route_set_weight_compile,
   route_set_weight_free,
+  RMAP_RULE_CACHEABLE
 };
 
 /* `set metric METRIC' */
@@ -1217,6 +1232,7 @@ struct route_map_rule_cmd route_set_metric_cmd =
   route_set_metric,
   route_set_metric_compile,
   route_set_metric_free,
+  RMAP_RULE_CACHEABLE
 };
 
 /* `set as-path prepend ASPATH' */
@@ -1273,6 +1289,7 @@ struct route_map_rule_cmd route_set_aspath_prepend_cmd =
   route_set_aspath_prepend,
   route_set_aspath_prepend_compile,
   route_set_aspath_prepend_free,
+  RMAP_RULE_CACHEABLE
 };
 
 /* `set as-path exclude ASn' */
@@ -1331,6 +1348,7 @@ struct route_map_rule_cmd route_set_aspath_exclude_cmd =
   route_set_aspath_exclude,
   route_set_aspath_exclude_compile,
   route_set_aspath_exclude_free,
+  RMAP_RULE_CACHEABLE
 };
 
 /* `set community COMMUNITY' */
@@ -1452,6 +1470,7 @@ struct route_map_rule_cmd route_set_community_cmd =
   route_set_community,
   route_set_community_compile,
   route_set_community_free,
+  RMAP_RULE_CACHEABLE
 };
 
 /* `set comm-list (<1-99>|<100-500>|WORD) delete' */
@@ -1534,6 +1553,7 @@ struct route_map_rule_cmd route_set_community_delete_cmd =
   route_set_community_delete,
   route_set_community_delete_compile,
   route_set_community_delete_free,
+  RMAP_RULE_CACHEABLE
 };
 
 /* `set extcommunity rt COMMUNITY' */
@@ -1601,6 +1621,7 @@ struct route_map_rule_cmd route_set_ecommunity_rt_cmd =
   route_set_ecommunity_rt,
   route_set_ecommunity_rt_compile,
   route_set_ecommunity_rt_free,
+  RMAP_RULE_CACHEABLE
 };
 
 /* `set extcommunity soo COMMUNITY' */
@@ -1655,6 +1676,7 @@ struct route_map_rule_cmd route_set_ecommunity_soo_cmd =
   route_set_ecommunity_soo,
   route_set_ecommunity_soo_compile,
   route_set_ecommunity_soo_free,
+  RMAP_RULE_CACHEABLE
 };
 
 /* `set origin ORIGIN' */
@@ -1709,6 +1731,7 @@ struct route_map_rule_cmd route_set_origin_cmd =
   route_set_origin,
   route_set_origin_compile,
   route_set_origin_free,
+  RMAP_RULE_CACHEABLE
 };
 
 /* `set atomic-aggregate' */
@@ -1750,6 +1773,7 @@ struct route_map_rule_cmd route_set_atomic_aggregate_cmd =
   route_set_atomic_aggregate,
   route_set_atomic_aggregate_compile,
   route_set_atomic_aggregate_free,
+  RMAP_RULE_CACHEABLE
 };
 
 /* `set aggregator as AS A.B.C.D' */
@@ -1809,6 +1833,7 @@ struct route_map_rule_cmd route_set_aggregator_as_cmd =
   route_set_aggregator_as,
   route_set_aggregator_as_compile,
   route_set_aggregator_as_free,
+  RMAP_RULE_CACHEABLE
 };
 
 #ifdef HAVE_IPV6
@@ -2306,6 +2331,8 @@ bgp_route_map_update (const char *unused)
   struct bgp_node *bn;
   struct bgp_static *bgp_static;
 
+  bgp_updgrp_invalidate ();
+
   /* For neighbor route-map updates. */
   for (ALL_LIST_ELEMENTS (bm->bgp, mnode, mnnode, bgp))
     {
@@ -2416,6 +2443,9 @@ void bgp_route_map_changed (route_map_event_t e, const char *rm)
   struct listnode *mnode, *mnnode;
   struct bgp *bgp;
 
+  /* Whether a route-map can be shared depends on its rules. */
+  bgp_updgrp_invalidate ();
+
   if (!bgp_option_check (BGP_OPT_REDIST_RMAP_RESPONSIVE))
     return;
 
@@ -3883,6 +3913,72 @@ ALIAS (no_match_pathlimit_as,
 
 
 /* Initialization of route map. */
+/* Route-map results are cached by interned attribute.  Attributes
+   with parts that aren't interned yet belong to the caller, and
+   interning them here could free parts the caller still refers to. */
+static void *
+bgp_route_map_cache_key (void *object)
+{
+  struct attr *attr = ((struct bgp_info *) object)->attr;
+  struct attr_extra *ae = attr->extra;
+
+  if ((attr->aspath && ! attr->aspath->refcnt)
+      || (attr->community && ! attr->community->refcnt)
+      || (ae && ((ae->ecommunity && ! ae->ecommunity->refcnt)
+		 || (ae->cluster && ! ae->cluster->refcnt)
+		 || (ae->transit && ! ae->transit->refcnt))))
+    return NULL;
+
+  return bgp_attr_intern (attr);
+}
+
+/* Parts made by set rules are only referred to by the attribute, it is
+   safe to intern them. */
+static void *
+bgp_route_map_cache_result (void *object)
+{
+  return bgp_attr_intern (((struct bgp_info *) object)->attr);
+}
+
+/* Load what cacheable set rules may have changed. */
+static void
+bgp_route_map_cache_set (void *object, void *result)
+{
+  struct attr *attr = ((struct bgp_info *) object)->attr;
+  struct attr *res = result;
+  struct attr_extra *ae;
+
+  attr->flag = res->flag;
+  attr->origin = res->origin;
+  attr->med = res->med;
+  attr->local_pref = res->local_pref;
+  attr->aspath = res->aspath;
+  attr->community = res->community;
+
+  if (res->extra)
+    {
+      ae = bgp_attr_extra_get (attr);
+      ae->weight = res->extra->weight;
+      ae->ecommunity = res->extra->ecommunity;
+      ae->aggregator_as = res->extra->aggregator_as;
+      ae->aggregator_addr = res->extra->aggregator_addr;
+    }
+}
+
+static void
+bgp_route_map_cache_release (void *ref)
+{
+  bgp_attr_unintern (ref);
+}
+
+static struct route_map_cache_ops bgp_route_map_cache_ops =
+{
+  bgp_route_map_cache_key,
+  bgp_route_map_cache_result,
+  bgp_route_map_cache_set,
+  bgp_route_map_cache_release
+};
+
 void
 bgp_route_map_init (void)
 {
@@ -3891,6 +3987,7 @@ bgp_route_map_init (void)
   route_map_add_hook (bgp_route_map_update);
   route_map_delete_hook (bgp_route_map_update);
   route_map_event_hook (bgp_route_map_changed);
+  route_map_cache_install (RMAP_BGP, &bgp_route_map_cache_ops);
 
   install_element (CONFIG_NODE, &responsive_rmap_cmd);
   install_element (CONFIG_NODE, &no_responsive_rmap_cmd);
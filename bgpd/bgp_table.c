@@ -27,6 +27,7 @@ Software Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
 
 #include "bgpd/bgpd.h"
 #include "bgpd/bgp_table.h"
+#include "bgpd/bgp_advertise.h"
 
 static void bgp_node_delete (struct bgp_node *);
 static void bgp_table_free (struct bgp_table *);
@@ -150,6 +151,8 @@ bgp_table_free (struct bgp_table *rt)
  
   assert (rt->count == 0);
 
+  bgp_adj_index_finish (rt);
+
   if (rt->owner)
     {
       peer_unlock (rt->owner);
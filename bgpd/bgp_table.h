@@ -43,6 +43,10 @@ struct bgp_table
   struct bgp_node *top;
   
   unsigned long count;
+
+  /* Peer index of the adjacencies of crowded nodes, see
+     bgp_advertise.c. */
+  struct hash *adj_index;
 };
 
 struct bgp_node
@@ -67,6 +71,7 @@ struct bgp_node
 
   u_char flags;
 #define BGP_NODE_PROCESS_SCHEDULED	(1 << 0)
+#define BGP_NODE_ADJ_INDEX		(1 << 1)
 };
 
 extern struct bgp_table *bgp_table_init (afi_t, safi_t);
@@ -0,0 +1,447 @@
+/* BGP update groups
+   Copyright (C) 2026 Quagga developers
+
+This file is part of GNU Zebra.
+
+GNU Zebra is free software; you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the
+Free Software Foundation; either version 2, or (at your option) any
+later version.
+
+GNU Zebra is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with GNU Zebra; see the file COPYING.  If not, write to the Free
+Software Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+02111-1307, USA.  */
+
+#include <zebra.h>
+
+#include "prefix.h"
+#include "linklist.h"
+#include "memory.h"
+#include "hash.h"
+#include "jhash.h"
+#include "stream.h"
+#include "vty.h"
+#include "filter.h"
+#include "plist.h"
+#include "routemap.h"
+
+#include "bgpd/bgpd.h"
+#include "bgpd/bgp_table.h"
+#include "bgpd/bgp_route.h"
+#include "bgpd/bgp_attr.h"
+#include "bgpd/bgp_advertise.h"
+#include "bgpd/bgp_nexthop.h"
+#include "bgpd/bgp_filter.h"
+#include "bgpd/bgp_vty.h"
+#include "bgpd/bgp_updgrp.h"
+
+#define UPDGRP_FILTER_DLIST	(1 << 0)
+#define UPDGRP_FILTER_PLIST	(1 << 1)
+#define UPDGRP_FILTER_ASLIST	(1 << 2)
+#define UPDGRP_FILTER_RMAP	(1 << 3)
+#define UPDGRP_FILTER_USMAP	(1 << 4)
+
+/* Bumped whenever anything a key is made of may have changed.  Until
+   then a peer stays in the group it was found in, without its key
+   being made again. */
+static unsigned long updgrp_serial = 1;
+
+static unsigned int
+updgrp_hash_key (void *p)
+{
+  struct update_group *group = p;
+
+  return jhash (&group->key, sizeof (struct update_group_key), 0);
+}
+
+static int
+updgrp_hash_cmp (const void *p1, const void *p2)
+{
+  const struct update_group *g1 = p1;
+  const struct update_group *g2 = p2;
+
+  return memcmp (&g1->key, &g2->key, sizeof (struct update_group_key)) == 0;
+}
+
+static void *
+updgrp_hash_alloc (void *p)
+{
+  static unsigned long id;
+  struct update_group *ref = p;
+  struct update_group *group;
+
+  group = XCALLOC (MTYPE_BGP_UPDGRP, sizeof (struct update_group));
+  group->id = ++id;
+  group->key = ref->key;
+  group->bgp = ref->bgp;
+  return group;
+}
+
+static int
+updgrp_packet_slot (struct attr *attr, struct bgp_node *rn)
+{
+  return jhash_2words ((u_int32_t) (uintptr_t) attr,
+		       (u_int32_t) (uintptr_t) rn, 0) % UPDGRP_PACKET_SLOTS;
+}
+
+static void
+updgrp_packet_free (struct update_group_packet *pkt)
+{
+  int i;
+
+  for (i = 0; i < pkt->count; i++)
+    bgp_unlock_node (pkt->rn[i]);
+  bgp_attr_unintern (pkt->attr);
+  if (pkt->from)
+    peer_unlock (pkt->from);
+  stream_free (pkt->packet);
+  XFREE (MTYPE_BGP_UPDGRP_PACKET, pkt->rn);
+  XFREE (MTYPE_BGP_UPDGRP_PACKET, pkt);
+}
+
+static void
+updgrp_packets_flush (struct update_group *group)
+{
+  int i;
+
+  for (i = 0; i < UPDGRP_PACKET_SLOTS; i++)
+    if (group->packets[i])
+      {
+	updgrp_packet_free (group->packets[i]);
+	group->packets[i] = NULL;
+      }
+}
+
+static void
+updgrp_free (struct update_group *group)
+{
+  updgrp_packets_flush (group);
+  if (group->attr)
+    bgp_attr_unintern (group->attr);
+  XFREE (MTYPE_BGP_UPDGRP, group);
+}
+
+/* Route-maps whose rules look at the peer make it a group of its own. */
+static int
+updgrp_rmap_shareable (const char *name, struct route_map *map)
+{
+  return name == NULL || map == NULL || ! route_map_depends_on_peer (map);
+}
+
+static void
+updgrp_key_make (struct update_group_key *key, struct peer *peer,
+		 afi_t afi, safi_t safi)
+{
+  struct bgp_filter *filter = &peer->filter[afi][safi];
+
+  memset (key, 0, sizeof (struct update_group_key));
+  key->afi = afi;
+  key->safi = safi;
+
+  if (peer->orf_plist[afi][safi]
+      || ! updgrp_rmap_shareable (ROUTE_MAP_OUT_NAME (filter),
+				  ROUTE_MAP_OUT (filter))
+      || ! updgrp_rmap_shareable (UNSUPPRESS_MAP_NAME (filter),
+				  UNSUPPRESS_MAP (filter)))
+    {
+      key->peer = peer;
+      return;
+    }
+
+  key->sort = peer_sort (peer);
+  key->as4 = CHECK_FLAG (peer->cap, PEER_CAP_AS4_RCV) ? 1 : 0;
+  key->local_as = peer->local_as;
+  key->change_local_as = peer->change_local_as;
+#ifdef BGP_SEND_ASPATH_CHECK
+  key->as = peer->as;
+#endif /* BGP_SEND_ASPATH_CHECK */
+  key->af_flags = peer->af_flags[afi][safi];
+  key->af_sflags = peer->af_sflags[afi][safi] & PEER_STATUS_DEFAULT_ORIGINATE;
+
+  if (DISTRIBUTE_OUT_NAME (filter))
+    SET_FLAG (key->filters, UPDGRP_FILTER_DLIST);
+  if (PREFIX_LIST_OUT_NAME (filter))
+    SET_FLAG (key->filters, UPDGRP_FILTER_PLIST);
+  if (FILTER_LIST_OUT_NAME (filter))
+    SET_FLAG (key->filters, UPDGRP_FILTER_ASLIST);
+  if (ROUTE_MAP_OUT_NAME (filter))
+    SET_FLAG (key->filters, UPDGRP_FILTER_RMAP);
+  if (UNSUPPRESS_MAP_NAME (filter))
+    SET_FLAG (key->filters, UPDGRP_FILTER_USMAP);
+  key->dlist = DISTRIBUTE_OUT (filter);
+  key->plist = PREFIX_LIST_OUT (filter);
+  key->aslist = FILTER_LIST_OUT (filter);
+  key->rmap = ROUTE_MAP_OUT (filter);
+  key->usmap = UNSUPPRESS_MAP (filter);
+
+  key->nexthop = peer->nexthop.v4;
+#ifdef HAVE_IPV6
+  key->nexthop_global = peer->nexthop.v6_global;
+  key->nexthop_local = peer->nexthop.v6_local;
+  key->shared_network = peer->shared_network;
+#endif /* HAVE_IPV6 */
+  if (key->sort == BGP_PEER_EBGP)
+    key->connected = bgp_multiaccess_network_v4 (peer->host);
+}
+
+/* Outbound configuration, a filter or route-map, the connected
+   networks or the state of a session may have changed. */
+void
+bgp_updgrp_invalidate (void)
+{
+  if (++updgrp_serial == 0)
+    updgrp_serial = 1;
+}
+
+/* One member fewer may still want the packet. */
+static void
+updgrp_packet_release (struct update_group *group,
+		       struct update_group_packet *pkt)
+{
+  int slot;
+
+  if (--pkt->pending > 0)
+    return;
+
+  slot = updgrp_packet_slot (pkt->attr, pkt->rn[0]);
+  group->packets[slot] = NULL;
+  updgrp_packet_free (pkt);
+}
+
+/* Leave the update group of the address family, if in one.  Whether
+   the peer has already sent the packets kept is not known, so they are
+   all released, and a packet another member still wanted may be built
+   again by it. */
+void
+bgp_updgrp_leave (struct peer *peer, afi_t afi, safi_t safi)
+{
+  struct update_group *group = peer->updgrp[afi][safi];
+  int i;
+
+  if (! group)
+    return;
+
+  peer->updgrp[afi][safi] = NULL;
+  peer->updgrp_serial[afi][safi] = 0;
+  if (--group->members == 0)
+    {
+      hash_release (group->bgp->update_groups, group);
+      updgrp_free (group);
+      return;
+    }
+
+  /* Nobody is left to share packets with. */
+  if (group->members == 1)
+    {
+      updgrp_packets_flush (group);
+      return;
+    }
+
+  for (i = 0; i < UPDGRP_PACKET_SLOTS; i++)
+    if (group->packets[i])
+      updgrp_packet_release (group, group->packets[i]);
+}
+
+/* Update group of the peer, moving it to another one when its outbound
+   configuration has changed since the last call. */
+struct update_group *
+bgp_updgrp_get (struct peer *peer, afi_t afi, safi_t safi)
+{
+  struct update_group ref;
+  struct update_group *group = peer->updgrp[afi][safi];
+  int i;
+
+  if (group && peer->updgrp_serial[afi][safi] == updgrp_serial)
+    return group;
+
+  updgrp_key_make (&ref.key, peer, afi, safi);
+  peer->updgrp_serial[afi][safi] = updgrp_serial;
+  if (group && ! memcmp (&group->key, &ref.key, sizeof (ref.key)))
+    return group;
+
+  bgp_updgrp_leave (peer, afi, safi);
+  peer->updgrp_serial[afi][safi] = updgrp_serial;
+
+  ref.bgp = peer->bgp;
+  group = hash_get (peer->bgp->update_groups, &ref, updgrp_hash_alloc);
+  group->members++;
+  peer->updgrp[afi][safi] = group;
+
+  /* A new member may want any of the packets kept so far. */
+  for (i = 0; i < UPDGRP_PACKET_SLOTS; i++)
+    if (group->packets[i])
+      group->packets[i]->pending++;
+
+  return group;
+}
+
+/* Remember the outbound policy result of the route being processed
+   for the other members of the group. */
+void
+bgp_updgrp_set_policy (struct update_group *group, unsigned long serial,
+		       struct bgp_info *ri, int announce, struct attr *attr)
+{
+  if (group->attr)
+    bgp_attr_unintern (group->attr);
+
+  group->serial = serial;
+  group->ri = ri;
+  group->announce = announce;
+  group->attr = announce ? bgp_attr_intern (attr) : NULL;
+  group->policy_runs++;
+}
+
+/* Order in which bgp_update_packet() packs the advertisements sharing
+   the attribute of the first one. */
+static struct bgp_advertise *
+updgrp_adv_next (struct bgp_advertise *first, struct bgp_advertise *adv)
+{
+  adv = (adv == first) ? first->baa->adv : adv->next;
+  if (adv == first)
+    adv = adv->next;
+  return adv;
+}
+
+/* A packet some other member built for exactly the prefixes the peer
+   would put in its next UPDATE, starting with the advertisement. */
+struct update_group_packet *
+bgp_updgrp_packet_lookup (struct update_group *group,
+			  struct bgp_advertise *first)
+{
+  struct update_group_packet *pkt;
+  struct bgp_advertise *adv;
+  struct peer *from;
+  int i;
+
+  if (group->members < 2 || first->baa == NULL)
+    return NULL;
+
+  pkt = group->packets[updgrp_packet_slot (first->baa->attr, first->rn)];
+  if (! pkt || pkt->attr != first->baa->attr || pkt->rn[0] != first->rn)
+    return NULL;
+
+  from = first->binfo ? first->binfo->peer : NULL;
+  if (pkt->from != from)
+    return NULL;
+
+  for (i = 0, adv = first; i < pkt->count; i++)
+    {
+      if (! adv || adv->rn != pkt->rn[i])
+	return NULL;
+      adv = updgrp_adv_next (first, adv);
+    }
+  if (pkt->last && adv)
+    return NULL;
+
+  return pkt;
+}
+
+/* The packet has been queued to one more member. */
+void
+bgp_updgrp_packet_sent (struct update_group *group,
+			struct update_group_packet *pkt)
+{
+  group->packets_shared++;
+  updgrp_packet_release (group, pkt);
+}
+
+/* Keep a packet just built so the other members can send it as is. */
+void
+bgp_updgrp_packet_add (struct update_group *group, struct stream *packet,
+		       struct bgp_node **rn, int count, int last,
+		       struct attr *attr, struct peer *from)
+{
+  struct update_group_packet *pkt;
+  int slot;
+  int i;
+
+  group->packets_built++;
+  if (group->members < 2 || count == 0)
+    return;
+
+  slot = updgrp_packet_slot (attr, rn[0]);
+  if (group->packets[slot])
+    updgrp_packet_free (group->packets[slot]);
+
+  pkt = XCALLOC (MTYPE_BGP_UPDGRP_PACKET,
+		 sizeof (struct update_group_packet));
+  pkt->rn = XMALLOC (MTYPE_BGP_UPDGRP_PACKET,
+		     count * sizeof (struct bgp_node *));
+  for (i = 0; i < count; i++)
+    pkt->rn[i] = bgp_lock_node (rn[i]);
+  pkt->count = count;
+  pkt->last = last;
+  pkt->attr = bgp_attr_intern (attr);
+  pkt->from = from ? peer_lock (from) : NULL;
+  pkt->packet = stream_share (packet);
+  pkt->pending = group->members - 1;
+
+  group->packets[slot] = pkt;
+}
+
+void
+bgp_updgrp_init (struct bgp *bgp)
+{
+  bgp->update_groups = hash_create (updgrp_hash_key, updgrp_hash_cmp);
+}
+
+static void
+updgrp_hash_free (void *group)
+{
+  updgrp_free (group);
+}
+
+void
+bgp_updgrp_finish (struct bgp *bgp)
+{
+  hash_clean (bgp->update_groups, updgrp_hash_free);
+  hash_free (bgp->update_groups);
+  bgp->update_groups = NULL;
+}
+
+static void
+updgrp_show_group (struct hash_backet *backet, void *arg)
+{
+  struct update_group *group = backet->data;
+  struct vty *vty = arg;
+  struct peer *peer;
+  struct listnode *node, *nnode;
+  int i, packets;
+
+  for (i = packets = 0; i < UPDGRP_PACKET_SLOTS; i++)
+    if (group->packets[i])
+      packets++;
+
+  vty_out (vty, "Update group %lu, %s, %lu member%s%s", group->id,
+	   afi_safi_print (group->key.afi, group->key.safi),
+	   group->members, group->members == 1 ? "" : "s", VTY_NEWLINE);
+  vty_out (vty, "  Policy evaluated %lu times, shared %lu times%s",
+	   group->policy_runs, group->policy_shared, VTY_NEWLINE);
+  vty_out (vty, "  Packets formatted %lu, shared %lu, %d kept%s",
+	   group->packets_built, group->packets_shared, packets,
+	   VTY_NEWLINE);
+
+  for (ALL_LIST_ELEMENTS (group->bgp->peer, node, nnode, peer))
+    if (peer->updgrp[group->key.afi][group->key.safi] == group)
+      vty_out (vty, "    %s%s", peer->host, VTY_NEWLINE);
+}
+
+void
+bgp_updgrp_show (struct vty *vty)
+{
+  struct bgp *bgp;
+  struct listnode *node;
+
+  for (ALL_LIST_ELEMENTS_RO (bm->bgp, node, bgp))
+    {
+      if (bgp->name)
+	vty_out (vty, "BGP view %s%s", bgp->name, VTY_NEWLINE);
+      hash_iterate (bgp->update_groups, updgrp_show_group, vty);
+    }
+}
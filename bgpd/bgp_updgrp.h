@@ -0,0 +1,128 @@
+/* BGP update groups
+   Copyright (C) 2026 Quagga developers
+
+This file is part of GNU Zebra.
+
+GNU Zebra is free software; you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the
+Free Software Foundation; either version 2, or (at your option) any
+later version.
+
+GNU Zebra is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with GNU Zebra; see the file COPYING.  If not, write to the Free
+Software Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+02111-1307, USA.  */
+
+#ifndef _QUAGGA_BGP_UPDGRP_H
+#define _QUAGGA_BGP_UPDGRP_H
+
+/* Peers whose outbound configuration is the same end up in the same
+   update group.  Outbound policy is then evaluated once per group for
+   each route, and an UPDATE formatted for one member is handed to the
+   others instead of being formatted again.  The key holds everything
+   bgp_announce_check() and bgp_packet_attribute() look at, apart from
+   the few per peer checks which are still done for every member.  */
+struct update_group_key
+{
+  afi_t afi;
+  safi_t safi;
+
+  /* Set when the peer can't share its updates with anybody. */
+  struct peer *peer;
+
+  int sort;
+  int as4;
+  as_t local_as;
+  as_t change_local_as;
+#ifdef BGP_SEND_ASPATH_CHECK
+  as_t as;
+#endif /* BGP_SEND_ASPATH_CHECK */
+  u_int32_t af_flags;
+  u_int16_t af_sflags;
+
+  /* Outbound filters.  A name without a list denies everything, so the
+     names which are set are part of the key too. */
+  u_char filters;
+  struct access_list *dlist;
+  struct prefix_list *plist;
+  struct as_list *aslist;
+  struct route_map *rmap;
+  struct route_map *usmap;
+
+  /* Nexthop self and the connected network the peer is on. */
+  struct in_addr nexthop;
+#ifdef HAVE_IPV6
+  struct in6_addr nexthop_global;
+  struct in6_addr nexthop_local;
+  int shared_network;
+#endif /* HAVE_IPV6 */
+  void *connected;
+};
+
+/* UPDATE formatted for a member of the group, kept until the other
+   members have sent it too. */
+#define UPDGRP_PACKET_SLOTS	64
+
+struct update_group_packet
+{
+  struct attr *attr;
+  struct peer *from;
+  struct stream *packet;
+
+  /* Prefixes in the packet, in the order they were packed. */
+  struct bgp_node **rn;
+  int count;
+
+  /* Set when the packet took the last prefix with this attribute. */
+  int last;
+
+  /* Members which still may want the packet. */
+  int pending;
+};
+
+struct update_group
+{
+  struct update_group_key key;
+  unsigned long id;
+  struct bgp *bgp;
+
+  unsigned long members;
+
+  /* Outbound policy result for the route being processed.  Valid while
+     the serial matches the one of the current bgp_process_main() run. */
+  unsigned long serial;
+  struct bgp_info *ri;
+  int announce;
+  struct attr *attr;
+
+  struct update_group_packet *packets[UPDGRP_PACKET_SLOTS];
+
+  /* Statistics. */
+  unsigned long policy_runs;
+  unsigned long policy_shared;
+  unsigned long packets_built;
+  unsigned long packets_shared;
+};
+
+extern void bgp_updgrp_init (struct bgp *);
+extern void bgp_updgrp_invalidate (void);
+extern void bgp_updgrp_finish (struct bgp *);
+extern struct update_group *bgp_updgrp_get (struct peer *, afi_t, safi_t);
+extern void bgp_updgrp_leave (struct peer *, afi_t, safi_t);
+extern void bgp_updgrp_set_policy (struct update_group *, unsigned long,
+				   struct bgp_info *, int, struct attr *);
+extern struct update_group_packet *
+  bgp_updgrp_packet_lookup (struct update_group *, struct bgp_advertise *);
+extern void bgp_updgrp_packet_sent (struct update_group *,
+				    struct update_group_packet *);
+extern void bgp_updgrp_packet_add (struct update_group *, struct stream *,
+				   struct bgp_node **, int, int,
+				   struct attr *, struct peer *);
+extern void bgp_updgrp_show (struct vty *);
+
+#endif /* _QUAGGA_BGP_UPDGRP_H */
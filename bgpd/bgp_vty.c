@@ -48,6 +48,7 @@ Software Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
 #include "bgpd/bgp_zebra.h"
 #include "bgpd/bgp_table.h"
 #include "bgpd/bgp_vty.h"
+#include "bgpd/bgp_updgrp.h"
 
 extern struct in_addr router_id_zebra;
 
@@ -8067,6 +8068,18 @@ DEFUN (show_ip_bgp_attr_info,
   attr_show_all (vty);
   return CMD_SUCCESS;
 }
+
+DEFUN (show_ip_bgp_update_groups,
+       show_ip_bgp_update_groups_cmd,
+       "show ip bgp update-groups",
+       SHOW_STR
+       IP_STR
+       BGP_STR
+       "Peers sharing outbound policy and UPDATE packets\n")
+{
+  bgp_updgrp_show (vty);
+  return CMD_SUCCESS;
+}
 
 static int
 bgp_write_rsclient_summary (struct vty *vty, struct peer *rsclient,
@@ -9978,6 +9991,10 @@ bgp_vty_init (void)
   install_element (VIEW_NODE, &show_ip_bgp_attr_info_cmd);
   install_element (ENABLE_NODE, &show_ip_bgp_attr_info_cmd);
 
+  /* "show ip bgp update-groups" commands. */
+  install_element (VIEW_NODE, &show_ip_bgp_update_groups_cmd);
+  install_element (ENABLE_NODE, &show_ip_bgp_update_groups_cmd);
+
   /* "redistribute" commands.  */
   install_element (BGP_NODE, &bgp_redistribute_ipv4_cmd);
   install_element (BGP_NODE, &no_bgp_redistribute_ipv4_cmd);
@@ -27,6 +27,7 @@ Software Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
 #include "command.h"
 #include "sockopt.h"
 #include "sockunion.h"
+#include "hash.h"
 #include "network.h"
 #include "memory.h"
 #include "filter.h"
@@ -58,6 +59,7 @@ Software Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
 #include "bgpd/bgp_advertise.h"
 #include "bgpd/bgp_network.h"
 #include "bgpd/bgp_vty.h"
+#include "bgpd/bgp_updgrp.h"
 #ifdef HAVE_SNMP
 #include "bgpd/bgp_snmp.h"
 #endif /* HAVE_SNMP */
@@ -283,6 +285,8 @@ bgp_confederation_id_set (struct bgp *bgp, as_t as)
   struct listnode *node, *nnode;
   int already_confed;
 
+  bgp_updgrp_invalidate ();
+
   if (as == 0)
     return BGP_ERR_INVALID_AS;
 
@@ -343,6 +347,8 @@ bgp_confederation_id_unset (struct bgp *bgp)
   struct peer *peer;
   struct listnode *node, *nnode;
 
+  bgp_updgrp_invalidate ();
+
   bgp->confed_id = 0;
   bgp_config_unset (bgp, BGP_CONFIG_CONFEDERATION);
       
@@ -389,6 +395,8 @@ bgp_confederation_peers_add (struct bgp *bgp, as_t as)
   struct peer *peer;
   struct listnode *node, *nnode;
 
+  bgp_updgrp_invalidate ();
+
   if (! bgp)
     return BGP_ERR_INVALID_BGP;
 
@@ -439,6 +447,8 @@ bgp_confederation_peers_remove (struct bgp *bgp, as_t as)
   struct peer *peer;
   struct listnode *node, *nnode;
 
+  bgp_updgrp_invalidate ();
+
   if (! bgp)
     return -1;
 
@@ -823,6 +833,7 @@ peer_new (struct bgp *bgp)
 
   /* Create buffers.  */
   peer->ibuf = stream_new (BGP_MAX_PACKET_SIZE);
+  peer->ibuf_work = stream_new (BGP_READ_BUFSIZE);
   peer->obuf = stream_fifo_new ();
   peer->work = stream_new (BGP_MAX_PACKET_SIZE);
 
@@ -835,6 +846,35 @@ peer_new (struct bgp *bgp)
   return peer;
 }
 
+/* Peers of an instance are hashed by address for peer_lookup (), which
+   runs for every incoming connection.  Accept peers share the address of
+   their configured peer and are not in the hash. */
+static unsigned int
+peer_hash_key_make (void *p)
+{
+  struct peer *peer = p;
+
+  return sockunion_hash (&peer->su);
+}
+
+static int
+peer_hash_cmp (const void *p1, const void *p2)
+{
+  const struct peer *peer1 = p1;
+  const struct peer *peer2 = p2;
+
+  return sockunion_same (&peer1->su, &peer2->su);
+}
+
+static struct peer *
+peer_lookup_hash (struct bgp *bgp, union sockunion *su)
+{
+  struct peer tmp;
+
+  tmp.su = *su;
+  return hash_lookup (bgp->peerhash, &tmp);
+}
+
 /* Create new BGP peer.  */
 static struct peer *
 peer_create (union sockunion *su, struct bgp *bgp, as_t local_as,
@@ -858,6 +898,7 @@ peer_create (union sockunion *su, struct bgp *bgp, as_t local_as,
     
   peer = peer_lock (peer); /* bgp peer list reference */
   listnode_add_sort (bgp->peer, peer);
+  hash_get (bgp->peerhash, peer, hash_alloc_intern);
 
   active = peer_active (peer);
 
@@ -901,6 +942,8 @@ peer_as_change (struct peer *peer, as_t as)
 {
   int type;
 
+  bgp_updgrp_invalidate ();
+
   /* Stop peer. */
   if (! CHECK_FLAG (peer->sflags, PEER_STATUS_GROUP))
     {
@@ -1232,6 +1275,8 @@ peer_delete (struct peer *peer)
   if (! CHECK_FLAG (peer->sflags, PEER_STATUS_GROUP)
       && (pn = listnode_lookup (bgp->peer, peer)))
     {
+      if (hash_lookup (bgp->peerhash, peer) == peer)
+	hash_release (bgp->peerhash, peer);
       peer_unlock (peer); /* bgp peer list reference */
       list_delete_node (bgp->peer, pn);
     }
@@ -1260,12 +1305,14 @@ peer_delete (struct peer *peer)
   /* Buffers.  */
   if (peer->ibuf)
     stream_free (peer->ibuf);
+  if (peer->ibuf_work)
+    stream_free (peer->ibuf_work);
   if (peer->obuf)
     stream_fifo_free (peer->obuf);
   if (peer->work)
     stream_free (peer->work);
   peer->obuf = NULL;
-  peer->work = peer->ibuf = NULL;
+  peer->work = peer->ibuf = peer->ibuf_work = NULL;
 
   /* Local and remote addresses. */
   if (peer->su_local)
@@ -1742,6 +1789,8 @@ peer_group_bind (struct bgp *bgp, union sockunion *su,
   struct peer *peer;
   int first_member = 0;
 
+  bgp_updgrp_invalidate ();
+
   /* Check peer group's address family.  */
   if (! group->conf->afc[afi][safi])
     return BGP_ERR_PEER_GROUP_AF_UNCONFIGURED;
@@ -1884,6 +1933,8 @@ peer_group_unbind (struct bgp *bgp, struct peer *peer,
   if (! peer->af_group[afi][safi])
       return 0;
 
+  bgp_updgrp_invalidate ();
+
   if (group != peer->group)
     return BGP_ERR_PEER_GROUP_MISMATCH;
 
@@ -1937,6 +1988,7 @@ bgp_create (as_t *as, const char *name)
 
   bgp->peer = list_new ();
   bgp->peer->cmp = (int (*)(void *, void *)) peer_cmp;
+  bgp->peerhash = hash_create (peer_hash_key_make, peer_hash_cmp);
 
   bgp->group = list_new ();
   bgp->group->cmp = (int (*)(void *, void *)) peer_group_cmp;
@@ -1951,6 +2003,7 @@ bgp_create (as_t *as, const char *name)
 	bgp->aggregate[afi][safi] = bgp_table_init (afi, safi);
 	bgp->rib[afi][safi] = bgp_table_init (afi, safi);
       }
+  bgp_updgrp_init (bgp);
 
   bgp->default_local_pref = BGP_DEFAULT_LOCAL_PREF;
   bgp->default_holdtime = BGP_DEFAULT_HOLDTIME;
@@ -2078,6 +2131,8 @@ bgp_delete (struct bgp *bgp)
   afi_t afi;
   int i;
 
+  bgp_dump_routes_cancel (bgp);
+
   /* Delete static route. */
   bgp_static_delete (bgp);
 
@@ -2136,7 +2191,10 @@ bgp_free (struct bgp *bgp)
 
   list_delete (bgp->group);
   list_delete (bgp->peer);
+  hash_clean (bgp->peerhash, NULL);
+  hash_free (bgp->peerhash);
   list_delete (bgp->rsclient);
+  bgp_updgrp_finish (bgp);
 
   if (bgp->name)
     free (bgp->name);
@@ -2161,22 +2219,13 @@ peer_lookup (struct bgp *bgp, union sockunion *su)
   struct listnode *node, *nnode;
 
   if (bgp != NULL)
-    {
-      for (ALL_LIST_ELEMENTS (bgp->peer, node, nnode, peer))
-        if (sockunion_same (&peer->su, su)
-            && ! CHECK_FLAG (peer->sflags, PEER_STATUS_ACCEPT_PEER))
-          return peer;
-    }
-  else if (bm->bgp != NULL)
-    {
-      struct listnode *bgpnode, *nbgpnode;
-  
-      for (ALL_LIST_ELEMENTS (bm->bgp, bgpnode, nbgpnode, bgp))
-        for (ALL_LIST_ELEMENTS (bgp->peer, node, nnode, peer))
-          if (sockunion_same (&peer->su, su)
-              && ! CHECK_FLAG (peer->sflags, PEER_STATUS_ACCEPT_PEER))
-            return peer;
-    }
+    return peer_lookup_hash (bgp, su);
+
+  if (bm->bgp != NULL)
+    for (ALL_LIST_ELEMENTS (bm->bgp, node, nnode, bgp))
+      if ((peer = peer_lookup_hash (bgp, su)) != NULL)
+        return peer;
+
   return NULL;
 }
 
@@ -2185,7 +2234,6 @@ peer_lookup_with_open (union sockunion *su, as_t remote_as,
 		       struct in_addr *remote_id, int *as)
 {
   struct peer *peer;
-  struct listnode *node;
   struct listnode *bgpnode;
   struct bgp *bgp;
 
@@ -2194,35 +2242,18 @@ peer_lookup_with_open (union sockunion *su, as_t remote_as,
 
   for (ALL_LIST_ELEMENTS_RO (bm->bgp, bgpnode, bgp))
     {
-      for (ALL_LIST_ELEMENTS_RO (bgp->peer, node, peer))
-        {
-          if (sockunion_same (&peer->su, su)
-              && ! CHECK_FLAG (peer->sflags, PEER_STATUS_ACCEPT_PEER))
-            {
-              if (peer->as == remote_as
-                  && peer->remote_id.s_addr == remote_id->s_addr)
-                return peer;
-              if (peer->as == remote_as)
-                *as = 1;
-            }
-        }
+      peer = peer_lookup_hash (bgp, su);
+      if (! peer || peer->as != remote_as)
+        continue;
 
-      for (ALL_LIST_ELEMENTS_RO (bgp->peer, node, peer))
-        {
-          if (sockunion_same (&peer->su, su)
-              &&  ! CHECK_FLAG (peer->sflags, PEER_STATUS_ACCEPT_PEER))
-            {
-              if (peer->as == remote_as
-                  && peer->remote_id.s_addr == 0)
-                return peer;
-              if (peer->as == remote_as)
-                *as = 1;
-            }
-        }
+      if (peer->remote_id.s_addr == remote_id->s_addr
+          || peer->remote_id.s_addr == 0)
+        return peer;
+      *as = 1;
     }
   return NULL;
 }
-
+
 /* If peer is configured at least one address family return 1. */
 int
 peer_active (struct peer *peer)
@@ -2540,6 +2571,8 @@ peer_af_flag_modify (struct peer *peer, afi_t afi, safi_t safi, u_int32_t flag,
   struct peer_group *group;
   struct peer_flag_action action;
 
+  bgp_updgrp_invalidate ();
+
   memset (&action, 0, sizeof (struct peer_flag_action));
   size = sizeof peer_af_flag_action_list / sizeof (struct peer_flag_action);
   
@@ -3014,6 +3047,8 @@ peer_default_originate_set (struct peer *peer, afi_t afi, safi_t safi,
   struct peer_group *group;
   struct listnode *node, *nnode;
 
+  bgp_updgrp_invalidate ();
+
   /* Adress family must be activated.  */
   if (! peer->afc[afi][safi])
     return BGP_ERR_PEER_INACTIVE;
@@ -3070,6 +3105,8 @@ peer_default_originate_unset (struct peer *peer, afi_t afi, safi_t safi)
   struct peer_group *group;
   struct listnode *node, *nnode;
 
+  bgp_updgrp_invalidate ();
+
   /* Adress family must be activated.  */
   if (! peer->afc[afi][safi])
     return BGP_ERR_PEER_INACTIVE;
@@ -3401,6 +3438,8 @@ peer_local_as_set (struct peer *peer, as_t as, int no_prepend)
   struct peer_group *group;
   struct listnode *node, *nnode;
 
+  bgp_updgrp_invalidate ();
+
   if (peer_sort (peer) != BGP_PEER_EBGP
       && peer_sort (peer) != BGP_PEER_INTERNAL)
     return BGP_ERR_LOCAL_AS_ALLOWED_ONLY_FOR_EBGP;
@@ -3464,6 +3503,8 @@ peer_local_as_unset (struct peer *peer)
   struct peer_group *group;
   struct listnode *node, *nnode;
 
+  bgp_updgrp_invalidate ();
+
   if (peer_group_active (peer))
     return BGP_ERR_INVALID_FOR_PEER_GROUP_MEMBER;
 
@@ -3619,6 +3660,8 @@ peer_distribute_set (struct peer *peer, afi_t afi, safi_t safi, int direct,
   struct peer_group *group;
   struct listnode *node, *nnode;
 
+  bgp_updgrp_invalidate ();
+
   if (! peer->afc[afi][safi])
     return BGP_ERR_PEER_INACTIVE;
 
@@ -3666,6 +3709,8 @@ peer_distribute_unset (struct peer *peer, afi_t afi, safi_t safi, int direct)
   struct peer_group *group;
   struct listnode *node, *nnode;
 
+  bgp_updgrp_invalidate ();
+
   if (! peer->afc[afi][safi])
     return BGP_ERR_PEER_INACTIVE;
 
@@ -3731,6 +3776,11 @@ peer_distribute_update (struct access_list *access)
   struct peer_group *group;
   struct bgp_filter *filter;
 
+  bgp_updgrp_invalidate ();
+
+  /* Route-map results may depend on the list. */
+  route_map_cache_flush ();
+
   for (ALL_LIST_ELEMENTS (bm->bgp, mnode, mnnode, bgp))
     {
       for (ALL_LIST_ELEMENTS (bgp->peer, node, nnode, peer))
@@ -3779,6 +3829,8 @@ peer_prefix_list_set (struct peer *peer, afi_t afi, safi_t safi, int direct,
   struct peer_group *group;
   struct listnode *node, *nnode;
 
+  bgp_updgrp_invalidate ();
+
   if (! peer->afc[afi][safi])
     return BGP_ERR_PEER_INACTIVE;
 
@@ -3825,6 +3877,8 @@ peer_prefix_list_unset (struct peer *peer, afi_t afi, safi_t safi, int direct)
   struct peer_group *group;
   struct listnode *node, *nnode;
 
+  bgp_updgrp_invalidate ();
+
   if (! peer->afc[afi][safi])
     return BGP_ERR_PEER_INACTIVE;
 
@@ -3890,6 +3944,11 @@ peer_prefix_list_update (struct prefix_list *plist)
   safi_t safi;
   int direct;
 
+  bgp_updgrp_invalidate ();
+
+  /* Route-map results may depend on the list. */
+  route_map_cache_flush ();
+
   for (ALL_LIST_ELEMENTS (bm->bgp, mnode, mnnode, bgp))
     {
       for (ALL_LIST_ELEMENTS (bgp->peer, node, nnode, peer))
@@ -3937,6 +3996,8 @@ peer_aslist_set (struct peer *peer, afi_t afi, safi_t safi, int direct,
   struct peer_group *group;
   struct listnode *node, *nnode;
 
+  bgp_updgrp_invalidate ();
+
   if (! peer->afc[afi][safi])
     return BGP_ERR_PEER_INACTIVE;
 
@@ -3980,6 +4041,8 @@ peer_aslist_unset (struct peer *peer,afi_t afi, safi_t safi, int direct)
   struct peer_group *group;
   struct listnode *node, *nnode;
 
+  bgp_updgrp_invalidate ();
+
   if (! peer->afc[afi][safi])
     return BGP_ERR_PEER_INACTIVE;
 
@@ -4044,6 +4107,11 @@ peer_aslist_update (void)
   struct peer_group *group;
   struct bgp_filter *filter;
 
+  bgp_updgrp_invalidate ();
+
+  /* Route-map results may depend on the list. */
+  route_map_cache_flush ();
+
   for (ALL_LIST_ELEMENTS (bm->bgp, mnode, mnnode, bgp))
     {
       for (ALL_LIST_ELEMENTS (bgp->peer, node, nnode, peer))
@@ -4092,6 +4160,8 @@ peer_route_map_set (struct peer *peer, afi_t afi, safi_t safi, int direct,
   struct peer_group *group;
   struct listnode *node, *nnode;
 
+  bgp_updgrp_invalidate ();
+
   if (! peer->afc[afi][safi])
     return BGP_ERR_PEER_INACTIVE;
 
@@ -4139,6 +4209,8 @@ peer_route_map_unset (struct peer *peer, afi_t afi, safi_t safi, int direct)
   struct peer_group *group;
   struct listnode *node, *nnode;
 
+  bgp_updgrp_invalidate ();
+
   if (! peer->afc[afi][safi])
     return BGP_ERR_PEER_INACTIVE;
 
@@ -4200,6 +4272,8 @@ peer_unsuppress_map_set (struct peer *peer, afi_t afi, safi_t safi,
   struct peer_group *group;
   struct listnode *node, *nnode;
 
+  bgp_updgrp_invalidate ();
+
   if (! peer->afc[afi][safi])
     return BGP_ERR_PEER_INACTIVE;
 
@@ -4241,6 +4315,8 @@ peer_unsuppress_map_unset (struct peer *peer, afi_t afi, safi_t safi)
   struct peer_group *group;
   struct listnode *node, *nnode;
 
+  bgp_updgrp_invalidate ();
+
   if (! peer->afc[afi][safi])
     return BGP_ERR_PEER_INACTIVE;
   
@@ -80,6 +80,9 @@ struct bgp
   /* BGP peer. */
   struct list *peer;
 
+  /* Configured peers by address, see peer_lookup (). */
+  struct hash *peerhash;
+
   /* BGP peer group.  */
   struct list *group;
 
@@ -134,6 +137,9 @@ struct bgp
   /* BGP routing information base.  */
   struct bgp_table *rib[AFI_MAX][SAFI_MAX];
 
+  /* Update groups of the peers.  */
+  struct hash *update_groups;
+
   /* BGP redistribute configuration. */
   u_char redist[AFI_MAX][ZEBRA_ROUTE_MAX];
 
@@ -291,6 +297,7 @@ struct peer
 
   /* Packet receive and send buffer. */
   struct stream *ibuf;
+  struct stream *ibuf_work;
   struct stream_fifo *obuf;
   struct stream *work;
 
@@ -300,6 +307,7 @@ struct peer
 
   /* Peer index, used for dumping TABLE_DUMP_V2 format */
   uint16_t table_dump_index;
+  unsigned int table_dump_gen;
 
   /* Peer information */
   int fd;			/* File descriptor */
@@ -484,6 +492,11 @@ struct peer
   /* Announcement attribute hash.  */
   struct hash *hash[AFI_MAX][SAFI_MAX];
 
+  /* Update group, see bgp_updgrp.c, and the serial it was last found
+     under.  */
+  struct update_group *updgrp[AFI_MAX][SAFI_MAX];
+  unsigned long updgrp_serial[AFI_MAX][SAFI_MAX];
+
   /* Notify data. */
   struct bgp_notify notify;
 
@@ -33,6 +33,8 @@
 #include "hash.h"
 #include "if.h"
 #include "table.h"
+#include "pqueue.h"
+#include "jhash.h"
 
 #include "isis_constants.h"
 #include "isis_common.h"
@@ -188,6 +190,85 @@ vid2string (struct isis_vertex *vertex, u_char * buff)
 }
 #endif /* EXTREME_DEBUG */
 
+/*
+ * TENT is a heap ordered on d(N).  Equal distances come out most
+ * recently added first, as they did from the sorted list it replaced.
+ */
+static int
+isis_vertex_queue_cmp (void *node1, void *node2)
+{
+  struct isis_vertex *v1 = node1;
+  struct isis_vertex *v2 = node2;
+
+  if (v1->d_N != v2->d_N)
+    return v1->d_N < v2->d_N ? -1 : 1;
+  if (v1->seq != v2->seq)
+    return v1->seq > v2->seq ? -1 : 1;
+  return 0;
+}
+
+static void
+isis_vertex_queue_update (void *node, int position)
+{
+  struct isis_vertex *vertex = node;
+
+  vertex->tent_index = position;
+}
+
+/*
+ * TENT and PATHS are indexed by vertex type and id, which is all
+ * isis_find_vertex() looks at.
+ */
+static unsigned int
+isis_vertex_hash_key (void *data)
+{
+  struct isis_vertex *vertex = data;
+  struct prefix *p;
+
+  switch (vertex->type)
+    {
+    case VTYPE_ES:
+    case VTYPE_NONPSEUDO_IS:
+    case VTYPE_NONPSEUDO_TE_IS:
+      return jhash (vertex->N.id, ISIS_SYS_ID_LEN, vertex->type);
+    case VTYPE_PSEUDO_IS:
+    case VTYPE_PSEUDO_TE_IS:
+      return jhash (vertex->N.id, ISIS_SYS_ID_LEN + 1, vertex->type);
+    default:
+      p = &vertex->N.prefix;
+      return jhash (&p->u.prefix, PSIZE (p->prefixlen),
+		    (p->family << 16) | (p->prefixlen << 8) | vertex->type);
+    }
+}
+
+static int
+isis_vertex_hash_cmp (const void *data1, const void *data2)
+{
+  const struct isis_vertex *v1 = data1;
+  const struct isis_vertex *v2 = data2;
+  const struct prefix *p1, *p2;
+
+  if (v1->type != v2->type)
+    return 0;
+
+  switch (v1->type)
+    {
+    case VTYPE_ES:
+    case VTYPE_NONPSEUDO_IS:
+    case VTYPE_NONPSEUDO_TE_IS:
+      return memcmp (v1->N.id, v2->N.id, ISIS_SYS_ID_LEN) == 0;
+    case VTYPE_PSEUDO_IS:
+    case VTYPE_PSEUDO_TE_IS:
+      return memcmp (v1->N.id, v2->N.id, ISIS_SYS_ID_LEN + 1) == 0;
+    default:
+      p1 = &v1->N.prefix;
+      p2 = &v2->N.prefix;
+      return (p1->family == p2->family && p1->prefixlen == p2->prefixlen
+	      && memcmp (&p1->u.prefix, &p2->u.prefix,
+			 PSIZE (p1->prefixlen)) == 0);
+    }
+}
+
 static struct isis_spftree *
 isis_spftree_new ()
 {
@@ -200,8 +281,12 @@ isis_spftree_new ()
       return NULL;
     }
 
-  tree->tents = list_new ();
+  tree->tents = pqueue_create ();
+  tree->tents->cmp = isis_vertex_queue_cmp;
+  tree->tents->update = isis_vertex_queue_update;
+  tree->tents_hash = hash_create (isis_vertex_hash_key, isis_vertex_hash_cmp);
   tree->paths = list_new ();
+  tree->paths_hash = hash_create (isis_vertex_hash_key, isis_vertex_hash_cmp);
   return tree;
 }
 
@@ -219,11 +304,11 @@ isis_vertex_del (struct isis_vertex *vertex)
 static void
 isis_spftree_del (struct isis_spftree *spftree)
 {
-  spftree->tents->del = (void (*)(void *)) isis_vertex_del;
-  list_delete (spftree->tents);
-
-  spftree->paths->del = (void (*)(void *)) isis_vertex_del;
+  init_spt (spftree);
+  pqueue_delete (spftree->tents);
+  hash_free (spftree->tents_hash);
   list_delete (spftree->paths);
+  hash_free (spftree->paths_hash);
 
   XFREE (MTYPE_ISIS_SPFTREE, spftree);
 
@@ -258,18 +343,10 @@ spftree_area_init (struct isis_area *area)
   return;
 }
 
-static struct isis_vertex *
-isis_vertex_new (void *id, enum vertextype vtype)
+static void
+isis_vertex_id_set (struct isis_vertex *vertex, void *id,
+		    enum vertextype vtype)
 {
-  struct isis_vertex *vertex;
-
-  vertex = XCALLOC (MTYPE_ISIS_VERTEX, sizeof (struct isis_vertex));
-  if (vertex == NULL)
-    {
-      zlog_err ("isis_vertex_new Out of memory!");
-      return NULL;
-    }
-
   vertex->type = vtype;
   switch (vtype)
     {
@@ -295,7 +372,21 @@ isis_vertex_new (void *id, enum vertextype vtype)
     default:
       zlog_err ("WTF!");
     }
+}
+
+static struct isis_vertex *
+isis_vertex_new (void *id, enum vertextype vtype)
+{
+  struct isis_vertex *vertex;
+
+  vertex = XCALLOC (MTYPE_ISIS_VERTEX, sizeof (struct isis_vertex));
+  if (vertex == NULL)
+    {
+      zlog_err ("isis_vertex_new Out of memory!");
+      return NULL;
+    }
 
+  isis_vertex_id_set (vertex, id, vtype);
   vertex->Adj_N = list_new ();
 
   return vertex;
@@ -331,6 +422,7 @@ isis_spf_add_self (struct isis_spftree *spftree, struct isis_area *area,
   vertex->lsp = lsp;
 
   listnode_add (spftree->paths, vertex);
+  hash_get (spftree->paths_hash, vertex, hash_alloc_intern);
 
 #ifdef EXTREME_DEBUG
   zlog_debug ("ISIS-Spf: added this IS  %s %s depth %d dist %d to PATHS",
@@ -342,51 +434,28 @@ isis_spf_add_self (struct isis_spftree *spftree, struct isis_area *area,
 }
 
 static struct isis_vertex *
-isis_find_vertex (struct list *list, void *id, enum vertextype vtype)
+isis_find_vertex (struct hash *hash, void *id, enum vertextype vtype)
 {
-  struct listnode *node;
-  struct isis_vertex *vertex;
-  struct prefix *p1, *p2;
+  struct isis_vertex key;
 
-  for (ALL_LIST_ELEMENTS_RO (list, node, vertex))
-    {
-      if (vertex->type != vtype)
-	continue;
-      switch (vtype)
-	{
-	case VTYPE_ES:
-	case VTYPE_NONPSEUDO_IS:
-	case VTYPE_NONPSEUDO_TE_IS:
-	  if (memcmp ((u_char *) id, vertex->N.id, ISIS_SYS_ID_LEN) == 0)
-	    return vertex;
-	  break;
-	case VTYPE_PSEUDO_IS:
-	case VTYPE_PSEUDO_TE_IS:
-	  if (memcmp ((u_char *) id, vertex->N.id, ISIS_SYS_ID_LEN + 1) == 0)
-	    return vertex;
-	  break;
-	case VTYPE_IPREACH_INTERNAL:
-	case VTYPE_IPREACH_EXTERNAL:
-	case VTYPE_IPREACH_TE:
-#ifdef HAVE_IPV6
-	case VTYPE_IP6REACH_INTERNAL:
-	case VTYPE_IP6REACH_EXTERNAL:
-#endif /* HAVE_IPV6 */
-	  p1 = (struct prefix *) id;
-	  p2 = (struct prefix *) &vertex->N.id;
-	  if (p1->family == p2->family && p1->prefixlen == p2->prefixlen &&
-	      memcmp (&p1->u.prefix, &p2->u.prefix,
-		      PSIZE (p1->prefixlen)) == 0)
-	    return vertex;
-	  break;
-	}
-    }
+  isis_vertex_id_set (&key, id, vtype);
+  return hash_lookup (hash, &key);
+}
 
-  return NULL;
+/*
+ * Take a vertex off TENT and free it.
+ */
+static void
+isis_spf_tent_del (struct isis_spftree *spftree, struct isis_vertex *vertex)
+{
+  pqueue_remove_at (vertex->tent_index, spftree->tents);
+  if (hash_lookup (spftree->tents_hash, vertex) == vertex)
+    hash_release (spftree->tents_hash, vertex);
+  isis_vertex_del (vertex);
 }
 
 /*
- * Add a vertex to TENT sorted by cost and by vertextype on tie break situation
+ * Add a vertex to TENT
  */
 static struct isis_vertex *
 isis_spf_add2tent (struct isis_spftree *spftree, enum vertextype vtype,
@@ -394,7 +463,6 @@ isis_spf_add2tent (struct isis_spftree *spftree, enum vertextype vtype,
 		   int depth, int family)
 {
   struct isis_vertex *vertex, *v;
-  struct listnode *node;
 #ifdef EXTREME_DEBUG
   u_char buff[BUFSIZ];
 #endif
@@ -402,6 +470,7 @@ isis_spf_add2tent (struct isis_spftree *spftree, enum vertextype vtype,
   vertex = isis_vertex_new (id, vtype);
   vertex->d_N = cost;
   vertex->depth = depth;
+  vertex->seq = spftree->tents_seq++;
 
   if (adj)
     listnode_add (vertex->Adj_N, adj);
@@ -412,43 +481,19 @@ isis_spf_add2tent (struct isis_spftree *spftree, enum vertextype vtype,
 	      vertex->depth, vertex->d_N);
 #endif /* EXTREME_DEBUG */
 
-  if (list_isempty (spftree->tents))
+  pqueue_enqueue (vertex, spftree->tents);
+
+  /* A pseudonode may put an IS on TENT more than once, the index
+     holds the copy that will come off first. */
+  v = hash_lookup (spftree->tents_hash, vertex);
+  if (v && isis_vertex_queue_cmp (vertex, v) < 0)
     {
-      listnode_add (spftree->tents, vertex);
-      return vertex;
-    }
-  
-  /* XXX: This cant use the standard ALL_LIST_ELEMENT macro */
-  for (node = listhead (spftree->tents); node; node = listnextnode (node))
-    {
-      v = listgetdata (node);
-      if (v->d_N > vertex->d_N)
-	{
-	  list_add_node_prev (spftree->tents, node, vertex);
-	  break;
-	}
-      else if (v->d_N == vertex->d_N)
-	{
-	  /*  Tie break, add according to type */
-	  while (v && v->d_N == vertex->d_N && v->type > vertex->type)
-	    {
-	      if (v->type > vertex->type)
-		{
-		  break;
-		}
-              /* XXX: this seems dubious, node is the loop iterator */
-	      node = listnextnode (node);
-	      (node) ? (v = listgetdata (node)) : (v = NULL);
-	    }
-	  list_add_node_prev (spftree->tents, node, vertex);
-	  break;
-	}
-      else if (node->next == NULL)
-	{
-	  list_add_node_next (spftree->tents, node, vertex);
-	  break;
-	}
+      hash_release (spftree->tents_hash, v);
+      v = NULL;
     }
+  if (v == NULL)
+    hash_get (spftree->tents_hash, vertex, hash_alloc_intern);
+
   return vertex;
 }
 
@@ -459,7 +504,7 @@ isis_spf_add_local (struct isis_spftree *spftree, enum vertextype vtype,
 {
   struct isis_vertex *vertex;
 
-  vertex = isis_find_vertex (spftree->tents, id, vtype);
+  vertex = isis_find_vertex (spftree->tents_hash, id, vtype);
 
   if (vertex)
     {
@@ -475,7 +520,7 @@ isis_spf_add_local (struct isis_spftree *spftree, enum vertextype vtype,
       /*         f) */
       else if (vertex->d_N > cost)
 	{
-	  listnode_delete (spftree->tents, vertex);
+	  isis_spf_tent_del (spftree, vertex);
 	  goto add2tent;
 	}
       /*       e) do nothing */
@@ -500,7 +545,7 @@ process_N (struct isis_spftree *spftree, enum vertextype vtype, void *id,
   if (dist > MAX_PATH_METRIC)
     return;
   /*       c)    */
-  vertex = isis_find_vertex (spftree->paths, id, vtype);
+  vertex = isis_find_vertex (spftree->paths_hash, id, vtype);
   if (vertex)
     {
 #ifdef EXTREME_DEBUG
@@ -511,7 +556,7 @@ process_N (struct isis_spftree *spftree, enum vertextype vtype, void *id,
       return;
     }
 
-  vertex = isis_find_vertex (spftree->tents, id, vtype);
+  vertex = isis_find_vertex (spftree->tents_hash, id, vtype);
   /*       d)    */
   if (vertex)
     {
@@ -537,7 +582,7 @@ process_N (struct isis_spftree *spftree, enum vertextype vtype, void *id,
 	}
       else
 	{
-	  listnode_delete (spftree->tents, vertex);
+	  isis_spf_tent_del (spftree, vertex);
 	}
     }
 
@@ -716,8 +761,8 @@ pseudofragloop:
 	if (!memcmp (is_neigh->neigh_id, isis->sysid, ISIS_SYS_ID_LEN))
 	  continue;
 	if ((depth > 0 || isis_find_vertex
-	    (spftree->tents, (void *) is_neigh->neigh_id, vtype) == NULL)
-	    && isis_find_vertex (spftree->paths, (void *) is_neigh->neigh_id,
+	    (spftree->tents_hash, (void *) is_neigh->neigh_id, vtype) == NULL)
+	    && isis_find_vertex (spftree->paths_hash, (void *) is_neigh->neigh_id,
 			       vtype) == NULL)
 	  {
 	    /* C.2.5 i) */
@@ -734,8 +779,8 @@ pseudofragloop:
 	if (!memcmp (te_is_neigh->neigh_id, isis->sysid, ISIS_SYS_ID_LEN))
 	  continue;
 	if ((depth > 0 || isis_find_vertex
-	     (spftree->tents, (void *) te_is_neigh->neigh_id, vtype) == NULL)
-	    && isis_find_vertex (spftree->paths, (void *) te_is_neigh->neigh_id,
+	     (spftree->tents_hash, (void *) te_is_neigh->neigh_id, vtype) == NULL)
+	    && isis_find_vertex (spftree->paths_hash, (void *) te_is_neigh->neigh_id,
 				 vtype) == NULL)
 	  {
 	    /* C.2.5 i) */
@@ -941,6 +986,7 @@ add_to_paths (struct isis_spftree *spftree, struct isis_vertex *vertex,
   u_char buff[BUFSIZ];
 #endif /* EXTREME_DEBUG */
   listnode_add (spftree->paths, vertex);
+  hash_get (spftree->paths_hash, vertex, hash_alloc_intern);
 
 #ifdef EXTREME_DEBUG
   zlog_debug ("ISIS-Spf: added  %s %s depth %d dist %d to PATHS",
@@ -962,10 +1008,15 @@ add_to_paths (struct isis_spftree *spftree, struct isis_vertex *vertex,
 static void
 init_spt (struct isis_spftree *spftree)
 {
-  spftree->tents->del = spftree->paths->del = (void (*)(void *)) isis_vertex_del;
-  list_delete_all_node (spftree->tents);
+  while (spftree->tents->size > 0)
+    isis_vertex_del (pqueue_dequeue (spftree->tents));
+  hash_clean (spftree->tents_hash, NULL);
+  spftree->tents_seq = 0;
+
+  spftree->paths->del = (void (*)(void *)) isis_vertex_del;
   list_delete_all_node (spftree->paths);
-  spftree->tents->del = spftree->paths->del = NULL;
+  spftree->paths->del = NULL;
+  hash_clean (spftree->paths_hash, NULL);
 
   return;
 }
@@ -974,7 +1025,6 @@ static int
 isis_run_spf (struct isis_area *area, int level, int family)
 {
   int retval = ISIS_OK;
-  struct listnode *node;
   struct isis_vertex *vertex;
   struct isis_spftree *spftree = NULL;
   u_char lsp_id[ISIS_SYS_ID_LEN + 2];
@@ -1022,24 +1072,25 @@ isis_run_spf (struct isis_area *area, int level, int family)
   /*
    * C.2.7 Step 2
    */
-  if (listcount (spftree->tents) == 0)
+  if (spftree->tents->size == 0)
     {
       zlog_warn ("ISIS-Spf: TENT is empty");
       goto out;
     }
 
-  while (listcount (spftree->tents) > 0)
+  while (spftree->tents->size > 0)
     {
-      /* C.2.7 a) 1) */
-      node = listhead (spftree->tents);
-      vertex = listgetdata (node);
-
-      /* C.2.7 a) 2) */
-      list_delete_node (spftree->tents, node);
+      /* C.2.7 a) 1) 2) */
+      vertex = pqueue_dequeue (spftree->tents);
+      if (hash_lookup (spftree->tents_hash, vertex) == vertex)
+	hash_release (spftree->tents_hash, vertex);
 
       /* C.2.7 a) 3) */
-      if (isis_find_vertex (spftree->paths, vertex->N.id, vertex->type))
-	continue;
+      if (hash_lookup (spftree->paths_hash, vertex))
+	{
+	  isis_vertex_del (vertex);
+	  continue;
+	}
       add_to_paths (spftree, vertex, area, level);
 
       if (vertex->type == VTYPE_PSEUDO_IS ||
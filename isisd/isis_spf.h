@@ -59,6 +59,9 @@ struct isis_vertex
   u_int16_t depth;		/* The depth in the imaginary tree */
 
   struct list *Adj_N;		/* {Adj(N)}  */
+
+  u_int32_t seq;		/* Order it was added to TENT in */
+  int tent_index;		/* Position in the TENT heap */
 };
 
 struct isis_spftree
@@ -67,7 +70,10 @@ struct isis_spftree
   time_t lastrun;		/* for scheduling */
   int pending;			/* already scheduled */
   struct list *paths;		/* the SPT */
-  struct list *tents;		/* TENT */
+  struct hash *paths_hash;	/* PATHS by vertex id */
+  struct pqueue *tents;		/* TENT, a heap on d(N) */
+  struct hash *tents_hash;	/* TENT by vertex id */
+  u_int32_t tents_seq;
 
   u_int32_t timerun;		/* statistics */
 };
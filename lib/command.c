@@ -30,6 +30,7 @@ Boston, MA 02111-1307, USA.  */
 #include "vty.h"
 #include "command.h"
 #include "workqueue.h"
+#include "hash.h"
 
 /* Command vector which includes some level of command lists. Normally
    each daemon maintains each own cmdvec. */
@@ -537,6 +538,8 @@ zencrypt (const char *passwd)
 static int
 config_write_host (struct vty *vty)
 {
+  struct zlog_async_stats stats;
+
   if (host.name)
     vty_out (vty, "hostname %s%s", host.name, VTY_NEWLINE);
 
@@ -607,6 +610,10 @@ config_write_host (struct vty *vty)
     vty_out (vty, "log timestamp precision %d%s",
 	     zlog_default->timestamp_precision, VTY_NEWLINE);
 
+  zlog_async_stats (&stats);
+  if (stats.enabled)
+    vty_out (vty, "log async%s", VTY_NEWLINE);
+
   if (host.advanced)
     vty_out (vty, "service advanced-vty%s", VTY_NEWLINE);
 
@@ -3084,6 +3091,7 @@ DEFUN (show_logging,
        "Show current logging configuration\n")
 {
   struct zlog *zl = zlog_default;
+  struct zlog_async_stats stats;
 
   vty_out (vty, "Syslog logging: ");
   if (zl->maxlvl[ZLOG_DEST_SYSLOG] == ZLOG_DISABLED)
@@ -3127,6 +3135,22 @@ DEFUN (show_logging,
   vty_out (vty, "Timestamp precision: %d%s",
 	   zl->timestamp_precision, VTY_NEWLINE);
 
+  zlog_async_stats (&stats);
+  vty_out (vty, "Asynchronous logging: ");
+  if (! stats.enabled)
+    vty_out (vty, "disabled%s", VTY_NEWLINE);
+  else
+    {
+      vty_out (vty, "%u records of %u bytes%s",
+	       stats.records, stats.record_size, VTY_NEWLINE);
+      vty_out (vty, "  Pending: %u, peak %u%s",
+	       stats.pending, stats.peak, VTY_NEWLINE);
+      vty_out (vty, "  Queued: %lu, written %lu%s",
+	       stats.queued, stats.written, VTY_NEWLINE);
+      vty_out (vty, "  Dropped: %lu, truncated %lu%s",
+	       stats.dropped, stats.truncated, VTY_NEWLINE);
+    }
+
   return CMD_SUCCESS;
 }
 
@@ -3481,6 +3505,31 @@ DEFUN (no_config_log_timestamp_precision,
   return CMD_SUCCESS;
 }
 
+DEFUN (config_log_async,
+       config_log_async_cmd,
+       "log async",
+       "Logging control\n"
+       "Write to file and syslog from a separate thread\n")
+{
+  if (! zlog_set_async (1))
+    {
+      vty_out (vty, "Asynchronous logging is not supported%s", VTY_NEWLINE);
+      return CMD_WARNING;
+    }
+  return CMD_SUCCESS;
+}
+
+DEFUN (no_config_log_async,
+       no_config_log_async_cmd,
+       "no log async",
+       NO_STR
+       "Logging control\n"
+       "Write to file and syslog from a separate thread\n")
+{
+  zlog_set_async (0);
+  return CMD_SUCCESS;
+}
+
 DEFUN (banner_motd_file,
        banner_motd_file_cmd,
        "banner motd file [FILE]",
@@ -3654,6 +3703,8 @@ cmd_init (int terminal)
       install_element (CONFIG_NODE, &no_config_log_record_priority_cmd);
       install_element (CONFIG_NODE, &config_log_timestamp_precision_cmd);
       install_element (CONFIG_NODE, &no_config_log_timestamp_precision_cmd);
+      install_element (CONFIG_NODE, &config_log_async_cmd);
+      install_element (CONFIG_NODE, &no_config_log_async_cmd);
       install_element (CONFIG_NODE, &service_password_encrypt_cmd);
       install_element (CONFIG_NODE, &no_service_password_encrypt_cmd);
       install_element (CONFIG_NODE, &banner_motd_default_cmd);
@@ -3664,6 +3715,7 @@ cmd_init (int terminal)
 
       install_thread_cmds();
       install_work_queues_cmds();
+      install_hash_cmds();
     }
   srand(time(NULL));
 }
@@ -826,12 +826,43 @@ distribute_print (struct vty *vty, char *tab[], int is_prefix,
   return has_print;
 }
 
+/* Show the filters of one interface in one direction. */
+static void
+distribute_show_if (struct hash_backet *backet, void *args[])
+{
+  struct vty *vty = args[0];
+  int output = *(int *) args[1];
+  struct distribute *dist = backet->data;
+  int has_print = 0;
+
+  if (! dist->ifname)
+    return;
+
+  vty_out (vty, "    %s filtered by", dist->ifname);
+  has_print = distribute_print(vty, dist->list,   0,
+                               output ? DISTRIBUTE_V4_OUT : DISTRIBUTE_V4_IN,
+                               has_print);
+  has_print = distribute_print(vty, dist->prefix, 1,
+                               output ? DISTRIBUTE_V4_OUT : DISTRIBUTE_V4_IN,
+                               has_print);
+  has_print = distribute_print(vty, dist->list,   0,
+                               output ? DISTRIBUTE_V6_OUT : DISTRIBUTE_V6_IN,
+                               has_print);
+  has_print = distribute_print(vty, dist->prefix, 1,
+                               output ? DISTRIBUTE_V6_OUT : DISTRIBUTE_V6_IN,
+                               has_print);
+  if (has_print)
+    vty_out (vty, "%s", VTY_NEWLINE);
+  else
+    vty_out(vty, " nothing%s", VTY_NEWLINE);
+}
+
 int
 config_show_distribute (struct vty *vty)
 {
-  unsigned int i;
   int has_print = 0;
-  struct hash_backet *mp;
+  int output;
+  void *args[2] = {vty, &output};
   struct distribute *dist;
 
   /* Output filter configuration. */
@@ -854,28 +885,10 @@ config_show_distribute (struct vty *vty)
   else
     vty_out (vty, " not set%s", VTY_NEWLINE);
 
-  for (i = 0; i < disthash->size; i++)
-    for (mp = disthash->index[i]; mp; mp = mp->next)
-      {
-	dist = mp->data;
-	if (dist->ifname)
-          {
-            vty_out (vty, "    %s filtered by", dist->ifname);
-            has_print = 0;
-            has_print = distribute_print(vty, dist->list,   0,
-                                         DISTRIBUTE_V4_OUT, has_print);
-            has_print = distribute_print(vty, dist->prefix, 1,
-                                         DISTRIBUTE_V4_OUT, has_print);
-            has_print = distribute_print(vty, dist->list,   0,
-                                         DISTRIBUTE_V6_OUT, has_print);
-            has_print = distribute_print(vty, dist->prefix, 1,
-                                         DISTRIBUTE_V6_OUT, has_print);
-            if (has_print)
-              vty_out (vty, "%s", VTY_NEWLINE);
-            else
-              vty_out(vty, " nothing%s", VTY_NEWLINE);
-          }
-      }
+  output = 1;
+  hash_iterate (disthash,
+		(void (*) (struct hash_backet *, void *)) distribute_show_if,
+		args);
 
 
   /* Input filter configuration. */
@@ -898,74 +911,60 @@ config_show_distribute (struct vty *vty)
   else
     vty_out (vty, " not set%s", VTY_NEWLINE);
 
-  for (i = 0; i < disthash->size; i++)
-    for (mp = disthash->index[i]; mp; mp = mp->next)
-      {
-	dist = mp->data;
-        if (dist->ifname)
-          {
-            vty_out (vty, "    %s filtered by", dist->ifname);
-            has_print = 0;
-            has_print = distribute_print(vty, dist->list,   0,
-                                         DISTRIBUTE_V4_IN, has_print);
-            has_print = distribute_print(vty, dist->prefix, 1,
-                                         DISTRIBUTE_V4_IN, has_print);
-            has_print = distribute_print(vty, dist->list,   0,
-                                         DISTRIBUTE_V6_IN, has_print);
-            has_print = distribute_print(vty, dist->prefix, 1,
-                                         DISTRIBUTE_V6_IN, has_print);
-            if (has_print)
-              vty_out (vty, "%s", VTY_NEWLINE);
-            else
-              vty_out(vty, " nothing%s", VTY_NEWLINE);
-          }
-      }
+  output = 0;
+  hash_iterate (disthash,
+		(void (*) (struct hash_backet *, void *)) distribute_show_if,
+		args);
   return 0;
 }
 
+/* Write the distribute-lists of one interface. */
+static void
+config_write_distribute_if (struct hash_backet *mp, void *args[])
+{
+  struct vty *vty = args[0];
+  int *write = args[1];
+  struct distribute *dist = mp->data;
+  int j;
+  int output, v6;
+
+  for (j=0; j < DISTRIBUTE_MAX; j++)
+    if (dist->list[j]) {
+      output = j == DISTRIBUTE_V4_OUT || j == DISTRIBUTE_V6_OUT;
+      v6 = j == DISTRIBUTE_V6_IN || j == DISTRIBUTE_V6_OUT;
+      vty_out (vty, " %sdistribute-list %s %s %s%s",
+               v6 ? "ipv6 " : "",
+               dist->list[j],
+               output ? "out" : "in",
+               dist->ifname ? dist->ifname : "",
+               VTY_NEWLINE);
+      (*write)++;
+    }
+
+  for (j=0; j < DISTRIBUTE_MAX; j++)
+    if (dist->prefix[j]) {
+      output = j == DISTRIBUTE_V4_OUT || j == DISTRIBUTE_V6_OUT;
+      v6 = j == DISTRIBUTE_V6_IN || j == DISTRIBUTE_V6_OUT;
+      vty_out (vty, " %sdistribute-list prefix %s %s %s%s",
+               v6 ? "ipv6 " : "",
+               dist->prefix[j],
+               output ? "out" : "in",
+               dist->ifname ? dist->ifname : "",
+               VTY_NEWLINE);
+      (*write)++;
+    }
+}
+
 /* Configuration write function. */
 int
 config_write_distribute (struct vty *vty)
 {
-  unsigned int i;
-  int j;
-  int output, v6;
-  struct hash_backet *mp;
   int write = 0;
+  void *args[2] = {vty, &write};
 
-  for (i = 0; i < disthash->size; i++)
-    for (mp = disthash->index[i]; mp; mp = mp->next)
-      {
-	struct distribute *dist;
-
-	dist = mp->data;
-
-	for (j=0; j < DISTRIBUTE_MAX; j++)
-	  if (dist->list[j]) {
-	    output = j == DISTRIBUTE_V4_OUT || j == DISTRIBUTE_V6_OUT;
-            v6 = j == DISTRIBUTE_V6_IN || j == DISTRIBUTE_V6_OUT;
-	    vty_out (vty, " %sdistribute-list %s %s %s%s",
-                     v6 ? "ipv6 " : "",
-		     dist->list[j],
-		     output ? "out" : "in",
-		     dist->ifname ? dist->ifname : "",
-		     VTY_NEWLINE);
-	    write++;
-	  }
-
-	for (j=0; j < DISTRIBUTE_MAX; j++)
-	  if (dist->prefix[j]) {
-	    output = j == DISTRIBUTE_V4_OUT || j == DISTRIBUTE_V6_OUT;
-            v6 = j == DISTRIBUTE_V6_IN || j == DISTRIBUTE_V6_OUT;
-	    vty_out (vty, " %sdistribute-list prefix %s %s %s%s",
-                     v6 ? "ipv6 " : "",
-		     dist->prefix[j],
-		     output ? "out" : "in",
-		     dist->ifname ? dist->ifname : "",
-		     VTY_NEWLINE);
-	    write++;
-	  }
-      }
+  hash_iterate (disthash,
+		(void (*) (struct hash_backet *, void *))
+		config_write_distribute_if, args);
   return write;
 }
 
@@ -23,6 +23,11 @@
 
 #include "hash.h"
 #include "memory.h"
+#include "linklist.h"
+#include "command.h"
+
+/* Named hash tables, for "show hashtable statistics". */
+static struct list *hash_tables = NULL;
 
 /* Allocate a new hash.  */
 struct hash *
@@ -31,10 +36,11 @@ hash_create_size (unsigned int size, unsigned int (*hash_key) (void *),
 {
   struct hash *hash;
 
-  hash = XMALLOC (MTYPE_HASH, sizeof (struct hash));
+  hash = XCALLOC (MTYPE_HASH, sizeof (struct hash));
   hash->index = XCALLOC (MTYPE_HASH_INDEX,
 			 sizeof (struct hash_backet *) * size);
   hash->size = size;
+  hash->min_size = size;
   hash->hash_key = hash_key;
   hash->hash_cmp = hash_cmp;
   hash->count = 0;
@@ -50,6 +56,127 @@ hash_create (unsigned int (*hash_key) (void *),
   return hash_create_size (HASHTABSIZE, hash_key, hash_cmp);
 }
 
+/* Name a hash, which also makes it show in "show hashtable statistics". */
+void
+hash_set_name (struct hash *hash, const char *name)
+{
+  if (hash->name)
+    XFREE (MTYPE_HASH_NAME, hash->name);
+  else
+    {
+      if (hash_tables == NULL)
+	hash_tables = list_new ();
+      listnode_add (hash_tables, hash);
+    }
+  hash->name = XSTRDUP (MTYPE_HASH_NAME, name);
+}
+
+/* Move up to steps buckets of the old table into the new one, and
+   release the old table once it is empty.
+
+   Resizing is incremental so that a table of hundreds of thousands of
+   entries does not stall whichever caller happens to push it over its
+   load limit: every lookup, insert and release moves a few buckets
+   along, and entries are searched for in both tables in between.  */
+static void
+hash_rehash_step (struct hash *hash, unsigned int steps)
+{
+  struct hash_backet *hb;
+  struct hash_backet *next;
+  unsigned int index;
+
+  while (steps-- && hash->rehash_pos < hash->old_size)
+    {
+      for (hb = hash->old_index[hash->rehash_pos]; hb; hb = next)
+	{
+	  next = hb->next;
+	  index = hb->key % hash->size;
+	  hb->next = hash->index[index];
+	  hash->index[index] = hb;
+	}
+      hash->old_index[hash->rehash_pos++] = NULL;
+    }
+
+  if (hash->rehash_pos == hash->old_size)
+    {
+      XFREE (MTYPE_HASH_INDEX, hash->old_index);
+      hash->old_index = NULL;
+      hash->old_size = 0;
+      hash->rehash_pos = 0;
+    }
+}
+
+/* Start moving entries into a new table of the given size. */
+static void
+hash_resize (struct hash *hash, unsigned int new_size)
+{
+  /* Finish any resize still in progress first. */
+  if (hash->old_index)
+    hash_rehash_step (hash, hash->old_size);
+
+  hash->old_index = hash->index;
+  hash->old_size = hash->size;
+  hash->rehash_pos = 0;
+
+  hash->index = XCALLOC (MTYPE_HASH_INDEX,
+			 sizeof (struct hash_backet *) * new_size);
+  hash->size = new_size;
+
+  hash_rehash_step (hash, HASH_REHASH_STEP);
+}
+
+/* Advance any resize in progress, unless the table is being walked. */
+static void
+hash_rehash (struct hash *hash)
+{
+  if (hash->old_index && !hash->iterating)
+    hash_rehash_step (hash, HASH_REHASH_STEP);
+}
+
+/* Check the load of the table after an insert or release. */
+static void
+hash_check_load (struct hash *hash)
+{
+  if (hash->iterating)
+    return;
+
+  if (hash->count > (unsigned long) hash->size * HASH_LOAD_MAX)
+    {
+      hash->grows++;
+      hash_resize (hash, hash->size * 2);
+    }
+  else if (hash->size > hash->min_size && !hash->old_index
+	   && hash->count < hash->size / HASH_LOAD_MIN_DIV)
+    {
+      hash->shrinks++;
+      hash_resize (hash, MAX (hash->size / 2, hash->min_size));
+    }
+}
+
+/* Return the chain head pointer holding data with key, or NULL. */
+static struct hash_backet **
+hash_find (struct hash *hash, unsigned int key, void *data)
+{
+  struct hash_backet **hbp;
+  unsigned int index;
+
+  index = key % hash->size;
+  for (hbp = &hash->index[index]; *hbp; hbp = &(*hbp)->next)
+    if ((*hbp)->key == key && (*hash->hash_cmp) ((*hbp)->data, data))
+      return hbp;
+
+  if (hash->old_index)
+    {
+      index = key % hash->old_size;
+      if (index >= hash->rehash_pos)
+	for (hbp = &hash->old_index[index]; *hbp; hbp = &(*hbp)->next)
+	  if ((*hbp)->key == key && (*hash->hash_cmp) ((*hbp)->data, data))
+	    return hbp;
+    }
+
+  return NULL;
+}
+
 /* Utility function for hash_get().  When this function is specified
    as alloc_func, return arugment as it is.  This function is used for
    intern already allocated value.  */
@@ -69,13 +196,14 @@ hash_get (struct hash *hash, void *data, void * (*alloc_func) (void *))
   unsigned int index;
   void *newdata;
   struct hash_backet *backet;
+  struct hash_backet **hbp;
+
+  hash_rehash (hash);
 
   key = (*hash->hash_key) (data);
-  index = key % hash->size;
 
-  for (backet = hash->index[index]; backet != NULL; backet = backet->next) 
-    if (backet->key == key && (*hash->hash_cmp) (backet->data, data))
-      return backet->data;
+  if ((hbp = hash_find (hash, key, data)) != NULL)
+    return (*hbp)->data;
 
   if (alloc_func)
     {
@@ -83,12 +211,17 @@ hash_get (struct hash *hash, void *data, void * (*alloc_func) (void *))
       if (newdata == NULL)
 	return NULL;
 
+      index = key % hash->size;
       backet = XMALLOC (MTYPE_HASH_BACKET, sizeof (struct hash_backet));
       backet->data = newdata;
       backet->key = key;
       backet->next = hash->index[index];
       hash->index[index] = backet;
       hash->count++;
+      if (hash->count > hash->peak_count)
+	hash->peak_count = hash->count;
+
+      hash_check_load (hash);
       return backet->data;
     }
   return NULL;
@@ -119,44 +252,36 @@ void *
 hash_release (struct hash *hash, void *data)
 {
   void *ret;
-  unsigned int key;
-  unsigned int index;
   struct hash_backet *backet;
-  struct hash_backet *pp;
+  struct hash_backet **hbp;
 
-  key = (*hash->hash_key) (data);
-  index = key % hash->size;
+  hash_rehash (hash);
 
-  for (backet = pp = hash->index[index]; backet; backet = backet->next)
-    {
-      if (backet->key == key && (*hash->hash_cmp) (backet->data, data)) 
-	{
-	  if (backet == pp) 
-	    hash->index[index] = backet->next;
-	  else 
-	    pp->next = backet->next;
+  if ((hbp = hash_find (hash, (*hash->hash_key) (data), data)) == NULL)
+    return NULL;
 
-	  ret = backet->data;
-	  XFREE (MTYPE_HASH_BACKET, backet);
-	  hash->count--;
-	  return ret;
-	}
-      pp = backet;
-    }
-  return NULL;
+  backet = *hbp;
+  *hbp = backet->next;
+
+  ret = backet->data;
+  XFREE (MTYPE_HASH_BACKET, backet);
+  hash->count--;
+
+  hash_check_load (hash);
+  return ret;
 }
 
-/* Iterator function for hash.  */
-void
-hash_iterate (struct hash *hash, 
-	      void (*func) (struct hash_backet *, void *), void *arg)
+static void
+hash_iterate_index (struct hash_backet **index, unsigned int start,
+		    unsigned int size,
+		    void (*func) (struct hash_backet *, void *), void *arg)
 {
   unsigned int i;
   struct hash_backet *hb;
   struct hash_backet *hbnext;
 
-  for (i = 0; i < hash->size; i++)
-    for (hb = hash->index[i]; hb; hb = hbnext)
+  for (i = start; i < size; i++)
+    for (hb = index[i]; hb; hb = hbnext)
       {
 	/* get pointer to next hash backet here, in case (*func)
 	 * decides to delete hb by calling hash_release
@@ -166,17 +291,33 @@ hash_iterate (struct hash *hash,
       }
 }
 
-/* Clean up hash.  */
+/* Iterator function for hash.  */
 void
-hash_clean (struct hash *hash, void (*free_func) (void *))
+hash_iterate (struct hash *hash, 
+	      void (*func) (struct hash_backet *, void *), void *arg)
+{
+  /* Entries must stay in their buckets until we are done. */
+  hash->iterating++;
+
+  hash_iterate_index (hash->index, 0, hash->size, func, arg);
+  if (hash->old_index)
+    hash_iterate_index (hash->old_index, hash->rehash_pos, hash->old_size,
+			func, arg);
+
+  hash->iterating--;
+}
+
+static void
+hash_clean_index (struct hash *hash, struct hash_backet **index,
+		  unsigned int size, void (*free_func) (void *))
 {
   unsigned int i;
   struct hash_backet *hb;
   struct hash_backet *next;
 
-  for (i = 0; i < hash->size; i++)
+  for (i = 0; i < size; i++)
     {
-      for (hb = hash->index[i]; hb; hb = next)
+      for (hb = index[i]; hb; hb = next)
 	{
 	  next = hb->next;
 	      
@@ -186,7 +327,22 @@ hash_clean (struct hash *hash, void (*free_func) (void *))
 	  XFREE (MTYPE_HASH_BACKET, hb);
 	  hash->count--;
 	}
-      hash->index[i] = NULL;
+      index[i] = NULL;
+    }
+}
+
+/* Clean up hash.  */
+void
+hash_clean (struct hash *hash, void (*free_func) (void *))
+{
+  hash_clean_index (hash, hash->index, hash->size, free_func);
+  if (hash->old_index)
+    {
+      hash_clean_index (hash, hash->old_index, hash->old_size, free_func);
+      XFREE (MTYPE_HASH_INDEX, hash->old_index);
+      hash->old_index = NULL;
+      hash->old_size = 0;
+      hash->rehash_pos = 0;
     }
 }
 
@@ -195,6 +351,106 @@ hash_clean (struct hash *hash, void (*free_func) (void *))
 void
 hash_free (struct hash *hash)
 {
+  if (hash->name)
+    {
+      listnode_delete (hash_tables, hash);
+      if (list_isempty (hash_tables))
+	{
+	  list_free (hash_tables);
+	  hash_tables = NULL;
+	}
+      XFREE (MTYPE_HASH_NAME, hash->name);
+    }
+
+  if (hash->old_index)
+    XFREE (MTYPE_HASH_INDEX, hash->old_index);
   XFREE (MTYPE_HASH_INDEX, hash->index);
   XFREE (MTYPE_HASH, hash);
 }
+
+/* Chain length histogram buckets: 0, 1, 2, 3, 4-7, 8-15, 16+. */
+#define HASH_HIST_SIZE 7
+
+static const char *hash_hist_label[HASH_HIST_SIZE] =
+  { "0", "1", "2", "3", "4-7", "8-15", "16+" };
+
+static void
+hash_chain_histogram (struct hash_backet **index, unsigned int start,
+		      unsigned int size, unsigned long *hist,
+		      unsigned int *longest)
+{
+  unsigned int i;
+  unsigned int len;
+  struct hash_backet *hb;
+
+  for (i = start; i < size; i++)
+    {
+      len = 0;
+      for (hb = index[i]; hb; hb = hb->next)
+	len++;
+
+      if (len > *longest)
+	*longest = len;
+
+      if (len < 4)
+	hist[len]++;
+      else if (len < 8)
+	hist[4]++;
+      else if (len < 16)
+	hist[5]++;
+      else
+	hist[6]++;
+    }
+}
+
+DEFUN (show_hash_stats,
+       show_hash_stats_cmd,
+       "show hashtable statistics",
+       SHOW_STR
+       "Hash tables\n"
+       "Statistics\n")
+{
+  struct listnode *node;
+  struct hash *hash;
+  unsigned long hist[HASH_HIST_SIZE];
+  unsigned int longest;
+  int i;
+
+  if (!hash_tables)
+    return CMD_SUCCESS;
+
+  vty_out (vty, "%-24s %9s %9s %5s %9s %6s %7s%s",
+	   "Hash table", "Entries", "Buckets", "Load", "Peak", "Grows",
+	   "Shrinks", VTY_NEWLINE);
+
+  for (ALL_LIST_ELEMENTS_RO (hash_tables, node, hash))
+    {
+      memset (hist, 0, sizeof (hist));
+      longest = 0;
+      hash_chain_histogram (hash->index, 0, hash->size, hist, &longest);
+      if (hash->old_index)
+	hash_chain_histogram (hash->old_index, hash->rehash_pos,
+			      hash->old_size, hist, &longest);
+
+      vty_out (vty, "%-24s %9lu %9u %5.2f %9lu %6lu %7lu%s%s",
+	       hash->name, hash->count, hash->size,
+	       (double) hash->count / hash->size, hash->peak_count,
+	       hash->grows, hash->shrinks,
+	       hash->old_index ? " (resizing)" : "", VTY_NEWLINE);
+
+      vty_out (vty, "  Chain lengths:");
+      for (i = 0; i < HASH_HIST_SIZE; i++)
+	if (hist[i])
+	  vty_out (vty, " %s: %lu", hash_hist_label[i], hist[i]);
+      vty_out (vty, ", longest %u%s", longest, VTY_NEWLINE);
+    }
+
+  return CMD_SUCCESS;
+}
+
+void
+install_hash_cmds (void)
+{
+  install_element (VIEW_NODE, &show_hash_stats_cmd);
+  install_element (ENABLE_NODE, &show_hash_stats_cmd);
+}
@@ -24,6 +24,16 @@ Boston, MA 02111-1307, USA.  */
 /* Default hash table size.  */ 
 #define HASHTABSIZE     1024
 
+/* Tables grow when the average chain is longer than HASH_LOAD_MAX and
+   shrink, never below their initial size, when it falls under
+   1/HASH_LOAD_MIN_DIV.  */
+#define HASH_LOAD_MAX           1
+#define HASH_LOAD_MIN_DIV       8
+
+/* Buckets moved from the old to the new table per hash operation while
+   a resize is in progress.  */
+#define HASH_REHASH_STEP        16
+
 struct hash_backet
 {
   /* Linked list.  */
@@ -52,12 +62,33 @@ struct hash
 
   /* Backet alloc. */
   unsigned long count;
+
+  /* Size the table was created with, it never shrinks below this. */
+  unsigned int min_size;
+
+  /* Table being migrated into index while a resize is in progress,
+     buckets below rehash_pos have been moved already.  */
+  struct hash_backet **old_index;
+  unsigned int old_size;
+  unsigned int rehash_pos;
+
+  /* Resizing is held off while iterating. */
+  unsigned int iterating;
+
+  /* Statistics. */
+  unsigned long grows;
+  unsigned long shrinks;
+  unsigned long peak_count;
+
+  /* Name, for "show hashtable statistics". */
+  char *name;
 };
 
 extern struct hash *hash_create (unsigned int (*) (void *), 
 				 int (*) (const void *, const void *));
 extern struct hash *hash_create_size (unsigned int, unsigned int (*) (void *), 
                                              int (*) (const void *, const void *));
+extern void hash_set_name (struct hash *, const char *);
 
 extern void *hash_get (struct hash *, void *, void * (*) (void *));
 extern void *hash_alloc_intern (void *);
@@ -72,4 +103,6 @@ extern void hash_free (struct hash *);
 
 extern unsigned int string_hash_make (const char *);
 
+extern void install_hash_cmds (void);
+
 #endif /* _ZEBRA_HASH_H */
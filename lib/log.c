@@ -27,6 +27,7 @@
 #include "log.h"
 #include "memory.h"
 #include "command.h"
+#include "network.h"
 #ifndef SUNOS_5
 #include <sys/un.h>
 #endif
@@ -34,6 +35,9 @@
 #ifdef HAVE_UCONTEXT_H
 #include <ucontext.h>
 #endif
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
 
 static int logfile_fd = -1;	/* Used in signal handler. */
 
@@ -144,6 +148,348 @@ time_print(FILE *fp, struct timestamp_control *ctl)
     }
   fprintf(fp, "%s ", ctl->buf);
 }
+
+#ifdef HAVE_PTHREAD
+/* Asynchronous logging.  Messages for file and syslog are rendered by
+   the daemon into a ring of fixed size records, and written out by a
+   thread of their own, a batch of file records with a single writev().
+   The daemon is the only producer and the writer the only consumer, so
+   each side only ever moves its own index and no lock is needed.  When
+   the ring is full, messages are dropped and counted.  */
+#define ZLOG_ASYNC_RECORDS	1024
+#define ZLOG_ASYNC_TEXT		1012
+#define ZLOG_ASYNC_IOV		64
+
+struct zlog_record
+{
+  int fd;			/* file to write to, or -1 */
+  int priority;			/* syslog priority and facility, or -1 */
+  u_short msg;			/* start of the message, for syslog */
+  u_short len;			/* of text, including the newline */
+  char text[ZLOG_ASYNC_TEXT];
+};
+
+static struct
+{
+  struct zlog_record *ring;
+
+  /* Records are filled at head and written from tail.  Both only ever
+     grow, the ring index is taken modulo ZLOG_ASYNC_RECORDS.  */
+  volatile unsigned int head;
+  volatile unsigned int tail;
+
+  /* Set by the writer before it waits on wake[0], cleared by whoever
+     wakes it up.  */
+  volatile int sleeping;
+  volatile int stop;
+  int wake[2];
+
+  /* Signalled by the writer when the tail moves while somebody waits
+     in zlog_async_drain().  */
+  pthread_mutex_t lock;
+  pthread_cond_t drained;
+  int draining;
+
+  int running;
+  int atfork;
+  pthread_t writer;
+
+  /* Statistics. */
+  unsigned long queued;
+  volatile unsigned long written;
+  unsigned long dropped;
+  unsigned long truncated;
+  unsigned int peak;
+} zlog_async =
+{
+  .wake = { -1, -1 },
+  .lock = PTHREAD_MUTEX_INITIALIZER,
+  .drained = PTHREAD_COND_INITIALIZER,
+};
+
+static void
+zlog_async_wakeup (void)
+{
+  __sync_synchronize ();
+  if (zlog_async.sleeping
+      && __sync_bool_compare_and_swap (&zlog_async.sleeping, 1, 0))
+    write (zlog_async.wake[1], "", 1);
+}
+
+static void *
+zlog_async_writer (void *arg)
+{
+  struct iovec iov[ZLOG_ASYNC_IOV];
+  struct zlog_record *rec;
+  unsigned int head, tail;
+  unsigned long count;
+  char buf[64];
+  int fd, n;
+
+  while (1)
+    {
+      tail = zlog_async.tail;
+      head = zlog_async.head;
+      if (tail == head)
+	{
+	  if (zlog_async.stop)
+	    break;
+	  zlog_async.sleeping = 1;
+	  __sync_synchronize ();
+	  if (zlog_async.head == tail && ! zlog_async.stop)
+	    read (zlog_async.wake[0], buf, sizeof (buf));
+	  zlog_async.sleeping = 0;
+	  continue;
+	}
+      /* Records are complete once head covers them. */
+      __sync_synchronize ();
+
+      fd = -1;
+      n = 0;
+      for (count = 0; tail != head; tail++, count++)
+	{
+	  rec = &zlog_async.ring[tail % ZLOG_ASYNC_RECORDS];
+	  if (rec->priority >= 0)
+	    syslog (rec->priority, "%.*s", rec->len - rec->msg - 1,
+		    rec->text + rec->msg);
+	  if (rec->fd < 0)
+	    continue;
+	  if (n && (rec->fd != fd || n == ZLOG_ASYNC_IOV))
+	    {
+	      writev (fd, iov, n);
+	      n = 0;
+	    }
+	  fd = rec->fd;
+	  iov[n].iov_base = rec->text;
+	  iov[n].iov_len = rec->len;
+	  n++;
+	}
+      if (n)
+	writev (fd, iov, n);
+
+      pthread_mutex_lock (&zlog_async.lock);
+      zlog_async.written += count;
+      zlog_async.tail = tail;
+      if (zlog_async.draining)
+	pthread_cond_broadcast (&zlog_async.drained);
+      pthread_mutex_unlock (&zlog_async.lock);
+    }
+  return NULL;
+}
+
+/* Threads do not survive fork(), which daemons call after reading the
+   configuration.  The writer is started again on the next message,
+   with a wakeup pipe of its own.  */
+static void
+zlog_async_atfork_child (void)
+{
+  zlog_async.running = 0;
+  zlog_async.sleeping = 0;
+  zlog_async.draining = 0;
+  pthread_mutex_init (&zlog_async.lock, NULL);
+  pthread_cond_init (&zlog_async.drained, NULL);
+  if (zlog_async.ring)
+    {
+      close (zlog_async.wake[0]);
+      close (zlog_async.wake[1]);
+      if (pipe (zlog_async.wake) < 0)
+	zlog_async.wake[0] = zlog_async.wake[1] = -1;
+      else
+	set_nonblocking (zlog_async.wake[1]);
+    }
+}
+
+/* The writer is started with every signal blocked, so that they are
+   all delivered to the daemon's own thread.  */
+static int
+zlog_async_start (void)
+{
+  sigset_t all, old;
+  int ret;
+
+  if (! zlog_async.atfork)
+    {
+      pthread_atfork (NULL, NULL, zlog_async_atfork_child);
+      zlog_async.atfork = 1;
+    }
+  zlog_async.stop = 0;
+
+  sigfillset (&all);
+  pthread_sigmask (SIG_SETMASK, &all, &old);
+  ret = pthread_create (&zlog_async.writer, NULL, zlog_async_writer, NULL);
+  pthread_sigmask (SIG_SETMASK, &old, NULL);
+  if (ret)
+    return 0;
+  zlog_async.running = 1;
+  return 1;
+}
+
+/* Wait until everything queued has been written, so that log files can
+   be closed and reopened.  */
+static void
+zlog_async_drain (void)
+{
+  if (! zlog_async.running)
+    return;
+
+  pthread_mutex_lock (&zlog_async.lock);
+  zlog_async.draining = 1;
+  while (zlog_async.tail != zlog_async.head)
+    {
+      zlog_async_wakeup ();
+      pthread_cond_wait (&zlog_async.drained, &zlog_async.lock);
+    }
+  zlog_async.draining = 0;
+  pthread_mutex_unlock (&zlog_async.lock);
+}
+
+static void
+zlog_async_stop (void)
+{
+  if (! zlog_async.running)
+    return;
+
+  zlog_async_drain ();
+  zlog_async.stop = 1;
+  __sync_synchronize ();
+  write (zlog_async.wake[1], "", 1);
+  pthread_join (zlog_async.writer, NULL);
+  zlog_async.running = 0;
+  zlog_async.sleeping = 0;
+}
+
+/* Queue a message for the file and syslog destinations it is meant
+   for.  Returns 0 if it has to be logged synchronously.  */
+static int
+zlog_async_enqueue (struct zlog *zl, int priority, int to_file,
+		    int to_syslog, struct timestamp_control *ctl,
+		    const char *format, va_list args)
+{
+  struct zlog_record *rec;
+  unsigned int depth;
+  int len, ret;
+
+  if (! zlog_async.running && ! zlog_async_start ())
+    return 0;
+
+  depth = zlog_async.head - zlog_async.tail;
+  if (depth >= ZLOG_ASYNC_RECORDS)
+    {
+      zlog_async.dropped++;
+      return 1;
+    }
+  if (depth + 1 > zlog_async.peak)
+    zlog_async.peak = depth + 1;
+
+  rec = &zlog_async.ring[zlog_async.head % ZLOG_ASYNC_RECORDS];
+  rec->fd = to_file ? fileno (zl->fp) : -1;
+  rec->priority = to_syslog ? (priority | zlog_default->facility) : -1;
+
+  if (!ctl->already_rendered)
+    {
+      ctl->len = quagga_timestamp (ctl->precision, ctl->buf, sizeof (ctl->buf));
+      ctl->already_rendered = 1;
+    }
+  len = snprintf (rec->text, sizeof (rec->text), "%s %s%s%s: ", ctl->buf,
+		  zl->record_priority ? zlog_priority[priority] : "",
+		  zl->record_priority ? ": " : "",
+		  zlog_proto_names[zl->protocol]);
+  rec->msg = len;
+
+  /* Leave room for the newline. */
+  ret = vsnprintf (rec->text + len, sizeof (rec->text) - len - 1,
+		   format, args);
+  if (ret < 0)
+    ret = 0;
+  if (ret >= (int) sizeof (rec->text) - len - 1)
+    {
+      ret = sizeof (rec->text) - len - 2;
+      zlog_async.truncated++;
+    }
+  len += ret;
+  rec->text[len++] = '\n';
+  rec->len = len;
+
+  zlog_async.queued++;
+  __sync_synchronize ();
+  zlog_async.head++;
+  zlog_async_wakeup ();
+
+  return 1;
+}
+
+/* Write what is still queued for files, from a signal handler.  Some of
+   it may be written twice, by the writer as well.  */
+static void
+zlog_async_flush_sigsafe (void)
+{
+  struct zlog_record *rec;
+  unsigned int tail;
+
+  if (! zlog_async.ring)
+    return;
+
+  for (tail = zlog_async.tail; tail != zlog_async.head; tail++)
+    {
+      rec = &zlog_async.ring[tail % ZLOG_ASYNC_RECORDS];
+      if (rec->fd >= 0)
+	write (rec->fd, rec->text, rec->len);
+    }
+}
+#endif /* HAVE_PTHREAD */
+
+/* Turn asynchronous logging on or off.  Returns 0 if it is not
+   available.  */
+int
+zlog_set_async (int enable)
+{
+#ifdef HAVE_PTHREAD
+  if (enable)
+    {
+      if (zlog_async.ring)
+	return 1;
+      if (pipe (zlog_async.wake) < 0)
+	return 0;
+      set_nonblocking (zlog_async.wake[1]);
+      zlog_async.ring = XCALLOC (MTYPE_ZLOG_ASYNC,
+				 ZLOG_ASYNC_RECORDS
+				 * sizeof (struct zlog_record));
+      return 1;
+    }
+
+  if (! zlog_async.ring)
+    return 1;
+  zlog_async_stop ();
+  XFREE (MTYPE_ZLOG_ASYNC, zlog_async.ring);
+  zlog_async.ring = NULL;
+  zlog_async.head = zlog_async.tail = 0;
+  close (zlog_async.wake[0]);
+  close (zlog_async.wake[1]);
+  zlog_async.wake[0] = zlog_async.wake[1] = -1;
+  return 1;
+#else
+  return enable ? 0 : 1;
+#endif /* HAVE_PTHREAD */
+}
+
+void
+zlog_async_stats (struct zlog_async_stats *stats)
+{
+  memset (stats, 0, sizeof (struct zlog_async_stats));
+#ifdef HAVE_PTHREAD
+  if (! zlog_async.ring)
+    return;
+  stats->enabled = 1;
+  stats->records = ZLOG_ASYNC_RECORDS;
+  stats->record_size = ZLOG_ASYNC_TEXT;
+  stats->pending = zlog_async.head - zlog_async.tail;
+  stats->peak = zlog_async.peak;
+  stats->queued = zlog_async.queued;
+  stats->written = zlog_async.written;
+  stats->dropped = zlog_async.dropped;
+  stats->truncated = zlog_async.truncated;
+#endif /* HAVE_PTHREAD */
+}
   
 
 /* va_list version of zlog. */
@@ -172,6 +518,25 @@ vzlog (struct zlog *zl, int priority, const char *format, va_list args)
     }
   tsctl.precision = zl->timestamp_precision;
 
+#ifdef HAVE_PTHREAD
+  /* File and syslog output, from the writer thread. */
+  if (zlog_async.ring)
+    {
+      int to_file = (priority <= zl->maxlvl[ZLOG_DEST_FILE]) && zl->fp;
+      int to_syslog = priority <= zl->maxlvl[ZLOG_DEST_SYSLOG];
+      va_list ac;
+      int queued;
+
+      va_copy (ac, args);
+      queued = ((to_file || to_syslog)
+		&& zlog_async_enqueue (zl, priority, to_file, to_syslog,
+				       &tsctl, format, ac));
+      va_end (ac);
+      if (queued)
+	goto sync;
+    }
+#endif /* HAVE_PTHREAD */
+
   /* Syslog output */
   if (priority <= zl->maxlvl[ZLOG_DEST_SYSLOG])
     {
@@ -196,6 +561,9 @@ vzlog (struct zlog *zl, int priority, const char *format, va_list args)
       fflush (zl->fp);
     }
 
+#ifdef HAVE_PTHREAD
+ sync:
+#endif /* HAVE_PTHREAD */
   /* stdout output. */
   if (priority <= zl->maxlvl[ZLOG_DEST_STDOUT])
     {
@@ -400,6 +768,10 @@ zlog_signal(int signo, const char *action
 #define PRI LOG_CRIT
 
 #define DUMP(FD) write(FD, buf, s-buf);
+#ifdef HAVE_PTHREAD
+  /* What led up to the crash goes first. */
+  zlog_async_flush_sigsafe ();
+#endif /* HAVE_PTHREAD */
   /* If no file logging configured, try to write to fallback log file. */
   if ((logfile_fd >= 0) || ((logfile_fd = open_crashlog()) >= 0))
     DUMP(logfile_fd)
@@ -608,6 +980,9 @@ void
 _zlog_assert_failed (const char *assertion, const char *file,
 		     unsigned int line, const char *function)
 {
+  /* Write out what is queued, and the rest synchronously. */
+  zlog_set_async (0);
+
   /* Force fallback file logging? */
   if (zlog_default && !zlog_default->fp &&
       ((logfile_fd = open_crashlog()) >= 0) &&
@@ -649,6 +1024,9 @@ openzlog (const char *progname, zlog_proto_t protocol,
 void
 closezlog (struct zlog *zl)
 {
+  if (zl == zlog_default)
+    zlog_set_async (0);
+
   closelog();
 
   if (zl->fp != NULL)
@@ -706,6 +1084,9 @@ zlog_reset_file (struct zlog *zl)
   if (zl == NULL)
     zl = zlog_default;
 
+#ifdef HAVE_PTHREAD
+  zlog_async_drain ();
+#endif /* HAVE_PTHREAD */
   if (zl->fp)
     fclose (zl->fp);
   zl->fp = NULL;
@@ -728,6 +1109,9 @@ zlog_rotate (struct zlog *zl)
   if (zl == NULL)
     zl = zlog_default;
 
+#ifdef HAVE_PTHREAD
+  zlog_async_drain ();
+#endif /* HAVE_PTHREAD */
   if (zl->fp)
     fclose (zl->fp);
   zl->fp = NULL;
@@ -846,6 +1230,9 @@ static const struct zebra_desc_table command_types[] = {
   DESC_ENTRY	(ZEBRA_ROUTER_ID_UPDATE),
   DESC_ENTRY	(ZEBRA_HELLO),
   DESC_ENTRY	(ZEBRA_BGP_IPV4_RGATE_VERIFY),
+  DESC_ENTRY	(ZEBRA_NEXTHOP_REGISTER),
+  DESC_ENTRY	(ZEBRA_NEXTHOP_UNREGISTER),
+  DESC_ENTRY	(ZEBRA_NEXTHOP_UPDATE),
 };
 #undef DESC_ENTRY
 
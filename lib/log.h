@@ -146,6 +146,25 @@ extern int zlog_reset_file (struct zlog *zl);
 /* Rotate log. */
 extern int zlog_rotate (struct zlog *);
 
+/* Asynchronous file and syslog logging, see zlog_set_async(). */
+struct zlog_async_stats
+{
+  int enabled;
+  unsigned int records;		/* size of the ring */
+  unsigned int record_size;	/* longest message kept, in bytes */
+  unsigned int pending;		/* queued, not yet written */
+  unsigned int peak;		/* most ever pending */
+  unsigned long queued;
+  unsigned long written;
+  unsigned long dropped;	/* ring was full */
+  unsigned long truncated;	/* message was too long */
+};
+
+/* Hand file and syslog output to a writer thread, or take it back.
+   Returns 0 if that is not supported. */
+extern int zlog_set_async (int enable);
+extern void zlog_async_stats (struct zlog_async_stats *);
+
 /* For hackey massage lookup and check */
 #define LOOKUP(x, y) mes_lookup(x, x ## _max, y, "(no item found)", #x)
 
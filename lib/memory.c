@@ -32,6 +32,14 @@
 static void alloc_inc (int);
 static void alloc_dec (int);
 static void log_memstats(int log_priority);
+
+static void *mpool_alloc (int type, size_t size);
+static void mpool_free (int type, void *ptr);
+static void *mpool_realloc (int type, void *ptr, size_t size);
+
+/* Types allocated from a memory pool, see memory_pool_enable(). */
+struct mpool;
+static struct mpool *mpools[MTYPE_MAX];
 
 static const struct message mstr [] =
 {
@@ -68,7 +76,10 @@ zmalloc (int type, size_t size)
 {
   void *memory;
 
-  memory = malloc (size);
+  if (mpools[type])
+    memory = mpool_alloc (type, size);
+  else
+    memory = malloc (size);
 
   if (memory == NULL)
     zerror ("malloc", type, size);
@@ -86,7 +97,13 @@ zcalloc (int type, size_t size)
 {
   void *memory;
 
-  memory = calloc (1, size);
+  if (mpools[type])
+    {
+      if ((memory = mpool_alloc (type, size)) != NULL)
+	memset (memory, 0, size);
+    }
+  else
+    memory = calloc (1, size);
 
   if (memory == NULL)
     zerror ("calloc", type, size);
@@ -108,7 +125,10 @@ zrealloc (int type, void *ptr, size_t size)
 {
   void *memory;
 
-  memory = realloc (ptr, size);
+  if (mpools[type])
+    memory = mpool_realloc (type, ptr, size);
+  else
+    memory = realloc (ptr, size);
   if (memory == NULL)
     zerror ("realloc", type, size);
   if (ptr == NULL)
@@ -129,7 +149,10 @@ zfree (int type, void *ptr)
   if (ptr != NULL)
     {
       alloc_dec (type);
-      free (ptr);
+      if (mpools[type])
+	mpool_free (type, ptr);
+      else
+	free (ptr);
     }
 }
 
@@ -144,7 +167,13 @@ zstrdup (int type, const char *str)
 {
   void *dup;
 
-  dup = strdup (str);
+  if (mpools[type])
+    {
+      if ((dup = mpool_alloc (type, strlen (str) + 1)) != NULL)
+	strcpy (dup, str);
+    }
+  else
+    dup = strdup (str);
   if (dup == NULL)
     zerror ("strdup", type, strlen (str));
   alloc_inc (type);
@@ -246,6 +275,221 @@ static struct
 } mstat [MTYPE_MAX];
 #endif /* MEMORY_LOG */
 
+/*
+ * Memory pools.
+ *
+ * Small fixed size objects which are allocated and freed at high rates
+ * (routes, adjacencies, attributes, hash buckets, threads, ...) can be
+ * served from per-type pools instead of malloc, once the type has been
+ * enabled with memory_pool_enable().  A pool carves objects out of
+ * slabs of MPOOL_SLAB_SIZE bytes, aligned to their own size so that
+ * the slab of an object can be found from its address, and keeps freed
+ * objects on per slab free lists.  Objects are packed with the
+ * alignment malloc() would give them, not padded to cache lines.  Slabs with no objects in use are
+ * handed back to the system, except for one kept for reuse.
+ */
+#define MPOOL_SLAB_SIZE		(64 * 1024)
+#define MPOOL_CACHELINE		64
+#define MPOOL_ALIGN		(2 * sizeof (void *))
+#define MPOOL_ROUNDUP(x, a)	(((x) + (a) - 1) & ~((a) - 1))
+
+struct mpool_slab
+{
+  struct mpool_slab *next;
+  struct mpool_slab *prev;
+
+  /* Freed objects, linked through their first word. */
+  void *free;
+
+  /* Objects from here on have never been handed out. */
+  char *unused;
+
+  unsigned int inuse;
+};
+
+/* Objects start at the first cache line after the slab header. */
+#define MPOOL_SLAB_HDR \
+  MPOOL_ROUNDUP (sizeof (struct mpool_slab), MPOOL_CACHELINE)
+
+struct mpool
+{
+  size_t size;
+  unsigned int per_slab;
+
+  /* Slabs with objects free, slabs with none, and an empty spare. */
+  struct mpool_slab *partial;
+  struct mpool_slab *full;
+  struct mpool_slab *spare;
+
+  unsigned long slabs;
+  unsigned long inuse;
+};
+
+static void
+mpool_slab_add (struct mpool_slab **head, struct mpool_slab *slab)
+{
+  slab->prev = NULL;
+  slab->next = *head;
+  if (*head)
+    (*head)->prev = slab;
+  *head = slab;
+}
+
+static void
+mpool_slab_del (struct mpool_slab **head, struct mpool_slab *slab)
+{
+  if (slab->prev)
+    slab->prev->next = slab->next;
+  else
+    *head = slab->next;
+  if (slab->next)
+    slab->next->prev = slab->prev;
+  slab->next = slab->prev = NULL;
+}
+
+static void
+mpool_slab_reset (struct mpool_slab *slab)
+{
+  slab->free = NULL;
+  slab->unused = (char *) slab + MPOOL_SLAB_HDR;
+  slab->inuse = 0;
+}
+
+static struct mpool_slab *
+mpool_slab_new (struct mpool *pool)
+{
+  void *memory = NULL;
+
+#ifdef HAVE_POSIX_MEMALIGN
+  if (posix_memalign (&memory, MPOOL_SLAB_SIZE, MPOOL_SLAB_SIZE) != 0)
+    return NULL;
+#endif /* HAVE_POSIX_MEMALIGN */
+  if (memory == NULL)
+    return NULL;
+
+  mpool_slab_reset (memory);
+  pool->slabs++;
+  return memory;
+}
+
+static void *
+mpool_alloc (int type, size_t size)
+{
+  struct mpool *pool = mpools[type];
+  struct mpool_slab *slab;
+  void *memory;
+
+  /* Pooled types must only ever be allocated at their pool size. */
+  assert (size <= pool->size);
+
+  if ((slab = pool->partial) == NULL)
+    {
+      if ((slab = pool->spare) != NULL)
+	pool->spare = NULL;
+      else if ((slab = mpool_slab_new (pool)) == NULL)
+	return NULL;
+      mpool_slab_add (&pool->partial, slab);
+    }
+
+  if (slab->free)
+    {
+      memory = slab->free;
+      slab->free = *(void **) memory;
+    }
+  else
+    {
+      memory = slab->unused;
+      slab->unused += pool->size;
+    }
+
+  pool->inuse++;
+  if (++slab->inuse == pool->per_slab)
+    {
+      mpool_slab_del (&pool->partial, slab);
+      mpool_slab_add (&pool->full, slab);
+    }
+
+  return memory;
+}
+
+static void
+mpool_free (int type, void *ptr)
+{
+  struct mpool *pool = mpools[type];
+  struct mpool_slab *slab;
+
+  slab = (struct mpool_slab *) ((uintptr_t) ptr & ~(MPOOL_SLAB_SIZE - 1));
+
+  if (slab->inuse == pool->per_slab)
+    {
+      mpool_slab_del (&pool->full, slab);
+      mpool_slab_add (&pool->partial, slab);
+    }
+
+  *(void **) ptr = slab->free;
+  slab->free = ptr;
+  pool->inuse--;
+
+  if (--slab->inuse == 0)
+    {
+      mpool_slab_del (&pool->partial, slab);
+      if (pool->spare == NULL)
+	{
+	  mpool_slab_reset (slab);
+	  pool->spare = slab;
+	}
+      else
+	{
+	  free (slab);
+	  pool->slabs--;
+	}
+    }
+}
+
+/* Pool objects can't grow, so this is only useful for ptr == NULL. */
+static void *
+mpool_realloc (int type, void *ptr, size_t size)
+{
+  assert (size <= mpools[type]->size);
+
+  if (ptr == NULL)
+    return mpool_alloc (type, size);
+  return ptr;
+}
+
+/*
+ * Serve all further allocations of type, which must be of at most size
+ * bytes, from a memory pool.  This must be done before anything of the
+ * type has been allocated.
+ * Effects: Returns 0 on success, -1 if the type can't be pooled.
+ */
+int
+memory_pool_enable (int type, size_t size)
+{
+#ifdef HAVE_POSIX_MEMALIGN
+  struct mpool *pool;
+
+  size = MPOOL_ROUNDUP (MAX (size, sizeof (void *)), MPOOL_ALIGN);
+
+  if (type <= 0 || type >= MTYPE_MAX || mpools[type]
+      || mstat[type].alloc != 0
+      || size > (MPOOL_SLAB_SIZE - MPOOL_SLAB_HDR) / 16)
+    return -1;
+
+  if ((pool = calloc (1, sizeof (struct mpool))) == NULL)
+    return -1;
+
+  pool->size = size;
+  pool->per_slab = (MPOOL_SLAB_SIZE - MPOOL_SLAB_HDR) / size;
+  mpools[type] = pool;
+
+  return 0;
+#else
+  /* Slabs could not be aligned to their size. */
+  return -1;
+#endif /* HAVE_POSIX_MEMALIGN */
+}
+
 /* Increment allocation counter. */
 static void
 alloc_inc (int type)
@@ -392,6 +636,47 @@ show_memory_mallinfo (struct vty *vty)
 }
 #endif /* HAVE_MALLINFO */
 
+/* Slab usage of pooled types, see memory_pool_enable(). */
+static int
+show_memory_pools (struct vty *vty, int needsep)
+{
+  struct mlist *ml;
+  struct memory_list *m;
+  struct mpool *pool;
+  unsigned long capacity;
+  char buf[MTYPE_MEMSTR_LEN];
+  int header = 0;
+
+  for (ml = mlists; ml->list; ml++)
+    for (m = ml->list; m->index >= 0; m++)
+      {
+	if (!m->index || (pool = mpools[m->index]) == NULL)
+	  continue;
+
+	if (!header)
+	  {
+	    if (needsep)
+	      show_separator (vty);
+	    vty_out (vty, "Memory pools:%s", VTY_NEWLINE);
+	    vty_out (vty, "%-30s %5s %9s %9s %6s %9s %5s%s",
+		     "", "Size", "In use", "Free", "Slabs", "Memory", "Used",
+		     VTY_NEWLINE);
+	    header = 1;
+	  }
+
+	capacity = pool->slabs * pool->per_slab;
+	vty_out (vty, "%-30s %5lu %9lu %9lu %6lu %9s %4lu%%%s",
+		 m->format, (unsigned long) pool->size, pool->inuse,
+		 capacity - pool->inuse, pool->slabs,
+		 mtype_memstr (buf, MTYPE_MEMSTR_LEN,
+			       pool->slabs * MPOOL_SLAB_SIZE),
+		 capacity ? (pool->inuse * 100) / capacity : 0,
+		 VTY_NEWLINE);
+      }
+
+  return header ? 1 : needsep;
+}
+
 DEFUN (show_memory_all,
        show_memory_all_cmd,
        "show memory all",
@@ -405,6 +690,8 @@ DEFUN (show_memory_all,
 #ifdef HAVE_MALLINFO
   needsep = show_memory_mallinfo (vty);
 #endif /* HAVE_MALLINFO */
+
+  needsep = show_memory_pools (vty, needsep);
   
   for (ml = mlists; ml->list; ml++)
     {
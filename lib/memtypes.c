@@ -22,6 +22,8 @@ struct memory_list memory_list_lib[] =
   { MTYPE_THREAD_MASTER,	"Thread master"			},
   { MTYPE_THREAD_STATS,		"Thread stats"			},
   { MTYPE_THREAD_FUNCNAME,	"Thread function name" 		},
+  { MTYPE_THREAD_FD_INDEX,	"Thread fd index"		},
+  { MTYPE_THREAD_POLL,		"Thread poll events"		},
   { MTYPE_VTY,			"VTY"				},
   { MTYPE_VTY_OUT_BUF,		"VTY output buffer"		},
   { MTYPE_VTY_HIST,		"VTY history"			},
@@ -33,14 +35,17 @@ struct memory_list memory_list_lib[] =
   { MTYPE_STREAM,		"Stream"			},
   { MTYPE_STREAM_DATA,		"Stream data"			},
   { MTYPE_STREAM_FIFO,		"Stream FIFO"			},
+  { MTYPE_STREAM_SEGMENT,	"Stream segment"		},
   { MTYPE_PREFIX,		"Prefix"			},
   { MTYPE_PREFIX_IPV4,		"Prefix IPv4"			},
   { MTYPE_PREFIX_IPV6,		"Prefix IPv6"			},
   { MTYPE_HASH,			"Hash"				},
   { MTYPE_HASH_BACKET,		"Hash Bucket"			},
   { MTYPE_HASH_INDEX,		"Hash Index"			},
+  { MTYPE_HASH_NAME,		"Hash Name"			},
   { MTYPE_ROUTE_TABLE,		"Route table"			},
   { MTYPE_ROUTE_NODE,		"Route node"			},
+  { MTYPE_ROUTE_TABLE_INDEX,	"Route table index"		},
   { MTYPE_DISTRIBUTE,		"Distribute list"		},
   { MTYPE_DISTRIBUTE_IFNAME,	"Dist-list ifname"		},
   { MTYPE_ACCESS_LIST,		"Access List"			},
@@ -55,6 +60,7 @@ struct memory_list memory_list_lib[] =
   { MTYPE_ROUTE_MAP_RULE,	"Route map rule"		},
   { MTYPE_ROUTE_MAP_RULE_STR,	"Route map rule str"		},
   { MTYPE_ROUTE_MAP_COMPILED,	"Route map compiled"		},
+  { MTYPE_ROUTE_MAP_CACHE,	"Route map cache"		},
   { MTYPE_DESC,			"Command desc"			},
   { MTYPE_KEY,			"Key"				},
   { MTYPE_KEYCHAIN,		"Key chain"			},
@@ -63,6 +69,7 @@ struct memory_list memory_list_lib[] =
   { MTYPE_SOCKUNION,		"Socket union"			},
   { MTYPE_PRIVS,		"Privilege information"		},
   { MTYPE_ZLOG,			"Logging"			},
+  { MTYPE_ZLOG_ASYNC,		"Logging ring"			},
   { MTYPE_ZCLIENT,		"Zclient"			},
   { MTYPE_WORK_QUEUE,		"Work queue"			},
   { MTYPE_WORK_QUEUE_ITEM,	"Work queue item"		},
@@ -80,6 +87,8 @@ struct memory_list memory_list_zebra[] =
   { MTYPE_VRF,			"VRF"				},
   { MTYPE_VRF_NAME,		"VRF name"			},
   { MTYPE_NEXTHOP,		"Nexthop"			},
+  { MTYPE_NEXTHOP_GROUP,	"Nexthop group"			},
+  { MTYPE_NEXTHOP_TRACK,	"Nexthop tracking"		},
   { MTYPE_RIB,			"RIB"				},
   { MTYPE_RIB_QUEUE,		"RIB process work queue"	},
   { MTYPE_STATIC_IPV4,		"Static IPv4 route"		},
@@ -114,6 +123,10 @@ struct memory_list memory_list_bgp[] =
   { MTYPE_BGP_SYNCHRONISE,	"BGP synchronise"		},
   { MTYPE_BGP_ADJ_IN,		"BGP adj in"			},
   { MTYPE_BGP_ADJ_OUT,		"BGP adj out"			},
+  { MTYPE_BGP_ADJ_INDEX,	"BGP adj index"			},
+  { MTYPE_BGP_UPDGRP,		"BGP update group"		},
+  { MTYPE_BGP_UPDGRP_PACKET,	"BGP update group packet"	},
+  { MTYPE_BGP_INPUT_CACHE,	"BGP input policy cache"	},
   { 0, NULL },
   { MTYPE_AS_LIST,		"BGP AS list"			},
   { MTYPE_AS_FILTER,		"BGP AS filter"			},
@@ -132,6 +145,7 @@ struct memory_list memory_list_bgp[] =
   { MTYPE_COMMUNITY_LIST_ENTRY,	"community-list entry"		},
   { MTYPE_COMMUNITY_LIST_CONFIG,  "community-list config"	},
   { MTYPE_COMMUNITY_LIST_HANDLER, "community-list handler"	},
+  { MTYPE_COMMUNITY_LIST_INDEX, "community-list index"		},
   { 0, NULL },
   { MTYPE_CLUSTER,		"Cluster list"			},
   { MTYPE_CLUSTER_VAL,		"Cluster list val"		},
@@ -144,6 +158,7 @@ struct memory_list memory_list_bgp[] =
   { 0, NULL },
   { MTYPE_BGP_DISTANCE,		"BGP distance"			},
   { MTYPE_BGP_NEXTHOP_CACHE,	"BGP nexthop"			},
+  { MTYPE_BGP_ZLOOKUP,		"BGP nexthop lookup"		},
   { MTYPE_BGP_CONFED_LIST,	"BGP confed list"		},
   { MTYPE_PEER_UPDATE_SOURCE,	"BGP peer update interface"	},
   { MTYPE_BGP_DAMP_INFO,	"Dampening info"		},
@@ -210,6 +225,8 @@ struct memory_list memory_list_ospf[] =
   { MTYPE_OSPF_IF_INFO,       "OSPF if info"			},
   { MTYPE_OSPF_IF_PARAMS,     "OSPF if params"			},
   { MTYPE_OSPF_MESSAGE,		"OSPF message"			},
+  { MTYPE_OSPF_ASE_DEP,		"OSPF ASE dependency"		},
+  { MTYPE_OSPF_SPF_SAVED,	"OSPF saved SPF tree"		},
   { -1, NULL },
 };
 
@@ -29,6 +29,7 @@
 #include "buffer.h"
 #include "stream.h"
 #include "log.h"
+#include "table.h"
 
 /* Each prefix-list's entry. */
 struct prefix_list_entry
@@ -48,6 +49,11 @@ struct prefix_list_entry
 
   struct prefix_list_entry *next;
   struct prefix_list_entry *prev;
+
+  /* Trie node of the prefix, and the next entry with the same prefix
+     in sequence order. */
+  struct route_node *trie_node;
+  struct prefix_list_entry *trie_next;
 };
 
 /* List of struct prefix_list. */
@@ -156,12 +162,14 @@ prefix_list_new (void)
   struct prefix_list *new;
 
   new = XCALLOC (MTYPE_PREFIX_LIST, sizeof (struct prefix_list));
+  new->trie = route_table_init ();
   return new;
 }
 
 static void
 prefix_list_free (struct prefix_list *plist)
 {
+  route_table_finish (plist->trie);
   XFREE (MTYPE_PREFIX_LIST, plist);
 }
 
@@ -430,6 +438,47 @@ prefix_list_entry_lookup (struct prefix_list *plist, struct prefix *prefix,
   return NULL;
 }
 
+/* Index an entry by its prefix.  Entries sharing a prefix are kept
+   in sequence order. */
+static void
+prefix_list_trie_add (struct prefix_list *plist,
+		      struct prefix_list_entry *pentry)
+{
+  struct route_node *rn;
+  struct prefix_list_entry **pp;
+
+  rn = route_node_get (plist->trie, &pentry->prefix);
+  if (rn->info)
+    route_unlock_node (rn);
+
+  for (pp = (struct prefix_list_entry **) &rn->info; *pp;
+       pp = &(*pp)->trie_next)
+    if ((*pp)->seq > pentry->seq)
+      break;
+
+  pentry->trie_next = *pp;
+  *pp = pentry;
+  pentry->trie_node = rn;
+}
+
+static void
+prefix_list_trie_delete (struct prefix_list_entry *pentry)
+{
+  struct route_node *rn = pentry->trie_node;
+  struct prefix_list_entry **pp;
+
+  for (pp = (struct prefix_list_entry **) &rn->info; *pp;
+       pp = &(*pp)->trie_next)
+    if (*pp == pentry)
+      {
+	*pp = pentry->trie_next;
+	break;
+      }
+
+  if (rn->info == NULL)
+    route_unlock_node (rn);
+}
+
 static void
 prefix_list_entry_delete (struct prefix_list *plist, 
 			  struct prefix_list_entry *pentry,
@@ -446,6 +495,7 @@ prefix_list_entry_delete (struct prefix_list *plist,
   else
     plist->tail = pentry->prev;
 
+  prefix_list_trie_delete (pentry);
   prefix_list_entry_free (pentry);
 
   plist->count--;
@@ -507,6 +557,8 @@ prefix_list_entry_add (struct prefix_list *plist,
       plist->tail = pentry;
     }
 
+  prefix_list_trie_add (plist, pentry);
+
   /* Increment count. */
   plist->count++;
 
@@ -560,10 +612,18 @@ prefix_list_entry_match (struct prefix_list_entry *pentry, struct prefix *p)
   return 1;
 }
 
+/* Only entries whose prefix covers P can match it, and those all sit
+   on the trie path from the longest one up.  The first match in
+   sequence order wins, as if the list had been walked.  Entries that
+   would have been passed on the way count as referenced, other
+   entries are never touched. */
 enum prefix_list_type
 prefix_list_apply (struct prefix_list *plist, void *object)
 {
   struct prefix_list_entry *pentry;
+  struct prefix_list_entry *best;
+  struct route_node *rn;
+  struct route_node *node;
   struct prefix *p;
 
   p = (struct prefix *) object;
@@ -574,16 +634,38 @@ prefix_list_apply (struct prefix_list *plist, void *object)
   if (plist->count == 0)
     return PREFIX_PERMIT;
 
-  for (pentry = plist->head; pentry; pentry = pentry->next)
+  rn = route_node_match (plist->trie, p);
+  if (rn == NULL)
+    return PREFIX_DENY;
+
+  best = NULL;
+  for (node = rn; node; node = node->parent)
+    for (pentry = node->info; pentry; pentry = pentry->trie_next)
+      {
+	if (best && pentry->seq > best->seq)
+	  break;
+	if (prefix_list_entry_match (pentry, p))
+	  {
+	    best = pentry;
+	    break;
+	  }
+      }
+
+  for (node = rn; node; node = node->parent)
+    for (pentry = node->info; pentry; pentry = pentry->trie_next)
+      {
+	if (best && pentry->seq > best->seq)
+	  break;
+	pentry->refcnt++;
+      }
+
+  route_unlock_node (rn);
+
+  if (best)
     {
-      pentry->refcnt++;
-      if (prefix_list_entry_match (pentry, p))
-	{
-	  pentry->hitcnt++;
-	  return pentry->type;
-	}
+      best->hitcnt++;
+      return best->type;
     }
-
   return PREFIX_DENY;
 }
 
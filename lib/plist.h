@@ -52,6 +52,9 @@ struct prefix_list
   struct prefix_list_entry *head;
   struct prefix_list_entry *tail;
 
+  /* Entries indexed by prefix, for prefix_list_apply(). */
+  struct route_table *trie;
+
   struct prefix_list *next;
   struct prefix_list *prev;
 };
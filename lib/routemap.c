@@ -28,6 +28,8 @@ Software Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
 #include "command.h"
 #include "vty.h"
 #include "log.h"
+#include "hash.h"
+#include "jhash.h"
 
 /* Vector for route match rules. */
 static vector route_match_vec;
@@ -66,12 +68,31 @@ struct route_map_list
 /* Master list of route map. */
 static struct route_map_list route_map_master = { NULL, NULL, NULL, NULL };
 
+/* Route-map result cache.  Changing any route-map, or anything its
+   rules refer to, bumps the version, which empties every cache the
+   next time it is used. */
+#define ROUTE_MAP_CACHE_MAX 65536
+
+struct route_map_cache_entry
+{
+  void *key;
+  route_map_result_t ret;
+  void *result;
+};
+
+static struct route_map_cache_ops *route_map_cache_ops;
+static route_map_object_t route_map_cache_type;
+static unsigned int route_map_cache_version = 1;
+
 static void
 route_map_rule_delete (struct route_map_rule_list *,
 		       struct route_map_rule *);
 
 static void
 route_map_index_delete (struct route_map_index *, int);
+
+static void
+route_map_cache_clean (struct route_map *);
 
 /* New route map allocation. Please note route map's name must be
    specified. */
@@ -135,6 +156,12 @@ route_map_delete (struct route_map *map)
   else
     list->head = map->next;
 
+  if (map->cache)
+    {
+      route_map_cache_clean (map);
+      hash_free (map->cache);
+    }
+
   XFREE (MTYPE_ROUTE_MAP, map);
 
   /* Execute deletion hook. */
@@ -210,6 +237,14 @@ vty_show_route_map_entry (struct vty *vty, struct route_map *map)
     vty_out (vty, "%s:%s", zlog_proto_names[zlog_default->protocol],
              VTY_NEWLINE);
 
+  if (map->cache_hits || map->cache_misses)
+    vty_out (vty, "route-map %s, result cache: %lu entries, "
+             "%lu hits, %lu misses (%lu%% hit)%s",
+             map->name, map->cache ? map->cache->count : 0,
+             map->cache_hits, map->cache_misses,
+             map->cache_hits * 100 / (map->cache_hits + map->cache_misses),
+             VTY_NEWLINE);
+
   for (index = map->head; index; index = index->next)
     {
       vty_out (vty, "route-map %s, %s, sequence %d%s",
@@ -318,6 +353,8 @@ route_map_index_delete (struct route_map_index *index, int notify)
   if (index->nextrm)
     XFREE (MTYPE_ROUTE_MAP_NAME, index->nextrm);
 
+  route_map_cache_flush ();
+
     /* Execute event hook. */
   if (route_map_master.event_hook && notify)
     (*route_map_master.event_hook) (RMAP_EVENT_INDEX_DELETED,
@@ -384,6 +421,8 @@ route_map_index_add (struct route_map *map, enum route_map_type type,
       point->prev = index;
     }
 
+  route_map_cache_flush ();
+
   /* Execute event hook. */
   if (route_map_master.event_hook)
     (*route_map_master.event_hook) (RMAP_EVENT_INDEX_ADDED,
@@ -475,6 +514,8 @@ route_map_rule_add (struct route_map_rule_list *list,
   else
     list->head = rule;
   list->tail = rule;
+
+  route_map_cache_flush ();
 }
 
 /* Delete rule from rule list. */
@@ -498,6 +539,8 @@ route_map_rule_delete (struct route_map_rule_list *list,
     list->head = rule->next;
 
   XFREE (MTYPE_ROUTE_MAP_RULE, rule);
+
+  route_map_cache_flush ();
 }
 
 /* strcmp wrapper function which don't crush even argument is NULL. */
@@ -769,10 +812,10 @@ route_map_apply_match (struct route_map_rule_list *match_list,
   return ret;
 }
 
-/* Apply route map to the object. */
-route_map_result_t
-route_map_apply (struct route_map *map, struct prefix *prefix,
-                 route_map_object_t type, void *object)
+/* Apply route map's rules to the object. */
+static route_map_result_t
+route_map_apply_rules (struct route_map *map, struct prefix *prefix,
+                       route_map_object_t type, void *object)
 {
   static int recursion = 0;
   int ret = 0;
@@ -864,6 +907,180 @@ route_map_apply (struct route_map *map, struct prefix *prefix,
   return RMAP_DENYMATCH;
 }
 
+static unsigned int
+route_map_cache_hash_key (void *p)
+{
+  const struct route_map_cache_entry *entry = p;
+
+  return jhash_1word ((u_int32_t) (uintptr_t) entry->key, 0);
+}
+
+static int
+route_map_cache_hash_cmp (const void *p1, const void *p2)
+{
+  const struct route_map_cache_entry *e1 = p1;
+  const struct route_map_cache_entry *e2 = p2;
+
+  return e1->key == e2->key;
+}
+
+static void
+route_map_cache_entry_free (void *p)
+{
+  struct route_map_cache_entry *entry = p;
+
+  (*route_map_cache_ops->release) (entry->key);
+  if (entry->result)
+    (*route_map_cache_ops->release) (entry->result);
+  XFREE (MTYPE_ROUTE_MAP_CACHE, entry);
+}
+
+static void
+route_map_cache_clean (struct route_map *map)
+{
+  hash_clean (map->cache, route_map_cache_entry_free);
+}
+
+/* Results of a route-map can be cached when none of its rules look
+   beyond the object key, and it doesn't call other route-maps. */
+static int
+route_map_cacheable (struct route_map *map)
+{
+  struct route_map_index *index;
+  struct route_map_rule *rule;
+
+  for (index = map->head; index; index = index->next)
+    {
+      if (index->nextrm)
+	return 0;
+      for (rule = index->match_list.head; rule; rule = rule->next)
+	if (! CHECK_FLAG (rule->cmd->flags, RMAP_RULE_CACHEABLE))
+	  return 0;
+      for (rule = index->set_list.head; rule; rule = rule->next)
+	if (! CHECK_FLAG (rule->cmd->flags, RMAP_RULE_CACHEABLE))
+	  return 0;
+    }
+  return 1;
+}
+
+/* Whether the results of the route-map depend on nothing but the
+   object key.  Drops results cached before the last flush. */
+int
+route_map_is_cacheable (struct route_map *map)
+{
+  if (map->cache_version != route_map_cache_version)
+    {
+      if (map->cache)
+	route_map_cache_clean (map);
+      map->cacheable = route_map_cacheable (map);
+      map->cache_version = route_map_cache_version;
+    }
+  return map->cacheable;
+}
+
+/* Limit on the route-maps called in a row, against call loops. */
+#define ROUTE_MAP_CALL_DEPTH_MAX 16
+
+static int
+route_map_depends_on_peer_depth (struct route_map *map, int depth)
+{
+  struct route_map_index *index;
+  struct route_map_rule *rule;
+  struct route_map *nextrm;
+
+  if (depth > ROUTE_MAP_CALL_DEPTH_MAX)
+    return 1;
+
+  for (index = map->head; index; index = index->next)
+    {
+      for (rule = index->match_list.head; rule; rule = rule->next)
+	if (CHECK_FLAG (rule->cmd->flags, RMAP_RULE_PEER))
+	  return 1;
+      for (rule = index->set_list.head; rule; rule = rule->next)
+	if (CHECK_FLAG (rule->cmd->flags, RMAP_RULE_PEER))
+	  return 1;
+      if (index->nextrm
+	  && (nextrm = route_map_lookup_by_name (index->nextrm)) != NULL
+	  && route_map_depends_on_peer_depth (nextrm, depth + 1))
+	return 1;
+    }
+  return 0;
+}
+
+/* Whether the route-map, or one it calls, has a rule that looks at
+   the peer it is applied for, so that its results for one peer don't
+   hold for another. */
+int
+route_map_depends_on_peer (struct route_map *map)
+{
+  return route_map_depends_on_peer_depth (map, 0);
+}
+
+/* Apply route map to the object. */
+route_map_result_t
+route_map_apply (struct route_map *map, struct prefix *prefix,
+                 route_map_object_t type, void *object)
+{
+  struct route_map_cache_entry lookup;
+  struct route_map_cache_entry *entry;
+  route_map_result_t ret;
+
+  if (map == NULL || route_map_cache_ops == NULL
+      || type != route_map_cache_type)
+    return route_map_apply_rules (map, prefix, type, object);
+
+  if (! route_map_is_cacheable (map)
+      || (lookup.key = (*route_map_cache_ops->key) (object)) == NULL)
+    return route_map_apply_rules (map, prefix, type, object);
+
+  if (map->cache == NULL)
+    map->cache = hash_create (route_map_cache_hash_key,
+			      route_map_cache_hash_cmp);
+
+  entry = hash_lookup (map->cache, &lookup);
+  if (entry)
+    {
+      map->cache_hits++;
+      (*route_map_cache_ops->release) (lookup.key);
+      if (entry->result)
+	(*route_map_cache_ops->set) (object, entry->result);
+      return entry->ret;
+    }
+  map->cache_misses++;
+
+  ret = route_map_apply_rules (map, prefix, type, object);
+
+  if (map->cache->count >= ROUTE_MAP_CACHE_MAX)
+    route_map_cache_clean (map);
+
+  entry = XCALLOC (MTYPE_ROUTE_MAP_CACHE,
+		   sizeof (struct route_map_cache_entry));
+  entry->key = lookup.key;
+  entry->ret = ret;
+  if (ret != RMAP_DENYMATCH)
+    entry->result = (*route_map_cache_ops->result) (object);
+  hash_get (map->cache, entry, hash_alloc_intern);
+
+  return ret;
+}
+
+/* Cache results of route-maps applied to objects of the given type. */
+void
+route_map_cache_install (route_map_object_t type,
+			 struct route_map_cache_ops *ops)
+{
+  route_map_cache_type = type;
+  route_map_cache_ops = ops;
+  route_map_cache_flush ();
+}
+
+/* Forget all cached results, something they depend on has changed. */
+void
+route_map_cache_flush (void)
+{
+  route_map_cache_version++;
+}
+
 void
 route_map_add_hook (void (*func) (const char *))
 {
@@ -1053,6 +1270,7 @@ DEFUN (rmap_onmatch_next,
   if (index)
     index->exitpolicy = RMAP_NEXT;
 
+  route_map_cache_flush ();
   return CMD_SUCCESS;
 }
 
@@ -1070,6 +1288,7 @@ DEFUN (no_rmap_onmatch_next,
   if (index)
     index->exitpolicy = RMAP_EXIT;
 
+  route_map_cache_flush ();
   return CMD_SUCCESS;
 }
 
@@ -1103,6 +1322,8 @@ DEFUN (rmap_onmatch_goto,
 	  index->nextpref = d;
 	}
     }
+
+  route_map_cache_flush ();
   return CMD_SUCCESS;
 }
 
@@ -1120,6 +1341,7 @@ DEFUN (no_rmap_onmatch_goto,
   if (index)
     index->exitpolicy = RMAP_EXIT;
   
+  route_map_cache_flush ();
   return CMD_SUCCESS;
 }
 
@@ -1183,6 +1405,8 @@ DEFUN (rmap_call,
           XFREE (MTYPE_ROUTE_MAP_NAME, index->nextrm);
       index->nextrm = XSTRDUP (MTYPE_ROUTE_MAP_NAME, argv[0]);
     }
+
+  route_map_cache_flush ();
   return CMD_SUCCESS;
 }
 
@@ -1202,6 +1426,7 @@ DEFUN (no_rmap_call,
       index->nextrm = NULL;
     }
 
+  route_map_cache_flush ();
   return CMD_SUCCESS;
 }
 
@@ -87,6 +87,29 @@ struct route_map_rule_cmd
 
   /* Free allocated value by func_compile (). */
   void (*func_free)(void *);
+
+  /* RMAP_RULE_CACHEABLE when the rule only depends on, or only
+     changes, the part of an object that route-map results are cached
+     by.  See route_map_cache_install().  RMAP_RULE_PEER when the rule
+     looks at the peer the object is applied for. */
+  int flags;
+};
+
+#define RMAP_RULE_CACHEABLE	(1 << 0)
+#define RMAP_RULE_PEER		(1 << 1)
+
+/* Hooks for caching route-map results of one object type.  key()
+   returns a reference to a shared summary of an object, or NULL when
+   the object can't be summarised; equal objects must get the same
+   pointer.  result() returns a reference to the object once set rules
+   ran, set() loads such a result into another object, and release()
+   drops a reference taken by either. */
+struct route_map_cache_ops
+{
+  void *(*key) (void *object);
+  void *(*result) (void *object);
+  void (*set) (void *object, void *result);
+  void (*release) (void *ref);
 };
 
 /* Route map apply error. */
@@ -149,6 +172,13 @@ struct route_map
   /* Make linked list. */
   struct route_map *next;
   struct route_map *prev;
+
+  /* Results by object key, when all rules are cacheable. */
+  struct hash *cache;
+  unsigned int cache_version;
+  int cacheable;
+  unsigned long cache_hits;
+  unsigned long cache_misses;
 };
 
 /* Prototypes. */
@@ -195,4 +225,10 @@ extern void route_map_add_hook (void (*func) (const char *));
 extern void route_map_delete_hook (void (*func) (const char *));
 extern void route_map_event_hook (void (*func) (route_map_event_t, const char *));
 
+extern void route_map_cache_install (route_map_object_t,
+                                     struct route_map_cache_ops *);
+extern void route_map_cache_flush (void);
+extern int route_map_is_cacheable (struct route_map *);
+extern int route_map_depends_on_peer (struct route_map *);
+
 #endif /* _ZEBRA_ROUTEMAP_H */
@@ -27,6 +27,7 @@
 #include "memory.h"
 #include "str.h"
 #include "log.h"
+#include "jhash.h"
 
 #ifndef HAVE_INET_ATON
 int
@@ -453,7 +454,7 @@ sockunion_bind (int sock, union sockunion *su, unsigned short port,
 
 /* If same family and same prefix return 1. */
 int
-sockunion_same (union sockunion *su1, union sockunion *su2)
+sockunion_same (const union sockunion *su1, const union sockunion *su2)
 {
   int ret = 0;
 
@@ -479,6 +480,23 @@ sockunion_same (union sockunion *su1, union sockunion *su2)
     return 0;
 }
 
+/* Hash of the address, consistent with sockunion_same (). */
+unsigned int
+sockunion_hash (const union sockunion *su)
+{
+  switch (su->sa.sa_family)
+    {
+    case AF_INET:
+      return jhash_1word (su->sin.sin_addr.s_addr, 0);
+#ifdef HAVE_IPV6
+    case AF_INET6:
+      return jhash2 ((u_int32_t *) &su->sin6.sin6_addr,
+		     sizeof (struct in6_addr) / sizeof (u_int32_t), 0);
+#endif /* HAVE_IPV6 */
+    }
+  return 0;
+}
+
 /* After TCP connection is established.  Get local address and port. */
 union sockunion *
 sockunion_getsockname (int fd)
@@ -121,7 +121,16 @@ stream_free (struct stream *s)
   if (!s)
     return;
   
-  XFREE (MTYPE_STREAM_DATA, s->data);
+  if (s->segment)
+    {
+      if (--s->segment->refcnt == 0)
+	{
+	  XFREE (MTYPE_STREAM_DATA, s->segment->data);
+	  XFREE (MTYPE_STREAM_SEGMENT, s->segment);
+	}
+    }
+  else
+    XFREE (MTYPE_STREAM_DATA, s->data);
   XFREE (MTYPE_STREAM, s);
 }
 
@@ -154,12 +163,46 @@ stream_dup (struct stream *s)
   return (stream_copy (new, s));
 }
 
+/* Another stream reading the same data, which can't be written to by
+   either afterwards. */
+struct stream *
+stream_share (struct stream *s)
+{
+  struct stream *new;
+
+  STREAM_VERIFY_SANE (s);
+
+  if (s->segment == NULL)
+    {
+      s->segment = XMALLOC (MTYPE_STREAM_SEGMENT,
+			    sizeof (struct stream_segment));
+      s->segment->refcnt = 1;
+      s->segment->data = s->data;
+      s->size = s->endp;
+    }
+
+  new = XCALLOC (MTYPE_STREAM, sizeof (struct stream));
+  new->getp = s->getp;
+  new->endp = new->size = s->endp;
+  new->data = s->data;
+  new->segment = s->segment;
+  new->segment->refcnt++;
+
+  return new;
+}
+
 size_t
 stream_resize (struct stream *s, size_t newsize)
 {
   u_char *newdata;
   STREAM_VERIFY_SANE (s);
   
+  if (s->segment)
+    {
+      zlog_warn ("stream_resize(): called on shared stream %p", s);
+      return s->size;
+    }
+
   newdata = XREALLOC (MTYPE_STREAM_DATA, s->data, newsize);
   
   if (newdata == NULL)
@@ -569,6 +612,12 @@ int
 stream_putc_at (struct stream *s, size_t putp, u_char c)
 {
   STREAM_VERIFY_SANE(s);
+
+  if (s->segment)
+    {
+      zlog_warn ("stream_putc_at(): called on shared stream %p", s);
+      return 0;
+    }
   
   if (!PUT_AT_VALID (s, putp + sizeof (u_char)))
     {
@@ -585,6 +634,12 @@ int
 stream_putw_at (struct stream *s, size_t putp, u_int16_t w)
 {
   STREAM_VERIFY_SANE(s);
+
+  if (s->segment)
+    {
+      zlog_warn ("stream_putw_at(): called on shared stream %p", s);
+      return 0;
+    }
   
   if (!PUT_AT_VALID (s, putp + sizeof (u_int16_t)))
     {
@@ -602,6 +657,12 @@ int
 stream_putl_at (struct stream *s, size_t putp, u_int32_t l)
 {
   STREAM_VERIFY_SANE(s);
+
+  if (s->segment)
+    {
+      zlog_warn ("stream_putl_at(): called on shared stream %p", s);
+      return 0;
+    }
   
   if (!PUT_AT_VALID (s, putp + sizeof (u_int32_t)))
     {
@@ -620,6 +681,12 @@ int
 stream_putq_at (struct stream *s, size_t putp, uint64_t q)
 {
   STREAM_VERIFY_SANE(s);
+
+  if (s->segment)
+    {
+      zlog_warn ("stream_putq_at(): called on shared stream %p", s);
+      return 0;
+    }
   
   if (!PUT_AT_VALID (s, putp + sizeof (uint64_t)))
     {
@@ -886,9 +953,37 @@ stream_reset (struct stream *s)
 {
   STREAM_VERIFY_SANE (s);
 
+  if (s->segment)
+    {
+      zlog_warn ("stream_reset(): called on shared stream %p", s);
+      return;
+    }
+
   s->getp = s->endp = 0;
 }
 
+/* Move the data which was not read yet to the start of the stream,
+   making room for more after it. */
+void
+stream_pulldown (struct stream *s)
+{
+  size_t len;
+
+  STREAM_VERIFY_SANE (s);
+
+  if (s->segment)
+    {
+      zlog_warn ("stream_pulldown(): called on shared stream %p", s);
+      return;
+    }
+
+  len = STREAM_READABLE (s);
+  if (len && s->getp)
+    memmove (s->data, s->data + s->getp, len);
+  s->getp = 0;
+  s->endp = len;
+}
+
 /* Write stream contens to the file discriptor. */
 int
 stream_flush (struct stream *s, int fd)
@@ -976,3 +1071,30 @@ stream_fifo_free (struct stream_fifo *fifo)
   stream_fifo_clean (fifo);
   XFREE (MTYPE_STREAM_FIFO, fifo);
 }
+
+#ifdef IOV_MAX
+#define STREAM_IOV_MAX ((IOV_MAX >= 64) ? 64 : IOV_MAX)
+#else
+#define STREAM_IOV_MAX 16
+#endif
+
+ssize_t
+stream_fifo_writev (struct stream_fifo *fifo, int fd, int max)
+{
+  struct iovec iov[STREAM_IOV_MAX];
+  struct stream *s;
+  int iovcnt = 0;
+
+  if (max > STREAM_IOV_MAX)
+    max = STREAM_IOV_MAX;
+
+  for (s = fifo->head; s && iovcnt < max; s = s->next)
+    {
+      STREAM_VERIFY_SANE (s);
+      iov[iovcnt].iov_base = s->data + s->getp;
+      iov[iovcnt].iov_len = s->endp - s->getp;
+      iovcnt++;
+    }
+
+  return writev (fd, iov, iovcnt);
+}
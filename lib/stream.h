@@ -89,6 +89,13 @@
  *
  * Best practice is to use stream_put (<stream *>, NULL, <size>) to zero out
  * any part of a stream which isn't otherwise written to.
+ *
+ * Shared data:
+ * stream_share() returns a new stream reading the same data as the one
+ * given, without copying it.  From then on the data is an immutable
+ * segment, refcounted by all the streams using it and freed along with
+ * the last of them.  Each stream keeps its own getp, so the same packet
+ * can sit on many output queues, but none of them may be written to.
  */
 
 /* Stream buffer. */
@@ -104,6 +111,14 @@ struct stream
   size_t endp;		/* last valid data position */
   size_t size;		/* size of data segment */
   unsigned char *data; /* data pointer */
+  struct stream_segment *segment; /* set when data is shared */
+};
+
+/* Data shared by several streams, see stream_share(). */
+struct stream_segment
+{
+  unsigned long refcnt;
+  unsigned char *data;
 };
 
 /* First in first out queue structure. */
@@ -139,6 +154,7 @@ extern struct stream *stream_new (size_t);
 extern void stream_free (struct stream *);
 extern struct stream * stream_copy (struct stream *, struct stream *src);
 extern struct stream *stream_dup (struct stream *);
+extern struct stream *stream_share (struct stream *);
 extern size_t stream_resize (struct stream *, size_t);
 extern size_t stream_get_getp (struct stream *);
 extern size_t stream_get_endp (struct stream *);
@@ -204,6 +220,8 @@ extern size_t stream_write (struct stream *, const void *, size_t);
 
 /* reset the stream. See Note above */
 extern void stream_reset (struct stream *);
+/* move the unread data to the start of the stream */
+extern void stream_pulldown (struct stream *);
 extern int stream_flush (struct stream *, int);
 extern int stream_empty (struct stream *); /* is the stream empty? */
 
@@ -218,4 +236,9 @@ extern struct stream *stream_fifo_head (struct stream_fifo *fifo);
 extern void stream_fifo_clean (struct stream_fifo *fifo);
 extern void stream_fifo_free (struct stream_fifo *fifo);
 
+/* Write the readable data of up to max streams from the head of the
+   fifo with one writev(), returning what that does.  The streams are
+   left for the caller to advance or pop as the result tells. */
+extern ssize_t stream_fifo_writev (struct stream_fifo *fifo, int fd, int max);
+
 #endif /* _ZEBRA_STREAM_H */
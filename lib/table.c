@@ -47,10 +47,12 @@ route_table_finish (struct route_table *rt)
 
 /* Allocate new route node. */
 static struct route_node *
-route_node_new (void)
+route_node_new (struct route_table *table)
 {
   struct route_node *node;
   node = XCALLOC (MTYPE_ROUTE_NODE, sizeof (struct route_node));
+  node->table = table;
+  table->count++;
   return node;
 }
 
@@ -60,10 +62,9 @@ route_node_set (struct route_table *table, struct prefix *prefix)
 {
   struct route_node *node;
   
-  node = route_node_new ();
+  node = route_node_new (table);
 
   prefix_copy (&node->p, prefix);
-  node->table = table;
 
   return node;
 }
@@ -72,6 +73,7 @@ route_node_set (struct route_table *table, struct prefix *prefix)
 static void
 route_node_free (struct route_node *node)
 {
+  node->table->count--;
   XFREE (MTYPE_ROUTE_NODE, node);
 }
 
@@ -119,7 +121,9 @@ route_table_free (struct route_table *rt)
 	  break;
 	}
     }
- 
+
+  if (rt->index)
+    XFREE (MTYPE_ROUTE_TABLE_INDEX, rt->index);
   XFREE (MTYPE_ROUTE_TABLE, rt);
   return;
 }
@@ -165,6 +169,141 @@ route_common (struct prefix *n, struct prefix *p, struct prefix *new)
     }
 }
 
+/* Same as prefix_match(), which the tree walks below can't afford to
+   call for every node. */
+static inline int
+route_prefix_match (const struct prefix *n, const struct prefix *p)
+{
+  int offset;
+  int shift;
+  const u_char *np, *pp;
+
+  if (n->prefixlen > p->prefixlen)
+    return 0;
+
+  np = (const u_char *)&n->u.prefix;
+  pp = (const u_char *)&p->u.prefix;
+
+  offset = n->prefixlen / 8;
+  shift =  n->prefixlen % 8;
+
+  if (shift)
+    if (maskbit[shift] & (np[offset] ^ pp[offset]))
+      return 0;
+
+  while (offset--)
+    if (np[offset] != pp[offset])
+      return 0;
+  return 1;
+}
+
+/* First stride of a prefix, used as the index slot. */
+static inline unsigned int
+route_index_slot (const struct prefix *p)
+{
+  const u_char *pp = (const u_char *)&p->u.prefix;
+  u_int32_t key;
+
+  key = (pp[0] << 24) | (pp[1] << 16) | (pp[2] << 8) | pp[3];
+  return key >> (32 - ROUTE_TABLE_INDEX_BITS);
+}
+
+/* Point the slots covered by a new node at it, unless a longer node
+   already covers them.  All nodes covering a slot lie on one path
+   from the top of the tree, so the longest is the deepest. */
+static void
+route_index_add (struct route_table *table, struct route_node *node)
+{
+  struct route_node **slot;
+  unsigned int n;
+
+  if (table->index == NULL || node->p.prefixlen > ROUTE_TABLE_INDEX_BITS)
+    return;
+
+  n = 1U << (ROUTE_TABLE_INDEX_BITS - node->p.prefixlen);
+  slot = table->index + (route_index_slot (&node->p) & ~(n - 1));
+
+  for (; n; n--, slot++)
+    if (*slot == NULL || (*slot)->p.prefixlen < node->p.prefixlen)
+      *slot = node;
+}
+
+/* A node is going away, its parent becomes the deepest node covering
+   the slots it was indexed by. */
+static void
+route_index_del (struct route_table *table, struct route_node *node)
+{
+  struct route_node **slot;
+  unsigned int n;
+
+  if (table->index == NULL || node->p.prefixlen > ROUTE_TABLE_INDEX_BITS)
+    return;
+
+  n = 1U << (ROUTE_TABLE_INDEX_BITS - node->p.prefixlen);
+  slot = table->index + (route_index_slot (&node->p) & ~(n - 1));
+
+  for (; n; n--, slot++)
+    if (*slot == node)
+      *slot = node->parent;
+}
+
+static void
+route_index_build (struct route_table *table)
+{
+  struct route_node *node;
+
+  table->index = XCALLOC (MTYPE_ROUTE_TABLE_INDEX,
+			  sizeof (struct route_node *)
+			  << ROUTE_TABLE_INDEX_BITS);
+
+  /* Nodes below the stride are never indexed, don't descend to them. */
+  node = table->top;
+  while (node)
+    {
+      route_index_add (table, node);
+
+      if (node->p.prefixlen < ROUTE_TABLE_INDEX_BITS
+	  && (node->l_left || node->l_right))
+	{
+	  node = node->l_left ? node->l_left : node->l_right;
+	  continue;
+	}
+
+      while (node->parent
+	     && (node->parent->l_right == node || ! node->parent->l_right))
+	node = node->parent;
+      node = node->parent ? node->parent->l_right : NULL;
+    }
+}
+
+/* Where to start walking down the tree to find P.  The returned node
+   and all its parents cover P, when it isn't the top. */
+static inline struct route_node *
+route_index_start (const struct route_table *table, const struct prefix *p)
+{
+  struct route_node *node;
+
+  if (table->index && p->prefixlen >= ROUTE_TABLE_INDEX_BITS
+      && (node = table->index[route_index_slot (p)]) != NULL)
+    return node;
+
+  return table->top;
+}
+
+/* Turn the first stride index of a table on or off.  It is on by
+   default, and built once the table holds enough nodes. */
+void
+route_table_set_index (struct route_table *table, int enable)
+{
+  table->index_disable = ! enable;
+
+  if (! enable && table->index)
+    XFREE (MTYPE_ROUTE_TABLE_INDEX, table->index);
+  else if (enable && table->index == NULL
+	   && table->count >= ROUTE_TABLE_INDEX_MIN)
+    route_index_build (table);
+}
+
 static void
 set_link (struct route_node *node, struct route_node *new)
 {
@@ -197,15 +336,16 @@ struct route_node *
 route_node_match (const struct route_table *table, const struct prefix *p)
 {
   struct route_node *node;
+  struct route_node *start;
   struct route_node *matched;
 
   matched = NULL;
-  node = table->top;
+  node = start = route_index_start (table, p);
 
   /* Walk down tree.  If there is matched route then store it to
      matched. */
   while (node && node->p.prefixlen <= p->prefixlen && 
-	 prefix_match (&node->p, p))
+	 route_prefix_match (&node->p, p))
     {
       if (node->info)
 	matched = node;
@@ -216,6 +356,15 @@ route_node_match (const struct route_table *table, const struct prefix *p)
       node = node->link[prefix_bit(&p->u.prefix, node->p.prefixlen)];
     }
 
+  /* The walk may have started below the top, look above it too. */
+  if (! matched && start)
+    for (node = start->parent; node; node = node->parent)
+      if (node->info)
+	{
+	  matched = node;
+	  break;
+	}
+
   /* If matched route found, return it. */
   if (matched)
     return route_lock_node (matched);
@@ -259,10 +408,10 @@ route_node_lookup (struct route_table *table, struct prefix *p)
 {
   struct route_node *node;
 
-  node = table->top;
+  node = route_index_start (table, p);
 
   while (node && node->p.prefixlen <= p->prefixlen && 
-	 prefix_match (&node->p, p))
+	 route_prefix_match (&node->p, p))
     {
       if (node->p.prefixlen == p->prefixlen)
         return node->info ? route_lock_node (node) : NULL;
@@ -281,10 +430,10 @@ route_node_get (struct route_table *table, struct prefix *p)
   struct route_node *node;
   struct route_node *match;
 
-  match = NULL;
-  node = table->top;
+  node = route_index_start (table, p);
+  match = node ? node->parent : NULL;
   while (node && node->p.prefixlen <= p->prefixlen && 
-	 prefix_match (&node->p, p))
+	 route_prefix_match (&node->p, p))
     {
       if (node->p.prefixlen == p->prefixlen)
         return route_lock_node (node);
@@ -303,16 +452,16 @@ route_node_get (struct route_table *table, struct prefix *p)
     }
   else
     {
-      new = route_node_new ();
+      new = route_node_new (table);
       route_common (&node->p, p, &new->p);
       new->p.family = p->family;
-      new->table = table;
       set_link (new, node);
 
       if (match)
 	set_link (match, new);
       else
 	table->top = new;
+      route_index_add (table, new);
 
       if (new->p.prefixlen != p->prefixlen)
 	{
@@ -321,7 +470,12 @@ route_node_get (struct route_table *table, struct prefix *p)
 	  set_link (match, new);
 	}
     }
+  route_index_add (table, new);
   route_lock_node (new);
+
+  if (table->index == NULL && ! table->index_disable
+      && table->count >= ROUTE_TABLE_INDEX_MIN)
+    route_index_build (table);
   
   return new;
 }
@@ -330,6 +484,7 @@ route_node_get (struct route_table *table, struct prefix *p)
 void
 route_node_delete (struct route_node *node)
 {
+  struct route_table *table;
   struct route_node *child;
   struct route_node *parent;
 
@@ -344,8 +499,11 @@ route_node_delete (struct route_node *node)
   else
     child = node->l_right;
 
+  table = node->table;
   parent = node->parent;
 
+  route_index_del (table, node);
+
   if (child)
     child->parent = parent;
 
@@ -357,10 +515,14 @@ route_node_delete (struct route_node *node)
 	parent->l_right = child;
     }
   else
-    node->table->top = child;
+    table->top = child;
 
   route_node_free (node);
 
+  /* Don't keep the index of a table that has been flushed. */
+  if (table->index && table->count < ROUTE_TABLE_INDEX_MIN / 2)
+    XFREE (MTYPE_ROUTE_TABLE_INDEX, table->index);
+
   /* If parent node is stub then delete it also. */
   if (parent && parent->lock == 0)
     route_node_delete (parent);
@@ -26,10 +26,25 @@
 /* for struct prefix */
 #include "prefix.h"
 
+/* The radix tree is level compressed at the top: once a table holds
+   ROUTE_TABLE_INDEX_MIN nodes, an array indexed by the first
+   ROUTE_TABLE_INDEX_BITS bits of a prefix points at the deepest node
+   no longer than that stride covering it, so lookups skip the upper
+   levels of the tree. */
+#define ROUTE_TABLE_INDEX_BITS  16
+#define ROUTE_TABLE_INDEX_MIN   8192
+
 /* Routing table top structure. */
 struct route_table
 {
   struct route_node *top;
+
+  /* Number of nodes, including internal ones. */
+  unsigned long count;
+
+  /* First stride index, NULL until the table grows large enough. */
+  struct route_node **index;
+  int index_disable;
 };
 
 /* Each routing entry. */
@@ -38,12 +53,13 @@ struct route_node
   /* Actual prefix of this radix. */
   struct prefix p;
 
-  /* Tree link. */
-  struct route_table *table;
-  struct route_node *parent;
+  /* Tree link.  Kept next to the prefix, which is all a lookup
+     touches. */
   struct route_node *link[2];
 #define l_left   link[0]
 #define l_right  link[1]
+  struct route_node *parent;
+  struct route_table *table;
 
   /* Lock of this radix */
   unsigned int lock;
@@ -58,6 +74,7 @@ struct route_node
 /* Prototypes. */
 extern struct route_table *route_table_init (void);
 extern void route_table_finish (struct route_table *);
+extern void route_table_set_index (struct route_table *, int);
 extern void route_unlock_node (struct route_node *node);
 extern void route_node_delete (struct route_node *node);
 extern struct route_node *route_top (struct route_table *);
@@ -29,6 +29,12 @@
 #include "hash.h"
 #include "command.h"
 #include "sigevent.h"
+#include "pqueue.h"
+#include "linklist.h"
+
+#ifdef HAVE_EPOLL
+#include <sys/epoll.h>
+#endif /* HAVE_EPOLL */
 
 /* Recent absolute time of day */
 struct timeval recent_time;
@@ -40,6 +46,41 @@ static struct timeval relative_time_base;
 static unsigned short timers_inited;
 
 static struct hash *cpu_record = NULL;
+
+/* All thread masters, for timer queue statistics. */
+static struct list *thread_masters = NULL;
+
+/* I/O event backends.
+ *
+ * A backend keeps the system's view of the descriptors we are
+ * interested in up to date, and waits for some of them to become ready.
+ * select() is always available.  Where the system has epoll it is used
+ * in preference: the interest set is kept in the kernel rather than
+ * being copied in on every wait, readiness is reported per descriptor
+ * rather than by scanning every pending I/O thread, and descriptors are
+ * not limited to FD_SETSIZE.
+ */
+#define THREAD_IO_READ		(1 << 0)
+#define THREAD_IO_WRITE		(1 << 1)
+
+struct thread_io_backend
+{
+  const char *name;
+
+  /* Set up backend state in the master, returns 0 on success. */
+  int (*init) (struct thread_master *);
+  void (*finish) (struct thread_master *);
+
+  /* Interest in fd has changed from the old to the new THREAD_IO_
+   * mask.  Returns 0 on success, -1 with errno set otherwise. */
+  int (*update) (struct thread_master *, int fd, int old, int new_events);
+
+  /* Wait for I/O, at most timer_wait (NULL is forever), and move the
+   * threads of ready descriptors onto the given list.  Returns the
+   * number of ready descriptors, or -1 with errno set. */
+  int (*wait) (struct thread_master *, struct timeval *timer_wait,
+	       struct thread_list *ready);
+};
 
 /* Struct timeval's tv_usec one second value.  */
 #define TIMER_SECOND_MICRO 1000000L
@@ -323,6 +364,62 @@ cpu_record_print(struct vty *vty, thread_type filter)
     vty_out_cpu_thread_history(vty, &tmp);
 }
 
+static void
+vty_out_timer_stats (struct vty *vty, const char *name,
+		     struct pqueue *queue, struct thread_timer_stats *stats)
+{
+  vty_out (vty, "%-12s %9d %9d %10lu %10lu%s", name, queue->size,
+	   stats->peak, stats->added, stats->cancelled, VTY_NEWLINE);
+}
+
+/* Depth of the timer queues, which the threads above were run from. */
+static void
+timer_stats_print (struct vty *vty, thread_type filter)
+{
+  struct listnode *node;
+  struct thread_master *m;
+
+  if (!thread_masters
+      || !(filter & ((1 << THREAD_TIMER) | (1 << THREAD_BACKGROUND))))
+    return;
+
+  vty_out (vty, "%sTimer queue    Pending      Peak      Added  Cancelled%s",
+	   VTY_NEWLINE, VTY_NEWLINE);
+  for (ALL_LIST_ELEMENTS_RO (thread_masters, node, m))
+    {
+      if (filter & (1 << THREAD_TIMER))
+	vty_out_timer_stats (vty, "Timer", m->timer, &m->timer_stats);
+      if (filter & (1 << THREAD_BACKGROUND))
+	vty_out_timer_stats (vty, "Background", m->background,
+			     &m->background_stats);
+    }
+}
+
+static void
+timer_stats_clear (thread_type filter)
+{
+  struct listnode *node;
+  struct thread_master *m;
+
+  if (!thread_masters)
+    return;
+
+  for (ALL_LIST_ELEMENTS_RO (thread_masters, node, m))
+    {
+      if (filter & (1 << THREAD_TIMER))
+	{
+	  memset (&m->timer_stats, 0, sizeof (struct thread_timer_stats));
+	  m->timer_stats.peak = m->timer->size;
+	}
+      if (filter & (1 << THREAD_BACKGROUND))
+	{
+	  memset (&m->background_stats, 0,
+		  sizeof (struct thread_timer_stats));
+	  m->background_stats.peak = m->background->size;
+	}
+    }
+}
+
 DEFUN(show_thread_cpu,
       show_thread_cpu_cmd,
       "show thread cpu [FILTER]",
@@ -380,6 +477,7 @@ DEFUN(show_thread_cpu,
     }
 
   cpu_record_print(vty, filter);
+  timer_stats_print(vty, filter);
   return CMD_SUCCESS;
 }
 
@@ -463,6 +561,7 @@ DEFUN(clear_thread_cpu,
     }
 
   cpu_record_clear (filter);
+  timer_stats_clear (filter);
   return CMD_SUCCESS;
 }
 
@@ -483,15 +582,16 @@ thread_master_debug (struct thread_master *m)
   thread_list_debug (&m->read);
   printf ("writelist : ");
   thread_list_debug (&m->write);
-  printf ("timerlist : ");
-  thread_list_debug (&m->timer);
+  printf ("timerqueue: size [%d] array [%d]\n",
+	  m->timer->size, m->timer->array_size);
   printf ("eventlist : ");
   thread_list_debug (&m->event);
   printf ("unuselist : ");
   thread_list_debug (&m->unuse);
-  printf ("bgndlist : ");
-  thread_list_debug (&m->background);
+  printf ("bgndqueue : size [%d] array [%d]\n",
+	  m->background->size, m->background->array_size);
   printf ("total alloc: [%ld]\n", m->alloc);
+  printf ("io backend: [%s] fd index [%d]\n", m->io->name, m->fd_size);
   printf ("-----------\n");
 }
 
@@ -505,19 +605,6 @@ install_thread_cmds(void)
   install_element (ENABLE_NODE, &clear_thread_cpu_cmd);
 }
 
-/* Allocate new thread master.  */
-struct thread_master *
-thread_master_create ()
-{
-  if (cpu_record == NULL) 
-    cpu_record 
-      = hash_create_size (1011, (unsigned int (*) (void *))cpu_record_hash_key, 
-                          (int (*) (const void *, const void *))cpu_record_hash_cmp);
-    
-  return (struct thread_master *) XCALLOC (MTYPE_THREAD_MASTER,
-					   sizeof (struct thread_master));
-}
-
 /* Add a new thread to the list.  */
 static void
 thread_list_add (struct thread_list *list, struct thread *thread)
@@ -532,22 +619,6 @@ thread_list_add (struct thread_list *list, struct thread *thread)
   list->count++;
 }
 
-/* Add a new thread just before the point.  */
-static void
-thread_list_add_before (struct thread_list *list, 
-			struct thread *point, 
-			struct thread *thread)
-{
-  thread->next = point;
-  thread->prev = point->prev;
-  if (point->prev)
-    point->prev->next = thread;
-  else
-    list->head = thread;
-  point->prev = thread;
-  list->count++;
-}
-
 /* Delete a thread from the list. */
 static struct thread *
 thread_list_delete (struct thread_list *list, struct thread *thread)
@@ -565,6 +636,25 @@ thread_list_delete (struct thread_list *list, struct thread *thread)
   return thread;
 }
 
+/* Move all threads of src onto the tail of list, leaving src empty. */
+static void
+thread_list_append (struct thread_list *list, struct thread_list *src)
+{
+  if (!src->head)
+    return;
+
+  src->head->prev = list->tail;
+  if (list->tail)
+    list->tail->next = src->head;
+  else
+    list->head = src->head;
+  list->tail = src->tail;
+  list->count += src->count;
+
+  src->head = src->tail = NULL;
+  src->count = 0;
+}
+
 /* Move thread to unuse list. */
 static void
 thread_add_unuse (struct thread_master *m, struct thread *thread)
@@ -577,6 +667,377 @@ thread_add_unuse (struct thread_master *m, struct thread *thread)
   /* XXX: Should we deallocate funcname here? */
 }
 
+/* Initial size of the fd -> thread index. */
+#define THREAD_FD_INDEX_MIN	64
+
+/* Make sure fd can be used to index m->fd_read and m->fd_write. */
+static void
+thread_fd_index_grow (struct thread_master *m, int fd)
+{
+  int size;
+
+  if (fd < m->fd_size)
+    return;
+
+  size = m->fd_size ? m->fd_size : THREAD_FD_INDEX_MIN;
+  while (size <= fd)
+    size *= 2;
+
+  m->fd_read = XREALLOC (MTYPE_THREAD_FD_INDEX, m->fd_read,
+			 size * sizeof (struct thread *));
+  m->fd_write = XREALLOC (MTYPE_THREAD_FD_INDEX, m->fd_write,
+			  size * sizeof (struct thread *));
+  memset (m->fd_read + m->fd_size, 0,
+	  (size - m->fd_size) * sizeof (struct thread *));
+  memset (m->fd_write + m->fd_size, 0,
+	  (size - m->fd_size) * sizeof (struct thread *));
+  m->fd_size = size;
+}
+
+/* THREAD_IO_ mask of the threads currently waiting on fd. */
+static int
+thread_fd_events (struct thread_master *m, int fd)
+{
+  int events = 0;
+
+  if (fd >= 0 && fd < m->fd_size)
+    {
+      if (m->fd_read[fd])
+	events |= THREAD_IO_READ;
+      if (m->fd_write[fd])
+	events |= THREAD_IO_WRITE;
+    }
+  return events;
+}
+
+/* Descriptor of an I/O thread is ready: take it out of the fd index and
+ * move it to the given ready list.  The backend is responsible for
+ * updating its own interest set. */
+static void
+thread_io_ready (struct thread_master *m, struct thread *thread,
+		 struct thread_list *ready)
+{
+  int fd = THREAD_FD (thread);
+
+  if (thread->type == THREAD_READ)
+    {
+      assert (m->fd_read[fd] == thread);
+      m->fd_read[fd] = NULL;
+      thread_list_delete (&m->read, thread);
+    }
+  else
+    {
+      assert (thread->type == THREAD_WRITE);
+      assert (m->fd_write[fd] == thread);
+      m->fd_write[fd] = NULL;
+      thread_list_delete (&m->write, thread);
+    }
+  thread_list_add (ready, thread);
+  thread->type = THREAD_READY;
+}
+
+/* select() backend. */
+static int
+thread_select_init (struct thread_master *m)
+{
+  FD_ZERO (&m->readfd);
+  FD_ZERO (&m->writefd);
+  FD_ZERO (&m->exceptfd);
+  return 0;
+}
+
+static void
+thread_select_finish (struct thread_master *m)
+{
+}
+
+static int
+thread_select_update (struct thread_master *m, int fd, int old,
+		      int new_events)
+{
+  if (fd >= FD_SETSIZE)
+    {
+      errno = EINVAL;
+      return -1;
+    }
+
+  if (new_events & THREAD_IO_READ)
+    FD_SET (fd, &m->readfd);
+  else
+    FD_CLR (fd, &m->readfd);
+
+  if (new_events & THREAD_IO_WRITE)
+    FD_SET (fd, &m->writefd);
+  else
+    FD_CLR (fd, &m->writefd);
+
+  return 0;
+}
+
+static void
+thread_select_process (struct thread_master *m, struct thread_list *list,
+		       fd_set *fdset, fd_set *mfdset,
+		       struct thread_list *ready)
+{
+  struct thread *thread;
+  struct thread *next;
+
+  for (thread = list->head; thread; thread = next)
+    {
+      next = thread->next;
+
+      if (FD_ISSET (THREAD_FD (thread), fdset))
+        {
+          assert (FD_ISSET (THREAD_FD (thread), mfdset));
+          FD_CLR (THREAD_FD (thread), mfdset);
+          thread_io_ready (m, thread, ready);
+        }
+    }
+}
+
+static int
+thread_select_wait (struct thread_master *m, struct timeval *timer_wait,
+		    struct thread_list *ready)
+{
+  fd_set readfd;
+  fd_set writefd;
+  fd_set exceptfd;
+  int num;
+
+  /* Structure copy.  */
+  readfd = m->readfd;
+  writefd = m->writefd;
+  exceptfd = m->exceptfd;
+
+  num = select (FD_SETSIZE, &readfd, &writefd, &exceptfd, timer_wait);
+
+  if (num > 0)
+    {
+      /* Normal priority read thead. */
+      thread_select_process (m, &m->read, &readfd, &m->readfd, ready);
+      /* Write thead. */
+      thread_select_process (m, &m->write, &writefd, &m->writefd, ready);
+    }
+  return num;
+}
+
+static const struct thread_io_backend thread_select_backend =
+{
+  "select",
+  thread_select_init,
+  thread_select_finish,
+  thread_select_update,
+  thread_select_wait,
+};
+
+#ifdef HAVE_EPOLL
+/* epoll backend.  The event buffer starts small and doubles, up to a
+ * limit, whenever a wait fills it. */
+#define THREAD_EPOLL_EVENTS_MIN	64
+#define THREAD_EPOLL_EVENTS_MAX	4096
+
+static int
+thread_epoll_init (struct thread_master *m)
+{
+  m->epoll_fd = epoll_create (THREAD_EPOLL_EVENTS_MIN);
+  if (m->epoll_fd < 0)
+    {
+      zlog_warn ("epoll_create() error: %s, falling back to select()",
+		 safe_strerror (errno));
+      return -1;
+    }
+  fcntl (m->epoll_fd, F_SETFD, FD_CLOEXEC);
+
+  m->events_size = THREAD_EPOLL_EVENTS_MIN;
+  m->events = XCALLOC (MTYPE_THREAD_POLL,
+		       m->events_size * sizeof (struct epoll_event));
+  return 0;
+}
+
+static void
+thread_epoll_finish (struct thread_master *m)
+{
+  close (m->epoll_fd);
+  m->epoll_fd = -1;
+  XFREE (MTYPE_THREAD_POLL, m->events);
+  m->events_size = 0;
+}
+
+static int
+thread_epoll_update (struct thread_master *m, int fd, int old,
+		     int new_events)
+{
+  struct epoll_event ev;
+  int op;
+  int ret;
+
+  memset (&ev, 0, sizeof (struct epoll_event));
+  ev.data.fd = fd;
+  if (new_events & THREAD_IO_READ)
+    ev.events |= EPOLLIN;
+  if (new_events & THREAD_IO_WRITE)
+    ev.events |= EPOLLOUT;
+
+  /* The descriptor may already have been closed, which removes it from
+   * the epoll set, so a failure to delete is not an error. */
+  if (!new_events)
+    {
+      epoll_ctl (m->epoll_fd, EPOLL_CTL_DEL, fd, &ev);
+      return 0;
+    }
+
+  op = old ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+  ret = epoll_ctl (m->epoll_fd, op, fd, &ev);
+
+  /* Our view and the kernel's can differ when a descriptor was closed
+   * and its number reused behind our back. */
+  if (ret < 0 && op == EPOLL_CTL_MOD && errno == ENOENT)
+    ret = epoll_ctl (m->epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+  else if (ret < 0 && op == EPOLL_CTL_ADD && errno == EEXIST)
+    ret = epoll_ctl (m->epoll_fd, EPOLL_CTL_MOD, fd, &ev);
+
+  return ret;
+}
+
+static int
+thread_epoll_wait (struct thread_master *m, struct timeval *timer_wait,
+		   struct thread_list *ready)
+{
+  struct epoll_event *events = m->events;
+  int timeout = -1;
+  int num;
+  int i;
+
+  /* Round up, so that we do not spin until a timer is due. */
+  if (timer_wait)
+    timeout = timer_wait->tv_sec * 1000 + (timer_wait->tv_usec + 999) / 1000;
+
+  num = epoll_wait (m->epoll_fd, events, m->events_size, timeout);
+  if (num <= 0)
+    return num;
+
+  for (i = 0; i < num; i++)
+    {
+      int fd = events[i].data.fd;
+      uint32_t revents = events[i].events;
+      int old = thread_fd_events (m, fd);
+      int new_events;
+
+      /* Errors and hangups are reported to whoever is waiting, as
+       * select() would report the descriptor readable and writable. */
+      if ((old & THREAD_IO_READ)
+	  && (revents & (EPOLLIN | EPOLLHUP | EPOLLERR)))
+	thread_io_ready (m, m->fd_read[fd], ready);
+      if ((old & THREAD_IO_WRITE)
+	  && (revents & (EPOLLOUT | EPOLLHUP | EPOLLERR)))
+	thread_io_ready (m, m->fd_write[fd], ready);
+
+      new_events = thread_fd_events (m, fd);
+      if (new_events != old || !new_events)
+	thread_epoll_update (m, fd, old, new_events);
+    }
+
+  if (num == m->events_size && m->events_size < THREAD_EPOLL_EVENTS_MAX)
+    {
+      m->events_size *= 2;
+      m->events = XREALLOC (MTYPE_THREAD_POLL, m->events,
+			    m->events_size * sizeof (struct epoll_event));
+    }
+
+  return num;
+}
+
+static const struct thread_io_backend thread_epoll_backend =
+{
+  "epoll",
+  thread_epoll_init,
+  thread_epoll_finish,
+  thread_epoll_update,
+  thread_epoll_wait,
+};
+#endif /* HAVE_EPOLL */
+
+/* Backends in order of preference, the last must not fail to init. */
+static const struct thread_io_backend *thread_io_backends[] =
+{
+#ifdef HAVE_EPOLL
+  &thread_epoll_backend,
+#endif /* HAVE_EPOLL */
+  &thread_select_backend,
+  NULL
+};
+
+/* Timer queues are binary heaps ordered by expiry time, each thread
+ * keeping its own position so it can be cancelled in O(log n). */
+static int
+thread_timer_cmp (void *a, void *b)
+{
+  struct thread *thread_a = a;
+  struct thread *thread_b = b;
+  long cmp;
+
+  cmp = timeval_cmp (thread_a->u.sands, thread_b->u.sands);
+  if (cmp < 0)
+    return -1;
+  if (cmp > 0)
+    return 1;
+  return 0;
+}
+
+static void
+thread_timer_update (void *node, int actual_position)
+{
+  struct thread *thread = node;
+
+  thread->index = actual_position;
+}
+
+static struct pqueue *
+thread_timer_queue_create (void)
+{
+  struct pqueue *queue;
+
+  queue = pqueue_create ();
+  queue->cmp = thread_timer_cmp;
+  queue->update = thread_timer_update;
+  return queue;
+}
+
+/* Allocate new thread master.  */
+struct thread_master *
+thread_master_create ()
+{
+  struct thread_master *m;
+  int i;
+
+  if (cpu_record == NULL) 
+    {
+      cpu_record 
+        = hash_create_size (1011, (unsigned int (*) (void *))cpu_record_hash_key, 
+                            (int (*) (const void *, const void *))cpu_record_hash_cmp);
+      hash_set_name (cpu_record, "Thread CPU history");
+    }
+    
+  m = XCALLOC (MTYPE_THREAD_MASTER, sizeof (struct thread_master));
+  m->epoll_fd = -1;
+  m->timer = thread_timer_queue_create ();
+  m->background = thread_timer_queue_create ();
+
+  for (i = 0; thread_io_backends[i]; i++)
+    if (thread_io_backends[i]->init (m) == 0)
+      {
+        m->io = thread_io_backends[i];
+        break;
+      }
+  assert (m->io);
+
+  if (thread_masters == NULL)
+    thread_masters = list_new ();
+  listnode_add (thread_masters, m);
+
+  return m;
+}
+
 /* Free all unused thread. */
 static void
 thread_list_free (struct thread_master *m, struct thread_list *list)
@@ -595,17 +1056,48 @@ thread_list_free (struct thread_master *m, struct thread_list *list)
     }
 }
 
+/* Free all threads in a timer queue, and the queue. */
+static void
+thread_queue_free (struct thread_master *m, struct pqueue *queue)
+{
+  int i;
+
+  for (i = 0; i < queue->size; i++)
+    {
+      struct thread *t = queue->array[i];
+
+      if (t->funcname)
+        XFREE (MTYPE_THREAD_FUNCNAME, t->funcname);
+      XFREE (MTYPE_THREAD, t);
+      m->alloc--;
+    }
+  pqueue_delete (queue);
+}
+
 /* Stop thread scheduler. */
 void
 thread_master_free (struct thread_master *m)
 {
   thread_list_free (m, &m->read);
   thread_list_free (m, &m->write);
-  thread_list_free (m, &m->timer);
+  thread_queue_free (m, m->timer);
   thread_list_free (m, &m->event);
   thread_list_free (m, &m->ready);
   thread_list_free (m, &m->unuse);
-  thread_list_free (m, &m->background);
+  thread_queue_free (m, m->background);
+
+  listnode_delete (thread_masters, m);
+  if (list_isempty (thread_masters))
+    {
+      list_free (thread_masters);
+      thread_masters = NULL;
+    }
+
+  m->io->finish (m);
+  if (m->fd_read)
+    XFREE (MTYPE_THREAD_FD_INDEX, m->fd_read);
+  if (m->fd_write)
+    XFREE (MTYPE_THREAD_FD_INDEX, m->fd_write);
   
   XFREE (MTYPE_THREAD_MASTER, m);
 
@@ -695,56 +1187,88 @@ thread_get (struct thread_master *m, u_char type,
   thread->master = m;
   thread->func = func;
   thread->arg = arg;
+  thread->index = -1;
   
   thread->funcname = strip_funcname(funcname);
 
   return thread;
 }
 
-/* Add new read thread. */
-struct thread *
-funcname_thread_add_read (struct thread_master *m, 
-		 int (*func) (struct thread *), void *arg, int fd, const char* funcname)
+/* Add new read or write thread. */
+static struct thread *
+thread_add_fd (struct thread_master *m, u_char type,
+	       int (*func) (struct thread *), void *arg, int fd,
+	       const char* funcname)
 {
   struct thread *thread;
+  struct thread **slot;
+  const char *dir = (type == THREAD_READ) ? "read" : "write";
+  int old;
 
   assert (m != NULL);
+  assert (fd >= 0);
 
-  if (FD_ISSET (fd, &m->readfd))
+  thread_fd_index_grow (m, fd);
+  slot = (type == THREAD_READ) ? &m->fd_read[fd] : &m->fd_write[fd];
+
+  if (*slot)
+    {
+      zlog (NULL, LOG_WARNING, "There is already %s fd [%d]", dir, fd);
+      return NULL;
+    }
+
+  old = thread_fd_events (m, fd);
+  if (m->io->update (m, fd, old,
+		     old | (type == THREAD_READ
+			    ? THREAD_IO_READ : THREAD_IO_WRITE)) < 0)
     {
-      zlog (NULL, LOG_WARNING, "There is already read fd [%d]", fd);
+      zlog (NULL, LOG_WARNING, "Can't add %s fd [%d] to %s: %s",
+	    dir, fd, m->io->name, safe_strerror (errno));
       return NULL;
     }
 
-  thread = thread_get (m, THREAD_READ, func, arg, funcname);
-  FD_SET (fd, &m->readfd);
+  thread = thread_get (m, type, func, arg, funcname);
   thread->u.fd = fd;
-  thread_list_add (&m->read, thread);
+  *slot = thread;
+  thread_list_add ((type == THREAD_READ) ? &m->read : &m->write, thread);
 
   return thread;
 }
 
+/* Add new read thread. */
+struct thread *
+funcname_thread_add_read (struct thread_master *m, 
+		 int (*func) (struct thread *), void *arg, int fd, const char* funcname)
+{
+  return thread_add_fd (m, THREAD_READ, func, arg, fd, funcname);
+}
+
 /* Add new write thread. */
 struct thread *
 funcname_thread_add_write (struct thread_master *m,
 		 int (*func) (struct thread *), void *arg, int fd, const char* funcname)
 {
-  struct thread *thread;
+  return thread_add_fd (m, THREAD_WRITE, func, arg, fd, funcname);
+}
 
-  assert (m != NULL);
+/* Remove an I/O thread from the fd index and the backend's interest. */
+static void
+thread_fd_cancel (struct thread_master *m, struct thread *thread)
+{
+  int fd = THREAD_FD (thread);
+  int old = thread_fd_events (m, fd);
 
-  if (FD_ISSET (fd, &m->writefd))
+  if (thread->type == THREAD_READ)
     {
-      zlog (NULL, LOG_WARNING, "There is already write fd [%d]", fd);
-      return NULL;
+      assert (m->fd_read[fd] == thread);
+      m->fd_read[fd] = NULL;
     }
-
-  thread = thread_get (m, THREAD_WRITE, func, arg, funcname);
-  FD_SET (fd, &m->writefd);
-  thread->u.fd = fd;
-  thread_list_add (&m->write, thread);
-
-  return thread;
+  else
+    {
+      assert (m->fd_write[fd] == thread);
+      m->fd_write[fd] = NULL;
+    }
+  m->io->update (m, fd, old, thread_fd_events (m, fd));
 }
 
 static struct thread *
@@ -756,16 +1280,25 @@ funcname_thread_add_timer_timeval (struct thread_master *m,
                                   const char* funcname)
 {
   struct thread *thread;
-  struct thread_list *list;
+  struct pqueue *queue;
+  struct thread_timer_stats *stats;
   struct timeval alarm_time;
-  struct thread *tt;
 
   assert (m != NULL);
 
   assert (type == THREAD_TIMER || type == THREAD_BACKGROUND);
   assert (time_relative);
   
-  list = ((type == THREAD_TIMER) ? &m->timer : &m->background);
+  if (type == THREAD_TIMER)
+    {
+      queue = m->timer;
+      stats = &m->timer_stats;
+    }
+  else
+    {
+      queue = m->background;
+      stats = &m->background_stats;
+    }
   thread = thread_get (m, type, func, arg, funcname);
 
   /* Do we need jitter here? */
@@ -774,15 +1307,11 @@ funcname_thread_add_timer_timeval (struct thread_master *m,
   alarm_time.tv_usec = relative_time.tv_usec + time_relative->tv_usec;
   thread->u.sands = timeval_adjust(alarm_time);
 
-  /* Sort by timeval. */
-  for (tt = list->head; tt; tt = tt->next)
-    if (timeval_cmp (thread->u.sands, tt->u.sands) <= 0)
-      break;
+  pqueue_enqueue (thread, queue);
 
-  if (tt)
-    thread_list_add_before (list, tt, thread);
-  else
-    thread_list_add (list, thread);
+  stats->added++;
+  if (queue->size > stats->peak)
+    stats->peak = queue->size;
 
   return thread;
 }
@@ -873,17 +1402,19 @@ thread_cancel (struct thread *thread)
   switch (thread->type)
     {
     case THREAD_READ:
-      assert (FD_ISSET (thread->u.fd, &thread->master->readfd));
-      FD_CLR (thread->u.fd, &thread->master->readfd);
+      thread_fd_cancel (thread->master, thread);
       list = &thread->master->read;
       break;
     case THREAD_WRITE:
-      assert (FD_ISSET (thread->u.fd, &thread->master->writefd));
-      FD_CLR (thread->u.fd, &thread->master->writefd);
+      thread_fd_cancel (thread->master, thread);
       list = &thread->master->write;
       break;
     case THREAD_TIMER:
-      list = &thread->master->timer;
+      assert (thread->index >= 0);
+      pqueue_remove_at (thread->index, thread->master->timer);
+      thread->index = -1;
+      thread->master->timer_stats.cancelled++;
+      list = NULL;
       break;
     case THREAD_EVENT:
       list = &thread->master->event;
@@ -892,13 +1423,18 @@ thread_cancel (struct thread *thread)
       list = &thread->master->ready;
       break;
     case THREAD_BACKGROUND:
-      list = &thread->master->background;
+      assert (thread->index >= 0);
+      pqueue_remove_at (thread->index, thread->master->background);
+      thread->index = -1;
+      thread->master->background_stats.cancelled++;
+      list = NULL;
       break;
     default:
       return;
       break;
     }
-  thread_list_delete (list, thread);
+  if (list)
+    thread_list_delete (list, thread);
   thread->type = THREAD_UNUSED;
   thread_add_unuse (thread->master, thread);
 }
@@ -930,11 +1466,13 @@ thread_cancel_event (struct thread_master *m, void *arg)
 }
 
 static struct timeval *
-thread_timer_wait (struct thread_list *tlist, struct timeval *timer_val)
+thread_timer_wait (struct pqueue *queue, struct timeval *timer_val)
 {
-  if (!thread_empty (tlist))
+  if (queue->size)
     {
-      *timer_val = timeval_subtract (tlist->head->u.sands, relative_time);
+      struct thread *next_timer = queue->array[0];
+
+      *timer_val = timeval_subtract (next_timer->u.sands, relative_time);
       return timer_val;
     }
   return NULL;
@@ -951,44 +1489,20 @@ thread_run (struct thread_master *m, struct thread *thread,
   return fetch;
 }
 
-static int
-thread_process_fd (struct thread_list *list, fd_set *fdset, fd_set *mfdset)
-{
-  struct thread *thread;
-  struct thread *next;
-  int ready = 0;
-  
-  assert (list);
-  
-  for (thread = list->head; thread; thread = next)
-    {
-      next = thread->next;
-
-      if (FD_ISSET (THREAD_FD (thread), fdset))
-        {
-          assert (FD_ISSET (THREAD_FD (thread), mfdset));
-          FD_CLR(THREAD_FD (thread), mfdset);
-          thread_list_delete (list, thread);
-          thread_list_add (&thread->master->ready, thread);
-          thread->type = THREAD_READY;
-          ready++;
-        }
-    }
-  return ready;
-}
-
 /* Add all timers that have popped to the ready list. */
 static unsigned int
-thread_timer_process (struct thread_list *list, struct timeval *timenow)
+thread_timer_process (struct pqueue *queue, struct timeval *timenow)
 {
   struct thread *thread;
   unsigned int ready = 0;
   
-  for (thread = list->head; thread; thread = thread->next)
+  while (queue->size)
     {
+      thread = queue->array[0];
       if (timeval_cmp (*timenow, thread->u.sands) < 0)
         return ready;
-      thread_list_delete (list, thread);
+      pqueue_dequeue (queue);
+      thread->index = -1;
       thread->type = THREAD_READY;
       thread_list_add (&thread->master->ready, thread);
       ready++;
@@ -1001,9 +1515,7 @@ struct thread *
 thread_fetch (struct thread_master *m, struct thread *fetch)
 {
   struct thread *thread;
-  fd_set readfd;
-  fd_set writefd;
-  fd_set exceptfd;
+  struct thread_list io_ready;
   struct timeval timer_val;
   struct timeval timer_val_bg;
   struct timeval *timer_wait;
@@ -1026,28 +1538,24 @@ thread_fetch (struct thread_master *m, struct thread *fetch)
       if ((thread = thread_trim_head (&m->ready)) != NULL)
         return thread_run (m, thread, fetch);
       
-      /* Structure copy.  */
-      readfd = m->readfd;
-      writefd = m->writefd;
-      exceptfd = m->exceptfd;
-      
-      /* Calculate select wait timer if nothing else to do */
+      /* Calculate I/O wait timer if nothing else to do */
       quagga_get_relative (NULL);
-      timer_wait = thread_timer_wait (&m->timer, &timer_val);
-      timer_wait_bg = thread_timer_wait (&m->background, &timer_val_bg);
+      timer_wait = thread_timer_wait (m->timer, &timer_val);
+      timer_wait_bg = thread_timer_wait (m->background, &timer_val_bg);
       
       if (timer_wait_bg &&
 	  (!timer_wait || (timeval_cmp (*timer_wait, *timer_wait_bg) > 0)))
 	timer_wait = timer_wait_bg;
       
-      num = select (FD_SETSIZE, &readfd, &writefd, &exceptfd, timer_wait);
+      memset (&io_ready, 0, sizeof (struct thread_list));
+      num = m->io->wait (m, timer_wait, &io_ready);
       
       /* Signals should get quick treatment */
       if (num < 0)
         {
           if (errno == EINTR)
             continue; /* signal received - process it */
-          zlog_warn ("select() error: %s", safe_strerror (errno));
+          zlog_warn ("%s() error: %s", m->io->name, safe_strerror (errno));
             return NULL;
         }
 
@@ -1055,16 +1563,10 @@ thread_fetch (struct thread_master *m, struct thread *fetch)
          priority than I/O threads, so let's push them onto the ready
 	 list in front of the I/O threads. */
       quagga_get_relative (NULL);
-      thread_timer_process (&m->timer, &relative_time);
+      thread_timer_process (m->timer, &relative_time);
       
-      /* Got IO, process it */
-      if (num > 0)
-        {
-          /* Normal priority read thead. */
-          thread_process_fd (&m->read, &readfd, &m->readfd);
-          /* Write thead. */
-          thread_process_fd (&m->write, &writefd, &m->writefd);
-        }
+      /* Got IO, queue it behind the timers */
+      thread_list_append (&m->ready, &io_ready);
 
 #if 0
       /* If any threads were made ready above (I/O or foreground timer),
@@ -1076,7 +1578,7 @@ thread_fetch (struct thread_master *m, struct thread *fetch)
 #endif
 
       /* Background timer/events, lowest priority */
-      thread_timer_process (&m->background, &relative_time);
+      thread_timer_process (m->background, &relative_time);
       
       if ((thread = thread_trim_head (&m->ready)) != NULL)
         return thread_run (m, thread, fetch);
@@ -43,19 +43,44 @@ struct thread_list
   int count;
 };
 
+/* I/O event backend, see thread.c. */
+struct thread_io_backend;
+
+/* Timer queue statistics. */
+struct thread_timer_stats
+{
+  unsigned long added;
+  unsigned long cancelled;
+  int peak;
+};
+
 /* Master of the theads. */
 struct thread_master
 {
   struct thread_list read;
   struct thread_list write;
-  struct thread_list timer;
+  struct pqueue *timer;
   struct thread_list event;
   struct thread_list ready;
   struct thread_list unuse;
-  struct thread_list background;
+  struct pqueue *background;
+  struct thread_timer_stats timer_stats;
+  struct thread_timer_stats background_stats;
+
+  /* fd -> pending read/write thread, for O(1) lookup by descriptor. */
+  struct thread **fd_read;
+  struct thread **fd_write;
+  int fd_size;
+
+  /* I/O backend in use and its private state. */
+  const struct thread_io_backend *io;
   fd_set readfd;
   fd_set writefd;
   fd_set exceptfd;
+  int epoll_fd;
+  void *events;
+  int events_size;
+
   unsigned long alloc;
 };
 
@@ -76,6 +101,7 @@ struct thread
     int fd;			/* file descriptor in case of read/write. */
     struct timeval sands;	/* rest of time sands value. */
   } u;
+  int index;			/* position in timer queue, -1 if none */
   RUSAGE_T ru;			/* Indepth usage info.  */
   struct cpu_thread_history *hist; /* cache pointer to cpu_history */
   char* funcname;
@@ -419,7 +419,10 @@ struct in_pktinfo
 #define ZEBRA_ROUTER_ID_UPDATE            22
 #define ZEBRA_HELLO                       23
 #define ZEBRA_BGP_IPV4_RGATE_VERIFY       24
-#define ZEBRA_MESSAGE_MAX                 25
+#define ZEBRA_NEXTHOP_REGISTER            25
+#define ZEBRA_NEXTHOP_UNREGISTER          26
+#define ZEBRA_NEXTHOP_UPDATE              27
+#define ZEBRA_MESSAGE_MAX                 28
 
 /* Marker value used in new Zserv, in the byte location corresponding
  * the command value in the old zserv header. To allow old and new
@@ -31,6 +31,7 @@
 #include "table.h"
 #include "vty.h"
 #include "log.h"
+#include "jhash.h"
 
 #include "ospfd/ospfd.h"
 #include "ospfd/ospf_interface.h"
@@ -627,55 +628,531 @@ ospf_ase_compare_tables (struct route_table *new_external_route,
   return 0;
 }
 
+/* AS-external routes depend on the routing table in two ways: on the
+   ASBR route to the LSA's originator and, when the LSA has a forwarding
+   address, on the network route that address falls in.  Every
+   registered LSA is indexed by both, so that when the routing table
+   changes only the destinations whose LSAs use a changed route need to
+   be recalculated.  The routes the last calculation used are kept to
+   find the changes with: the ASBR route in the dependency and the
+   network routes in ospf->ase_networks. */
+struct ospf_ase_dep
+{
+  /* LSAs originated by the ASBR or using the forwarding address. */
+  struct hash *lsas;
+
+  /* Copy of the ASBR route the LSAs were last calculated with. */
+  struct ospf_route *route;
+};
+
+static unsigned int
+ospf_ase_dep_key (void *data)
+{
+  return jhash (&data, sizeof (data), 0);
+}
+
 static int
-ospf_ase_calculate_timer (struct thread *t)
+ospf_ase_dep_cmp (const void *a, const void *b)
 {
-  struct ospf *ospf;
+  return a == b;
+}
+
+static void
+ospf_ase_dep_add (struct route_table *deps, struct in_addr addr,
+		  struct ospf_lsa *lsa)
+{
+  struct route_node *rn;
+  struct ospf_ase_dep *dep;
+  struct prefix_ipv4 p;
+
+  p.family = AF_INET;
+  p.prefix = addr;
+  p.prefixlen = IPV4_MAX_BITLEN;
+
+  rn = route_node_get (deps, (struct prefix *) &p);
+  if ((dep = rn->info) == NULL)
+    {
+      dep = XCALLOC (MTYPE_OSPF_ASE_DEP, sizeof (struct ospf_ase_dep));
+      dep->lsas = hash_create (ospf_ase_dep_key, ospf_ase_dep_cmp);
+      rn->info = dep;
+    }
+  else
+    route_unlock_node (rn);
+
+  hash_get (dep->lsas, lsa, hash_alloc_intern);
+}
+
+static void
+ospf_ase_dep_free (struct ospf_ase_dep *dep)
+{
+  hash_free (dep->lsas);
+  if (dep->route)
+    ospf_route_free (dep->route);
+  XFREE (MTYPE_OSPF_ASE_DEP, dep);
+}
+
+static void
+ospf_ase_dep_del (struct route_table *deps, struct in_addr addr,
+		  struct ospf_lsa *lsa)
+{
+  struct route_node *rn;
+  struct ospf_ase_dep *dep;
+  struct prefix_ipv4 p;
+
+  p.family = AF_INET;
+  p.prefix = addr;
+  p.prefixlen = IPV4_MAX_BITLEN;
+
+  if ((rn = route_node_lookup (deps, (struct prefix *) &p)) == NULL)
+    return;
+
+  dep = rn->info;
+  hash_release (dep->lsas, lsa);
+  if (dep->lsas->count == 0)
+    {
+      ospf_ase_dep_free (dep);
+      rn->info = NULL;
+      route_unlock_node (rn);
+    }
+  route_unlock_node (rn);
+}
+
+static void
+ospf_ase_deps_finish (struct route_table *deps)
+{
+  struct route_node *rn;
+
+  for (rn = route_top (deps); rn; rn = route_next (rn))
+    if (rn->info)
+      {
+	ospf_ase_dep_free (rn->info);
+	rn->info = NULL;
+	route_unlock_node (rn);
+      }
+  route_table_finish (deps);
+}
+
+/* Copy the parts of a route the external routes are calculated from. */
+static struct ospf_route *
+ospf_ase_route_snapshot (struct ospf_route *or)
+{
+  struct ospf_route *new;
+
+  new = ospf_route_new ();
+  new->type = or->type;
+  new->path_type = or->path_type;
+  new->cost = or->cost;
+  new->u.std.area_id = or->u.std.area_id;
+  new->u.std.flags = or->u.std.flags;
+  ospf_route_copy_nexthops (new, or->paths);
+
+  return new;
+}
+
+static int
+ospf_ase_asbr_route_same (struct ospf_route *old, struct ospf_route *new)
+{
+  struct listnode *n1, *n2;
+  struct ospf_path *op, *newop;
+
+  if (old == NULL || new == NULL)
+    return old == new;
+
+  if (old->cost != new->cost
+      || old->path_type != new->path_type
+      || old->u.std.flags != new->u.std.flags
+      || ! IPV4_ADDR_SAME (&old->u.std.area_id, &new->u.std.area_id)
+      || old->paths->count != new->paths->count)
+    return 0;
+
+  for (n1 = listhead (old->paths), n2 = listhead (new->paths);
+       n1 && n2; n1 = listnextnode (n1), n2 = listnextnode (n2))
+    {
+      op = listgetdata (n1);
+      newop = listgetdata (n2);
+
+      if (! IPV4_ADDR_SAME (&op->nexthop, &newop->nexthop)
+	  || op->ifindex != newop->ifindex)
+	return 0;
+    }
+  return 1;
+}
+
+static void
+ospf_ase_lsa_prefix (struct ospf_lsa *lsa, struct prefix_ipv4 *p)
+{
+  struct as_external_lsa *al;
+
+  al = (struct as_external_lsa *) lsa->data;
+  p->family = AF_INET;
+  p->prefix = lsa->data->id;
+  p->prefixlen = ip_masklen (al->mask);
+  apply_mask_ipv4 (p);
+}
+
+/* Add the destination of an LSA to a set of destinations. */
+static void
+ospf_ase_affect (struct route_table *affected, struct prefix_ipv4 *p)
+{
+  struct route_node *rn;
+
+  rn = route_node_get (affected, (struct prefix *) p);
+  if (rn->info)
+    route_unlock_node (rn);
+  else
+    rn->info = affected;
+}
+
+static void
+ospf_ase_affect_lsa (struct hash_backet *backet, void *arg)
+{
+  struct prefix_ipv4 p;
+
+  ospf_ase_lsa_prefix (backet->data, &p);
+  ospf_ase_affect (arg, &p);
+}
+
+/* Mark the externals using each ASBR whose route changed since the
+   last calculation, and remember the new routes.  AFFECTED is NULL
+   when everything is being recalculated anyway.  Returns the number
+   of ASBR routes that changed. */
+static unsigned long
+ospf_ase_check_asbrs (struct ospf *ospf, struct route_table *affected)
+{
+  struct route_node *rn;
+  struct ospf_ase_dep *dep;
+  struct ospf_route *or;
+  unsigned long changes = 0;
+
+  for (rn = route_top (ospf->ase_asbrs); rn; rn = route_next (rn))
+    if ((dep = rn->info) != NULL)
+      {
+	or = ospf_find_asbr_route (ospf, ospf->new_rtrs,
+				   (struct prefix_ipv4 *) &rn->p);
+	if (ospf_ase_asbr_route_same (dep->route, or))
+	  continue;
+
+	changes++;
+	if (affected)
+	  hash_iterate (dep->lsas, ospf_ase_affect_lsa, affected);
+
+	if (dep->route)
+	  ospf_route_free (dep->route);
+	dep->route = or ? ospf_ase_route_snapshot (or) : NULL;
+      }
+  return changes;
+}
+
+/* A network route changed: mark the externals to the same destination,
+   which the internal route takes precedence over, and the externals
+   whose forwarding address is in the network. */
+static void
+ospf_ase_network_changed (struct ospf *ospf, struct route_table *affected,
+			  struct prefix *p)
+{
+  struct route_node *rn, *start;
+  struct ospf_ase_dep *dep;
+
+  if ((rn = route_node_lookup (ospf->external_lsas, p)) != NULL)
+    {
+      if (listcount ((struct list *) rn->info))
+	ospf_ase_affect (affected, (struct prefix_ipv4 *) p);
+      route_unlock_node (rn);
+    }
+
+  start = route_node_get (ospf->ase_fwds, p);
+  for (rn = route_lock_node (start); rn; rn = route_next_until (rn, start))
+    if ((dep = rn->info) != NULL)
+      hash_iterate (dep->lsas, ospf_ase_affect_lsa, affected);
+  route_unlock_node (start);
+}
+
+/* Same for the network routes.  Returns the number of network routes
+   that were added, removed or changed. */
+static unsigned long
+ospf_ase_check_networks (struct ospf *ospf, struct route_table *affected)
+{
+  struct route_node *rn, *snap;
+  struct ospf_route *or;
+  unsigned long changes = 0;
+
+  if (ospf->new_table)
+    for (rn = route_top (ospf->new_table); rn; rn = route_next (rn))
+      if ((or = rn->info) != NULL)
+	{
+	  if (ospf_route_match_same (ospf->ase_networks,
+				     (struct prefix_ipv4 *) &rn->p, or))
+	    continue;
+
+	  changes++;
+	  if (affected)
+	    ospf_ase_network_changed (ospf, affected, &rn->p);
+
+	  snap = route_node_get (ospf->ase_networks, &rn->p);
+	  if (snap->info)
+	    {
+	      ospf_route_free (snap->info);
+	      route_unlock_node (snap);
+	    }
+	  snap->info = ospf_ase_route_snapshot (or);
+	}
+
+  for (snap = route_top (ospf->ase_networks); snap; snap = route_next (snap))
+    if (snap->info)
+      {
+	if (ospf->new_table
+	    && (rn = route_node_lookup (ospf->new_table, &snap->p)) != NULL)
+	  {
+	    route_unlock_node (rn);
+	    continue;
+	  }
+
+	changes++;
+	if (affected)
+	  ospf_ase_network_changed (ospf, affected, &snap->p);
+
+	ospf_route_free (snap->info);
+	snap->info = NULL;
+	route_unlock_node (snap);
+      }
+  return changes;
+}
+
+/* Recalculate the external route to P from all of its LSAs, install
+   the difference into zebra and keep the result in
+   ospf->old_external_route.  Returns the number of LSAs examined. */
+static unsigned long
+ospf_ase_update_prefix (struct ospf *ospf, struct prefix_ipv4 *p)
+{
+  struct route_node *rn, *old_rn, *new_rn;
+  struct ospf_route *old = NULL, *new = NULL;
+  struct listnode *node;
+  struct ospf_lsa *lsa;
+  unsigned long count = 0;
+
+  if ((rn = route_node_lookup (ospf->external_lsas, (struct prefix *) p)))
+    {
+      for (ALL_LIST_ELEMENTS_RO ((struct list *) rn->info, node, lsa))
+	{
+	  ospf_ase_calculate_route (ospf, lsa);
+	  count++;
+	}
+      route_unlock_node (rn);
+    }
+
+  old_rn = route_node_lookup (ospf->old_external_route, (struct prefix *) p);
+  if (old_rn)
+    old = old_rn->info;
+  new_rn = route_node_lookup (ospf->new_external_route, (struct prefix *) p);
+  if (new_rn)
+    new = new_rn->info;
+
+  /* install changes to zebra */
+  if (new == NULL)
+    {
+      if (old)
+	ospf_zebra_delete (p, old);
+    }
+  else if (! ospf_ase_route_match_same (ospf->old_external_route,
+					(struct prefix *) p, new))
+    ospf_zebra_add (p, new);
+
+  /* update ospf->old_external_route table */
+  if (old_rn)
+    {
+      ospf_route_free (old);
+      if (new)
+	old_rn->info = new;
+      else
+	{
+	  old_rn->info = NULL;
+	  route_unlock_node (old_rn);
+	}
+      route_unlock_node (old_rn);
+    }
+  else if (new)
+    {
+      old_rn = route_node_get (ospf->old_external_route, (struct prefix *) p);
+      old_rn->info = new;
+    }
+
+  if (new_rn)
+    {
+      /* new_rn->info is stored in ospf->old_external_route now */
+      new_rn->info = NULL;
+      route_unlock_node (new_rn);
+      route_unlock_node (new_rn);
+    }
+
+  return count;
+}
+
+static unsigned long
+ospf_ase_usecs_since (struct timeval *start)
+{
+  struct timeval now, diff;
+
+  quagga_gettime (QUAGGA_CLK_MONOTONIC, &now);
+  diff = tv_sub (now, *start);
+  return diff.tv_sec * 1000000UL + diff.tv_usec;
+}
+
+/* Recalculate the destinations in AFFECTED, less those in SKIP. */
+static void
+ospf_ase_update_affected (struct ospf *ospf, struct route_table *affected,
+			  struct route_table *skip, int type)
+{
+  struct ospf_ase_stat *stat = &ospf->ase_stats[type];
+  struct route_node *rn, *srn;
+  struct timeval start;
+
+  quagga_gettime (QUAGGA_CLK_MONOTONIC, &start);
+
+  for (rn = route_top (affected); rn; rn = route_next (rn))
+    if (rn->info)
+      {
+	if (skip && (srn = route_node_lookup (skip, &rn->p)))
+	  {
+	    route_unlock_node (srn);
+	    continue;
+	  }
+	stat->lsas += ospf_ase_update_prefix (ospf,
+					      (struct prefix_ipv4 *) &rn->p);
+      }
+
+  stat->usecs += ospf_ase_usecs_since (&start);
+}
+
+static void
+ospf_ase_calculate_full (struct ospf *ospf)
+{
+  struct ospf_ase_stat *stat = &ospf->ase_stats[OSPF_ASE_CALC_FULL];
   struct ospf_lsa *lsa;
   struct route_node *rn;
   struct listnode *node;
   struct ospf_area *area;
+  struct timeval start;
 
-  ospf = THREAD_ARG (t);
-  ospf->t_ase_calc = NULL;
+  quagga_gettime (QUAGGA_CLK_MONOTONIC, &start);
 
-  if (ospf->ase_calc)
+  /* Calculate external route for each AS-external-LSA */
+  LSDB_LOOP (EXTERNAL_LSDB (ospf), rn, lsa)
     {
-      ospf->ase_calc = 0;
+      ospf_ase_calculate_route (ospf, lsa);
+      stat->lsas++;
+    }
+
+  /*  This version simple adds to the table all NSSA areas  */
+  if (ospf->anyNSSA)
+    for (ALL_LIST_ELEMENTS_RO (ospf->areas, node, area))
+      {
+	if (IS_DEBUG_OSPF_NSSA)
+	  zlog_debug ("ospf_ase_calculate_timer(): looking at area %s",
+		     inet_ntoa (area->area_id));
+
+	if (area->external_routing == OSPF_AREA_NSSA)
+	  LSDB_LOOP (NSSA_LSDB (area), rn, lsa)
+	    {
+	      ospf_ase_calculate_route (ospf, lsa);
+	      stat->lsas++;
+	    }
+      }
+  /* kevinm: And add the NSSA routes in ospf_top */
+  LSDB_LOOP (NSSA_LSDB (ospf),rn,lsa)
+    {
+      ospf_ase_calculate_route(ospf,lsa);
+      stat->lsas++;
+    }
 
-      /* Calculate external route for each AS-external-LSA */
-      LSDB_LOOP (EXTERNAL_LSDB (ospf), rn, lsa)
-	ospf_ase_calculate_route (ospf, lsa);
+  /* Compare old and new external routing table and install the
+     difference info zebra/kernel */
+  ospf_ase_compare_tables (ospf->new_external_route,
+			   ospf->old_external_route);
 
-      /*  This version simple adds to the table all NSSA areas  */
-      if (ospf->anyNSSA)
-	for (ALL_LIST_ELEMENTS_RO (ospf->areas, node, area))
-	  {
-	    if (IS_DEBUG_OSPF_NSSA)
-	      zlog_debug ("ospf_ase_calculate_timer(): looking at area %s",
-			 inet_ntoa (area->area_id));
+  /* Delete old external routing table */
+  ospf_route_table_free (ospf->old_external_route);
+  ospf->old_external_route = ospf->new_external_route;
+  ospf->new_external_route = route_table_init ();
 
-	    if (area->external_routing == OSPF_AREA_NSSA)
-	      LSDB_LOOP (NSSA_LSDB (area), rn, lsa)
-		ospf_ase_calculate_route (ospf, lsa);
-	  }
-      /* kevinm: And add the NSSA routes in ospf_top */
-      LSDB_LOOP (NSSA_LSDB (ospf),rn,lsa)
-      		ospf_ase_calculate_route(ospf,lsa);
+  /* Remember the routes this calculation used. */
+  ospf_ase_check_asbrs (ospf, NULL);
+  ospf_ase_check_networks (ospf, NULL);
+
+  stat->runs++;
+  stat->usecs += ospf_ase_usecs_since (&start);
+}
+
+/* Recalculate only the externals whose ASBR or forwarding address
+   route changed since the last calculation. */
+static void
+ospf_ase_calculate_incremental (struct ospf *ospf)
+{
+  struct ospf_ase_stat *asbr = &ospf->ase_stats[OSPF_ASE_CALC_ASBR];
+  struct ospf_ase_stat *net = &ospf->ase_stats[OSPF_ASE_CALC_NETWORK];
+  struct route_table *asbr_affected, *net_affected;
+  unsigned long changes;
+  struct timeval start;
+
+  asbr_affected = route_table_init ();
+  net_affected = route_table_init ();
+
+  quagga_gettime (QUAGGA_CLK_MONOTONIC, &start);
+  if ((changes = ospf_ase_check_asbrs (ospf, asbr_affected)))
+    {
+      asbr->runs++;
+      asbr->changes += changes;
+    }
+  asbr->usecs += ospf_ase_usecs_since (&start);
+
+  quagga_gettime (QUAGGA_CLK_MONOTONIC, &start);
+  if ((changes = ospf_ase_check_networks (ospf, net_affected)))
+    {
+      net->runs++;
+      net->changes += changes;
+    }
+  net->usecs += ospf_ase_usecs_since (&start);
+
+  ospf_ase_update_affected (ospf, asbr_affected, NULL, OSPF_ASE_CALC_ASBR);
+  ospf_ase_update_affected (ospf, net_affected, asbr_affected,
+			    OSPF_ASE_CALC_NETWORK);
+
+  route_table_finish (asbr_affected);
+  route_table_finish (net_affected);
+}
+
+static int
+ospf_ase_calculate_timer (struct thread *t)
+{
+  struct ospf *ospf;
+
+  ospf = THREAD_ARG (t);
+  ospf->t_ase_calc = NULL;
 
-      /* Compare old and new external routing table and install the
-	 difference info zebra/kernel */
-      ospf_ase_compare_tables (ospf->new_external_route,
-			       ospf->old_external_route);
+  if (ospf->ase_calc)
+    {
+      if (ospf->ase_calc_full)
+	ospf_ase_calculate_full (ospf);
+      else
+	ospf_ase_calculate_incremental (ospf);
 
-      /* Delete old external routing table */
-      ospf_route_table_free (ospf->old_external_route);
-      ospf->old_external_route = ospf->new_external_route;
-      ospf->new_external_route = route_table_init ();
+      ospf->ase_calc = 0;
+      ospf->ase_calc_full = 0;
     }
   return 0;
 }
 
+/* Recalculate every external route next time, for changes that are not
+   visible in the routing table. */
+void
+ospf_ase_calculate_schedule_full (struct ospf *ospf)
+{
+  if (ospf == NULL)
+    return;
+
+  ospf->ase_calc = 1;
+  ospf->ase_calc_full = 1;
+}
+
 void
 ospf_ase_calculate_schedule (struct ospf *ospf)
 {
@@ -717,6 +1194,10 @@ ospf_ase_register_external_lsa (struct ospf_lsa *lsa, struct ospf *top)
   /* We assume that if LSA is deleted from DB
      is is also deleted from this RT */
   listnode_add (lst, ospf_lsa_lock (lsa)); /* external_lsas lst */
+
+  ospf_ase_dep_add (top->ase_asbrs, lsa->data->adv_router, lsa);
+  if (al->e[0].fwd_addr.s_addr)
+    ospf_ase_dep_add (top->ase_fwds, al->e[0].fwd_addr, lsa);
 }
 
 void
@@ -738,6 +1219,10 @@ ospf_ase_unregister_external_lsa (struct ospf_lsa *lsa, struct ospf *top)
 
   /* XXX lst can be NULL */
   if (lst) {
+    ospf_ase_dep_del (top->ase_asbrs, lsa->data->adv_router, lsa);
+    if (al->e[0].fwd_addr.s_addr)
+      ospf_ase_dep_del (top->ase_fwds, al->e[0].fwd_addr, lsa);
+
     listnode_delete (lst, lsa);
     ospf_lsa_unlock (&lsa); /* external_lsas list */
   }
@@ -762,21 +1247,23 @@ ospf_ase_external_lsas_finish (struct route_table *rt)
   route_table_finish (rt);
 }
 
+void
+ospf_ase_dependencies_finish (struct ospf *ospf)
+{
+  ospf_ase_deps_finish (ospf->ase_asbrs);
+  ospf_ase_deps_finish (ospf->ase_fwds);
+  ospf_route_table_free (ospf->ase_networks);
+}
+
 void
 ospf_ase_incremental_update (struct ospf *ospf, struct ospf_lsa *lsa)
 {
-  struct list *lsas;
-  struct listnode *node;
-  struct route_node *rn, *rn2;
+  struct ospf_ase_stat *stat = &ospf->ase_stats[OSPF_ASE_CALC_LSA];
+  struct route_node *rn;
   struct prefix_ipv4 p;
-  struct route_table *tmp_old;
-  struct as_external_lsa *al;
+  struct timeval start;
 
-  al = (struct as_external_lsa *) lsa->data;
-  p.family = AF_INET;
-  p.prefix = lsa->data->id;
-  p.prefixlen = ip_masklen (al->mask);
-  apply_mask_ipv4 (&p);
+  ospf_ase_lsa_prefix (lsa, &p);
 
   /* if new_table is NULL, there was no spf calculation, thus
      incremental update is unneeded */
@@ -795,57 +1282,8 @@ ospf_ase_incremental_update (struct ospf *ospf, struct ospf_lsa *lsa)
 	return;
     }
 
-  rn = route_node_lookup (ospf->external_lsas, (struct prefix *) &p);
-  assert (rn); 
-  assert (rn->info);
-  lsas = rn->info;
-  route_unlock_node (rn);
-
-  for (ALL_LIST_ELEMENTS_RO (lsas, node, lsa))
-    ospf_ase_calculate_route (ospf, lsa);
-
-  /* prepare temporary old routing table for compare */
-  tmp_old = route_table_init ();
-  rn = route_node_lookup (ospf->old_external_route, (struct prefix *) &p);
-  if (rn && rn->info)
-    {
-      rn2 = route_node_get (tmp_old, (struct prefix *) &p);
-      rn2->info = rn->info;
-    }
-
-  /* install changes to zebra */
-  ospf_ase_compare_tables (ospf->new_external_route, tmp_old);
-
-  /* update ospf->old_external_route table */
-  if (rn && rn->info)
-    ospf_route_free ((struct ospf_route *) rn->info);
-
-  rn2 = route_node_lookup (ospf->new_external_route, (struct prefix *) &p);
-  /* if new route exists, install it to ospf->old_external_route */
-  if (rn2 && rn2->info)
-    {
-      if (!rn)
-	rn = route_node_get (ospf->old_external_route, (struct prefix *) &p);
-      rn->info = rn2->info;
-    }
-  else
-    {
-      /* remove route node from ospf->old_external_route */
-      if (rn)
-	{
-	  rn->info = NULL;
-	  route_unlock_node (rn);
-	  route_unlock_node (rn);
-	}
-    }
-
-  if (rn2)
-    {
-      /* rn2->info is stored in route node of ospf->old_external_route */
-      rn2->info = NULL;
-      route_unlock_node (rn2);
-      route_unlock_node (rn2);
-    }
-
-  route_table_finish (tmp_old);
+  quagga_gettime (QUAGGA_CLK_MONOTONIC, &start);
+  stat->lsas += ospf_ase_update_prefix (ospf, &p);
+  stat->runs++;
+  stat->usecs += ospf_ase_usecs_since (&start);
 }
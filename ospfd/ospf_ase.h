@@ -36,9 +36,11 @@ extern struct ospf_route *ospf_find_asbr_route_through_area (struct
 
 extern int ospf_ase_calculate_route (struct ospf *, struct ospf_lsa *);
 extern void ospf_ase_calculate_schedule (struct ospf *);
+extern void ospf_ase_calculate_schedule_full (struct ospf *);
 extern void ospf_ase_calculate_timer_add (struct ospf *);
 
 extern void ospf_ase_external_lsas_finish (struct route_table *);
+extern void ospf_ase_dependencies_finish (struct ospf *);
 extern void ospf_ase_incremental_update (struct ospf *, struct ospf_lsa *);
 extern void ospf_ase_register_external_lsa (struct ospf_lsa *, struct ospf *);
 extern void ospf_ase_unregister_external_lsa (struct ospf_lsa *,
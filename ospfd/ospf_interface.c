@@ -328,6 +328,9 @@ ospf_if_free (struct ospf_interface *oi)
   listnode_delete (oi->ospf->oiflist, oi);
   listnode_delete (oi->area->oiflist, oi);
 
+  /* The saved SPF trees may use the interface as a nexthop. */
+  oi->ospf->spf_full = 1;
+
   thread_cancel_event (master, oi);
 
   memset (oi, 0, sizeof (*oi));
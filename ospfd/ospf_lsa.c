@@ -2368,10 +2368,60 @@ ospf_external_lsa_refresh (struct ospf *ospf, struct ospf_lsa *lsa,
 
 /* LSA installation functions. */
 
+/* Step to the next link of a router-LSA that is not to a stub network. */
+static struct router_lsa_link *
+ospf_router_lsa_next_transit (u_char **p, u_char *lim)
+{
+  struct router_lsa_link *l;
+
+  while (*p + OSPF_ROUTER_LSA_LINK_SIZE <= lim)
+    {
+      l = (struct router_lsa_link *) *p;
+      *p += (OSPF_ROUTER_LSA_LINK_SIZE +
+             (l->m[0].tos_count * OSPF_ROUTER_LSA_TOS_SIZE));
+      if (l->m[0].type != LSA_LINK_TYPE_STUB)
+        return l;
+    }
+  return NULL;
+}
+
+/* If two instances of a router-LSA differ in more than their links to
+   stub networks, that is in the part of the area's topology the
+   shortest-path tree is built from, return 1, otherwise return 0. */
+static int
+ospf_router_lsa_topology_different (struct ospf_lsa *l1, struct ospf_lsa *l2)
+{
+  u_char *p1, *p2, *lim1, *lim2;
+  struct router_lsa_link *k1, *k2;
+
+  if (IS_LSA_MAXAGE (l1) != IS_LSA_MAXAGE (l2))
+    return 1;
+
+  p1 = (u_char *) l1->data + OSPF_LSA_HEADER_SIZE + 4;
+  lim1 = (u_char *) l1->data + ntohs (l1->data->length);
+  p2 = (u_char *) l2->data + OSPF_LSA_HEADER_SIZE + 4;
+  lim2 = (u_char *) l2->data + ntohs (l2->data->length);
+
+  for (;;)
+    {
+      k1 = ospf_router_lsa_next_transit (&p1, lim1);
+      k2 = ospf_router_lsa_next_transit (&p2, lim2);
+
+      if (k1 == NULL || k2 == NULL)
+        return k1 != k2;
+
+      if (k1->m[0].type != k2->m[0].type
+          || k1->m[0].metric != k2->m[0].metric
+          || ! IPV4_ADDR_SAME (&k1->link_id, &k2->link_id)
+          || ! IPV4_ADDR_SAME (&k1->link_data, &k2->link_data))
+        return 1;
+    }
+}
+
 /* Install router-LSA to an area. */
 static struct ospf_lsa *
 ospf_router_lsa_install (struct ospf *ospf, struct ospf_lsa *new,
-                         int rt_recalc)
+                         int rt_recalc, int topology)
 {
   struct ospf_area *area = new->area;
 
@@ -2397,7 +2447,14 @@ ospf_router_lsa_install (struct ospf *ospf, struct ospf_lsa *new,
       ospf_refresher_register_lsa (ospf, new);
     }
   if (rt_recalc)
-    ospf_spf_calculate_schedule (ospf);
+    {
+      /* Stub networks are added to the tree the last SPF calculation
+         found. */
+      if (topology)
+        ospf_spf_calculate_schedule_area (area);
+      else
+        ospf_spf_calculate_schedule_routes (ospf);
+    }
 
   return new;
 }
@@ -2432,7 +2489,7 @@ ospf_network_lsa_install (struct ospf *ospf,
       ospf_refresher_register_lsa (ospf, new);
     }
   if (rt_recalc)
-    ospf_spf_calculate_schedule (ospf);
+    ospf_spf_calculate_schedule_area (new->area);
 
   return new;
 }
@@ -2455,7 +2512,7 @@ ospf_summary_lsa_install (struct ospf *ospf, struct ospf_lsa *new,
       /* This doesn't exist yet... */
       ospf_summary_incremental_update(new); */
 #else /* #if 0 */
-      ospf_spf_calculate_schedule (ospf);
+      ospf_spf_calculate_schedule_routes (ospf);
 #endif /* #if 0 */
  
       if (IS_DEBUG_OSPF (lsa, LSA_INSTALL))
@@ -2488,7 +2545,7 @@ ospf_summary_asbr_lsa_install (struct ospf *ospf, struct ospf_lsa *new,
 	 - RFC 2328 Section 16.5 implies it should be */
       /* ospf_ase_calculate_schedule(); */
 #else  /* #if 0 */
-      ospf_spf_calculate_schedule (ospf);
+      ospf_spf_calculate_schedule_routes (ospf);
 #endif /* #if 0 */
     }
 
@@ -2602,6 +2659,7 @@ ospf_lsa_install (struct ospf *ospf, struct ospf_interface *oi,
   struct ospf_lsa *old = NULL;
   struct ospf_lsdb *lsdb = NULL;
   int rt_recalc;
+  int topology;
 
   /* Set LSDB. */
   switch (lsa->data->type)
@@ -2697,6 +2755,11 @@ ospf_lsa_install (struct ospf *ospf, struct ospf_interface *oi,
         }
     }
 
+  /* A router-LSA whose links to other routers and transit networks
+     did not change leaves the area's shortest-path tree as it was. */
+  topology = (old == NULL || lsa->data->type != OSPF_ROUTER_LSA
+              || ospf_router_lsa_topology_different (old, lsa));
+
   /* discard old LSA from LSDB */
   if (old != NULL)
     ospf_discard_from_db (ospf, lsdb, lsa);
@@ -2713,7 +2776,7 @@ ospf_lsa_install (struct ospf *ospf, struct ospf_interface *oi,
   switch (lsa->data->type)
     {
     case OSPF_ROUTER_LSA:
-      new = ospf_router_lsa_install (ospf, lsa, rt_recalc);
+      new = ospf_router_lsa_install (ospf, lsa, rt_recalc, topology);
       break;
     case OSPF_NETWORK_LSA:
       assert (oi);
@@ -2964,6 +3027,10 @@ ospf_lsa_maxage_walker_remover (struct ospf *ospf, struct ospf_lsa *lsa)
           case OSPF_AS_NSSA_LSA:
 	    ospf_ase_incremental_update (ospf, lsa);
             break;
+          case OSPF_ROUTER_LSA:
+          case OSPF_NETWORK_LSA:
+	    ospf_spf_calculate_schedule_area (lsa->area);
+            break;
           default:
 	    ospf_spf_calculate_schedule (ospf);
             break;
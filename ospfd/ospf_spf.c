@@ -214,6 +214,116 @@ ospf_vertex_free (void *data)
   XFREE (MTYPE_OSPF_VERTEX, v);
 }
 
+/* The shortest-path tree of an area's last SPF calculation, kept to
+ * rebuild the area's routes from as long as the topology of the area
+ * does not change, see ospf_spf_replay().  The vertices are copied
+ * with their nexthops, since the tree itself is freed after each
+ * calculation, and their LSAs are looked up again when used.
+ */
+struct ospf_spf_saved_vertex
+{
+  struct vertex v;
+  struct in_addr adv_router;
+  int parent_is_root;
+};
+
+struct ospf_spf_saved
+{
+  /* Vertices in the order they were added to the tree, less the root. */
+  struct ospf_spf_saved_vertex *tree;
+  unsigned int tree_count;
+  unsigned int tree_size;
+
+  /* Router vertices in the order their stub links were processed. */
+  struct ospf_spf_saved_vertex *stubs;
+  unsigned int stubs_count;
+  unsigned int stubs_size;
+};
+
+static struct ospf_spf_saved_vertex *
+ospf_spf_save_vertex (struct ospf_spf_saved_vertex **array,
+                      unsigned int *count, unsigned int *size,
+                      struct vertex *v, int parent_is_root)
+{
+  struct ospf_spf_saved_vertex *sv;
+  struct vertex_parent *vp;
+  struct vertex_nexthop *nh;
+  struct listnode *node;
+
+  if (*count == *size)
+    {
+      *size = *size ? *size * 2 : 64;
+      *array = XREALLOC (MTYPE_OSPF_SPF_SAVED, *array,
+                         *size * sizeof (struct ospf_spf_saved_vertex));
+    }
+  sv = &(*array)[(*count)++];
+
+  memset (sv, 0, sizeof (struct ospf_spf_saved_vertex));
+  sv->v.type = v->type;
+  sv->v.id = v->id;
+  sv->v.distance = v->distance;
+  sv->v.parents = list_new ();
+  sv->v.parents->del = vertex_parent_free;
+  sv->adv_router = v->lsa->adv_router;
+  sv->parent_is_root = parent_is_root;
+
+  for (ALL_LIST_ELEMENTS_RO (v->parents, node, vp))
+    {
+      nh = vertex_nexthop_new ();
+      *nh = *vp->nexthop;
+      listnode_add (sv->v.parents, vertex_parent_new (NULL, -1, nh));
+    }
+  return sv;
+}
+
+static void
+ospf_spf_saved_vertices_free (struct ospf_spf_saved_vertex *array,
+                              unsigned int count)
+{
+  struct vertex_parent *vp;
+  struct listnode *node;
+  unsigned int i;
+
+  for (i = 0; i < count; i++)
+    {
+      for (ALL_LIST_ELEMENTS_RO (array[i].v.parents, node, vp))
+        vertex_nexthop_free (vp->nexthop);
+      list_delete (array[i].v.parents);
+    }
+  if (array)
+    XFREE (MTYPE_OSPF_SPF_SAVED, array);
+}
+
+void
+ospf_spf_saved_free (struct ospf_area *area)
+{
+  struct ospf_spf_saved *saved = area->spf_saved;
+
+  if (saved == NULL)
+    return;
+
+  ospf_spf_saved_vertices_free (saved->tree, saved->tree_count);
+  ospf_spf_saved_vertices_free (saved->stubs, saved->stubs_count);
+  XFREE (MTYPE_OSPF_SPF_SAVED, saved);
+  area->spf_saved = NULL;
+}
+
+/* Point a saved vertex at the current instance of its LSA. */
+static int
+ospf_spf_saved_lookup (struct ospf_area *area,
+                       struct ospf_spf_saved_vertex *sv)
+{
+  struct ospf_lsa *lsa;
+
+  lsa = ospf_lsdb_lookup_by_id (area->lsdb, sv->v.type, sv->v.id,
+                                sv->adv_router);
+  if (lsa == NULL || IS_LSA_MAXAGE (lsa))
+    return 0;
+
+  sv->v.lsa = lsa->data;
+  return 1;
+}
+
 static void
 ospf_vertex_dump(const char *msg, struct vertex *v,
 		 int print_parents, int print_children)
@@ -951,12 +1061,47 @@ ospf_spf_dump (struct vertex *v, int i)
     ospf_spf_dump (v, i);
 }
 
+/* Add the stub networks of a router vertex. */
+static void
+ospf_spf_add_stubs (struct ospf_area *area, struct vertex *v,
+                    struct route_table *rt, int parent_is_root)
+{
+  u_char *p;
+  u_char *lim;
+  struct router_lsa_link *l;
+  struct router_lsa *rlsa;
+
+  if (IS_DEBUG_OSPF_EVENT)
+    zlog_debug ("ospf_process_stubs():processing router LSA, id: %s",
+               inet_ntoa (v->lsa->id));
+  rlsa = (struct router_lsa *) v->lsa;
+
+
+  if (IS_DEBUG_OSPF_EVENT)
+    zlog_debug ("ospf_process_stubs(): we have %d links to process",
+               ntohs (rlsa->links));
+  p = ((u_char *) v->lsa) + OSPF_LSA_HEADER_SIZE + 4;
+  lim = ((u_char *) v->lsa) + ntohs (v->lsa->length);
+
+  while (p < lim)
+    {
+      l = (struct router_lsa_link *) p;
+
+      p += (OSPF_ROUTER_LSA_LINK_SIZE +
+            (l->m[0].tos_count * OSPF_ROUTER_LSA_TOS_SIZE));
+
+      if (l->m[0].type == LSA_LINK_TYPE_STUB)
+        ospf_intra_add_stub (rt, l, v, area, parent_is_root);
+    }
+}
+
 /* Second stage of SPF calculation. */
 static void
 ospf_spf_process_stubs (struct ospf_area *area, struct vertex *v,
                         struct route_table *rt,
                         int parent_is_root)
 {
+  struct ospf_spf_saved *saved = area->spf_saved;
   struct listnode *cnode, *cnnode;
   struct vertex *child;
 
@@ -965,33 +1110,9 @@ ospf_spf_process_stubs (struct ospf_area *area, struct vertex *v,
                inet_ntoa (area->area_id));
   if (v->type == OSPF_VERTEX_ROUTER)
     {
-      u_char *p;
-      u_char *lim;
-      struct router_lsa_link *l;
-      struct router_lsa *rlsa;
-
-      if (IS_DEBUG_OSPF_EVENT)
-        zlog_debug ("ospf_process_stubs():processing router LSA, id: %s",
-                   inet_ntoa (v->lsa->id));
-      rlsa = (struct router_lsa *) v->lsa;
-
-
-      if (IS_DEBUG_OSPF_EVENT)
-        zlog_debug ("ospf_process_stubs(): we have %d links to process",
-                   ntohs (rlsa->links));
-      p = ((u_char *) v->lsa) + OSPF_LSA_HEADER_SIZE + 4;
-      lim = ((u_char *) v->lsa) + ntohs (v->lsa->length);
-
-      while (p < lim)
-        {
-          l = (struct router_lsa_link *) p;
-
-          p += (OSPF_ROUTER_LSA_LINK_SIZE +
-                (l->m[0].tos_count * OSPF_ROUTER_LSA_TOS_SIZE));
-
-          if (l->m[0].type == LSA_LINK_TYPE_STUB)
-            ospf_intra_add_stub (rt, l, v, area, parent_is_root);
-        }
+      ospf_spf_add_stubs (area, v, rt, parent_is_root);
+      ospf_spf_save_vertex (&saved->stubs, &saved->stubs_count,
+                            &saved->stubs_size, v, parent_is_root);
     }
 
   ospf_vertex_dump("ospf_process_stubs(): after examining links: ", v, 1, 1);
@@ -1109,6 +1230,7 @@ static void
 ospf_spf_calculate (struct ospf_area *area, struct route_table *new_table,
                     struct route_table *new_rtrs)
 {
+  struct ospf_spf_saved *saved;
   struct pqueue *candidate;
   struct vertex *v;
   
@@ -1119,6 +1241,9 @@ ospf_spf_calculate (struct ospf_area *area, struct route_table *new_table,
                  inet_ntoa (area->area_id));
     }
 
+  /* The tree saved by the last calculation is replaced. */
+  ospf_spf_saved_free (area);
+
   /* Check router-lsa-self.  If self-router-lsa is not yet allocated,
      return this area's calculation. */
   if (!area->router_lsa_self)
@@ -1152,6 +1277,9 @@ ospf_spf_calculate (struct ospf_area *area, struct route_table *new_table,
   /* Set Area A's TransitCapability to FALSE. */
   area->transit = OSPF_TRANSIT_FALSE;
   area->shortcut_capability = 1;
+
+  saved = area->spf_saved = XCALLOC (MTYPE_OSPF_SPF_SAVED,
+                                     sizeof (struct ospf_spf_saved));
   
   for (;;)
     {
@@ -1181,6 +1309,8 @@ ospf_spf_calculate (struct ospf_area *area, struct route_table *new_table,
         ospf_intra_add_router (new_rtrs, v, area);
       else
         ospf_intra_add_transit (new_table, v, area);
+      ospf_spf_save_vertex (&saved->tree, &saved->tree_count,
+                            &saved->tree_size, v, 0);
 
       /* RFC2328 16.1. (5). */
       /* Iterate the algorithm by returning to Step 2. */
@@ -1221,6 +1351,92 @@ ospf_spf_calculate (struct ospf_area *area, struct route_table *new_table,
                 mtype_stats_alloc(MTYPE_OSPF_VERTEX));
 }
 
+/* Rebuild the routes of an area whose topology did not change since
+   its last SPF calculation from the tree that calculation saved: the
+   intra-area routes to the routers and transit networks in the tree
+   are added again in the same order, with the distances and nexthops
+   found then, and the stub networks of the current router-LSAs are
+   added on top.  Returns 0 if the tree cannot be used. */
+static int
+ospf_spf_replay (struct ospf_area *area, struct route_table *new_table,
+                 struct route_table *new_rtrs)
+{
+  struct ospf_spf_saved *saved = area->spf_saved;
+  struct ospf_spf_saved_vertex *sv;
+  unsigned int i;
+
+  /* Virtual links are brought up from the tree itself. */
+  if (saved == NULL || saved->stubs_count == 0 || !area->router_lsa_self
+      || listcount (area->ospf->vlinks))
+    return 0;
+
+  for (i = 0; i < saved->tree_count; i++)
+    if (! ospf_spf_saved_lookup (area, &saved->tree[i]))
+      return 0;
+  for (i = 0; i < saved->stubs_count; i++)
+    if (! ospf_spf_saved_lookup (area, &saved->stubs[i]))
+      return 0;
+
+  if (IS_DEBUG_OSPF_EVENT)
+    zlog_debug ("ospf_spf_replay: reusing the tree of area %s",
+                inet_ntoa (area->area_id));
+
+  /* The stub links of the root are processed first. */
+  area->spf = &saved->stubs[0].v;
+  area->abr_count = 0;
+  area->asbr_count = 0;
+  area->transit = OSPF_TRANSIT_FALSE;
+  area->shortcut_capability = 1;
+
+  for (i = 0; i < saved->tree_count; i++)
+    {
+      sv = &saved->tree[i];
+      if (sv->v.type == OSPF_VERTEX_ROUTER)
+        ospf_intra_add_router (new_rtrs, &sv->v, area);
+      else
+        ospf_intra_add_transit (new_table, &sv->v, area);
+    }
+
+  for (i = 0; i < saved->stubs_count; i++)
+    {
+      sv = &saved->stubs[i];
+      if (IS_ROUTER_LSA_VIRTUAL ((struct router_lsa *) sv->v.lsa))
+        area->transit = OSPF_TRANSIT_TRUE;
+      ospf_spf_add_stubs (area, &sv->v, new_table, sv->parent_is_root);
+    }
+
+  area->spf = NULL;
+  return 1;
+}
+
+static unsigned long
+ospf_spf_usecs_since (struct timeval *start)
+{
+  struct timeval now, diff;
+
+  quagga_gettime (QUAGGA_CLK_MONOTONIC, &now);
+  diff = tv_sub (now, *start);
+  return diff.tv_sec * 1000000UL + diff.tv_usec;
+}
+
+/* Calculate an area's routes, reusing its last shortest-path tree when
+   only prefixes changed.  Returns 1 if the tree was calculated. */
+static int
+ospf_spf_calculate_area (struct ospf_area *area,
+                         struct route_table *new_table,
+                         struct route_table *new_rtrs)
+{
+  int changed = area->spf_changed;
+
+  area->spf_changed = 0;
+  if (!area->ospf->spf_full && !changed
+      && ospf_spf_replay (area, new_table, new_rtrs))
+    return 0;
+
+  ospf_spf_calculate (area, new_table, new_rtrs);
+  return 1;
+}
+
 /* Timer for SPF calculation. */
 static int
 ospf_spf_calculate_timer (struct thread *thread)
@@ -1229,12 +1445,17 @@ ospf_spf_calculate_timer (struct thread *thread)
   struct route_table *new_table, *new_rtrs;
   struct ospf_area *area;
   struct listnode *node, *nnode;
+  struct ospf_spf_stat *stat;
+  struct timeval start;
+  unsigned int calculated = 0;
 
   if (IS_DEBUG_OSPF_EVENT)
     zlog_debug ("SPF: Timer (SPF calculation expire)");
 
   ospf->t_spf_calc = NULL;
 
+  quagga_gettime (QUAGGA_CLK_MONOTONIC, &start);
+
   /* Allocate new table tree. */
   new_table = route_table_init ();
   new_rtrs = route_table_init ();
@@ -1250,12 +1471,13 @@ ospf_spf_calculate_timer (struct thread *thread)
       if (ospf->backbone && ospf->backbone == area)
         continue;
       
-      ospf_spf_calculate (area, new_table, new_rtrs);
+      calculated += ospf_spf_calculate_area (area, new_table, new_rtrs);
     }
   
   /* SPF for backbone, if required */
   if (ospf->backbone)
-    ospf_spf_calculate (ospf->backbone, new_table, new_rtrs);
+    calculated += ospf_spf_calculate_area (ospf->backbone,
+                                           new_table, new_rtrs);
   
   ospf_vl_shut_unapproved (ospf);
 
@@ -1290,6 +1512,21 @@ ospf_spf_calculate_timer (struct thread *thread)
   if (IS_OSPF_ABR (ospf))
     ospf_abr_task (ospf);
 
+  /* Every area calculated its tree, some did, or only the routes were
+     calculated again. */
+  if (calculated == 0)
+    stat = &ospf->spf_stats[OSPF_SPF_RUN_PRC];
+  else if (ospf->spf_full || calculated == listcount (ospf->areas))
+    stat = &ospf->spf_stats[OSPF_SPF_RUN_FULL];
+  else
+    stat = &ospf->spf_stats[OSPF_SPF_RUN_INCREMENTAL];
+  stat->runs++;
+  stat->last_usecs = ospf_spf_usecs_since (&start);
+  stat->usecs += stat->last_usecs;
+
+  ospf->spf_full = 0;
+  quagga_gettime (QUAGGA_CLK_MONOTONIC, &ospf->ts_spf);
+
   if (IS_DEBUG_OSPF_EVENT)
     zlog_debug ("SPF: calculation complete");
 
@@ -1298,8 +1535,8 @@ ospf_spf_calculate_timer (struct thread *thread)
 
 /* Add schedule for SPF calculation.  To avoid frequenst SPF calc, we
    set timer for SPF calc. */
-void
-ospf_spf_calculate_schedule (struct ospf *ospf)
+static void
+ospf_spf_schedule (struct ospf *ospf)
 {
   unsigned long delay, elapsed, ht;
   struct timeval result;
@@ -1358,3 +1595,30 @@ ospf_spf_calculate_schedule (struct ospf *ospf)
   ospf->t_spf_calc =
     thread_add_timer_msec (master, ospf_spf_calculate_timer, ospf, delay);
 }
+
+/* Schedule SPF calculation of every area. */
+void
+ospf_spf_calculate_schedule (struct ospf *ospf)
+{
+  if (ospf == NULL)
+    return;
+
+  ospf->spf_full = 1;
+  ospf_spf_schedule (ospf);
+}
+
+/* Schedule SPF calculation after the topology of AREA changed. */
+void
+ospf_spf_calculate_schedule_area (struct ospf_area *area)
+{
+  area->spf_changed = 1;
+  ospf_spf_schedule (area->ospf);
+}
+
+/* Schedule route calculation after only prefixes changed: the stub
+   links of router-LSAs, or summary-LSAs. */
+void
+ospf_spf_calculate_schedule_routes (struct ospf *ospf)
+{
+  ospf_spf_schedule (ospf);
+}
@@ -60,6 +60,9 @@ struct vertex_parent
 };
 
 extern void ospf_spf_calculate_schedule (struct ospf *);
+extern void ospf_spf_calculate_schedule_area (struct ospf_area *);
+extern void ospf_spf_calculate_schedule_routes (struct ospf *);
+extern void ospf_spf_saved_free (struct ospf_area *);
 extern void ospf_rtrs_free (struct route_table *);
 
 /* void ospf_spf_calculate_timer_add (); */
@@ -44,6 +44,7 @@
 #include "ospfd/ospf_abr.h"
 #include "ospfd/ospf_spf.h"
 #include "ospfd/ospf_route.h"
+#include "ospfd/ospf_ase.h"
 #include "ospfd/ospf_zebra.h"
 /*#include "ospfd/ospf_routemap.h" */
 #include "ospfd/ospf_vty.h"
@@ -2203,6 +2204,7 @@ DEFUN (ospf_compatible_rfc1583,
   if (!CHECK_FLAG (ospf->config, OSPF_RFC1583_COMPATIBLE))
     {
       SET_FLAG (ospf->config, OSPF_RFC1583_COMPATIBLE);
+      ospf_ase_calculate_schedule_full (ospf);
       ospf_spf_calculate_schedule (ospf);
     }
   return CMD_SUCCESS;
@@ -2220,6 +2222,7 @@ DEFUN (no_ospf_compatible_rfc1583,
   if (CHECK_FLAG (ospf->config, OSPF_RFC1583_COMPATIBLE))
     {
       UNSET_FLAG (ospf->config, OSPF_RFC1583_COMPATIBLE);
+      ospf_ase_calculate_schedule_full (ospf);
       ospf_spf_calculate_schedule (ospf);
     }
   return CMD_SUCCESS;
@@ -2572,6 +2575,21 @@ const char *ospf_abr_type_descr_str[] =
   "Alternative Shortcut"
 };
 
+static const char *ospf_spf_run_descr_str[] =
+{
+  "Full SPF runs:",
+  "Incremental SPF runs:",
+  "Partial route calculations:"
+};
+
+static const char *ospf_ase_calc_descr_str[] =
+{
+  "Full:",
+  "ASBR changes:",
+  "Network changes:",
+  "LSA updates:"
+};
+
 const char *ospf_shortcut_mode_descr_str[] = 
 {
   "Default",
@@ -2717,6 +2735,7 @@ DEFUN (show_ip_ospf,
   struct ospf *ospf;
   struct timeval result;
   char timebuf[OSPF_TIME_DUMP_SIZE];
+  int i;
 
   /* Check OSPF is enable. */
   ospf = ospf_lookup ();
@@ -2788,6 +2807,11 @@ DEFUN (show_ip_ospf,
            (ospf->t_spf_calc ? "due in " : "is "),
            ospf_timer_dump (ospf->t_spf_calc, timebuf, sizeof (timebuf)),
            VTY_NEWLINE);
+  for (i = 0; i < OSPF_SPF_RUN_MAX; i++)
+    vty_out (vty, " %s %lu, %lu msecs in total, last %lu msecs%s",
+             ospf_spf_run_descr_str[i], ospf->spf_stats[i].runs,
+             ospf->spf_stats[i].usecs / 1000,
+             ospf->spf_stats[i].last_usecs / 1000, VTY_NEWLINE);
   
   /* Show refresh parameters. */
   vty_out (vty, " Refresh timer %d secs%s",
@@ -2820,6 +2844,21 @@ DEFUN (show_ip_ospf,
 	   ospf_lsdb_count (ospf->lsdb, OSPF_OPAQUE_AS_LSA),
 	   ospf_lsdb_checksum (ospf->lsdb, OSPF_OPAQUE_AS_LSA), VTY_NEWLINE);
 #endif /* HAVE_OPAQUE_LSA */
+
+  /* Show AS-external route calculation statistics. */
+  vty_out (vty, " AS-external route calculations:%s", VTY_NEWLINE);
+  for (i = 0; i < OSPF_ASE_CALC_MAX; i++)
+    {
+      struct ospf_ase_stat *stat = &ospf->ase_stats[i];
+
+      vty_out (vty, "   %-16s %lu runs, ", ospf_ase_calc_descr_str[i],
+	       stat->runs);
+      if (i == OSPF_ASE_CALC_ASBR || i == OSPF_ASE_CALC_NETWORK)
+	vty_out (vty, "%lu route changes, ", stat->changes);
+      vty_out (vty, "%lu LSAs, %lu msecs%s",
+	       stat->lsas, stat->usecs / 1000, VTY_NEWLINE);
+    }
+
   /* Show number of areas attached. */
   vty_out (vty, " Number of areas attached to this router: %d%s",
            listcount (ospf->areas), VTY_NEWLINE);
@@ -179,6 +179,10 @@ ospf_new (void)
   new->new_external_route = route_table_init ();
   new->old_external_route = route_table_init ();
   new->external_lsas = route_table_init ();
+  new->ase_asbrs = route_table_init ();
+  new->ase_fwds = route_table_init ();
+  new->ase_networks = route_table_init ();
+  new->ase_calc_full = 1;
   
   new->stub_router_startup_time = OSPF_STUB_ROUTER_UNCONFIGURED;
   new->stub_router_shutdown_time = OSPF_STUB_ROUTER_UNCONFIGURED;
@@ -527,6 +531,7 @@ ospf_finish_final (struct ospf *ospf)
       ospf_route_delete (ospf->old_external_route);
       ospf_route_table_free (ospf->old_external_route);
     }
+  ospf_ase_dependencies_finish (ospf);
   if (ospf->external_lsas)
     {
       ospf_ase_external_lsas_finish (ospf->external_lsas);
@@ -620,6 +625,7 @@ ospf_area_free (struct ospf_area *area)
   ospf_lsdb_free (area->lsdb);
 
   ospf_lsa_unlock (&area->router_lsa_self);
+  ospf_spf_saved_free (area);
   
   route_table_finish (area->ranges);
   list_delete (area->oiflist);
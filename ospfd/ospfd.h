@@ -217,6 +217,7 @@ struct ospf
   /* Flags. */
   int external_origin;			/* AS-external-LSA origin flag. */
   int ase_calc;				/* ASE calculation flag. */
+  int ase_calc_full;			/* Recalculate all externals. */
 
 #ifdef HAVE_OPAQUE_LSA
   struct list *opaque_lsa_self;		/* Type-11 Opaque-LSAs */
@@ -235,9 +236,42 @@ struct ospf
   struct route_table *external_lsas;    /* Database of external LSAs,
 					   prefix is LSA's adv. network*/
 
+  /* External LSAs by the ASBR and the forwarding address their routes
+     depend on, and the network routes of the last ASE calculation. */
+  struct route_table *ase_asbrs;
+  struct route_table *ase_fwds;
+  struct route_table *ase_networks;
+
+  /* ASE calculation statistics, by what triggered the calculation. */
+#define OSPF_ASE_CALC_FULL	0
+#define OSPF_ASE_CALC_ASBR	1
+#define OSPF_ASE_CALC_NETWORK	2
+#define OSPF_ASE_CALC_LSA	3
+#define OSPF_ASE_CALC_MAX	4
+  struct ospf_ase_stat
+  {
+    unsigned long runs;			/* Calculations. */
+    unsigned long changes;		/* ASBR or network routes changed. */
+    unsigned long lsas;			/* LSAs (re)calculated. */
+    unsigned long usecs;		/* Time spent. */
+  } ase_stats[OSPF_ASE_CALC_MAX];
+
   /* Time stamps. */
   struct timeval ts_spf;		/* SPF calculation time stamp. */
 
+  /* SPF calculation statistics, see ospf_spf_calculate_timer(). */
+  int spf_full;				/* Calculate every area's tree. */
+#define OSPF_SPF_RUN_FULL		0
+#define OSPF_SPF_RUN_INCREMENTAL	1
+#define OSPF_SPF_RUN_PRC		2
+#define OSPF_SPF_RUN_MAX		3
+  struct ospf_spf_stat
+  {
+    unsigned long runs;
+    unsigned long usecs;
+    unsigned long last_usecs;
+  } spf_stats[OSPF_SPF_RUN_MAX];
+
   struct list *maxage_lsa;              /* List of MaxAge LSA for deletion. */
   int redistribute;                     /* Num of redistributed protocols. */
 
@@ -436,6 +470,11 @@ struct ospf_area
   /* Shortest Path Tree. */
   struct vertex *spf;
 
+  /* Tree of the last SPF calculation, and whether the topology of the
+     area changed since. */
+  struct ospf_spf_saved *spf_saved;
+  int spf_changed;
+
   /* Threads. */
   struct thread *t_stub_router;    /* Stub-router timer */
 #ifdef HAVE_OPAQUE_LSA
@@ -0,0 +1,259 @@
+/*
+ * BGP convergence benchmark.
+ *
+ * This file is part of Quagga.
+ *
+ * Quagga is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2, or (at your option) any
+ * later version.
+ *
+ * Quagga is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Quagga; see the file COPYING.  If not, write to the Free
+ * Software Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+
+/* Feeds a full table from a number of established peers straight into
+ * bgp_update(), withdraws it again from the peer with the best paths,
+ * and reports the CPU time it took to run the route processing queue
+ * dry each time.  No sockets are involved, so the numbers are for the
+ * route processing alone: best path selection and the adj-out of all
+ * the peers.
+ *
+ *   bgpconvbench [-p peers] [-n prefixes]
+ */
+#include <zebra.h>
+
+#include "vty.h"
+#include "command.h"
+#include "stream.h"
+#include "privs.h"
+#include "memory.h"
+#include "prefix.h"
+#include "if.h"
+#include "workqueue.h"
+
+#include "bgpd/bgpd.h"
+#include "bgpd/bgp_attr.h"
+#include "bgpd/bgp_aspath.h"
+#include "bgpd/bgp_route.h"
+#include "bgpd/bgp_nexthop.h"
+#include "bgpd/bgp_fsm.h"
+#include "bgpd/bgp_table.h"
+#include "bgpd/bgp_advertise.h"
+
+/* need these to link in libbgp */
+struct zebra_privs_t bgpd_privs;
+struct thread_master *master = NULL;
+
+static struct peer *peers[64];
+
+/* bm->address is not const. */
+static char listen_address[] = "127.0.0.1";
+
+static unsigned long
+cpu_msec (void)
+{
+  struct rusage ru;
+
+  getrusage (RUSAGE_SELF, &ru);
+  return ru.ru_utime.tv_sec * 1000 + ru.ru_utime.tv_usec / 1000
+    + ru.ru_stime.tv_sec * 1000 + ru.ru_stime.tv_usec / 1000;
+}
+
+/* Run threads until the route processing queue is empty. */
+static void
+run_queue (void)
+{
+  struct thread thread;
+
+  while (bm->process_main_queue
+	 && listcount (bm->process_main_queue->items))
+    if (thread_fetch (master, &thread))
+      thread_call (&thread);
+}
+
+/* Count the prefixes selected from each peer and the prefixes
+   advertised to the peers, to compare runs with. */
+static void
+report (struct bgp *bgp, int npeers)
+{
+  struct bgp_node *rn;
+  struct bgp_info *ri;
+  struct bgp_adj_out *adj;
+  unsigned long selected[64];
+  unsigned long adv = 0;
+  unsigned long bad = 0;
+  int i;
+
+  memset (selected, 0, sizeof selected);
+  for (rn = bgp_table_top (bgp->rib[AFI_IP][SAFI_UNICAST]); rn;
+       rn = bgp_route_next (rn))
+    {
+      for (ri = rn->info; ri; ri = ri->next)
+	if (CHECK_FLAG (ri->flags, BGP_INFO_SELECTED))
+	  for (i = 0; i < npeers; i++)
+	    if (ri->peer == peers[i])
+	      selected[i]++;
+      for (adj = rn->adj_out; adj; adj = adj->next)
+	{
+	  adv++;
+	  if (bgp_adj_out_find (rn, adj->peer) != adj)
+	    bad++;
+	}
+    }
+
+  printf ("  selected:");
+  for (i = 0; i < npeers; i++)
+    printf (" %lu", selected[i]);
+  printf (", advertised: %lu\n", adv);
+  if (bad)
+    printf ("  %lu adjacencies not found by peer\n", bad);
+}
+
+static struct peer *
+bench_peer (struct bgp *bgp, int i)
+{
+  union sockunion su;
+  struct peer *peer;
+  char buf[32];
+  as_t as = 65001 + i;
+
+  snprintf (buf, sizeof buf, "10.255.0.%d", i + 1);
+  str2sockunion (buf, &su);
+  peer_remote_as (bgp, &su, &as, AFI_IP, SAFI_UNICAST);
+  peer = peer_lookup (bgp, &su);
+
+  /* Pretend the session came up. */
+  BGP_TIMER_OFF (peer->t_start);
+  peer->status = Established;
+  peer->su_remote = sockunion_dup (&su);
+  peer->remote_id = su.sin.sin_addr;
+  peer->afc_nego[AFI_IP][SAFI_UNICAST] = 1;
+  peer->afc_recv[AFI_IP][SAFI_UNICAST] = 1;
+  peer->v_routeadv = 3600;
+  return peer;
+}
+
+static void
+feed (struct bgp *bgp, int npeers, int nprefixes, int withdraw)
+{
+  struct attr attr;
+  struct prefix p;
+  char buf[64];
+  int i, j;
+
+  for (i = 0; i < npeers; i++)
+    {
+      struct aspath *aspath;
+
+      if (withdraw && i > 0)
+	break;
+
+      /* Peer 0 has the shortest paths. */
+      snprintf (buf, sizeof buf, "%d 100 %d", 65001 + i, 200 + i);
+      aspath = aspath_str2aspath (i ? buf : "65001 100");
+
+      for (j = 0; j < nprefixes; j++)
+	{
+	  memset (&p, 0, sizeof p);
+	  p.family = AF_INET;
+	  p.prefixlen = 24;
+	  p.u.prefix4.s_addr = htonl ((10 << 24) + (j << 8));
+
+	  if (withdraw)
+	    {
+	      bgp_withdraw (peers[i], &p, NULL, AFI_IP, SAFI_UNICAST,
+			    ZEBRA_ROUTE_BGP, BGP_ROUTE_NORMAL, NULL, NULL);
+	      continue;
+	    }
+
+	  bgp_attr_default_set (&attr, BGP_ORIGIN_IGP);
+	  attr.aspath = aspath;
+	  attr.nexthop = peers[i]->su.sin.sin_addr;
+	  attr.med = j % 16;
+	  attr.flag |= ATTR_FLAG_BIT (BGP_ATTR_NEXT_HOP)
+	    | ATTR_FLAG_BIT (BGP_ATTR_MULTI_EXIT_DISC);
+	  bgp_update (peers[i], &p, &attr, AFI_IP, SAFI_UNICAST,
+		      ZEBRA_ROUTE_BGP, BGP_ROUTE_NORMAL, NULL, NULL, 0);
+	  bgp_attr_extra_free (&attr);
+	}
+    }
+}
+
+int
+main (int argc, char **argv)
+{
+  struct bgp *bgp;
+  struct interface *ifp;
+  struct prefix p;
+  as_t asn = 64512;
+  int npeers = 8;
+  int nprefixes = 100000;
+  unsigned long start;
+  int opt;
+  int i;
+
+  while ((opt = getopt (argc, argv, "p:n:")) != -1)
+    switch (opt)
+      {
+      case 'p':
+	npeers = atoi (optarg);
+	break;
+      case 'n':
+	nprefixes = atoi (optarg);
+	break;
+      default:
+	fprintf (stderr, "usage: %s [-p peers] [-n prefixes]\n",
+		 argv[0]);
+	return 1;
+      }
+  if (npeers < 1 || npeers > 64 || nprefixes < 1 || nprefixes > 65536 * 256)
+    return 1;
+
+  bgp_master_init ();
+  master = bm->master;
+  zprivs_init (&bgpd_privs);
+  cmd_init (1);
+  vty_init (master);
+  memory_init ();
+  bgp_init ();
+  bgp_option_set (BGP_OPT_NO_FIB);
+
+  /* Nobody connects, keep the listener out of the way. */
+  bm->port = 0;
+  bm->address = listen_address;
+
+  if (bgp_get (&bgp, &asn, NULL))
+    return 1;
+
+  /* The peers are on a connected network. */
+  ifp = if_get_by_name ("bench0");
+  str2prefix ("10.255.0.254/24", &p);
+  bgp_connected_add (connected_add_by_prefix (ifp, &p, NULL));
+
+  for (i = 0; i < npeers; i++)
+    peers[i] = bench_peer (bgp, i);
+
+  printf ("%d peers, %d prefixes\n", npeers, nprefixes);
+
+  start = cpu_msec ();
+  feed (bgp, npeers, nprefixes, 0);
+  run_queue ();
+  printf ("announce: %lu ms\n", cpu_msec () - start);
+  report (bgp, npeers);
+
+  start = cpu_msec ();
+  feed (bgp, npeers, nprefixes, 1);
+  run_queue ();
+  printf ("withdraw best: %lu ms\n", cpu_msec () - start);
+  report (bgp, npeers);
+
+  return 0;
+}
@@ -0,0 +1,156 @@
+#include <zebra.h>
+
+#include "vty.h"
+#include "stream.h"
+#include "privs.h"
+#include "memory.h"
+
+#include "bgpd/bgpd.h"
+#include "bgpd/bgp_aspath.h"
+#include "bgpd/bgp_regex.h"
+
+#define VT100_RESET "\x1b[0m"
+#define VT100_RED "\x1b[31m"
+#define VT100_GREEN "\x1b[32m"
+#define OK VT100_GREEN "OK" VT100_RESET
+#define FAILED VT100_RED "failed" VT100_RESET
+
+/* need these to link in libbgp */
+struct zebra_privs_t *bgpd_privs = NULL;
+struct thread_master *master = NULL;
+
+static int failed = 0;
+
+/* AS path regular expressions, and whether bgp_asregcomp() should take
+   them.  The others are left to regexec(). */
+static struct regex_test
+{
+  const char *regex;
+  int native;
+} regex_tests[] =
+{
+  { "_100_",		1 },
+  { "^100_",		1 },
+  { "_100$",		1 },
+  { "^100$",		1 },
+  { "^100_200_",	1 },
+  { "_100_200_",	1 },
+  { "_100_200$",	1 },
+  { "^100_200$",	1 },
+  { "_200_100_",	1 },
+  { "_1_",		1 },
+  { "_10_",		1 },
+  { "^1_",		1 },
+  { "_65000_",		1 },
+  { "^4294967295$",	1 },
+  { "^$",		1 },
+  { "_0100_",		0 },
+  { "_4294967296_",	0 },
+  { "100",		0 },
+  { "^100",		0 },
+  { "100_",		0 },
+  { "_100",		0 },
+  { "^100 200$",	0 },
+  { ".*",		0 },
+  { "^.*$",		0 },
+  { "_100_.*",		0 },
+  { "^100_.*_300$",	0 },
+  { "_[0-9]+_",		0 },
+  { NULL, 0 },
+};
+
+/* AS paths, as aspath_str2aspath() reads them, to match each of the
+   regular expressions against. */
+static const char *aspath_tests[] =
+{
+  "",
+  "100",
+  "1",
+  "10",
+  "1000",
+  "100 200",
+  "200 100",
+  "1 100 200",
+  "10 100",
+  "1000 100",
+  "100 200 300",
+  "100 100 200",
+  "100 2000",
+  "2100 200",
+  "{100,200}",
+  "300 {100,200}",
+  "{200,100} 300",
+  "(100 200) 300",
+  "(65000) 100 200",
+  "[100,200] 300",
+  "300 [200,100]",
+  "4294967295",
+  "65000 4294967295 1",
+  NULL,
+};
+
+/* The native matcher has to agree with regexec() on every path. */
+static void
+regex_test (const struct regex_test *t)
+{
+  struct bgp_asregex *asregex;
+  regex_t *regex;
+  struct aspath *as;
+  int fails = 0;
+  int i;
+
+  printf ("%s: ", t->regex);
+
+  regex = bgp_regcomp (t->regex);
+  asregex = bgp_asregcomp (t->regex);
+
+  if (regex == NULL)
+    {
+      printf ("regcomp failed\n");
+      fails++;
+    }
+  if ((asregex != NULL) != t->native)
+    {
+      printf ("native matcher %s it\n", t->native ? "doesn't take" : "takes");
+      fails++;
+    }
+
+  for (i = 0; regex && asregex && aspath_tests[i]; i++)
+    {
+      int expect, result;
+
+      as = aspath_str2aspath (aspath_tests[i]);
+      expect = bgp_regexec (regex, as) != REG_NOMATCH;
+      result = bgp_asregexec (asregex, as) != REG_NOMATCH;
+      if (result != expect)
+	{
+	  printf ("\"%s\" %s, should %s\n", as->str,
+		  result ? "matches" : "doesn't match",
+		  expect ? "match" : "not");
+	  fails++;
+	}
+      aspath_free (as);
+    }
+
+  if (regex)
+    bgp_regex_free (regex);
+  if (asregex)
+    bgp_asregex_free (asregex);
+
+  printf ("%s\n", fails ? FAILED : OK);
+  failed += fails;
+}
+
+int
+main (void)
+{
+  int i;
+
+  aspath_init ();
+
+  for (i = 0; regex_tests[i].regex; i++)
+    regex_test (&regex_tests[i]);
+
+  printf ("failures: %d\n", failed);
+  return failed;
+}
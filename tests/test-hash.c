@@ -0,0 +1,115 @@
+#include <zebra.h>
+
+#include "hash.h"
+#include "memory.h"
+
+/* Hash table resize tests: tables must grow and shrink around their
+ * load limits, and every entry must stay reachable through lookup,
+ * release and iteration while a resize is still in progress.
+ */
+
+struct thread_master *master;
+
+/* One past a power of two times the initial size, so that the last
+ * insert starts a resize which is still in progress afterwards. */
+#define ENTRIES (64 * 1024 + 1)
+
+static unsigned int
+test_hash_key (void *p)
+{
+  /* Poor spread on purpose, so chains actually form. */
+  return *(unsigned int *) p / 3;
+}
+
+static int
+test_hash_cmp (const void *a, const void *b)
+{
+  return *(const unsigned int *) a == *(const unsigned int *) b;
+}
+
+static void
+test_hash_count (struct hash_backet *hb, void *arg)
+{
+  unsigned long *count = arg;
+
+  (*count)++;
+}
+
+/* Releases every other entry while walking. */
+static void
+test_hash_release_odd (struct hash_backet *hb, void *arg)
+{
+  struct hash *hash = arg;
+
+  if (*(unsigned int *) hb->data & 1)
+    hash_release (hash, hb->data);
+}
+
+int
+main (void)
+{
+  struct hash *hash;
+  unsigned int *vals;
+  unsigned long count;
+  unsigned int i;
+  int fail = 0;
+
+  vals = XMALLOC (MTYPE_TMP, ENTRIES * sizeof (unsigned int));
+  for (i = 0; i < ENTRIES; i++)
+    vals[i] = i;
+
+  hash = hash_create_size (64, test_hash_key, test_hash_cmp);
+
+  for (i = 0; i < ENTRIES; i++)
+    hash_get (hash, &vals[i], hash_alloc_intern);
+
+  printf ("inserted: count %lu size %u grows %lu\n",
+          hash->count, hash->size, hash->grows);
+  if (hash->count != ENTRIES || hash->size < ENTRIES / HASH_LOAD_MAX)
+    fail++;
+
+  /* Lookups both advance the resize and must find entries in
+   * either table. */
+  for (i = 0; i < ENTRIES; i += 1024)
+    if (hash_lookup (hash, &vals[i]) != &vals[i])
+      {
+        printf ("lookup of %u failed\n", i);
+        fail++;
+        break;
+      }
+
+  /* Walk and release half the table while it is being resized. */
+  printf ("resizing: %s\n", hash->old_index ? "yes" : "no");
+  if (!hash->old_index)
+    fail++;
+  hash_iterate (hash, test_hash_release_odd, hash);
+
+  count = 0;
+  hash_iterate (hash, test_hash_count, &count);
+  printf ("after release: count %lu iterated %lu\n", hash->count, count);
+  if (hash->count != (ENTRIES + 1) / 2 || count != (ENTRIES + 1) / 2)
+    fail++;
+
+  for (i = 0; i < ENTRIES; i++)
+    if ((hash_lookup (hash, &vals[i]) != NULL) != !(i & 1))
+      {
+        printf ("lookup of %u wrong after release\n", i);
+        fail++;
+        break;
+      }
+
+  for (i = 0; i < ENTRIES; i += 2)
+    hash_release (hash, &vals[i]);
+
+  printf ("emptied: count %lu size %u shrinks %lu\n",
+          hash->count, hash->size, hash->shrinks);
+  if (hash->count != 0 || hash->shrinks == 0)
+    fail++;
+
+  hash_clean (hash, NULL);
+  hash_free (hash);
+  XFREE (MTYPE_TMP, vals);
+
+  printf ("%s\n", fail ? "FAILED" : "OK");
+  return fail ? 1 : 0;
+}
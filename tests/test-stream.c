@@ -27,6 +27,67 @@ print_stream (struct stream *s)
   stream_set_getp (s, getp);
 }
 
+/* Shared streams read the same data, each at its own pace, and the
+   data goes away with the last of them. */
+static void
+test_share (void)
+{
+  struct stream *s, *s1, *s2;
+  struct stream_fifo *fifo;
+  char buf[16];
+  int fd[2];
+  ssize_t n;
+
+  s = stream_new (1024);
+  stream_put (s, "abcdef", 6);
+
+  s1 = stream_share (s);
+  s2 = stream_share (s1);
+  printf ("shared: %d, refcnt %lu, writeable: %ld\n",
+          s1->data == s->data && s2->data == s->data,
+          s->segment->refcnt, STREAM_WRITEABLE (s));
+
+  stream_forward_getp (s1, 2);
+  printf ("getp: %ld %ld %ld\n", stream_get_getp (s),
+          stream_get_getp (s1), stream_get_getp (s2));
+
+  stream_free (s);
+  stream_free (s2);
+  printf ("s1: %c, refcnt %lu\n", stream_getc (s1), s1->segment->refcnt);
+
+  /* The rest of s1 and a copy of it in one go. */
+  if (pipe (fd) < 0)
+    return;
+  fifo = stream_fifo_new ();
+  stream_fifo_push (fifo, s1);
+  stream_fifo_push (fifo, stream_dup (s1));
+  n = stream_fifo_writev (fifo, fd[1], 16);
+  memset (buf, 0, sizeof (buf));
+  if (read (fd[0], buf, sizeof (buf) - 1) != n)
+    printf ("short read\n");
+  printf ("writev: %ld \"%s\"\n", (long) n, buf);
+  stream_fifo_free (fifo);
+  close (fd[0]);
+  close (fd[1]);
+}
+
+/* Pulling down the unread part of a stream makes room at its end. */
+static void
+test_pulldown (void)
+{
+  struct stream *s;
+
+  s = stream_new (8);
+  stream_put (s, "abcdef", 6);
+  stream_forward_getp (s, 4);
+  stream_pulldown (s);
+  printf ("pulldown: getp %ld endp %ld writeable %ld\n",
+          stream_get_getp (s), stream_get_endp (s), STREAM_WRITEABLE (s));
+  printf ("pulldown: %c", stream_getc (s));
+  printf ("%c\n", stream_getc (s));
+  stream_free (s);
+}
+
 int
 main (void)
 {
@@ -50,5 +111,8 @@ main (void)
   printf ("l: 0x%x\n", stream_getl (s));
   printf ("q: 0x%lx\n", stream_getq (s));
   
+  test_share ();
+  test_pulldown ();
+
   return 0;
 }
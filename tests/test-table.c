@@ -0,0 +1,261 @@
+#include <zebra.h>
+
+#include "prefix.h"
+#include "table.h"
+#include "memory.h"
+
+/* Route table benchmark: builds an IPv4 and an IPv6 table of Internet
+ * like size, once with the first stride index and once without it,
+ * and compares insert and longest match throughput and the memory the
+ * tables take.  Every lookup is checked against the other table, so
+ * this doubles as a test of the index.
+ */
+
+struct thread_master *master;
+
+#define V4_PREFIXES	600000
+#define V6_PREFIXES	150000
+#define LOOKUPS		2000000
+
+static int fail;
+
+static double
+elapsed (struct timeval *start)
+{
+  struct timeval now;
+
+  gettimeofday (&now, NULL);
+  return (now.tv_sec - start->tv_sec)
+         + (now.tv_usec - start->tv_usec) / 1000000.0;
+}
+
+static void
+random_bytes (u_char *buf, int len)
+{
+  while (len--)
+    *buf++ = random () & 0xff;
+}
+
+/* Prefix lengths roughly as in a full table. */
+static int
+random_prefixlen (int family)
+{
+  int r = random () % 100;
+
+  if (family == AF_INET)
+    {
+      if (r < 60)
+        return 24;
+      if (r < 85)
+        return 17 + random () % 7;
+      if (r < 95)
+        return 8 + random () % 9;
+      return 25 + random () % 8;
+    }
+  if (r < 60)
+    return 48;
+  if (r < 85)
+    return 32 + random () % 16;
+  return 49 + random () % 16;
+}
+
+static void
+random_prefix (int family, struct prefix *p)
+{
+  memset (p, 0, sizeof (struct prefix));
+  p->family = family;
+  p->prefixlen = random_prefixlen (family);
+  if (family == AF_INET)
+    {
+      random_bytes (&p->u.prefix, 4);
+      /* Unicast space only. */
+      p->u.val[0] = 1 + p->u.val[0] % 223;
+    }
+  else
+    {
+      random_bytes (&p->u.prefix, 16);
+      p->u.val[0] = 0x20 | (p->u.val[0] & 0x1f);
+    }
+  apply_mask (p);
+}
+
+/* An address inside a prefix, or anywhere one time in four. */
+static void
+random_address (int family, struct prefix *prefixes, int count,
+                struct prefix *addr)
+{
+  struct prefix *p = &prefixes[random () % count];
+  int len = family == AF_INET ? 4 : 16;
+  u_char host[16];
+  int i;
+
+  random_bytes (host, len);
+  memset (addr, 0, sizeof (struct prefix));
+  addr->family = family;
+  addr->prefixlen = len * 8;
+  if (random () % 4 == 0)
+    {
+      memcpy (&addr->u.prefix, host, len);
+      return;
+    }
+  memcpy (&addr->u.prefix, &p->u.prefix, len);
+  for (i = p->prefixlen; i < len * 8; i++)
+    if (host[i / 8] & (0x80 >> (i % 8)))
+      addr->u.val[i / 8] |= 0x80 >> (i % 8);
+    else
+      addr->u.val[i / 8] &= ~(0x80 >> (i % 8));
+}
+
+static void
+table_insert (struct route_table *table, struct prefix *prefixes, int count)
+{
+  struct route_node *rn;
+  int i;
+
+  for (i = 0; i < count; i++)
+    {
+      rn = route_node_get (table, &prefixes[i]);
+      if (rn->info)
+        route_unlock_node (rn);
+      else
+        rn->info = &prefixes[i];
+    }
+}
+
+/* Removes every other prefix. */
+static void
+table_delete_half (struct route_table *table, struct prefix *prefixes,
+                   int count)
+{
+  struct route_node *rn;
+  int i;
+
+  for (i = 0; i < count; i += 2)
+    if ((rn = route_node_lookup (table, &prefixes[i])) != NULL)
+      {
+        rn->info = NULL;
+        route_unlock_node (rn);
+        route_unlock_node (rn);
+      }
+}
+
+static unsigned long
+table_memory (struct route_table *table)
+{
+  return table->count * sizeof (struct route_node)
+         + (table->index
+            ? sizeof (struct route_node *) << ROUTE_TABLE_INDEX_BITS : 0);
+}
+
+static double
+table_lookups (struct route_table *table, struct prefix *addrs, int count)
+{
+  struct timeval start;
+  struct route_node *rn;
+  int i;
+
+  gettimeofday (&start, NULL);
+  for (i = 0; i < count; i++)
+    if ((rn = route_node_match (table, &addrs[i])) != NULL)
+      route_unlock_node (rn);
+  return elapsed (&start);
+}
+
+static void
+check_lookups (const char *what, struct route_table *a,
+               struct route_table *b, struct prefix *addrs, int count)
+{
+  struct route_node *ra, *rb;
+  int i;
+
+  for (i = 0; i < count; i++)
+    {
+      ra = route_node_match (a, &addrs[i]);
+      rb = route_node_match (b, &addrs[i]);
+
+      if ((ra == NULL) != (rb == NULL)
+          || (ra && ! prefix_same (&ra->p, &rb->p)))
+        {
+          printf ("%s: lookup %d differs\n", what, i);
+          fail++;
+          i = count;
+        }
+      if (ra)
+        route_unlock_node (ra);
+      if (rb)
+        route_unlock_node (rb);
+    }
+}
+
+static void
+bench (const char *name, int family, int count)
+{
+  struct route_table *plain, *indexed;
+  struct prefix *prefixes, *addrs;
+  struct timeval start;
+  double t_plain, t_indexed;
+  char mem1[MTYPE_MEMSTR_LEN], mem2[MTYPE_MEMSTR_LEN];
+  int i;
+
+  prefixes = XMALLOC (MTYPE_TMP, count * sizeof (struct prefix));
+  addrs = XMALLOC (MTYPE_TMP, LOOKUPS * sizeof (struct prefix));
+  for (i = 0; i < count; i++)
+    random_prefix (family, &prefixes[i]);
+  for (i = 0; i < LOOKUPS; i++)
+    random_address (family, prefixes, count, &addrs[i]);
+
+  plain = route_table_init ();
+  route_table_set_index (plain, 0);
+  indexed = route_table_init ();
+
+  gettimeofday (&start, NULL);
+  table_insert (plain, prefixes, count);
+  t_plain = elapsed (&start);
+  gettimeofday (&start, NULL);
+  table_insert (indexed, prefixes, count);
+  t_indexed = elapsed (&start);
+
+  printf ("%s, %d prefixes, %lu nodes\n", name, count, indexed->count);
+  printf ("  insert    %8.0f/s  %8.0f/s indexed\n",
+          count / t_plain, count / t_indexed);
+
+  t_plain = table_lookups (plain, addrs, LOOKUPS);
+  t_indexed = table_lookups (indexed, addrs, LOOKUPS);
+  printf ("  match     %8.0f/s  %8.0f/s indexed\n",
+          LOOKUPS / t_plain, LOOKUPS / t_indexed);
+  printf ("  memory    %10s  %10s indexed\n",
+          mtype_memstr (mem1, sizeof (mem1), table_memory (plain)),
+          mtype_memstr (mem2, sizeof (mem2), table_memory (indexed)));
+
+  check_lookups (name, plain, indexed, addrs, LOOKUPS);
+
+  /* Withdrawals must keep the index consistent. */
+  table_delete_half (plain, prefixes, count);
+  table_delete_half (indexed, prefixes, count);
+  if (plain->count != indexed->count)
+    {
+      printf ("%s: %lu nodes left, %lu with index\n", name,
+              plain->count, indexed->count);
+      fail++;
+    }
+  check_lookups (name, plain, indexed, addrs, LOOKUPS);
+
+  route_table_finish (plain);
+  route_table_finish (indexed);
+  XFREE (MTYPE_TMP, prefixes);
+  XFREE (MTYPE_TMP, addrs);
+}
+
+int
+main (void)
+{
+  srandom (1);
+
+  bench ("IPv4", AF_INET, V4_PREFIXES);
+#ifdef HAVE_IPV6
+  bench ("IPv6", AF_INET6, V6_PREFIXES);
+#endif /* HAVE_IPV6 */
+
+  printf ("%s\n", fail ? "FAILED" : "OK");
+  return fail ? 1 : 0;
+}
@@ -39,11 +39,16 @@
 #include "zebra/router-id.h"
 #include "zebra/irdp.h"
 #include "zebra/rtadv.h"
+#include "zebra/rt.h"
 
 /* Zebra instance */
 struct zebra_t zebrad =
 {
   .rtm_table_default = 0,
+#ifdef HAVE_NETLINK
+  .nl_batch_size = NL_BATCH_SIZE_DEFAULT,
+  .nl_batch_latency = NL_BATCH_LATENCY_DEFAULT,
+#endif /* HAVE_NETLINK */
 };
 
 /* process id. */
@@ -169,6 +174,9 @@ sigint (void)
 
   if (!retain_mode)
     rib_close ();
+#ifdef HAVE_NETLINK
+  netlink_batch_sync ();
+#endif /* HAVE_NETLINK */
 #ifdef HAVE_IRDP
   irdp_finish();
 #endif
@@ -30,6 +30,8 @@
 #include "zclient.h"
 #include "linklist.h"
 #include "log.h"
+#include "memory.h"
+#include "thread.h"
 
 #include "zebra/rib.h"
 #include "zebra/zserv.h"
@@ -390,3 +392,281 @@ zebra_interface_address_delete_update (struct interface *ifp,
     if (client->ifinfo && CHECK_FLAG (ifc->conf, ZEBRA_IFC_REAL))
       zsend_interface_address (ZEBRA_INTERFACE_ADDRESS_DELETE, client, ifp, ifc);
 }
+
+/* Nexthop tracking.  A client registers the addresses it needs resolved,
+   zebra answers each registration with ZEBRA_NEXTHOP_UPDATE and sends
+   another one whenever the answer changes.  Addresses are kept as host
+   routes, so that a changed route only has to look at the registered
+   addresses its prefix covers.  */
+struct zebra_nht
+{
+  /* Clients which registered the address. */
+  struct list *clients;
+
+  /* Last answer, as encoded by zserv_encode_nexthops(). */
+  u_char *answer;
+  size_t len;
+
+  /* Queued for evaluation. */
+  u_char dirty;
+};
+
+static struct route_table *zebra_nht_table[AFI_MAX];
+
+/* Nodes of registered addresses queued for evaluation, and the event
+   which evaluates them. */
+static struct list *zebra_nht_dirty;
+static struct thread *zebra_nht_thread;
+
+static struct stream *zebra_nht_stream;
+
+/* Look up where the address of rn resolves to now and keep the answer.
+   Return 1 if it differs from the previous one.  */
+static int
+zebra_nht_evaluate (struct route_node *rn)
+{
+  struct zebra_nht *nht = rn->info;
+  struct stream *s;
+  struct rib *rib = NULL;
+
+  if (! zebra_nht_stream)
+    zebra_nht_stream = stream_new (ZEBRA_MAX_PACKET_SIZ);
+  s = zebra_nht_stream;
+  stream_reset (s);
+
+  if (rn->p.family == AF_INET)
+    rib = rib_match_ipv4 (rn->p.u.prefix4);
+#ifdef HAVE_IPV6
+  else if (rn->p.family == AF_INET6)
+    rib = rib_match_ipv6 (&rn->p.u.prefix6);
+#endif /* HAVE_IPV6 */
+  zserv_encode_nexthops (s, rib);
+
+  nht->dirty = 0;
+  if (nht->answer && nht->len == stream_get_endp (s)
+      && memcmp (nht->answer, STREAM_DATA (s), nht->len) == 0)
+    return 0;
+
+  if (nht->answer)
+    XFREE (MTYPE_NEXTHOP_TRACK, nht->answer);
+  nht->len = stream_get_endp (s);
+  nht->answer = XMALLOC (MTYPE_NEXTHOP_TRACK, nht->len);
+  memcpy (nht->answer, STREAM_DATA (s), nht->len);
+  return 1;
+}
+
+static void
+zebra_nht_free (struct route_node *rn)
+{
+  struct zebra_nht *nht = rn->info;
+
+  list_delete (nht->clients);
+  if (nht->answer)
+    XFREE (MTYPE_NEXTHOP_TRACK, nht->answer);
+  XFREE (MTYPE_NEXTHOP_TRACK, nht);
+  rn->info = NULL;
+  route_unlock_node (rn);
+}
+
+static int
+zebra_nexthop_track_run (struct thread *thread)
+{
+  struct listnode *node, *nnode;
+  struct route_node *rn;
+  struct zebra_nht *nht;
+  struct zserv *client;
+  char buf[INET6_ADDRSTRLEN];
+
+  zebra_nht_thread = NULL;
+
+  while ((rn = listnode_head (zebra_nht_dirty)) != NULL)
+    {
+      list_delete_node (zebra_nht_dirty, listhead (zebra_nht_dirty));
+
+      if ((nht = rn->info) != NULL && zebra_nht_evaluate (rn))
+	{
+	  if (IS_ZEBRA_DEBUG_EVENT)
+	    zlog_debug ("MESSAGE: ZEBRA_NEXTHOP_UPDATE %s",
+			inet_ntop (rn->p.family, &rn->p.u.prefix,
+				   buf, INET6_ADDRSTRLEN));
+
+	  for (ALL_LIST_ELEMENTS (nht->clients, node, nnode, client))
+	    zsend_nexthop_update (client, &rn->p, nht->answer, nht->len);
+	}
+      route_unlock_node (rn);
+    }
+  return 0;
+}
+
+/* Mark the registered addresses under start, which route_node_get()
+   returned, for evaluation.  */
+static void
+zebra_nht_mark (struct route_node *start)
+{
+  struct route_node *rn;
+  struct zebra_nht *nht;
+
+  route_lock_node (start);
+  for (rn = start; rn; rn = route_next_until (rn, start))
+    if ((nht = rn->info) != NULL && ! nht->dirty)
+      {
+	nht->dirty = 1;
+	route_lock_node (rn);
+	listnode_add (zebra_nht_dirty, rn);
+      }
+  route_unlock_node (start);
+}
+
+/* Routes for p were selected, unselected, installed or uninstalled, so
+   registered addresses covered by p may resolve differently now.  A NULL
+   p covers all of them.  */
+void
+zebra_nexthop_track_changed (struct prefix *p)
+{
+  struct route_table *table;
+  afi_t afi;
+
+  for (afi = AFI_IP; afi < AFI_MAX; afi++)
+    {
+      table = zebra_nht_table[afi];
+      if (! table || ! table->top)
+	continue;
+
+      if (! p)
+	zebra_nht_mark (route_lock_node (table->top));
+      else if (family2afi (p->family) == afi)
+	zebra_nht_mark (route_node_get (table, p));
+    }
+
+  if (! zebra_nht_thread && zebra_nht_dirty && listcount (zebra_nht_dirty))
+    zebra_nht_thread = thread_add_event (zebrad.master,
+					 zebra_nexthop_track_run, NULL, 0);
+}
+
+static void
+zebra_nexthop_track_add (struct zserv *client, struct prefix *p)
+{
+  struct route_table *table;
+  struct route_node *rn;
+  struct zebra_nht *nht;
+  afi_t afi;
+
+  afi = family2afi (p->family);
+  if (! zebra_nht_table[afi])
+    zebra_nht_table[afi] = route_table_init ();
+  if (! zebra_nht_dirty)
+    zebra_nht_dirty = list_new ();
+  table = zebra_nht_table[afi];
+
+  rn = route_node_get (table, p);
+  if ((nht = rn->info) == NULL)
+    {
+      nht = XCALLOC (MTYPE_NEXTHOP_TRACK, sizeof (struct zebra_nht));
+      nht->clients = list_new ();
+      rn->info = nht;
+      zebra_nht_evaluate (rn);
+    }
+  else
+    route_unlock_node (rn);
+
+  if (! listnode_lookup (nht->clients, client))
+    listnode_add (nht->clients, client);
+
+  zsend_nexthop_update (client, p, nht->answer, nht->len);
+}
+
+static void
+zebra_nexthop_track_delete (struct zserv *client, struct prefix *p)
+{
+  struct route_table *table;
+  struct route_node *rn;
+  struct zebra_nht *nht;
+
+  table = zebra_nht_table[family2afi (p->family)];
+  if (! table)
+    return;
+
+  rn = route_node_lookup (table, p);
+  if (! rn)
+    return;
+
+  if ((nht = rn->info) != NULL)
+    {
+      listnode_delete (nht->clients, client);
+      if (! listcount (nht->clients))
+	zebra_nht_free (rn);
+    }
+  route_unlock_node (rn);
+}
+
+/* Read the addresses of a ZEBRA_NEXTHOP_REGISTER or
+   ZEBRA_NEXTHOP_UNREGISTER message, each an address family octet and
+   the address.  */
+static void
+zebra_nexthop_read (int command, struct zserv *client, int length)
+{
+  struct stream *s;
+  struct prefix p;
+
+  s = client->ibuf;
+
+  while (length > 0)
+    {
+      memset (&p, 0, sizeof (struct prefix));
+      p.family = stream_getc (s);
+      length--;
+
+      if (p.family == AF_INET)
+	p.prefixlen = IPV4_MAX_BITLEN;
+#ifdef HAVE_IPV6
+      else if (p.family == AF_INET6)
+	p.prefixlen = IPV6_MAX_BITLEN;
+#endif /* HAVE_IPV6 */
+      else
+	{
+	  zlog_warn ("%s: unknown address family %d", __func__, p.family);
+	  return;
+	}
+
+      if (length < PSIZE (p.prefixlen))
+	return;
+      stream_get (&p.u.prefix, s, PSIZE (p.prefixlen));
+      length -= PSIZE (p.prefixlen);
+
+      if (command == ZEBRA_NEXTHOP_REGISTER)
+	zebra_nexthop_track_add (client, &p);
+      else
+	zebra_nexthop_track_delete (client, &p);
+    }
+}
+
+void
+zebra_nexthop_register (int command, struct zserv *client, int length)
+{
+  zebra_nexthop_read (command, client, length);
+}
+
+void
+zebra_nexthop_unregister (int command, struct zserv *client, int length)
+{
+  zebra_nexthop_read (command, client, length);
+}
+
+/* Forget the registrations of a client going away. */
+void
+zebra_nexthop_client_close (struct zserv *client)
+{
+  struct route_node *rn;
+  struct zebra_nht *nht;
+  afi_t afi;
+
+  for (afi = AFI_IP; afi < AFI_MAX; afi++)
+    if (zebra_nht_table[afi])
+      for (rn = route_top (zebra_nht_table[afi]); rn; rn = route_next (rn))
+	if ((nht = rn->info) != NULL)
+	  {
+	    listnode_delete (nht->clients, client);
+	    if (! listcount (nht->clients))
+	      zebra_nht_free (rn);
+	  }
+}
@@ -46,6 +46,11 @@ extern void zebra_interface_address_add_update (struct interface *,
 extern void zebra_interface_address_delete_update (struct interface *,
 						   struct connected *c);
 
+extern void zebra_nexthop_register (int, struct zserv *, int);
+extern void zebra_nexthop_unregister (int, struct zserv *, int);
+extern void zebra_nexthop_track_changed (struct prefix *);
+extern void zebra_nexthop_client_close (struct zserv *);
+
 extern int zebra_check_addr (struct prefix *);
 
 #endif /* _ZEBRA_REDISTRIBUTE_H */
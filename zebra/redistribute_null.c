@@ -24,3 +24,6 @@ void zebra_interface_address_add_update (struct interface *a,
 					 	struct connected *b)
 { return; }
 #pragma weak zebra_interface_address_delete_update = zebra_interface_address_add_update
+
+void zebra_nexthop_track_changed (struct prefix *a)
+{ return; }
@@ -25,6 +25,7 @@
 
 #include "prefix.h"
 #include "log.h"
+#include "table.h"
 
 #define DISTANCE_INFINITY  255
 
@@ -49,6 +50,9 @@ struct rib
   
   /* Nexthop structure */
   struct nexthop *nexthop;
+
+  /* Shared group of the same nexthops, see nexthop_active_update().  */
+  struct nexthop_group *nhg;
   
   /* Reference count. */
   unsigned long refcnt;
@@ -196,6 +200,7 @@ struct nexthop
 #define NEXTHOP_FLAG_ACTIVE     (1 << 0) /* This nexthop is alive. */
 #define NEXTHOP_FLAG_FIB        (1 << 1) /* FIB nexthop. */
 #define NEXTHOP_FLAG_RECURSIVE  (1 << 2) /* Recursive nexthop. */
+#define NEXTHOP_FLAG_QUEUED     (1 << 3) /* Sent to the FIB, no answer yet. */
 
   /* Nexthop address or interface name. */
   union g_addr gate;
@@ -207,6 +212,35 @@ struct nexthop
   union g_addr src;
 };
 
+/* Nexthop of a group, and what it last resolved to.  */
+struct nexthop_group_hop
+{
+  /* The nexthop as given, without anything found by resolving it.  */
+  struct nexthop given;
+
+  /* Lookup of a gateway in the routing table, valid while generation
+     is current: whether it is reachable, the nexthop it resolved to
+     and the length of the prefix the lookup stopped at.  */
+  u_int32_t generation;
+  u_char active;
+  u_char len;
+  struct nexthop resolved;
+};
+
+/* Routes with the same nexthops share a group, so that gateways are
+   looked up once for all of them rather than once for every route.
+   Interned in nexthop_group_hash.  */
+struct nexthop_group
+{
+  unsigned long refcnt;
+
+  /* ZEBRA_FLAG_INTERNAL routes resolve through other routes' nexthops. */
+  u_char internal;
+
+  unsigned int hop_num;
+  struct nexthop_group_hop *hops;
+};
+
 /* Routing table instance.  */
 struct vrf
 {
@@ -236,6 +270,8 @@ extern struct nexthop *nexthop_ipv4_add (struct rib *, struct in_addr *,
 					 struct in_addr *);
 extern struct nexthop * nexthop_ipv4_ifindex_ol_add (struct rib *, const struct in_addr *,
 						     const struct in_addr *, const unsigned);
+extern void rib_nexthops_changed (struct route_node *, struct rib *);
+extern void rib_install_kernel_done (struct route_node *, struct rib *, int);
 extern void rib_lookup_and_dump (struct prefix_ipv4 *);
 extern void rib_lookup_and_pushup (struct prefix_ipv4 *);
 extern void rib_dump (const char *, const struct prefix_ipv4 *, const struct rib *);
@@ -43,6 +43,7 @@ extern int kernel_delete_ipv6_old (struct prefix_ipv6 *dest, struct in6_addr *ga
 
 #ifdef HAVE_NETLINK
 extern int netlink_route_read (void);
+extern void netlink_batch_sync (void);
 #endif
 
 #endif /* _ZEBRA_RT_H */
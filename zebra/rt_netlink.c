@@ -199,6 +199,9 @@ netlink_request (int family, int type, struct nlsock *nl)
       return -1;
     }
 
+  if (nl == &netlink_cmd)
+    netlink_batch_sync ();
+
   memset (&snl, 0, sizeof snl);
   snl.nl_family = AF_NETLINK;
 
@@ -1157,6 +1160,9 @@ netlink_talk (struct nlmsghdr *n, struct nlsock *nl)
   memset (&snl, 0, sizeof snl);
   snl.nl_family = AF_NETLINK;
 
+  if (nl == &netlink_cmd)
+    netlink_batch_sync ();
+
   n->nlmsg_seq = ++nl->seq;
 
   /* Request an acknowledgement by setting NLM_F_ACK */
@@ -1190,6 +1196,350 @@ netlink_talk (struct nlmsghdr *n, struct nlsock *nl)
   return netlink_parse_info (netlink_talk_filter, nl);
 }
 
+/* Route changes are not sent to the kernel one at a time.  They are
+   packed into a batch which goes out with a single sendmsg() once it
+   holds nl_batch_size messages, or nl_batch_latency milliseconds after
+   the first of them was queued.  Acknowledgements are read back from
+   the command socket as they arrive, and every message in flight is
+   remembered so that the answer can be tied to the route it was for.
+   A route's nexthops are only flagged as in the FIB once the kernel
+   has acknowledged it.  Anybody else talking on the command socket
+   syncs the batch first. */
+#define NL_BATCH_BUFSIZE	65536
+#define NL_BATCH_PENDING_MAX	256
+
+struct nl_batch_msg
+{
+  u_int32_t seq;
+  int cmd;
+  struct prefix p;
+  struct rib *rib;
+
+  /* Locked node of rib, for RTM_NEWROUTE. */
+  struct route_node *rn;
+};
+
+static struct
+{
+  char buf[NL_BATCH_BUFSIZE];
+  size_t len;
+
+  /* Ring of messages, oldest first: those sent and not acknowledged
+     yet, followed by those still waiting in buf. */
+  struct nl_batch_msg msgs[NL_BATCH_PENDING_MAX];
+  int head;
+  int sent;
+  int queued;
+
+  struct thread *t_flush;
+  struct thread *t_read;
+} nl_batch;
+
+#define NL_BATCH_MSG(i) \
+  (&nl_batch.msgs[(nl_batch.head + (i)) % NL_BATCH_PENDING_MAX])
+
+/* The node of rib, which is in one of the tables of the default VRF. */
+static struct route_node *
+netlink_batch_node (struct prefix *p, struct rib *rib)
+{
+  static const safi_t safis[] = { SAFI_UNICAST, SAFI_MULTICAST };
+  struct route_table *table;
+  struct route_node *rn;
+  struct rib *r;
+  unsigned int i;
+
+  for (i = 0; i < sizeof (safis) / sizeof (safis[0]); i++)
+    {
+      table = vrf_table (p->family == AF_INET ? AFI_IP : AFI_IP6,
+			 safis[i], 0);
+      if (! table || ! (rn = route_node_lookup (table, p)))
+	continue;
+
+      for (r = rn->info; r; r = r->next)
+	if (r == rib)
+	  return rn;
+      route_unlock_node (rn);
+    }
+  return NULL;
+}
+
+/* The kernel has answered a message installing a route.  The rib may
+   have been withdrawn and freed in the meantime, so it is only touched
+   when it is still found on its route node, and left alone when a
+   later message for it is on its way. */
+static void
+netlink_batch_installed (struct nl_batch_msg *m, int installed)
+{
+  int i;
+
+  for (i = 1; i < nl_batch.sent + nl_batch.queued; i++)
+    if (NL_BATCH_MSG (i)->rib == m->rib)
+      return;
+
+  rib_install_kernel_done (m->rn, m->rib, installed);
+}
+
+/* Result of the oldest message in the ring, which is then dropped. */
+static void
+netlink_batch_done (int errnum)
+{
+  struct nl_batch_msg *m = NL_BATCH_MSG (0);
+  char buf[BUFSIZ];
+
+  if (errnum == 0
+      || (m->cmd == RTM_DELROUTE && (errnum == ENODEV || errnum == ESRCH))
+      || (m->cmd == RTM_NEWROUTE && errnum == EEXIST))
+    {
+      if (IS_ZEBRA_DEBUG_KERNEL)
+	zlog_debug ("%s: %s %s %s: %s, seq=%u", netlink_cmd.name,
+		    errnum ? "error" : "ACK", lookup (nlmsg_str, m->cmd),
+		    prefix2str (&m->p, buf, sizeof buf) < 0 ? "?" : buf,
+		    safe_strerror (errnum), m->seq);
+    }
+  else
+    {
+      prefix2str (&m->p, buf, sizeof buf);
+      zlog_err ("%s error: %s, type=%s(%u), prefix=%s, seq=%u",
+		netlink_cmd.name, safe_strerror (errnum),
+		lookup (nlmsg_str, m->cmd), m->cmd, buf, m->seq);
+    }
+
+  if (m->rn)
+    {
+      netlink_batch_installed (m, errnum == 0 || errnum == EEXIST);
+      route_unlock_node (m->rn);
+      m->rn = NULL;
+    }
+
+  nl_batch.head = (nl_batch.head + 1) % NL_BATCH_PENDING_MAX;
+  nl_batch.sent--;
+}
+
+/* Acknowledgement or error for sequence number seq. */
+static void
+netlink_batch_ack (u_int32_t seq, int errnum)
+{
+  while (nl_batch.sent)
+    {
+      struct nl_batch_msg *m = NL_BATCH_MSG (0);
+
+      if (m->seq == seq)
+	{
+	  netlink_batch_done (errnum);
+	  return;
+	}
+
+      /* Not for a message in flight. */
+      if ((int) (m->seq - seq) > 0)
+	break;
+
+      /* The acknowledgement of an older message went missing. */
+      zlog_warn ("%s: no acknowledgement for seq=%u", netlink_cmd.name,
+		 m->seq);
+      netlink_batch_done (0);
+    }
+
+  zlog_warn ("%s: ignoring acknowledgement for seq=%u", netlink_cmd.name,
+	     seq);
+}
+
+/* Read one lot of acknowledgements.  Returns -1 if there was nothing
+   to read or the socket failed. */
+static int
+netlink_batch_recv (int flags)
+{
+  char buf[4096];
+  struct iovec iov = { buf, sizeof buf };
+  struct sockaddr_nl snl;
+  struct msghdr msg = { (void *) &snl, sizeof snl, &iov, 1, NULL, 0, 0 };
+  struct nlmsghdr *h;
+  int status;
+
+  status = recvmsg (netlink_cmd.sock, &msg, flags);
+  if (status < 0)
+    {
+      if (errno == EINTR)
+	return 0;
+      if (errno == EWOULDBLOCK || errno == EAGAIN)
+	return -1;
+
+      zlog (NULL, LOG_ERR, "%s recvmsg error: %s", netlink_cmd.name,
+	    safe_strerror (errno));
+
+      /* Acknowledgements were dropped, the messages in flight can't be
+	 accounted for any more. */
+      if (errno == ENOBUFS)
+	while (nl_batch.sent)
+	  netlink_batch_done (0);
+      return -1;
+    }
+
+  if (status == 0)
+    {
+      zlog (NULL, LOG_ERR, "%s EOF", netlink_cmd.name);
+      return -1;
+    }
+
+  for (h = (struct nlmsghdr *) buf; NLMSG_OK (h, (unsigned int) status);
+       h = NLMSG_NEXT (h, status))
+    {
+      struct nlmsgerr *err = (struct nlmsgerr *) NLMSG_DATA (h);
+
+      if (h->nlmsg_type != NLMSG_ERROR
+	  || h->nlmsg_len < NLMSG_LENGTH (sizeof (struct nlmsgerr)))
+	{
+	  zlog_warn ("%s: ignoring message type 0x%04x", netlink_cmd.name,
+		     h->nlmsg_type);
+	  continue;
+	}
+
+      netlink_batch_ack (err->msg.nlmsg_seq, -err->error);
+    }
+
+  return 0;
+}
+
+static int
+netlink_batch_read (struct thread *thread)
+{
+  nl_batch.t_read = NULL;
+
+  while (nl_batch.sent && netlink_batch_recv (MSG_DONTWAIT) == 0)
+    ;
+
+  if (nl_batch.sent)
+    nl_batch.t_read = thread_add_read (zebrad.master, netlink_batch_read,
+				       NULL, netlink_cmd.sock);
+  return 0;
+}
+
+/* Send the queued messages. */
+static void
+netlink_batch_flush (void)
+{
+  struct sockaddr_nl snl;
+  struct iovec iov = { nl_batch.buf, 0 };
+  struct msghdr msg = { (void *) &snl, sizeof snl, &iov, 1, NULL, 0, 0 };
+  int status;
+  int save_errno;
+  int queued;
+
+  THREAD_TIMER_OFF (nl_batch.t_flush);
+
+  if (! nl_batch.queued)
+    return;
+
+  memset (&snl, 0, sizeof snl);
+  snl.nl_family = AF_NETLINK;
+  iov.iov_len = nl_batch.len;
+
+  if (IS_ZEBRA_DEBUG_KERNEL)
+    zlog_debug ("netlink_batch_flush: %s %d messages, %lu bytes",
+		netlink_cmd.name, nl_batch.queued, (u_long) nl_batch.len);
+
+  if (zserv_privs.change (ZPRIVS_RAISE))
+    zlog (NULL, LOG_ERR, "Can't raise privileges");
+  status = sendmsg (netlink_cmd.sock, &msg, 0);
+  save_errno = errno;
+  if (zserv_privs.change (ZPRIVS_LOWER))
+    zlog (NULL, LOG_ERR, "Can't lower privileges");
+
+  queued = nl_batch.queued;
+  nl_batch.queued = 0;
+  nl_batch.len = 0;
+
+  if (status < 0)
+    {
+      zlog (NULL, LOG_ERR, "netlink_batch_flush sendmsg() error: %s",
+	    safe_strerror (save_errno));
+
+      /* None of them made it, fail them after the ones in flight. */
+      while (nl_batch.sent)
+	if (netlink_batch_recv (0) < 0)
+	  break;
+      while (nl_batch.sent)
+	netlink_batch_done (0);
+      nl_batch.sent = queued;
+      while (nl_batch.sent)
+	netlink_batch_done (save_errno);
+      return;
+    }
+
+  nl_batch.sent += queued;
+  if (! nl_batch.t_read)
+    nl_batch.t_read = thread_add_read (zebrad.master, netlink_batch_read,
+				       NULL, netlink_cmd.sock);
+}
+
+static int
+netlink_batch_timer (struct thread *thread)
+{
+  nl_batch.t_flush = NULL;
+  netlink_batch_flush ();
+  return 0;
+}
+
+/* Send everything queued and wait until it is all acknowledged. */
+void
+netlink_batch_sync (void)
+{
+  netlink_batch_flush ();
+
+  while (nl_batch.sent)
+    if (netlink_batch_recv (0) < 0)
+      break;
+
+  if (! nl_batch.sent)
+    THREAD_READ_OFF (nl_batch.t_read);
+}
+
+/* Queue a route message for p. */
+static int
+netlink_batch_add (struct nlmsghdr *n, struct prefix *p, struct rib *rib)
+{
+  struct nl_batch_msg *m;
+
+  if (netlink_cmd.sock < 0)
+    {
+      zlog (NULL, LOG_ERR, "%s socket isn't active.", netlink_cmd.name);
+      return -1;
+    }
+
+  if (nl_batch.len + NLMSG_ALIGN (n->nlmsg_len) > NL_BATCH_BUFSIZE)
+    netlink_batch_flush ();
+  if (nl_batch.sent + nl_batch.queued == NL_BATCH_PENDING_MAX)
+    netlink_batch_sync ();
+
+  n->nlmsg_seq = ++netlink_cmd.seq;
+  n->nlmsg_flags |= NLM_F_ACK;
+
+  if (IS_ZEBRA_DEBUG_KERNEL)
+    zlog_debug ("netlink_batch_add: %s type %s(%u), seq=%u",
+		netlink_cmd.name, lookup (nlmsg_str, n->nlmsg_type),
+		n->nlmsg_type, n->nlmsg_seq);
+
+  memcpy (nl_batch.buf + nl_batch.len, n, n->nlmsg_len);
+  nl_batch.len += NLMSG_ALIGN (n->nlmsg_len);
+
+  m = NL_BATCH_MSG (nl_batch.sent + nl_batch.queued);
+  m->seq = n->nlmsg_seq;
+  m->cmd = n->nlmsg_type;
+  prefix_copy (&m->p, p);
+  m->rib = rib;
+  m->rn = NULL;
+  if (m->cmd == RTM_NEWROUTE)
+    m->rn = netlink_batch_node (p, rib);
+  nl_batch.queued++;
+
+  if (nl_batch.queued >= zebrad.nl_batch_size)
+    netlink_batch_flush ();
+  else if (! nl_batch.t_flush)
+    nl_batch.t_flush = thread_add_timer_msec (zebrad.master,
+					      netlink_batch_timer, NULL,
+					      zebrad.nl_batch_latency);
+  return 0;
+}
+
 /* Routing table change via netlink interface. */
 static int
 netlink_route (int cmd, int family, void *dest, int length, void *gate,
@@ -1324,7 +1674,7 @@ netlink_route_multipath (int cmd, struct prefix *p, struct rib *rib,
     {
       if (cmd == RTM_NEWROUTE)
         for (nexthop = rib->nexthop; nexthop; nexthop = nexthop->next)
-          SET_FLAG (nexthop->flags, NEXTHOP_FLAG_FIB);
+          SET_FLAG (nexthop->flags, NEXTHOP_FLAG_QUEUED);
       goto skip;
     }
 
@@ -1337,7 +1687,8 @@ netlink_route_multipath (int cmd, struct prefix *p, struct rib *rib,
           if ((cmd == RTM_NEWROUTE
                && CHECK_FLAG (nexthop->flags, NEXTHOP_FLAG_ACTIVE))
               || (cmd == RTM_DELROUTE
-                  && CHECK_FLAG (nexthop->flags, NEXTHOP_FLAG_FIB)))
+                  && CHECK_FLAG (nexthop->flags,
+                                 NEXTHOP_FLAG_FIB | NEXTHOP_FLAG_QUEUED)))
             {
 
               if (CHECK_FLAG (nexthop->flags, NEXTHOP_FLAG_RECURSIVE))
@@ -1482,7 +1833,7 @@ netlink_route_multipath (int cmd, struct prefix *p, struct rib *rib,
                 }
 
               if (cmd == RTM_NEWROUTE)
-                SET_FLAG (nexthop->flags, NEXTHOP_FLAG_FIB);
+                SET_FLAG (nexthop->flags, NEXTHOP_FLAG_QUEUED);
 
               nexthop_num++;
               break;
@@ -1508,7 +1859,8 @@ netlink_route_multipath (int cmd, struct prefix *p, struct rib *rib,
           if ((cmd == RTM_NEWROUTE
                && CHECK_FLAG (nexthop->flags, NEXTHOP_FLAG_ACTIVE))
               || (cmd == RTM_DELROUTE
-                  && CHECK_FLAG (nexthop->flags, NEXTHOP_FLAG_FIB)))
+                  && CHECK_FLAG (nexthop->flags,
+                                 NEXTHOP_FLAG_FIB | NEXTHOP_FLAG_QUEUED)))
             {
               nexthop_num++;
 
@@ -1668,7 +2020,7 @@ netlink_route_multipath (int cmd, struct prefix *p, struct rib *rib,
               rtnh = RTNH_NEXT (rtnh);
 
               if (cmd == RTM_NEWROUTE)
-                SET_FLAG (nexthop->flags, NEXTHOP_FLAG_FIB);
+                SET_FLAG (nexthop->flags, NEXTHOP_FLAG_QUEUED);
             }
         }
       if (src)
@@ -1693,8 +2045,8 @@ skip:
   memset (&snl, 0, sizeof snl);
   snl.nl_family = AF_NETLINK;
 
-  /* Talk to netlink socket. */
-  return netlink_talk (&req.n, &netlink_cmd);
+  /* Queue for the kernel. */
+  return netlink_batch_add (&req.n, p, rib);
 }
 
 int
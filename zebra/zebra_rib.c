@@ -34,6 +34,8 @@
 #include "workqueue.h"
 #include "prefix.h"
 #include "routemap.h"
+#include "hash.h"
+#include "jhash.h"
 
 #include "zebra/rib.h"
 #include "zebra/rt.h"
@@ -91,6 +93,13 @@ static const struct
 /* Vector for routing table.  */
 static vector vrf_vector;
 
+/* Nexthop groups of all routes.  */
+static struct hash *nexthop_group_hash;
+
+/* Changes whenever gateways may resolve differently, see
+   rib_nexthops_changed().  */
+static u_int32_t nexthop_generation = 1;
+
 /* Allocate new VRF.  */
 static struct vrf *
 vrf_alloc (const char *name)
@@ -166,6 +175,156 @@ vrf_static_table (afi_t afi, safi_t safi, u_int32_t id)
   return vrf->stable[afi][safi];
 }
 
+/* Whether ifindex is part of a nexthop as given, rather than found by
+   resolving it.  */
+static int
+nexthop_ifindex_given (const struct nexthop *nexthop)
+{
+  switch (nexthop->type)
+    {
+    case NEXTHOP_TYPE_IFINDEX:
+    case NEXTHOP_TYPE_IPV4_IFINDEX:
+    case NEXTHOP_TYPE_IPV4_IFINDEX_OL:
+    case NEXTHOP_TYPE_IPV6_IFINDEX:
+      return 1;
+    default:
+      return 0;
+    }
+}
+
+static unsigned int
+nexthop_group_hash_key (void *arg)
+{
+  struct nexthop_group *nhg = arg;
+  struct nexthop *given;
+  unsigned int key;
+  unsigned int i;
+
+  key = jhash_2words (nhg->internal, nhg->hop_num, 0);
+  for (i = 0; i < nhg->hop_num; i++)
+    {
+      given = &nhg->hops[i].given;
+      key = jhash_3words (given->type, given->ifindex, key, 0);
+      key = jhash (&given->gate, sizeof (union g_addr), key);
+      key = jhash (&given->src, sizeof (union g_addr), key);
+      if (given->ifname)
+	key = jhash (given->ifname, strlen (given->ifname), key);
+    }
+  return key;
+}
+
+static int
+nexthop_group_hash_cmp (const void *arg1, const void *arg2)
+{
+  const struct nexthop_group *nhg1 = arg1;
+  const struct nexthop_group *nhg2 = arg2;
+  const struct nexthop *given1, *given2;
+  unsigned int i;
+
+  if (nhg1->internal != nhg2->internal || nhg1->hop_num != nhg2->hop_num)
+    return 0;
+
+  for (i = 0; i < nhg1->hop_num; i++)
+    {
+      given1 = &nhg1->hops[i].given;
+      given2 = &nhg2->hops[i].given;
+      if (given1->type != given2->type
+	  || given1->ifindex != given2->ifindex
+	  || memcmp (&given1->gate, &given2->gate, sizeof (union g_addr))
+	  || memcmp (&given1->src, &given2->src, sizeof (union g_addr)))
+	return 0;
+      if (given1->ifname || given2->ifname)
+	if (! given1->ifname || ! given2->ifname
+	    || strcmp (given1->ifname, given2->ifname))
+	  return 0;
+    }
+  return 1;
+}
+
+static void
+nexthop_group_free (struct nexthop_group *nhg)
+{
+  unsigned int i;
+
+  for (i = 0; i < nhg->hop_num; i++)
+    if (nhg->hops[i].given.ifname)
+      XFREE (MTYPE_NEXTHOP_GROUP, nhg->hops[i].given.ifname);
+  if (nhg->hops)
+    XFREE (MTYPE_NEXTHOP_GROUP, nhg->hops);
+  XFREE (MTYPE_NEXTHOP_GROUP, nhg);
+}
+
+/* Group of the nexthops of rib, shared with all routes which have the
+   same ones.  */
+static struct nexthop_group *
+nexthop_group_get (struct rib *rib)
+{
+  struct nexthop_group *nhg, *find;
+  struct nexthop *nexthop, *given;
+  int i;
+
+  nhg = XCALLOC (MTYPE_NEXTHOP_GROUP, sizeof (struct nexthop_group));
+  nhg->internal = CHECK_FLAG (rib->flags, ZEBRA_FLAG_INTERNAL) ? 1 : 0;
+  for (nexthop = rib->nexthop; nexthop; nexthop = nexthop->next)
+    nhg->hop_num++;
+
+  if (nhg->hop_num)
+    nhg->hops = XCALLOC (MTYPE_NEXTHOP_GROUP,
+			 nhg->hop_num * sizeof (struct nexthop_group_hop));
+  for (i = 0, nexthop = rib->nexthop; nexthop; i++, nexthop = nexthop->next)
+    {
+      given = &nhg->hops[i].given;
+      given->type = nexthop->type;
+      given->gate = nexthop->gate;
+      given->src = nexthop->src;
+      if (nexthop_ifindex_given (nexthop))
+	given->ifindex = nexthop->ifindex;
+      if (nexthop->ifname)
+	given->ifname = XSTRDUP (MTYPE_NEXTHOP_GROUP, nexthop->ifname);
+    }
+
+  find = hash_get (nexthop_group_hash, nhg, hash_alloc_intern);
+  if (find != nhg)
+    nexthop_group_free (nhg);
+  find->refcnt++;
+
+  return find;
+}
+
+/* Drop rib's reference to its nexthop group, after its nexthops
+   changed or before it is freed.  */
+static void
+nexthop_group_release (struct rib *rib)
+{
+  struct nexthop_group *nhg = rib->nhg;
+
+  if (! nhg)
+    return;
+
+  rib->nhg = NULL;
+  if (--nhg->refcnt == 0)
+    {
+      hash_release (nexthop_group_hash, nhg);
+      nexthop_group_free (nhg);
+    }
+}
+
+/* Note that rib for rn, which was or is now selected, may have changed
+   what gateways resolve to, so that nexthop groups and tracked nexthops
+   are looked up again.  Without rn, any gateway may have changed.
+   Gateways are never resolved through BGP routes.  */
+void
+rib_nexthops_changed (struct route_node *rn, struct rib *rib)
+{
+  if (rib && rib->type == ZEBRA_ROUTE_BGP)
+    return;
+
+  if (++nexthop_generation == 0)
+    nexthop_generation = 1;
+
+  zebra_nexthop_track_changed (rn ? &rn->p : NULL);
+}
+
 /* Add nexthop to the end of the list.  */
 static void
 nexthop_add (struct rib *rib, struct nexthop *nexthop)
@@ -181,6 +340,7 @@ nexthop_add (struct rib *rib, struct nexthop *nexthop)
   nexthop->prev = last;
 
   rib->nexthop_num++;
+  nexthop_group_release (rib);
 }
 
 /* Delete specified nexthop from the list. */
@@ -194,6 +354,7 @@ nexthop_delete (struct rib *rib, struct nexthop *nexthop)
   else
     rib->nexthop = nexthop->next;
   rib->nexthop_num--;
+  nexthop_group_release (rib);
 }
 
 /* Free nexthop. */
@@ -347,7 +508,7 @@ nexthop_blackhole_add (struct rib *rib)
    the route from FIB. */
 static int
 nexthop_active_ipv4 (struct rib *rib, struct nexthop *nexthop, int set,
-		     struct route_node *top)
+		     struct route_node *top, u_char *len)
 {
   struct prefix_ipv4 p;
   struct route_table *table;
@@ -368,6 +529,7 @@ nexthop_active_ipv4 (struct rib *rib, struct nexthop *nexthop, int set,
   p.prefix = nexthop->gate.ipv4;
 
   /* Lookup table.  */
+  *len = 0;
   table = vrf_table (AFI_IP, SAFI_UNICAST, 0);
   if (! table)
     return 0;
@@ -376,6 +538,7 @@ nexthop_active_ipv4 (struct rib *rib, struct nexthop *nexthop, int set,
   while (rn)
     {
       route_unlock_node (rn);
+      *len = rn->p.prefixlen;
       
       /* If lookup self prefix return immediately. */
       if (rn == top)
@@ -448,7 +611,7 @@ nexthop_active_ipv4 (struct rib *rib, struct nexthop *nexthop, int set,
    the route from FIB. */
 static int
 nexthop_active_ipv6 (struct rib *rib, struct nexthop *nexthop, int set,
-		     struct route_node *top)
+		     struct route_node *top, u_char *len)
 {
   struct prefix_ipv6 p;
   struct route_table *table;
@@ -469,6 +632,7 @@ nexthop_active_ipv6 (struct rib *rib, struct nexthop *nexthop, int set,
   p.prefix = nexthop->gate.ipv6;
 
   /* Lookup table.  */
+  *len = 0;
   table = vrf_table (AFI_IP6, SAFI_UNICAST, 0);
   if (! table)
     return 0;
@@ -477,6 +641,7 @@ nexthop_active_ipv6 (struct rib *rib, struct nexthop *nexthop, int set,
   while (rn)
     {
       route_unlock_node (rn);
+      *len = rn->p.prefixlen;
       
       /* If lookup self prefix return immediately. */
       if (rn == top)
@@ -548,6 +713,75 @@ nexthop_active_ipv6 (struct rib *rib, struct nexthop *nexthop, int set,
 }
 #endif /* HAVE_IPV6 */
 
+/* Look up the gateway of nexthop, a hop of rib's group, once for every
+   route with the same nexthops until rib_nexthops_changed(), and set
+   on nexthop what nexthop_active_ipv4() or nexthop_active_ipv6() would
+   have.  The lookup is made as if for no route, which is what it is for
+   any route that does not cover the gateway ahead of the one it
+   resolved through.  */
+static int
+nexthop_active_recursive (struct route_node *rn, struct rib *rib,
+			  struct nexthop *nexthop,
+			  struct nexthop_group_hop *hop, int set)
+{
+  struct nexthop *resolved;
+  struct route_table *table;
+  struct prefix p;
+  int v4;
+
+  v4 = (nexthop->type == NEXTHOP_TYPE_IPV4
+	|| nexthop->type == NEXTHOP_TYPE_IPV4_IFINDEX);
+
+  resolved = &hop->resolved;
+  if (hop->generation != nexthop_generation)
+    {
+      *resolved = hop->given;
+#ifdef HAVE_IPV6
+      if (! v4)
+	hop->active = nexthop_active_ipv6 (rib, resolved, 1, NULL, &hop->len);
+      else
+#endif /* HAVE_IPV6 */
+	hop->active = nexthop_active_ipv4 (rib, resolved, 1, NULL, &hop->len);
+      hop->generation = nexthop_generation;
+    }
+
+  if (nexthop->type == NEXTHOP_TYPE_IPV4 || nexthop->type == NEXTHOP_TYPE_IPV6)
+    nexthop->ifindex = 0;
+  if (set)
+    UNSET_FLAG (nexthop->flags, NEXTHOP_FLAG_RECURSIVE);
+
+  /* The lookup stops at the route's own prefix.  */
+  memset (&p, 0, sizeof (struct prefix));
+  p.family = v4 ? AF_INET : AF_INET6;
+  table = vrf_table (v4 ? AFI_IP : AFI_IP6, SAFI_UNICAST, 0);
+  if (v4)
+    {
+      p.prefixlen = IPV4_MAX_PREFIXLEN;
+      p.u.prefix4 = nexthop->gate.ipv4;
+    }
+#ifdef HAVE_IPV6
+  else
+    {
+      p.prefixlen = IPV6_MAX_PREFIXLEN;
+      p.u.prefix6 = nexthop->gate.ipv6;
+    }
+#endif /* HAVE_IPV6 */
+  if (rn->table == table && rn->p.prefixlen >= hop->len
+      && prefix_match (&rn->p, &p))
+    return 0;
+
+  if (nexthop->type == NEXTHOP_TYPE_IPV4 || nexthop->type == NEXTHOP_TYPE_IPV6)
+    nexthop->ifindex = resolved->ifindex;
+  if (set && CHECK_FLAG (resolved->flags, NEXTHOP_FLAG_RECURSIVE))
+    {
+      SET_FLAG (nexthop->flags, NEXTHOP_FLAG_RECURSIVE);
+      nexthop->rtype = resolved->rtype;
+      nexthop->rgate = resolved->rgate;
+      nexthop->rifindex = resolved->rifindex;
+    }
+  return hop->active;
+}
+
 struct rib *
 rib_match_ipv4 (struct in_addr addr)
 {
@@ -808,7 +1042,8 @@ rib_match_ipv6 (struct in6_addr *addr)
 
 static unsigned
 nexthop_active_check (struct route_node *rn, struct rib *rib,
-		      struct nexthop *nexthop, int set)
+		      struct nexthop *nexthop, struct nexthop_group_hop *hop,
+		      int set)
 {
   struct interface *ifp;
   route_map_result_t ret = RMAP_MATCH;
@@ -847,7 +1082,7 @@ nexthop_active_check (struct route_node *rn, struct rib *rib,
     case NEXTHOP_TYPE_IPV4:
     case NEXTHOP_TYPE_IPV4_IFINDEX:
       family = AFI_IP;
-      if (nexthop_active_ipv4 (rib, nexthop, set, rn))
+      if (nexthop_active_recursive (rn, rib, nexthop, hop, set))
 	SET_FLAG (nexthop->flags, NEXTHOP_FLAG_ACTIVE);
       else
 	UNSET_FLAG (nexthop->flags, NEXTHOP_FLAG_ACTIVE);
@@ -855,7 +1090,7 @@ nexthop_active_check (struct route_node *rn, struct rib *rib,
 #ifdef HAVE_IPV6
     case NEXTHOP_TYPE_IPV6:
       family = AFI_IP6;
-      if (nexthop_active_ipv6 (rib, nexthop, set, rn))
+      if (nexthop_active_recursive (rn, rib, nexthop, hop, set))
 	SET_FLAG (nexthop->flags, NEXTHOP_FLAG_ACTIVE);
       else
 	UNSET_FLAG (nexthop->flags, NEXTHOP_FLAG_ACTIVE);
@@ -872,7 +1107,7 @@ nexthop_active_check (struct route_node *rn, struct rib *rib,
 	}
       else
 	{
-	  if (nexthop_active_ipv6 (rib, nexthop, set, rn))
+	  if (nexthop_active_recursive (rn, rib, nexthop, hop, set))
 	    SET_FLAG (nexthop->flags, NEXTHOP_FLAG_ACTIVE);
 	  else
 	    UNSET_FLAG (nexthop->flags, NEXTHOP_FLAG_ACTIVE);
@@ -921,16 +1156,21 @@ static int
 nexthop_active_update (struct route_node *rn, struct rib *rib, int set)
 {
   struct nexthop *nexthop;
+  struct nexthop_group_hop *hop;
   unsigned int prev_active, prev_index, new_active;
 
   rib->nexthop_active_num = 0;
   UNSET_FLAG (rib->flags, ZEBRA_FLAG_CHANGED);
 
-  for (nexthop = rib->nexthop; nexthop; nexthop = nexthop->next)
+  if (! rib->nhg)
+    rib->nhg = nexthop_group_get (rib);
+  hop = rib->nhg->hops;
+
+  for (nexthop = rib->nexthop; nexthop; nexthop = nexthop->next, hop++)
   {
     prev_active = CHECK_FLAG (nexthop->flags, NEXTHOP_FLAG_ACTIVE);
     prev_index = nexthop->ifindex;
-    if ((new_active = nexthop_active_check (rn, rib, nexthop, set)))
+    if ((new_active = nexthop_active_check (rn, rib, nexthop, hop, set)))
       rib->nexthop_active_num++;
     if (prev_active != new_active ||
 	prev_index != nexthop->ifindex)
@@ -963,8 +1203,51 @@ rib_install_kernel (struct route_node *rn, struct rib *rib)
   if (ret < 0)
     {
       for (nexthop = rib->nexthop; nexthop; nexthop = nexthop->next)
-	UNSET_FLAG (nexthop->flags, NEXTHOP_FLAG_FIB);
+	UNSET_FLAG (nexthop->flags, NEXTHOP_FLAG_FIB | NEXTHOP_FLAG_QUEUED);
     }
+  rib_nexthops_changed (rn, rib);
+}
+
+/* Whether the kernel has yet to answer for some nexthops of rib. */
+static int
+rib_install_kernel_queued (struct rib *rib)
+{
+  struct nexthop *nexthop;
+
+  for (nexthop = rib->nexthop; nexthop; nexthop = nexthop->next)
+    if (CHECK_FLAG (nexthop->flags, NEXTHOP_FLAG_QUEUED))
+      return 1;
+  return 0;
+}
+
+/* The kernel has answered the last message installing rib, which was
+   queued rather than sent right away.  Its nexthops are in the FIB if
+   it was installed, and the route can be redistributed now.  Nothing
+   is done for a rib which has been unselected meanwhile. */
+void
+rib_install_kernel_done (struct route_node *rn, struct rib *rib,
+			 int installed)
+{
+  struct rib *r;
+  struct nexthop *nexthop;
+
+  for (r = rn->info; r; r = r->next)
+    if (r == rib)
+      break;
+  if (! r || ! CHECK_FLAG (rib->flags, ZEBRA_FLAG_SELECTED)
+      || CHECK_FLAG (rib->status, RIB_ENTRY_REMOVED)
+      || ! rib_install_kernel_queued (rib))
+    return;
+
+  for (nexthop = rib->nexthop; nexthop; nexthop = nexthop->next)
+    if (CHECK_FLAG (nexthop->flags, NEXTHOP_FLAG_QUEUED))
+      {
+	UNSET_FLAG (nexthop->flags, NEXTHOP_FLAG_QUEUED);
+	if (installed)
+	  SET_FLAG (nexthop->flags, NEXTHOP_FLAG_FIB);
+      }
+  rib_nexthops_changed (rn, rib);
+  redistribute_add (&rn->p, rib);
 }
 
 /* Uninstall the route from kernel. */
@@ -987,7 +1270,8 @@ rib_uninstall_kernel (struct route_node *rn, struct rib *rib)
     }
 
   for (nexthop = rib->nexthop; nexthop; nexthop = nexthop->next)
-    UNSET_FLAG (nexthop->flags, NEXTHOP_FLAG_FIB);
+    UNSET_FLAG (nexthop->flags, NEXTHOP_FLAG_FIB | NEXTHOP_FLAG_QUEUED);
+  rib_nexthops_changed (rn, rib);
 
   return ret;
 }
@@ -1002,6 +1286,7 @@ rib_uninstall (struct route_node *rn, struct rib *rib)
       if (! RIB_SYSTEM_ROUTE (rib))
 	rib_uninstall_kernel (rn, rib);
       UNSET_FLAG (rib->flags, ZEBRA_FLAG_SELECTED);
+      rib_nexthops_changed (rn, rib);
     }
 }
 
@@ -1129,10 +1414,12 @@ rib_process (struct route_node *rn)
 
           /* Set real nexthop. */
           nexthop_active_update (rn, select, 1);
+          rib_nexthops_changed (rn, select);
   
           if (! RIB_SYSTEM_ROUTE (select))
             rib_install_kernel (rn, select);
-          redistribute_add (&rn->p, select);
+          if (! rib_install_kernel_queued (select))
+            redistribute_add (&rn->p, select);
         }
       else if (! RIB_SYSTEM_ROUTE (select))
         {
@@ -1144,7 +1431,8 @@ rib_process (struct route_node *rn)
            */
 
           for (nexthop = select->nexthop; nexthop; nexthop = nexthop->next)
-            if (CHECK_FLAG (nexthop->flags, NEXTHOP_FLAG_FIB))
+            if (CHECK_FLAG (nexthop->flags,
+                            NEXTHOP_FLAG_FIB | NEXTHOP_FLAG_QUEUED))
             {
               installed = 1;
               break;
@@ -1168,6 +1456,7 @@ rib_process (struct route_node *rn)
       if (! RIB_SYSTEM_ROUTE (fib))
 	rib_uninstall_kernel (rn, fib);
       UNSET_FLAG (fib->flags, ZEBRA_FLAG_SELECTED);
+      rib_nexthops_changed (rn, fib);
 
       /* Set real nexthop. */
       nexthop_active_update (rn, fib, 1);
@@ -1188,7 +1477,10 @@ rib_process (struct route_node *rn)
       if (! RIB_SYSTEM_ROUTE (select))
         rib_install_kernel (rn, select);
       SET_FLAG (select->flags, ZEBRA_FLAG_SELECTED);
-      redistribute_add (&rn->p, select);
+      rib_nexthops_changed (rn, select);
+      /* Else once the kernel has answered. */
+      if (! rib_install_kernel_queued (select))
+        redistribute_add (&rn->p, select);
     }
 
   /* FIB route was removed, should be deleted */
@@ -1465,6 +1757,7 @@ rib_addnode (struct route_node *rn, struct rib *rib)
                     __func__, buf, rn->p.prefixlen, rn, rib);
       }
       UNSET_FLAG (rib->status, RIB_ENTRY_REMOVED);
+      rib_nexthops_changed (rn, rib);
       return;
     }
   rib_link (rn, rib);
@@ -1504,6 +1797,7 @@ rib_unlink (struct route_node *rn, struct rib *rib)
     }
 
   /* free RIB and nexthops */
+  nexthop_group_release (rib);
   for (nexthop = rib->nexthop; nexthop; nexthop = next)
     {
       next = nexthop->next;
@@ -1525,6 +1819,7 @@ rib_delnode (struct route_node *rn, struct rib *rib)
       buf, rn->p.prefixlen, rn, rib);
   }
   SET_FLAG (rib->status, RIB_ENTRY_REMOVED);
+  rib_nexthops_changed (rn, rib);
   rib_queue_add (&zebrad, rn);
 }
 
@@ -1959,6 +2254,7 @@ rib_delete_ipv4 (int type, int flags, struct prefix_ipv4 *p,
 	    UNSET_FLAG (nexthop->flags, NEXTHOP_FLAG_FIB);
 
 	  UNSET_FLAG (fib->flags, ZEBRA_FLAG_SELECTED);
+	  rib_nexthops_changed (rn, fib);
 	}
       else
 	{
@@ -2513,6 +2809,7 @@ rib_delete_ipv6 (int type, int flags, struct prefix_ipv6 *p,
 	    UNSET_FLAG (nexthop->flags, NEXTHOP_FLAG_FIB);
 
 	  UNSET_FLAG (fib->flags, ZEBRA_FLAG_SELECTED);
+	  rib_nexthops_changed (rn, fib);
 	}
       else
 	{
@@ -2849,6 +3146,9 @@ rib_update (void)
   struct route_node *rn;
   struct route_table *table;
   
+  /* Interfaces changed.  */
+  rib_nexthops_changed (NULL, NULL);
+
   table = vrf_table (AFI_IP, SAFI_UNICAST, 0);
   if (table)
     for (rn = route_top (table); rn; rn = route_next (rn))
@@ -2994,6 +3294,9 @@ void
 rib_init (void)
 {
   rib_queue_init (&zebrad);
+  nexthop_group_hash = hash_create (nexthop_group_hash_key,
+				    nexthop_group_hash_cmp);
+  hash_set_name (nexthop_group_hash, "Zebra nexthop groups");
   /* VRF initialization.  */
   vrf_init ();
 }
@@ -483,15 +483,65 @@ zsend_route_multipath (int cmd, struct zserv *client, struct prefix *p,
   return zebra_server_send_message(client);
 }
 
+/* Encode the metric and the FIB nexthops of rib as they follow the
+   address in lookup replies and nexthop tracking updates.  A NULL rib
+   is encoded as unreachable.  */
+void
+zserv_encode_nexthops (struct stream *s, struct rib *rib)
+{
+  unsigned long nump;
+  u_char num;
+  struct nexthop *nexthop;
+
+  if (! rib)
+    {
+      stream_putl (s, 0);
+      stream_putc (s, 0);
+      return;
+    }
+
+  stream_putl (s, rib->metric);
+  num = 0;
+  nump = stream_get_endp(s);
+  stream_putc (s, 0);
+  for (nexthop = rib->nexthop; nexthop; nexthop = nexthop->next)
+    if (CHECK_FLAG (nexthop->flags, NEXTHOP_FLAG_FIB))
+      {
+	stream_putc (s, nexthop->type);
+	switch (nexthop->type)
+	  {
+	  case ZEBRA_NEXTHOP_IPV4:
+	    stream_put_in_addr (s, &nexthop->gate.ipv4);
+	    break;
+#ifdef HAVE_IPV6
+	  case ZEBRA_NEXTHOP_IPV6:
+	    stream_put (s, &nexthop->gate.ipv6, 16);
+	    break;
+	  case ZEBRA_NEXTHOP_IPV6_IFINDEX:
+	  case ZEBRA_NEXTHOP_IPV6_IFNAME:
+	    stream_put (s, &nexthop->gate.ipv6, 16);
+	    stream_putl (s, nexthop->ifindex);
+	    break;
+#endif /* HAVE_IPV6 */
+	  case ZEBRA_NEXTHOP_IFINDEX:
+	  case ZEBRA_NEXTHOP_IFNAME:
+	    stream_putl (s, nexthop->ifindex);
+	    break;
+	  default:
+	    /* do nothing */
+	    break;
+	  }
+	num++;
+      }
+  stream_putc_at (s, nump, num);
+}
+
 #ifdef HAVE_IPV6
 static int
 zsend_ipv6_nexthop_lookup (struct zserv *client, struct in6_addr *addr)
 {
   struct stream *s;
   struct rib *rib;
-  unsigned long nump;
-  u_char num;
-  struct nexthop *nexthop;
 
   /* Lookup nexthop. */
   rib = rib_match_ipv6 (addr);
@@ -502,45 +552,8 @@ zsend_ipv6_nexthop_lookup (struct zserv *client, struct in6_addr *addr)
 
   /* Fill in result. */
   zserv_create_header (s, ZEBRA_IPV6_NEXTHOP_LOOKUP);
-  stream_put (s, &addr, 16);
-
-  if (rib)
-    {
-      stream_putl (s, rib->metric);
-      num = 0;
-      nump = stream_get_endp(s);
-      stream_putc (s, 0);
-      for (nexthop = rib->nexthop; nexthop; nexthop = nexthop->next)
-	if (CHECK_FLAG (nexthop->flags, NEXTHOP_FLAG_FIB))
-	  {
-	    stream_putc (s, nexthop->type);
-	    switch (nexthop->type)
-	      {
-	      case ZEBRA_NEXTHOP_IPV6:
-		stream_put (s, &nexthop->gate.ipv6, 16);
-		break;
-	      case ZEBRA_NEXTHOP_IPV6_IFINDEX:
-	      case ZEBRA_NEXTHOP_IPV6_IFNAME:
-		stream_put (s, &nexthop->gate.ipv6, 16);
-		stream_putl (s, nexthop->ifindex);
-		break;
-	      case ZEBRA_NEXTHOP_IFINDEX:
-	      case ZEBRA_NEXTHOP_IFNAME:
-		stream_putl (s, nexthop->ifindex);
-		break;
-	      default:
-                /* do nothing */
-		break;
-	      }
-	    num++;
-	  }
-      stream_putc_at (s, nump, num);
-    }
-  else
-    {
-      stream_putl (s, 0);
-      stream_putc (s, 0);
-    }
+  stream_put (s, addr, 16);
+  zserv_encode_nexthops (s, rib);
 
   stream_putw_at (s, 0, stream_get_endp (s));
   
@@ -553,9 +566,6 @@ zsend_ipv4_nexthop_lookup (struct zserv *client, struct in_addr addr)
 {
   struct stream *s;
   struct rib *rib;
-  unsigned long nump;
-  u_char num;
-  struct nexthop *nexthop;
 
   /* Lookup nexthop. */
   rib = rib_match_ipv4 (addr);
@@ -567,53 +577,39 @@ zsend_ipv4_nexthop_lookup (struct zserv *client, struct in_addr addr)
   /* Fill in result. */
   zserv_create_header (s, ZEBRA_IPV4_NEXTHOP_LOOKUP);
   stream_put_in_addr (s, &addr);
-
-  if (rib)
-    {
-      stream_putl (s, rib->metric);
-      num = 0;
-      nump = stream_get_endp(s);
-      stream_putc (s, 0);
-      for (nexthop = rib->nexthop; nexthop; nexthop = nexthop->next)
-	if (CHECK_FLAG (nexthop->flags, NEXTHOP_FLAG_FIB))
-	  {
-	    stream_putc (s, nexthop->type);
-	    switch (nexthop->type)
-	      {
-	      case ZEBRA_NEXTHOP_IPV4:
-		stream_put_in_addr (s, &nexthop->gate.ipv4);
-		break;
-	      case ZEBRA_NEXTHOP_IFINDEX:
-	      case ZEBRA_NEXTHOP_IFNAME:
-		stream_putl (s, nexthop->ifindex);
-		break;
-	      default:
-                /* do nothing */
-		break;
-	      }
-	    num++;
-	  }
-      stream_putc_at (s, nump, num);
-    }
-  else
-    {
-      stream_putl (s, 0);
-      stream_putc (s, 0);
-    }
+  zserv_encode_nexthops (s, rib);
 
   stream_putw_at (s, 0, stream_get_endp (s));
   
   return zebra_server_send_message(client);
 }
 
+/* Tell a client that a nexthop it registered for tracking now resolves
+   to the given answer, encoded by zserv_encode_nexthops().  */
+int
+zsend_nexthop_update (struct zserv *client, struct prefix *p,
+		      const u_char *answer, size_t len)
+{
+  struct stream *s;
+
+  s = client->obuf;
+  stream_reset (s);
+
+  zserv_create_header (s, ZEBRA_NEXTHOP_UPDATE);
+  stream_putc (s, p->family);
+  stream_put (s, &p->u.prefix, PSIZE (p->prefixlen));
+  stream_put (s, answer, len);
+
+  stream_putw_at (s, 0, stream_get_endp (s));
+
+  return zebra_server_send_message(client);
+}
+
 static int
 zsend_ipv4_import_lookup (struct zserv *client, struct prefix_ipv4 *p)
 {
   struct stream *s;
   struct rib *rib;
-  unsigned long nump;
-  u_char num;
-  struct nexthop *nexthop;
 
   /* Lookup nexthop. */
   rib = rib_lookup_ipv4 (p);
@@ -625,45 +621,13 @@ zsend_ipv4_import_lookup (struct zserv *client, struct prefix_ipv4 *p)
   /* Fill in result. */
   zserv_create_header (s, ZEBRA_IPV4_IMPORT_LOOKUP);
   stream_put_in_addr (s, &p->prefix);
-
-  if (rib)
-    {
-      stream_putl (s, rib->metric);
-      num = 0;
-      nump = stream_get_endp(s);
-      stream_putc (s, 0);
-      for (nexthop = rib->nexthop; nexthop; nexthop = nexthop->next)
-	if (CHECK_FLAG (nexthop->flags, NEXTHOP_FLAG_FIB))
-	  {
-	    stream_putc (s, nexthop->type);
-	    switch (nexthop->type)
-	      {
-	      case ZEBRA_NEXTHOP_IPV4:
-		stream_put_in_addr (s, &nexthop->gate.ipv4);
-		break;
-	      case ZEBRA_NEXTHOP_IFINDEX:
-	      case ZEBRA_NEXTHOP_IFNAME:
-		stream_putl (s, nexthop->ifindex);
-		break;
-	      default:
-                /* do nothing */
-		break;
-	      }
-	    num++;
-	  }
-      stream_putc_at (s, nump, num);
-    }
-  else
-    {
-      stream_putl (s, 0);
-      stream_putc (s, 0);
-    }
+  zserv_encode_nexthops (s, rib);
 
   stream_putw_at (s, 0, stream_get_endp (s));
   
   return zebra_server_send_message(client);
 }
-
+
 /* Router-id is updated. Send ZEBRA_ROUTER_ID_ADD to client. */
 int
 zsend_router_id_update (struct zserv *client, struct prefix *p)
@@ -1351,6 +1315,9 @@ zebra_client_close (struct zserv *client)
       client->sock = -1;
     }
 
+  /* Stop tracking nexthops for this client. */
+  zebra_nexthop_client_close (client);
+
   /* Free stream buffers. */
   if (client->ibuf)
     stream_free (client->ibuf);
@@ -1558,6 +1525,12 @@ zebra_client_read (struct thread *thread)
     case ZEBRA_BGP_IPV4_RGATE_VERIFY:
       zread_bgp_ipv4_rgate_verify (client, length);
       break;
+    case ZEBRA_NEXTHOP_REGISTER:
+      zebra_nexthop_register (command, client, length);
+      break;
+    case ZEBRA_NEXTHOP_UNREGISTER:
+      zebra_nexthop_unregister (command, client, length);
+      break;
     default:
       zlog_info ("Zebra received unknown command %d", command);
       break;
@@ -1776,6 +1749,70 @@ DEFUN (config_table,
   return CMD_SUCCESS;
 }
 
+#ifdef HAVE_NETLINK
+DEFUN (netlink_batch_size,
+       netlink_batch_size_cmd,
+       "netlink batch-size <1-256>",
+       "Kernel netlink interface\n"
+       "Route messages sent to the kernel at once\n"
+       "Number of messages\n")
+{
+  VTY_GET_INTEGER_RANGE ("batch size", zebrad.nl_batch_size, argv[0],
+			 1, 256);
+  return CMD_SUCCESS;
+}
+
+DEFUN (no_netlink_batch_size,
+       no_netlink_batch_size_cmd,
+       "no netlink batch-size",
+       NO_STR
+       "Kernel netlink interface\n"
+       "Route messages sent to the kernel at once\n")
+{
+  zebrad.nl_batch_size = NL_BATCH_SIZE_DEFAULT;
+  return CMD_SUCCESS;
+}
+
+ALIAS (no_netlink_batch_size,
+       no_netlink_batch_size_val_cmd,
+       "no netlink batch-size <1-256>",
+       NO_STR
+       "Kernel netlink interface\n"
+       "Route messages sent to the kernel at once\n"
+       "Number of messages\n")
+
+DEFUN (netlink_batch_latency,
+       netlink_batch_latency_cmd,
+       "netlink batch-latency <0-1000>",
+       "Kernel netlink interface\n"
+       "Longest a route message waits for its batch to fill\n"
+       "Milliseconds\n")
+{
+  VTY_GET_INTEGER_RANGE ("batch latency", zebrad.nl_batch_latency, argv[0],
+			 0, 1000);
+  return CMD_SUCCESS;
+}
+
+DEFUN (no_netlink_batch_latency,
+       no_netlink_batch_latency_cmd,
+       "no netlink batch-latency",
+       NO_STR
+       "Kernel netlink interface\n"
+       "Longest a route message waits for its batch to fill\n")
+{
+  zebrad.nl_batch_latency = NL_BATCH_LATENCY_DEFAULT;
+  return CMD_SUCCESS;
+}
+
+ALIAS (no_netlink_batch_latency,
+       no_netlink_batch_latency_val_cmd,
+       "no netlink batch-latency <0-1000>",
+       NO_STR
+       "Kernel netlink interface\n"
+       "Longest a route message waits for its batch to fill\n"
+       "Milliseconds\n")
+#endif /* HAVE_NETLINK */
+
 DEFUN (ip_forwarding,
        ip_forwarding_cmd,
        "ip forwarding",
@@ -1850,6 +1887,14 @@ config_write_table (struct vty *vty)
   if (zebrad.rtm_table_default)
     vty_out (vty, "table %d%s", zebrad.rtm_table_default,
 	     VTY_NEWLINE);
+#ifdef HAVE_NETLINK
+  if (zebrad.nl_batch_size != NL_BATCH_SIZE_DEFAULT)
+    vty_out (vty, "netlink batch-size %d%s", zebrad.nl_batch_size,
+	     VTY_NEWLINE);
+  if (zebrad.nl_batch_latency != NL_BATCH_LATENCY_DEFAULT)
+    vty_out (vty, "netlink batch-latency %d%s", zebrad.nl_batch_latency,
+	     VTY_NEWLINE);
+#endif /* HAVE_NETLINK */
   return 0;
 }
 
@@ -2003,6 +2048,12 @@ zebra_init (void)
   install_element (VIEW_NODE, &show_table_cmd);
   install_element (ENABLE_NODE, &show_table_cmd);
   install_element (CONFIG_NODE, &config_table_cmd);
+  install_element (CONFIG_NODE, &netlink_batch_size_cmd);
+  install_element (CONFIG_NODE, &no_netlink_batch_size_cmd);
+  install_element (CONFIG_NODE, &no_netlink_batch_size_val_cmd);
+  install_element (CONFIG_NODE, &netlink_batch_latency_cmd);
+  install_element (CONFIG_NODE, &no_netlink_batch_latency_cmd);
+  install_element (CONFIG_NODE, &no_netlink_batch_latency_val_cmd);
 #endif /* HAVE_NETLINK */
 
 #ifdef HAVE_IPV6
@@ -78,11 +78,22 @@ struct zebra_t
   /* default table */
   int rtm_table_default;
 
+#ifdef HAVE_NETLINK
+  /* netlink route message batching */
+  int nl_batch_size;
+  int nl_batch_latency;
+#endif /* HAVE_NETLINK */
+
   /* rib work queue */
   struct work_queue *ribq;
   struct meta_queue *mq;
 };
 
+#ifdef HAVE_NETLINK
+#define NL_BATCH_SIZE_DEFAULT		64
+#define NL_BATCH_LATENCY_DEFAULT	0
+#endif /* HAVE_NETLINK */
+
 /* Count prefix size from mask length */
 #define PSIZE(a) (((a) + 7) / (8))
 
@@ -107,6 +118,9 @@ extern int zsend_interface_update (int, struct zserv *, struct interface *);
 extern int zsend_route_multipath (int, struct zserv *, struct prefix *, 
                                   struct rib *);
 extern int zsend_router_id_update(struct zserv *, struct prefix *);
+extern void zserv_encode_nexthops (struct stream *, struct rib *);
+extern int zsend_nexthop_update (struct zserv *, struct prefix *,
+				 const u_char *, size_t);
 
 extern pid_t pid;
 